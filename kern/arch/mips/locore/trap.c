@@ -39,6 +39,7 @@
 #include <vm.h>
 #include <mainbus.h>
 #include <syscall.h>
+#include <ktrace.h>
 
 
 /* in exception.S */
@@ -126,6 +127,23 @@ kill_curthread(vaddr_t epc, unsigned code, vaddr_t vaddr)
   panic("I don't know how to handle this\n");
 }
 
+/*
+ * vm_fault, traced. (Called once the spl is sorted out, below, so
+ * KTRACE is safe.)
+ */
+static
+int
+mips_vm_fault(int faulttype, vaddr_t vaddr)
+{
+  int result;
+
+  KTRACE(KTE_VMFAULT, faulttype, vaddr);
+  result = vm_fault(faulttype, vaddr);
+  KTRACE(KTE_VMFAULTDONE, result, vaddr);
+
+  return result;
+}
+
 /*
  * General trap (exception) handling function for mips.
  * This is called by the assembly-language exception handler once
@@ -136,6 +154,7 @@ mips_trap(struct trapframe *tf)
 {
   uint32_t code;
   bool isutlb, iskern;
+  unsigned cpustate;
   int spl;
 
   /* The trap frame is supposed to be 37 registers long. */
@@ -157,6 +176,10 @@ mips_trap(struct trapframe *tf)
             + STACK_SIZE));
   }
 
+  // Time accounting: whatever we were doing stops here. Remember
+  // it, so a trap taken in the kernel can go back to it.
+  cpustate = cputime_switch(code == EX_IRQ ? CPUTIME_INTR : CPUTIME_SYS);
+
   /* Interrupt? Call the interrupt handler and return. */
   if (code == EX_IRQ) {
     int old_in;
@@ -240,17 +263,17 @@ mips_trap(struct trapframe *tf)
    */
   switch (code) {
   case EX_MOD:
-    if (vm_fault(VM_FAULT_READONLY, tf->tf_vaddr)==0) {
+    if (mips_vm_fault(VM_FAULT_READONLY, tf->tf_vaddr)==0) {
       goto done;
     }
     break;
   case EX_TLBL:
-    if (vm_fault(VM_FAULT_READ, tf->tf_vaddr)==0) {
+    if (mips_vm_fault(VM_FAULT_READ, tf->tf_vaddr)==0) {
       goto done;
     }
     break;
   case EX_TLBS:
-    if (vm_fault(VM_FAULT_WRITE, tf->tf_vaddr)==0) {
+    if (mips_vm_fault(VM_FAULT_WRITE, tf->tf_vaddr)==0) {
       goto done;
     }
     break;
@@ -330,6 +353,9 @@ mips_trap(struct trapframe *tf)
   cpu_irqoff();
  done2:
 
+  // Back to the kernel code we interrupted, or to userlevel.
+  cputime_switch(iskern ? cpustate : CPUTIME_USER);
+
   /*
    * The boot thread can get here (e.g. on interrupt return) but
    * since it doesn't go to userlevel, it can't be returning to
@@ -385,6 +411,8 @@ mips_usermode(struct trapframe *tf)
   spl0();
   cpu_irqoff();
 
+  cputime_switch(CPUTIME_USER);
+
   cputhreads[curcpu->c_number] = (vaddr_t)curthread;
   cpustacks[curcpu->c_number] = (vaddr_t)curthread->t_stack + STACK_SIZE;
 
@@ -36,6 +36,7 @@
 #include <current.h>
 #include <syscall.h>
 #include <copyinout.h>
+#include <ktrace.h>
 
 #include <syscall.h>
 
@@ -90,7 +91,7 @@ syscall(struct trapframe *tf)
   KASSERT(curthread->t_iplhigh_count == 0);
 
   callno = tf->tf_v0;
-
+  KTRACE(KTE_SYSCALL, callno, 0);
 
   /*
    * Initialize retval to 0. Many of the system calls don't
@@ -112,6 +113,14 @@ syscall(struct trapframe *tf)
         err = sys___time((userptr_t)tf->tf_a0, (userptr_t)tf->tf_a1);
         break;
 
+      case SYS_nanosleep:
+        err = sys_nanosleep((const_userptr_t)tf->tf_a0, (userptr_t)tf->tf_a1);
+        break;
+
+      case SYS_getrusage:
+        err = sys_getrusage(tf->tf_a0, (userptr_t)tf->tf_a1);
+        break;
+
       /* Add stuff here */
 
       case SYS_open:
@@ -130,6 +139,55 @@ syscall(struct trapframe *tf)
         err = sys_write(tf->tf_a0, (void *)tf->tf_a1, tf->tf_a2, &retval);
         break;
 
+      case SYS_pread:
+      case SYS_pwrite:
+        // The offset is 64-bit and a2/a3 is taken, so it's on the stack.
+        if (copyin((const_userptr_t)(tf->tf_sp + 16), &pos, sizeof(off_t))) {
+          err = EFAULT;
+          break;
+        }
+        if (callno == SYS_pread)
+          err = sys_pread(tf->tf_a0, (void *)tf->tf_a1, tf->tf_a2, pos, &retval);
+        else
+          err = sys_pwrite(tf->tf_a0, (const void *)tf->tf_a1, tf->tf_a2, pos, &retval);
+        break;
+
+      case SYS_readv:
+        err = sys_readv(tf->tf_a0, (const struct iovec *)tf->tf_a1, tf->tf_a2, &retval);
+        break;
+
+      case SYS_writev:
+        err = sys_writev(tf->tf_a0, (const struct iovec *)tf->tf_a1, tf->tf_a2, &retval);
+        break;
+
+      case SYS_getdirentry:
+        err = sys_getdirentry(tf->tf_a0, (char *)tf->tf_a1, tf->tf_a2, &retval);
+        break;
+
+      case SYS_getdirentries:
+        err = sys_getdirentries(tf->tf_a0, (char *)tf->tf_a1, tf->tf_a2, &retval);
+        break;
+
+      case SYS_copy_file_range:
+        err = sys_copy_file_range(tf->tf_a0, tf->tf_a1, tf->tf_a2, tf->tf_a3, &retval);
+        break;
+
+      case SYS_fstat:
+        err = sys_fstat(tf->tf_a0, (struct stat *)tf->tf_a1);
+        break;
+
+      case SYS_aio_setup:
+        err = sys_aio_setup((userptr_t)tf->tf_a0, tf->tf_a1);
+        break;
+
+      case SYS_aio_enter:
+        err = sys_aio_enter(tf->tf_a0, tf->tf_a1, &retval);
+        break;
+
+      case SYS_pipe:
+        err = sys_pipe((int *)tf->tf_a0);
+        break;
+
       case SYS_dup2:
         err = sys_dup2(tf->tf_a0, tf->tf_a1);
         break;
@@ -138,6 +196,14 @@ syscall(struct trapframe *tf)
         err = sys_chdir((const_userptr_t *)tf->tf_a0);
         break;
 
+      case SYS_remove:
+        err = sys_remove((const_userptr_t)tf->tf_a0);
+        break;
+
+      case SYS_rename:
+        err = sys_rename((const_userptr_t)tf->tf_a0, (const_userptr_t)tf->tf_a1);
+        break;
+
       case SYS___getcwd:
         err = sys__getcwd((char *)tf->tf_a0, tf->tf_a1);
         break;
@@ -194,7 +260,7 @@ syscall(struct trapframe *tf)
     err = ENOSYS;
     break;
   }
-
+  KTRACE(KTE_SYSRET, callno, err);
 
   if (err) {
     /*
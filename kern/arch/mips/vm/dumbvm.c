@@ -51,7 +51,7 @@
 /*
  * Wrap rma_stealmem in a spinlock.
  */
-static struct spinlock stealmem_lock = SPINLOCK_INITIALIZER;
+static struct spinlock stealmem_lock = SPINLOCK_QUEUED_INITIALIZER;
 
 void
 vm_bootstrap(void)
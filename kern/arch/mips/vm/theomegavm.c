@@ -9,6 +9,7 @@
 #include <addrspace.h>
 #include <vm.h>
 #include <synch.h>
+#include <ktrace.h>
 
 // The last VM you'll ever need.
 
@@ -18,7 +19,7 @@
 /*
  * Wrap rma_stealmem in a spinlock.
  */
-static struct spinlock stealmem_lock = SPINLOCK_INITIALIZER;
+static struct spinlock stealmem_lock = SPINLOCK_QUEUED_INITIALIZER;
 
 // startaddr, freeaddr is the coremap. freeaddr, endaddr is the
 // coremap.
@@ -59,6 +60,7 @@ void vm_bootstrap(void) {
   }
 
   coremaplock = lock_create("Coremap Lock");
+  lockprof_spinlock(&stealmem_lock, "stealmem");
 
   bootstrap = 1;
 }
@@ -302,6 +304,7 @@ vm_fault(int faulttype, vaddr_t faultaddress)
       elo = paddr | TLBLO_DIRTY | TLBLO_VALID;
       DEBUG(DB_VM, "dumbvm: 0x%x -> 0x%x\n", faultaddress, paddr);
       tlb_write(ehi, elo, i);
+      KTRACE(KTE_TLBREFILL, faultaddress, i);
       splx(spl);
       return 0;
     }
@@ -40,6 +40,7 @@
 #include <mainbus.h>
 #include <sys161/bus.h>
 #include <lamebus/lamebus.h>
+#include <platform/maxcpus.h>
 #include "autoconf.h"
 
 /*
@@ -56,6 +57,14 @@
  * The c0_count register increments on every cycle; when the value
  * matches the c0_compare register, the timer interrupt line is
  * asserted. Writing to c0_compare again clears the interrupt.
+ *
+ * On System/161 writing c0_compare also restarts c0_count from zero,
+ * so the value written is an interval and c0_count is the time since.
+ * The stock timer code relied on this: it wrote the same value,
+ * CPU_FREQUENCY / HZ, on every interrupt and got HZ interrupts a
+ * second. (A free-running count would have given one every 2^32
+ * cycles.) If it ever stops being true, hardclock still counts a
+ * tick per timer interrupt.
  */
 static
 void
@@ -73,6 +82,73 @@ mips_timer_set(uint32_t count)
 		:: "r" (count));
 }
 
+static
+uint32_t
+mips_timer_get(void)
+{
+	uint32_t count;
+
+	/* $9 == c0_count */
+	__asm volatile(
+		".set push;"		/* save assembler mode */
+		".set mips32;"		/* allow MIPS32 registers */
+		"mfc0 %0, $9;"		/* do it */
+		".set pop"		/* restore assembler mode */
+		: "=r" (count));
+	return count;
+}
+
+/* Cycles per hardclock, and the longest interval we can program */
+#define TIMER_TICK	(CPU_FREQUENCY / HZ)
+#define TIMER_MAXTICKS	(0xffffffffU / TIMER_TICK)
+
+/*
+ * Cycles of the current partial hardclock on each cpu, left over from
+ * the last mainbus_settimer. Carried into the next interval so that
+ * reprogramming the timer in mid-tick doesn't make time drift.
+ */
+static uint32_t timer_carry[MAXCPUS];
+
+/* Whole hardclocks' worth of cycles each cpu has counted, for cputime */
+static uint64_t timer_base[MAXCPUS];
+
+/*
+ * Program the next timer interrupt on this cpu.
+ */
+unsigned
+mainbus_settimer(unsigned hardclocks)
+{
+	uint32_t *carry = &timer_carry[curcpu->c_number];
+	uint32_t cycles;
+	unsigned elapsed;
+
+	cycles = mips_timer_get() + *carry;
+	elapsed = cycles / TIMER_TICK;
+	*carry = cycles % TIMER_TICK;
+	timer_base[curcpu->c_number] += (uint64_t)elapsed * TIMER_TICK;
+	if (hardclocks == 0 || hardclocks > TIMER_MAXTICKS) {
+		hardclocks = TIMER_MAXTICKS;
+	}
+	/* Less what's already gone by of the current tick */
+	mips_timer_set(hardclocks * TIMER_TICK - *carry);
+	return elapsed;
+}
+
+/*
+ * Nanoseconds this cpu has been running, to the cycle. Only
+ * comparable with other values from the same cpu; call with
+ * interrupts off.
+ */
+uint64_t
+mainbus_cputime(void)
+{
+	uint64_t cycles;
+
+	cycles = timer_base[curcpu->c_number];
+	cycles += timer_carry[curcpu->c_number] + mips_timer_get();
+	return cycles * (1000000000 / CPU_FREQUENCY);
+}
+
 /*
  * LAMEbus data for the system. (We have only one LAMEbus per system.)
  * This does not need to be locked, because it's constant once
@@ -113,7 +189,7 @@ mainbus_bootstrap(void)
 	/*
 	 * Configure the MIPS on-chip timer to interrupt HZ times a second.
 	 */
-	mips_timer_set(CPU_FREQUENCY / HZ);
+	mips_timer_set(TIMER_TICK);
 }
 
 /*
@@ -268,9 +344,10 @@ mainbus_interrupt(struct trapframe *tf)
 		lamebus_clear_ipi(lamebus, curcpu);
 	}
 	else if (cause & MIPS_TIMER_BIT) {
-		/* Reset the timer (this clears the interrupt) */
-		mips_timer_set(CPU_FREQUENCY / HZ);
-		/* and call hardclock */
+		/*
+		 * Call hardclock. It reprograms the timer, which
+		 * clears the interrupt.
+		 */
 		hardclock();
 	}
 	else {
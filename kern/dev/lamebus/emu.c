@@ -41,8 +41,10 @@
  */
 
 #include <types.h>
+#include <limits.h>
 #include <kern/errno.h>
 #include <kern/fcntl.h>
+#include <kern/dirent.h>
 #include <stat.h>
 #include <lib.h>
 #include <array.h>
@@ -399,6 +401,126 @@ emu_trunc(struct emu_softc *sc, uint32_t handle, off_t len)
 static int emufs_loadvnode(struct emufs_fs *ef, uint32_t handle, int isdir,
 			   struct emufs_vnode **ret);
 
+/*
+ * Data caching.
+ *
+ * Each trip to the device costs a round of register writes and an
+ * interrupt, and only one can be in flight per emu device, so we
+ * keep one EMU_MAXIO chunk per open file in ev_buf:
+ *
+ *    - reads always fetch a whole chunk starting at the requested
+ *      offset, so the small header reads load_elf does, and any
+ *      other small sequential reads, come out of memory;
+ *    - small sequential writes are collected and sent as one chunk
+ *      when the buffer fills, when the file is written elsewhere,
+ *      or at read, stat, truncate, fsync, sync, and last close.
+ *
+ * Copying to and from the caller's buffer happens under the vnode's
+ * ev_lock, not the device's e_lock, so a page fault on a user buffer
+ * doesn't hold up I/O on other files.
+ *
+ * If the buffer can't be allocated we fall back to going straight to
+ * the device.
+ */
+
+/*
+ * Make sure the vnode has a buffer. Returns false if out of memory.
+ */
+static
+bool
+emufs_getbuf(struct emufs_vnode *ev)
+{
+	KASSERT(lock_do_i_hold(ev->ev_lock));
+
+	if (ev->ev_buf == NULL) {
+		ev->ev_buf = kmalloc(EMU_MAXIO);
+		ev->ev_buflen = 0;
+		ev->ev_dirty = false;
+		ev->ev_bufeof = false;
+	}
+	return ev->ev_buf != NULL;
+}
+
+/*
+ * Free the buffer. It must not be dirty.
+ */
+static
+void
+emufs_dropbuf(struct emufs_vnode *ev)
+{
+	KASSERT(lock_do_i_hold(ev->ev_lock));
+	KASSERT(!ev->ev_dirty);
+
+	if (ev->ev_buf != NULL) {
+		kfree(ev->ev_buf);
+		ev->ev_buf = NULL;
+	}
+	ev->ev_buflen = 0;
+	ev->ev_bufeof = false;
+}
+
+/*
+ * Write back a dirty buffer. Afterwards the buffer is empty. If the
+ * write fails the data is dropped, as it would be by any other
+ * write-behind cache; the error goes to whoever asked for the flush.
+ */
+static
+int
+emufs_flush(struct emufs_vnode *ev)
+{
+	struct iovec iov;
+	struct uio ku;
+	int result;
+
+	KASSERT(lock_do_i_hold(ev->ev_lock));
+
+	if (!ev->ev_dirty) {
+		return 0;
+	}
+
+	result = 0;
+	if (ev->ev_buflen > 0) {
+		uio_kinit(&iov, &ku, ev->ev_buf, ev->ev_buflen,
+			  ev->ev_bufoff, UIO_WRITE);
+		result = emu_write(ev->ev_emu, ev->ev_handle,
+				   ev->ev_buflen, &ku);
+	}
+
+	ev->ev_dirty = false;
+	ev->ev_buflen = 0;
+	ev->ev_bufeof = false;
+	return result;
+}
+
+/*
+ * Load the buffer with the chunk starting at POS. The buffer must
+ * not be dirty. A short read means we hit EOF.
+ */
+static
+int
+emufs_fill(struct emufs_vnode *ev, off_t pos)
+{
+	struct iovec iov;
+	struct uio ku;
+	int result;
+
+	KASSERT(lock_do_i_hold(ev->ev_lock));
+	KASSERT(!ev->ev_dirty);
+
+	uio_kinit(&iov, &ku, ev->ev_buf, EMU_MAXIO, pos, UIO_READ);
+	result = emu_read(ev->ev_emu, ev->ev_handle, EMU_MAXIO, &ku);
+	if (result) {
+		ev->ev_buflen = 0;
+		ev->ev_bufeof = false;
+		return result;
+	}
+
+	ev->ev_bufoff = pos;
+	ev->ev_buflen = EMU_MAXIO - ku.uio_resid;
+	ev->ev_bufeof = ev->ev_buflen < EMU_MAXIO;
+	return 0;
+}
+
 /*
  * VOP_OPEN on files
  */
@@ -453,8 +575,16 @@ static
 int
 emufs_close(struct vnode *v)
 {
-	(void)v;
-	return 0;
+	struct emufs_vnode *ev = v->vn_data;
+	int result;
+
+	/* Push out anything still buffered and give back the memory */
+	lock_acquire(ev->ev_lock);
+	result = emufs_flush(ev);
+	emufs_dropbuf(ev);
+	lock_release(ev->ev_lock);
+
+	return result;
 }
 
 /*
@@ -472,24 +602,41 @@ emufs_reclaim(struct vnode *v)
 	int result;
 
 	/*
-	 * Need both of these locks, e_lock to protect the device
-	 * and vfs_biglock to protect the fs-related material.
+	 * Holding ef_vnlock keeps emufs_loadvnode from picking the
+	 * vnode up again while we get rid of it.
 	 */
 
-	vfs_biglock_acquire();
-	lock_acquire(ef->ef_emu->e_lock);
+	lock_acquire(ef->ef_vnlock);
 
-	if (ev->ev_v.vn_refcount != 1) {
-		lock_release(ef->ef_emu->e_lock);
-		vfs_biglock_release();
+	spinlock_acquire(&v->vn_countlock);
+	if (v->vn_refcount != 1) {
+		/* consume the reference VOP_DECREF gave us */
+		KASSERT(v->vn_refcount>1);
+		v->vn_refcount--;
+		spinlock_release(&v->vn_countlock);
+		lock_release(ef->ef_vnlock);
 		return EBUSY;
 	}
+	spinlock_release(&v->vn_countlock);
+
+	/*
+	 * Normally the last close already flushed the buffer. A
+	 * failed flush drops the data anyway, so don't let it keep
+	 * the vnode around.
+	 */
+	lock_acquire(ev->ev_lock);
+	result = emufs_flush(ev);
+	if (result) {
+		kprintf("emu%d: reclaim: write-behind failed: %s\n",
+			ef->ef_emu->e_unit, strerror(result));
+	}
+	emufs_dropbuf(ev);
+	lock_release(ev->ev_lock);
 
 	/* emu_close retries on I/O error */
 	result = emu_close(ev->ev_emu, ev->ev_handle);
 	if (result) {
-		lock_release(ef->ef_emu->e_lock);
-		vfs_biglock_release();
+		lock_release(ef->ef_vnlock);
 		return result;
 	}
 
@@ -512,27 +659,24 @@ emufs_reclaim(struct vnode *v)
 	vnodearray_remove(ef->ef_vnodes, ix);
 	VOP_CLEANUP(&ev->ev_v);
 
-	lock_release(ef->ef_emu->e_lock);
-	vfs_biglock_release();
+	lock_release(ef->ef_vnlock);
 
+	lock_destroy(ev->ev_lock);
 	kfree(ev);
 	return 0;
 }
 
 /*
- * VOP_READ
+ * Uncached read, used when there's no memory for a buffer.
  */
 static
 int
-emufs_read(struct vnode *v, struct uio *uio)
+emufs_readdirect(struct emufs_vnode *ev, struct uio *uio)
 {
-	struct emufs_vnode *ev = v->vn_data;
 	uint32_t amt;
 	size_t oldresid;
 	int result;
 
-	KASSERT(uio->uio_rw==UIO_READ);
-
 	while (uio->uio_resid > 0) {
 		amt = uio->uio_resid;
 		if (amt > EMU_MAXIO) {
@@ -555,6 +699,65 @@ emufs_read(struct vnode *v, struct uio *uio)
 	return 0;
 }
 
+/*
+ * VOP_READ
+ */
+static
+int
+emufs_read(struct vnode *v, struct uio *uio)
+{
+	struct emufs_vnode *ev = v->vn_data;
+	off_t pos, bufend;
+	size_t amt;
+	int result;
+
+	KASSERT(uio->uio_rw==UIO_READ);
+
+	lock_acquire(ev->ev_lock);
+
+	if (!emufs_getbuf(ev)) {
+		result = emufs_readdirect(ev, uio);
+		goto out;
+	}
+
+	/* Pending writes have to reach the file before we read it */
+	result = emufs_flush(ev);
+	if (result) {
+		goto out;
+	}
+
+	while (uio->uio_resid > 0) {
+		pos = uio->uio_offset;
+		bufend = ev->ev_bufoff + ev->ev_buflen;
+		if (pos < ev->ev_bufoff || pos > bufend ||
+		    (pos == bufend && !ev->ev_bufeof)) {
+			result = emufs_fill(ev, pos);
+			if (result) {
+				goto out;
+			}
+			bufend = ev->ev_bufoff + ev->ev_buflen;
+		}
+
+		if (pos == bufend) {
+			/* EOF */
+			break;
+		}
+
+		amt = bufend - pos;
+		if (amt > uio->uio_resid) {
+			amt = uio->uio_resid;
+		}
+		result = uiomove(ev->ev_buf + (pos - ev->ev_bufoff), amt, uio);
+		if (result) {
+			goto out;
+		}
+	}
+
+ out:
+	lock_release(ev->ev_lock);
+	return result;
+}
+
 /*
  * VOP_READDIR
  */
@@ -576,19 +779,79 @@ emufs_getdirentry(struct vnode *v, struct uio *uio)
 }
 
 /*
- * VOP_WRITE
+ * VOP_GETDIRENTRIES
+ *
+ * The hardware only hands out one name at a time, so this just saves
+ * the system calls: fetch names until the next record won't fit. The
+ * offset is the hardware's, and is only advanced past names that
+ * were actually returned.
  */
 static
 int
-emufs_write(struct vnode *v, struct uio *uio)
+emufs_getdirentries(struct vnode *v, struct uio *uio)
 {
 	struct emufs_vnode *ev = v->vn_data;
+	struct dirent de;
+	struct iovec iov;
+	struct uio ku;
+	off_t pos;
+	size_t namlen, reclen;
+	bool any = false;
+	int result;
+
+	KASSERT(uio->uio_rw==UIO_READ);
+
+	pos = uio->uio_offset;
+	while (1) {
+		uio_kinit(&iov, &ku, de.d_name, NAME_MAX, pos, UIO_READ);
+		result = emu_readdir(ev->ev_emu, ev->ev_handle, NAME_MAX, &ku);
+		if (result) {
+			break;
+		}
+		namlen = NAME_MAX - ku.uio_resid;
+		if (namlen == 0) {
+			/* end of directory */
+			break;
+		}
+
+		reclen = _DIRENT_RECLEN(namlen);
+		if (reclen > uio->uio_resid) {
+			if (!any) {
+				result = EINVAL;
+			}
+			break;
+		}
+
+		/* no inode numbers or types from the hardware */
+		de.d_ino = 0;
+		de.d_type = 0;
+		de.d_reclen = reclen;
+		de.d_namlen = namlen;
+		bzero(de.d_name + namlen, reclen - _DIRENT_HDRSIZE - namlen);
+
+		result = uiomove(&de, reclen, uio);
+		if (result) {
+			break;
+		}
+		any = true;
+		pos = ku.uio_offset;
+	}
+
+	uio->uio_offset = pos;
+	return result;
+}
+
+/*
+ * Uncached write, used when there's no memory for a buffer.
+ */
+static
+int
+emufs_writedirect(struct emufs_vnode *ev, struct uio *uio)
+{
 	uint32_t amt;
 	size_t oldresid;
 	int result;
 
-	KASSERT(uio->uio_rw==UIO_WRITE);
-
 	while (uio->uio_resid > 0) {
 		amt = uio->uio_resid;
 		if (amt > EMU_MAXIO) {
@@ -611,6 +874,67 @@ emufs_write(struct vnode *v, struct uio *uio)
 	return 0;
 }
 
+/*
+ * VOP_WRITE
+ */
+static
+int
+emufs_write(struct vnode *v, struct uio *uio)
+{
+	struct emufs_vnode *ev = v->vn_data;
+	size_t amt;
+	int result;
+
+	KASSERT(uio->uio_rw==UIO_WRITE);
+
+	lock_acquire(ev->ev_lock);
+
+	if (!emufs_getbuf(ev)) {
+		result = emufs_writedirect(ev, uio);
+		goto out;
+	}
+
+	result = 0;
+	while (uio->uio_resid > 0) {
+		if (ev->ev_dirty &&
+		    ev->ev_bufoff + ev->ev_buflen != uio->uio_offset) {
+			/* not contiguous with what we have */
+			result = emufs_flush(ev);
+			if (result) {
+				goto out;
+			}
+		}
+		if (!ev->ev_dirty) {
+			/* drop any cached read data and start over here */
+			ev->ev_bufoff = uio->uio_offset;
+			ev->ev_buflen = 0;
+			ev->ev_bufeof = false;
+			ev->ev_dirty = true;
+		}
+
+		amt = EMU_MAXIO - ev->ev_buflen;
+		if (amt > uio->uio_resid) {
+			amt = uio->uio_resid;
+		}
+		result = uiomove(ev->ev_buf + ev->ev_buflen, amt, uio);
+		if (result) {
+			goto out;
+		}
+		ev->ev_buflen += amt;
+
+		if (ev->ev_buflen == EMU_MAXIO) {
+			result = emufs_flush(ev);
+			if (result) {
+				goto out;
+			}
+		}
+	}
+
+ out:
+	lock_release(ev->ev_lock);
+	return result;
+}
+
 /*
  * VOP_IOCTL
  */
@@ -641,6 +965,14 @@ emufs_stat(struct vnode *v, struct stat *statbuf)
 
 	bzero(statbuf, sizeof(struct stat));
 
+	/* The size has to include anything still in the write buffer */
+	lock_acquire(ev->ev_lock);
+	result = emufs_flush(ev);
+	lock_release(ev->ev_lock);
+	if (result) {
+		return result;
+	}
+
 	result = emu_getsize(ev->ev_emu, ev->ev_handle, &statbuf->st_size);
 	if (result) {
 		return result;
@@ -705,8 +1037,14 @@ static
 int
 emufs_fsync(struct vnode *v)
 {
-	(void)v;
-	return 0;
+	struct emufs_vnode *ev = v->vn_data;
+	int result;
+
+	lock_acquire(ev->ev_lock);
+	result = emufs_flush(ev);
+	lock_release(ev->ev_lock);
+
+	return result;
 }
 
 /*
@@ -717,7 +1055,19 @@ int
 emufs_truncate(struct vnode *v, off_t len)
 {
 	struct emufs_vnode *ev = v->vn_data;
-	return emu_trunc(ev->ev_emu, ev->ev_handle, len);
+	int result;
+
+	lock_acquire(ev->ev_lock);
+	result = emufs_flush(ev);
+	if (result == 0) {
+		/* any cached data may now be past EOF */
+		ev->ev_buflen = 0;
+		ev->ev_bufeof = false;
+		result = emu_trunc(ev->ev_emu, ev->ev_handle, len);
+	}
+	lock_release(ev->ev_lock);
+
+	return result;
 }
 
 /*
@@ -1083,6 +1433,7 @@ static const struct vnode_ops emufs_fileops = {
 	emufs_read,
 	emufs_readlink_notlink,
 	emufs_uio_op_notdir, /* getdirentry */
+	emufs_uio_op_notdir, /* getdirentries */
 	emufs_write,
 	emufs_ioctl,
 	emufs_stat,
@@ -1118,6 +1469,7 @@ static const struct vnode_ops emufs_dirops = {
 	emufs_uio_op_isdir,   /* read */
 	emufs_uio_op_isdir,   /* readlink */
 	emufs_getdirentry,
+	emufs_getdirentries,
 	emufs_uio_op_isdir,   /* write */
 	emufs_ioctl,
 	emufs_stat,
@@ -1153,8 +1505,7 @@ emufs_loadvnode(struct emufs_fs *ef, uint32_t handle, int isdir,
 	unsigned i, num;
 	int result;
 
-	vfs_biglock_acquire();
-	lock_acquire(ef->ef_emu->e_lock);
+	lock_acquire(ef->ef_vnlock);
 
 	num = vnodearray_num(ef->ef_vnodes);
 	for (i=0; i<num; i++) {
@@ -1165,8 +1516,7 @@ emufs_loadvnode(struct emufs_fs *ef, uint32_t handle, int isdir,
 
 			VOP_INCREF(&ev->ev_v);
 
-			lock_release(ef->ef_emu->e_lock);
-			vfs_biglock_release();
+			lock_release(ef->ef_vnlock);
 			*ret = ev;
 			return 0;
 		}
@@ -1176,18 +1526,29 @@ emufs_loadvnode(struct emufs_fs *ef, uint32_t handle, int isdir,
 
 	ev = kmalloc(sizeof(struct emufs_vnode));
 	if (ev==NULL) {
-		lock_release(ef->ef_emu->e_lock);
+		lock_release(ef->ef_vnlock);
 		return ENOMEM;
 	}
 
 	ev->ev_emu = ef->ef_emu;
 	ev->ev_handle = handle;
+	ev->ev_buf = NULL;
+	ev->ev_bufoff = 0;
+	ev->ev_buflen = 0;
+	ev->ev_dirty = false;
+	ev->ev_bufeof = false;
+	ev->ev_lock = lock_create("emufs-vnode");
+	if (ev->ev_lock == NULL) {
+		lock_release(ef->ef_vnlock);
+		kfree(ev);
+		return ENOMEM;
+	}
 
 	result = VOP_INIT(&ev->ev_v, isdir ? &emufs_dirops : &emufs_fileops,
 			   &ef->ef_fs, ev);
 	if (result) {
-		lock_release(ef->ef_emu->e_lock);
-		vfs_biglock_release();
+		lock_release(ef->ef_vnlock);
+		lock_destroy(ev->ev_lock);
 		kfree(ev);
 		return result;
 	}
@@ -1196,14 +1557,13 @@ emufs_loadvnode(struct emufs_fs *ef, uint32_t handle, int isdir,
 	if (result) {
 		/* note: VOP_CLEANUP undoes VOP_INIT - it does not kfree */
 		VOP_CLEANUP(&ev->ev_v);
-		lock_release(ef->ef_emu->e_lock);
-		vfs_biglock_release();
+		lock_release(ef->ef_vnlock);
+		lock_destroy(ev->ev_lock);
 		kfree(ev);
 		return result;
 	}
 
-	lock_release(ef->ef_emu->e_lock);
-	vfs_biglock_release();
+	lock_release(ef->ef_vnlock);
 
 	*ret = ev;
 	return 0;
@@ -1224,8 +1584,27 @@ static
 int
 emufs_sync(struct fs *fs)
 {
-	(void)fs;
-	return 0;
+	struct emufs_fs *ef = fs->fs_data;
+	struct emufs_vnode *ev;
+	unsigned i, num;
+	int result, err;
+
+	/* Push out every file's write buffer */
+	err = 0;
+	lock_acquire(ef->ef_vnlock);
+	num = vnodearray_num(ef->ef_vnodes);
+	for (i=0; i<num; i++) {
+		ev = vnodearray_get(ef->ef_vnodes, i)->vn_data;
+		lock_acquire(ev->ev_lock);
+		result = emufs_flush(ev);
+		lock_release(ev->ev_lock);
+		if (result && err == 0) {
+			err = result;
+		}
+	}
+	lock_release(ef->ef_vnlock);
+
+	return err;
 }
 
 /*
@@ -1295,6 +1674,8 @@ emufs_addtovfs(struct emu_softc *sc, const char *devname)
 	ef->ef_fs.fs_getvolname = emufs_getvolname;
 	ef->ef_fs.fs_getroot = emufs_getroot;
 	ef->ef_fs.fs_unmount = emufs_unmount;
+	/* the host can change names behind our back */
+	ef->ef_fs.fs_ncache = false;
 	ef->ef_fs.fs_data = ef;
 
 	ef->ef_emu = sc;
@@ -1304,9 +1685,17 @@ emufs_addtovfs(struct emu_softc *sc, const char *devname)
 		kfree(ef);
 		return ENOMEM;
 	}
+	ef->ef_vnlock = lock_create("emufs-vnodes");
+	if (ef->ef_vnlock == NULL) {
+		vnodearray_destroy(ef->ef_vnodes);
+		kfree(ef);
+		return ENOMEM;
+	}
 
 	result = emufs_loadvnode(ef, EMU_ROOTHANDLE, 1, &ef->ef_root);
 	if (result) {
+		lock_destroy(ef->ef_vnlock);
+		vnodearray_destroy(ef->ef_vnodes);
 		kfree(ef);
 		return result;
 	}
@@ -39,6 +39,7 @@
 #include <platform/bus.h>
 #include <vfs.h>
 #include <lamebus/lhd.h>
+#include <ktrace.h>
 #include "autoconf.h"
 
 /* Registers (offsets within slot) */
@@ -102,6 +103,7 @@ static
 void
 lhd_iodone(struct lhd_softc *lh, int err)
 {
+	KTRACE(KTE_DISKDONE, lh->lh_unit, err);
 	lh->lh_result = err;
 	V(lh->lh_done);
 }
@@ -247,6 +249,8 @@ lhd_io(struct device *d, struct uio *uio)
 		lhd_wreg(lh, LHD_REG_SECT, sector+i);
 
 		/* and start the operation. */
+		KTRACE(uio->uio_rw == UIO_WRITE ? KTE_DISKWRITE : KTE_DISKREAD,
+		       lh->lh_unit, sector+i);
 		lhd_wreg(lh, LHD_REG_STAT, statval);
 
 		/* Now wait until the interrupt handler tells us we're done. */
@@ -0,0 +1,309 @@
+/*
+ * Copyright (c) 2000, 2001, 2002, 2003, 2004, 2005, 2008, 2009
+ *	The President and Fellows of Harvard College.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the University nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE UNIVERSITY AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE UNIVERSITY OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+/*
+ * In-memory name index for SFS directories.
+ *
+ * SFS directories are just arrays of struct sfs_dir, so finding a
+ * name on disk means reading and comparing every slot. Instead, the
+ * first time a directory is searched sfs_vnode.c reads it once and
+ * loads its entries in here; after that lookups go through a hash
+ * table and sfs_dir_link/sfs_dir_unlink keep it up to date as they
+ * write the on-disk entries. The index also remembers which slots
+ * are empty so new entries can be placed without a scan.
+ *
+ * The index is thrown away when the vnode is reclaimed. If it can't
+ * be kept up to date (out of memory) it is thrown away early and
+ * rebuilt on the next lookup.
+ */
+
+#include <types.h>
+#include <kern/errno.h>
+#include <lib.h>
+#include <sfs.h>
+
+/* Initial number of hash chains; doubled as the directory grows. */
+#define SFS_DIRHASH_MINBUCKETS 16
+
+struct sfs_dirent {
+	struct sfs_dirent *de_next;     /* next on hash chain */
+	uint32_t de_hash;               /* hash of de_name */
+	uint32_t de_ino;                /* inode number */
+	unsigned de_slot;               /* slot in the directory */
+	char de_name[SFS_NAMELEN];      /* filename */
+};
+
+struct sfs_dirhash {
+	struct sfs_dirent **dh_buckets; /* hash chains */
+	unsigned dh_nbuckets;           /* number of chains (power of 2) */
+	unsigned dh_nnames;             /* number of names in the table */
+	struct sfs_dirent **dh_slots;   /* entry in each slot, or NULL */
+	unsigned dh_nslots;             /* number of slots in directory */
+	unsigned dh_maxslots;           /* allocated size of dh_slots */
+	unsigned dh_freehint;           /* no empty slots below this */
+};
+
+/*
+ * Hash a filename. (This is the djb2 string hash.)
+ */
+static
+uint32_t
+sfs_dirhash_hash(const char *name)
+{
+	uint32_t h = 5381;
+
+	while (*name) {
+		h = h*33 + (unsigned char)*name++;
+	}
+	return h;
+}
+
+/*
+ * Create an empty index.
+ */
+struct sfs_dirhash *
+sfs_dirhash_create(void)
+{
+	struct sfs_dirhash *dh;
+	unsigned i;
+
+	dh = kmalloc(sizeof(struct sfs_dirhash));
+	if (dh == NULL) {
+		return NULL;
+	}
+	dh->dh_nbuckets = SFS_DIRHASH_MINBUCKETS;
+	dh->dh_buckets = kmalloc(dh->dh_nbuckets * sizeof(struct sfs_dirent *));
+	if (dh->dh_buckets == NULL) {
+		kfree(dh);
+		return NULL;
+	}
+	for (i=0; i<dh->dh_nbuckets; i++) {
+		dh->dh_buckets[i] = NULL;
+	}
+	dh->dh_nnames = 0;
+	dh->dh_slots = NULL;
+	dh->dh_nslots = 0;
+	dh->dh_maxslots = 0;
+	dh->dh_freehint = 0;
+	return dh;
+}
+
+/*
+ * Destroy an index.
+ */
+void
+sfs_dirhash_destroy(struct sfs_dirhash *dh)
+{
+	unsigned i;
+
+	for (i=0; i<dh->dh_nslots; i++) {
+		kfree(dh->dh_slots[i]);
+	}
+	kfree(dh->dh_slots);
+	kfree(dh->dh_buckets);
+	kfree(dh);
+}
+
+/*
+ * Make sure the slot array covers slots 0 through NSLOTS-1. New slots
+ * start out empty.
+ */
+int
+sfs_dirhash_setslots(struct sfs_dirhash *dh, unsigned nslots)
+{
+	struct sfs_dirent **newslots;
+	unsigned newmax, i;
+
+	if (nslots > dh->dh_maxslots) {
+		newmax = dh->dh_maxslots ? dh->dh_maxslots : 64;
+		while (newmax < nslots) {
+			newmax *= 2;
+		}
+		newslots = kmalloc(newmax * sizeof(struct sfs_dirent *));
+		if (newslots == NULL) {
+			return ENOMEM;
+		}
+		for (i=0; i<dh->dh_nslots; i++) {
+			newslots[i] = dh->dh_slots[i];
+		}
+		kfree(dh->dh_slots);
+		dh->dh_slots = newslots;
+		dh->dh_maxslots = newmax;
+	}
+	for (i=dh->dh_nslots; i<nslots; i++) {
+		dh->dh_slots[i] = NULL;
+	}
+	if (nslots > dh->dh_nslots) {
+		dh->dh_nslots = nslots;
+	}
+	return 0;
+}
+
+/*
+ * Double the number of hash chains. If there's no memory we just
+ * keep going with long chains.
+ */
+static
+void
+sfs_dirhash_grow(struct sfs_dirhash *dh)
+{
+	struct sfs_dirent **newbuckets, *de;
+	unsigned newn, i, b;
+
+	newn = dh->dh_nbuckets * 2;
+	newbuckets = kmalloc(newn * sizeof(struct sfs_dirent *));
+	if (newbuckets == NULL) {
+		return;
+	}
+	for (i=0; i<newn; i++) {
+		newbuckets[i] = NULL;
+	}
+	for (i=0; i<dh->dh_nslots; i++) {
+		de = dh->dh_slots[i];
+		if (de != NULL) {
+			b = de->de_hash & (newn - 1);
+			de->de_next = newbuckets[b];
+			newbuckets[b] = de;
+		}
+	}
+	kfree(dh->dh_buckets);
+	dh->dh_buckets = newbuckets;
+	dh->dh_nbuckets = newn;
+}
+
+/*
+ * Look up NAME. Returns ENOENT if it isn't there.
+ */
+int
+sfs_dirhash_lookup(struct sfs_dirhash *dh, const char *name,
+		   uint32_t *ino, int *slot)
+{
+	struct sfs_dirent *de;
+	uint32_t h;
+
+	h = sfs_dirhash_hash(name);
+	for (de = dh->dh_buckets[h & (dh->dh_nbuckets - 1)];
+	     de != NULL; de = de->de_next) {
+		if (de->de_hash == h && !strcmp(de->de_name, name)) {
+			if (ino != NULL) {
+				*ino = de->de_ino;
+			}
+			if (slot != NULL) {
+				*slot = de->de_slot;
+			}
+			return 0;
+		}
+	}
+	return ENOENT;
+}
+
+/*
+ * Record that slot SLOT, which must be empty, now holds NAME -> INO.
+ */
+int
+sfs_dirhash_add(struct sfs_dirhash *dh, const char *name, uint32_t ino,
+		int slot)
+{
+	struct sfs_dirent *de;
+	unsigned b;
+	int result;
+
+	KASSERT(slot >= 0);
+	KASSERT(strlen(name) < SFS_NAMELEN);
+
+	result = sfs_dirhash_setslots(dh, slot+1);
+	if (result) {
+		return result;
+	}
+	KASSERT(dh->dh_slots[slot] == NULL);
+
+	de = kmalloc(sizeof(struct sfs_dirent));
+	if (de == NULL) {
+		return ENOMEM;
+	}
+	de->de_hash = sfs_dirhash_hash(name);
+	de->de_ino = ino;
+	de->de_slot = slot;
+	strcpy(de->de_name, name);
+
+	b = de->de_hash & (dh->dh_nbuckets - 1);
+	de->de_next = dh->dh_buckets[b];
+	dh->dh_buckets[b] = de;
+	dh->dh_slots[slot] = de;
+	dh->dh_nnames++;
+
+	if (dh->dh_nnames > 2 * dh->dh_nbuckets) {
+		sfs_dirhash_grow(dh);
+	}
+	return 0;
+}
+
+/*
+ * Record that slot SLOT is now empty.
+ */
+void
+sfs_dirhash_remove(struct sfs_dirhash *dh, int slot)
+{
+	struct sfs_dirent *de, **pp;
+
+	KASSERT(slot >= 0 && (unsigned)slot < dh->dh_nslots);
+	de = dh->dh_slots[slot];
+	if (de == NULL) {
+		return;
+	}
+
+	pp = &dh->dh_buckets[de->de_hash & (dh->dh_nbuckets - 1)];
+	while (*pp != de) {
+		KASSERT(*pp != NULL);
+		pp = &(*pp)->de_next;
+	}
+	*pp = de->de_next;
+
+	dh->dh_slots[slot] = NULL;
+	dh->dh_nnames--;
+	if ((unsigned)slot < dh->dh_freehint) {
+		dh->dh_freehint = slot;
+	}
+	kfree(de);
+}
+
+/*
+ * Find an empty slot. Returns -1 if there aren't any.
+ */
+int
+sfs_dirhash_emptyslot(struct sfs_dirhash *dh)
+{
+	while (dh->dh_freehint < dh->dh_nslots) {
+		if (dh->dh_slots[dh->dh_freehint] == NULL) {
+			return dh->dh_freehint;
+		}
+		dh->dh_freehint++;
+	}
+	return -1;
+}
@@ -39,68 +39,123 @@
 #include <array.h>
 #include <bitmap.h>
 #include <uio.h>
+#include <synch.h>
 #include <vfs.h>
 #include <device.h>
 #include <sfs.h>
 
-/* Shortcuts for the size macros in kern/sfs.h */
-#define SFS_FS_BITMAPSIZE(sfs)  SFS_BITMAPSIZE((sfs)->sfs_super.sp_nblocks)
-#define SFS_FS_BITBLOCKS(sfs)   SFS_BITBLOCKS((sfs)->sfs_super.sp_nblocks)
-
 /*
  * Routine for doing I/O (reads or writes) on the free block bitmap.
- * We always do the whole bitmap at once; writing individual sectors
- * might or might not be a worthwhile optimization.
+ * Reads (at mount time) do the whole bitmap at once. Writes only do
+ * the bitmap blocks marked in sfs_mapdirty, so that syncing after a
+ * handful of allocations doesn't rewrite the map for the whole disk.
+ * Runs of adjacent dirty blocks go out as a single transfer. If the
+ * volume has a journal, the dirty blocks go into it instead.
  *
- * The free block bitmap consists of SFS_BITBLOCKS 512-byte sectors of
- * bits, one bit for each sector on the filesystem. The number of
+ * The free block bitmap consists of SFS_BITBLOCKS 4096-byte blocks of
+ * bits, one bit for each block on the filesystem. The number of
  * blocks in the bitmap is thus rounded up to the nearest multiple of
- * 512*8 = 4096. (This rounded number is SFS_BITMAPSIZE.) This means
+ * 4096*8 = 32768. (This rounded number is SFS_BITMAPSIZE.) This means
  * that the bitmap will (in general) contain space for some number of
- * invalid sectors that are actually beyond the end of the disk
- * device. This is ok. These sectors are supposed to be marked "in
+ * invalid blocks that are actually beyond the end of the disk
+ * device. This is ok. These blocks are supposed to be marked "in
  * use" by mksfs and never get marked "free".
  *
  * The sectors used by the superblock and the bitmap itself are
  * likewise marked in use by mksfs.
  */
 
+static
+int
+sfs_maprun(struct sfs_fs *sfs, uint32_t first, uint32_t num, enum uio_rw rw)
+{
+	struct iovec iov;
+	struct uio ku;
+	char *bitdata;
+
+	/* Pointer to our bitmap data in memory. */
+	bitdata = bitmap_getdata(sfs->sfs_freemap);
+
+	/* The bitmap starts at block 2. */
+	uio_kinit(&iov, &ku, bitdata + first*SFS_BLOCKSIZE,
+		  num*SFS_BLOCKSIZE,
+		  ((off_t)(SFS_MAP_LOCATION+first))*SFS_BLOCKSIZE, rw);
+	return sfs_rwblock(sfs, &ku);
+}
+
 static
 int
 sfs_mapio(struct sfs_fs *sfs, enum uio_rw rw)
 {
-	uint32_t j, mapsize;
+	uint32_t j, k, mapsize;
 	char *bitdata;
 	int result;
 
 	/* Number of blocks in the bitmap. */
 	mapsize = SFS_FS_BITBLOCKS(sfs);
 
-	/* Pointer to our bitmap data in memory. */
-	bitdata = bitmap_getdata(sfs->sfs_freemap);
-	
-	/* For each sector in the bitmap... */
-	for (j=0; j<mapsize; j++) {
-
-		/* Get a pointer to its data */
-		void *ptr = bitdata + j*SFS_BLOCKSIZE;
+	if (rw == UIO_READ) {
+		return sfs_maprun(sfs, 0, mapsize, rw);
+	}
 
-		/* and read or write it. The bitmap starts at sector 2. */ 
-		if (rw == UIO_READ) {
-			result = sfs_rblock(sfs, ptr, SFS_MAP_LOCATION+j);
+	if (sfs->sfs_jmax > 0) {
+		bitdata = bitmap_getdata(sfs->sfs_freemap);
+		for (j=0; j<mapsize; j++) {
+			if (!sfs->sfs_mapdirty[j]) {
+				continue;
+			}
+			result = sfs_jwblock(sfs, bitdata + j*SFS_BLOCKSIZE,
+					     SFS_MAP_LOCATION+j);
+			if (result) {
+				return result;
+			}
+			sfs->sfs_mapdirty[j] = false;
 		}
-		else {
-			result = sfs_wblock(sfs, ptr, SFS_MAP_LOCATION+j);
+		return 0;
+	}
+
+	/* For each run of dirty blocks in the bitmap... */
+	for (j=0; j<mapsize; j = k) {
+		if (!sfs->sfs_mapdirty[j]) {
+			k = j+1;
+			continue;
 		}
+		for (k=j+1; k<mapsize && sfs->sfs_mapdirty[k]; k++);
 
-		/* If we failed, stop. */
+		/* write it out. If we failed, stop. */
+		result = sfs_maprun(sfs, j, k-j, rw);
 		if (result) {
 			return result;
 		}
+		while (j < k) {
+			sfs->sfs_mapdirty[j++] = false;
+		}
 	}
 	return 0;
 }
 
+/*
+ * Count the free blocks covered by each bitmap block, so the
+ * allocator can pass over full ones without looking at their bits.
+ */
+static
+void
+sfs_mapcount(struct sfs_fs *sfs)
+{
+	uint32_t j, i, mapsize;
+
+	mapsize = SFS_FS_BITBLOCKS(sfs);
+	for (j=0; j<mapsize; j++) {
+		sfs->sfs_mapfree[j] = 0;
+		sfs->sfs_mapdirty[j] = false;
+		for (i=j*SFS_BLOCKBITS; i<(j+1)*SFS_BLOCKBITS; i++) {
+			if (!bitmap_isset(sfs->sfs_freemap, i)) {
+				sfs->sfs_mapfree[j]++;
+			}
+		}
+	}
+}
+
 /*
  * Sync routine. This is what gets invoked if you do FS_SYNC on the
  * sfs filesystem structure.
@@ -111,11 +166,10 @@ int
 sfs_sync(struct fs *fs)
 {
 	struct sfs_fs *sfs; 
+	struct vnode **vns;
 	unsigned i, num;
 	int result;
 
-	vfs_biglock_acquire();
-
 	/*
 	 * Get the sfs_fs from the generic abstract fs.
 	 *
@@ -148,18 +202,49 @@ sfs_sync(struct fs *fs)
 
 	sfs = fs->fs_data;
 
-	/* Go over the array of loaded vnodes, syncing as we go. */
+	/*
+	 * If there's a journal, this is a commit; wait for the
+	 * operations in progress and keep new ones out until done.
+	 */
+	sfs_jcommit_begin(sfs);
+
+	/*
+	 * Go over the array of loaded vnodes, syncing as we go. The
+	 * vnode locks come before sfs_vnlock, so we can't sync while
+	 * holding it; instead grab a reference to each vnode, then
+	 * let go of the table and sync them one at a time.
+	 */
+	lock_acquire(sfs->sfs_vnlock);
 	num = vnodearray_num(sfs->sfs_vnodes);
+	vns = kmalloc((num > 0 ? num : 1) * sizeof(struct vnode *));
+	if (vns == NULL) {
+		lock_release(sfs->sfs_vnlock);
+		sfs_jcommit_end(sfs);
+		return ENOMEM;
+	}
+	for (i=0; i<num; i++) {
+		vns[i] = vnodearray_get(sfs->sfs_vnodes, i);
+		VOP_INCREF(vns[i]);
+	}
+	lock_release(sfs->sfs_vnlock);
+
 	for (i=0; i<num; i++) {
-		struct vnode *v = vnodearray_get(sfs->sfs_vnodes, i);
-		VOP_FSYNC(v);
+		sfs_writeinode(vns[i]);
+		VOP_DECREF(vns[i]);
 	}
+	kfree(vns);
+
+	lock_acquire(sfs->sfs_freemaplock);
+
+	/* Blocks freed since the last commit can be reused now */
+	sfs_bfree_flush(sfs);
 
 	/* If the free block map needs to be written, write it. */
 	if (sfs->sfs_freemapdirty) {
 		result = sfs_mapio(sfs, UIO_WRITE);
 		if (result) {
-			vfs_biglock_release();
+			lock_release(sfs->sfs_freemaplock);
+			sfs_jcommit_end(sfs);
 			return result;
 		}
 		sfs->sfs_freemapdirty = false;
@@ -167,16 +252,20 @@ sfs_sync(struct fs *fs)
 
 	/* If the superblock needs to be written, write it. */
 	if (sfs->sfs_superdirty) {
-		result = sfs_wblock(sfs, &sfs->sfs_super, SFS_SB_LOCATION);
+		result = sfs_jwblock(sfs, &sfs->sfs_super, SFS_SB_LOCATION);
 		if (result) {
-			vfs_biglock_release();
+			lock_release(sfs->sfs_freemaplock);
+			sfs_jcommit_end(sfs);
 			return result;
 		}
 		sfs->sfs_superdirty = false;
 	}
 
-	vfs_biglock_release();
-	return 0;
+	lock_release(sfs->sfs_freemaplock);
+
+	result = sfs_jcommit(sfs);
+	sfs_jcommit_end(sfs);
+	return result;
 }
 
 /*
@@ -189,13 +278,9 @@ const char *
 sfs_getvolname(struct fs *fs)
 {
 	struct sfs_fs *sfs = fs->fs_data;
-	const char *ret;
-
-	vfs_biglock_acquire();
-	ret = sfs->sfs_super.sp_volname;
-	vfs_biglock_release();
 
-	return ret;
+	/* The volume name doesn't change while mounted; no lock needed */
+	return sfs->sfs_super.sp_volname;
 }
 
 /*
@@ -208,22 +293,37 @@ int
 sfs_unmount(struct fs *fs)
 {
 	struct sfs_fs *sfs = fs->fs_data;
+	int result;
 
-	vfs_biglock_acquire();
-	
-	/* Do we have any files open? If so, can't unmount. */
+	/*
+	 * Do we have any files open? If so, can't unmount. (The VFS
+	 * layer holds the mount list lock, so nobody can be looking
+	 * up new files on us while we do this.)
+	 */
+	lock_acquire(sfs->sfs_vnlock);
 	if (vnodearray_num(sfs->sfs_vnodes) > 0) {
-		vfs_biglock_release();
+		lock_release(sfs->sfs_vnlock);
 		return EBUSY;
 	}
+	lock_release(sfs->sfs_vnlock);
 
 	/* We should have just had sfs_sync called. */
 	KASSERT(sfs->sfs_superdirty == false);
 	KASSERT(sfs->sfs_freemapdirty == false);
 
+	/* Mark the journal clean */
+	result = sfs_junmount(sfs);
+	if (result) {
+		return result;
+	}
+
 	/* Once we start nuking stuff we can't fail. */
 	vnodearray_destroy(sfs->sfs_vnodes);
 	bitmap_destroy(sfs->sfs_freemap);
+	kfree(sfs->sfs_mapdirty);
+	kfree(sfs->sfs_mapfree);
+	lock_destroy(sfs->sfs_vnlock);
+	lock_destroy(sfs->sfs_freemaplock);
 	
 	/* The vfs layer takes care of the device for us */
 	(void)sfs->sfs_device;
@@ -232,7 +332,6 @@ sfs_unmount(struct fs *fs)
 	kfree(sfs);
 
 	/* nothing else to do */
-	vfs_biglock_release();
 	return 0;
 }
 
@@ -254,11 +353,10 @@ static
 int
 sfs_domount(void *options, struct device *dev, struct fs **ret)
 {
+	unsigned i;
 	int result;
 	struct sfs_fs *sfs;
 
-	vfs_biglock_acquire();
-
 	/* We don't pass any options through mount */
 	(void)options;
 
@@ -270,22 +368,19 @@ sfs_domount(void *options, struct device *dev, struct fs **ret)
 	KASSERT(SFS_BLOCKSIZE % sizeof(struct sfs_dir) == 0);
 
 	/*
-	 * We can't mount on devices with the wrong sector size.
-	 *
-	 * (Note: for all intents and purposes here, "sector" and
-	 * "block" are interchangeable terms. Technically a filesystem
-	 * block may be composed of several hardware sectors, but we
-	 * don't do that in sfs.)
+	 * We can't mount on devices whose sector size doesn't divide
+	 * our block size. Each filesystem block is made up of
+	 * SFS_BLOCKSIZE / d_blocksize hardware sectors (8, on lhd),
+	 * which the device transfers in one go.
 	 */
-	if (dev->d_blocksize != SFS_BLOCKSIZE) {
-		vfs_biglock_release();
+	if (dev->d_blocksize == 0 || dev->d_blocksize > SFS_BLOCKSIZE ||
+	    SFS_BLOCKSIZE % dev->d_blocksize != 0) {
 		return ENXIO;
 	}
 
 	/* Allocate object */
 	sfs = kmalloc(sizeof(struct sfs_fs));
 	if (sfs==NULL) {
-		vfs_biglock_release();
 		return ENOMEM;
 	}
 
@@ -293,10 +388,14 @@ sfs_domount(void *options, struct device *dev, struct fs **ret)
 	sfs->sfs_vnodes = vnodearray_create();
 	if (sfs->sfs_vnodes == NULL) {
 		kfree(sfs);
-		vfs_biglock_release();
 		return ENOMEM;
 	}
 
+	/* No vnodes loaded yet */
+	for (i=0; i<SFS_VNHASHSIZE; i++) {
+		sfs->sfs_vnhash[i] = NULL;
+	}
+
 	/* Set the device so we can use sfs_rblock() */
 	sfs->sfs_device = dev;
 
@@ -305,7 +404,6 @@ sfs_domount(void *options, struct device *dev, struct fs **ret)
 	if (result) {
 		vnodearray_destroy(sfs->sfs_vnodes);
 		kfree(sfs);
-		vfs_biglock_release();
 		return result;
 	}
 
@@ -318,40 +416,98 @@ sfs_domount(void *options, struct device *dev, struct fs **ret)
 			SFS_MAGIC);
 		vnodearray_destroy(sfs->sfs_vnodes);
 		kfree(sfs);
-		vfs_biglock_release();
 		return EINVAL;
 	}
 	
-	if (sfs->sfs_super.sp_nblocks > dev->d_blocks) {
+	if (sfs->sfs_super.sp_version != SFS_VERSION ||
+	    sfs->sfs_super.sp_blocksize != SFS_BLOCKSIZE) {
+		kprintf("sfs: Unsupported format version %u, block size %u "
+			"(should be %u, %u); rerun mksfs\n",
+			sfs->sfs_super.sp_version,
+			sfs->sfs_super.sp_blocksize,
+			SFS_VERSION, SFS_BLOCKSIZE);
+		vnodearray_destroy(sfs->sfs_vnodes);
+		kfree(sfs);
+		return EINVAL;
+	}
+
+	if (sfs->sfs_super.sp_nblocks >
+	    dev->d_blocks / (SFS_BLOCKSIZE / dev->d_blocksize)) {
 		kprintf("sfs: warning - fs has %u blocks, device has %u\n",
-			sfs->sfs_super.sp_nblocks, dev->d_blocks);
+			sfs->sfs_super.sp_nblocks,
+			dev->d_blocks / (SFS_BLOCKSIZE / dev->d_blocksize));
 	}
 
 	/* Ensure null termination of the volume name */
 	sfs->sfs_super.sp_volname[sizeof(sfs->sfs_super.sp_volname)-1] = 0;
 
+	/*
+	 * Set up the journal. This replays it if need be, so it has
+	 * to come before loading anything else.
+	 */
+	result = sfs_jmount(sfs);
+	if (result) {
+		vnodearray_destroy(sfs->sfs_vnodes);
+		kfree(sfs);
+		return result;
+	}
+
 	/* Load free space bitmap */
 	sfs->sfs_freemap = bitmap_create(SFS_FS_BITMAPSIZE(sfs));
 	if (sfs->sfs_freemap == NULL) {
+		sfs_jdestroy(sfs);
+		vnodearray_destroy(sfs->sfs_vnodes);
+		kfree(sfs);
+		return ENOMEM;
+	}
+	sfs->sfs_mapdirty = kmalloc(SFS_FS_BITBLOCKS(sfs) * sizeof(bool));
+	sfs->sfs_mapfree = kmalloc(SFS_FS_BITBLOCKS(sfs) * sizeof(uint32_t));
+	if (sfs->sfs_mapdirty == NULL || sfs->sfs_mapfree == NULL) {
+		kfree(sfs->sfs_mapdirty);
+		kfree(sfs->sfs_mapfree);
+		bitmap_destroy(sfs->sfs_freemap);
+		sfs_jdestroy(sfs);
 		vnodearray_destroy(sfs->sfs_vnodes);
 		kfree(sfs);
-		vfs_biglock_release();
 		return ENOMEM;
 	}
 	result = sfs_mapio(sfs, UIO_READ);
 	if (result) {
+		kfree(sfs->sfs_mapdirty);
+		kfree(sfs->sfs_mapfree);
 		bitmap_destroy(sfs->sfs_freemap);
+		sfs_jdestroy(sfs);
 		vnodearray_destroy(sfs->sfs_vnodes);
 		kfree(sfs);
-		vfs_biglock_release();
 		return result;
 	}
+	sfs_mapcount(sfs);
+
+	/* Create the locks (see sfs.h) */
+	sfs->sfs_vnlock = lock_create("sfs_vnlock");
+	sfs->sfs_freemaplock = lock_create("sfs_freemaplock");
+	if (sfs->sfs_vnlock == NULL || sfs->sfs_freemaplock == NULL) {
+		if (sfs->sfs_vnlock != NULL) {
+			lock_destroy(sfs->sfs_vnlock);
+		}
+		if (sfs->sfs_freemaplock != NULL) {
+			lock_destroy(sfs->sfs_freemaplock);
+		}
+		kfree(sfs->sfs_mapdirty);
+		kfree(sfs->sfs_mapfree);
+		bitmap_destroy(sfs->sfs_freemap);
+		sfs_jdestroy(sfs);
+		vnodearray_destroy(sfs->sfs_vnodes);
+		kfree(sfs);
+		return ENOMEM;
+	}
 
 	/* Set up abstract fs calls */
 	sfs->sfs_absfs.fs_sync = sfs_sync;
 	sfs->sfs_absfs.fs_getvolname = sfs_getvolname;
 	sfs->sfs_absfs.fs_getroot = sfs_getroot;
 	sfs->sfs_absfs.fs_unmount = sfs_unmount;
+	sfs->sfs_absfs.fs_ncache = true;
 	sfs->sfs_absfs.fs_data = sfs;
 
 	/* the other fields */
@@ -361,7 +517,6 @@ sfs_domount(void *options, struct device *dev, struct fs **ret)
 	/* Hand back the abstract fs */
 	*ret = &sfs->sfs_absfs;
 
-	vfs_biglock_release();
 	return 0;
 }
 
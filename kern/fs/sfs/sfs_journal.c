@@ -0,0 +1,807 @@
+/*
+ * Copyright (c) 2000, 2001, 2002, 2003, 2004, 2005, 2008, 2009
+ *	The President and Fellows of Harvard College.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the University nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE UNIVERSITY AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE UNIVERSITY OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+/*
+ * SFS metadata journal.
+ *
+ * Metadata blocks (inodes, indirect blocks, directory blocks, and at
+ * commit time the dirty bitmap blocks and superblock) are not written
+ * in place as they change. sfs_jwblock instead copies them into the
+ * running transaction, which is kept in memory; writing the same
+ * block again just updates the copy. sfs_jrblock checks the
+ * transaction before going to the disk.
+ *
+ * sfs_sync commits the transaction: the copies are written to the
+ * journal area in one transfer, then the journal header (see
+ * kern/sfs.h), which is the commit point, and then the copies are
+ * written to their home locations. If the system goes down after the
+ * header is written, sfs_jmount finishes the job at the next mount.
+ *
+ * Operations that change metadata are bracketed by sfs_jbegin and
+ * sfs_jend, and a commit waits until none are in progress, so a
+ * transaction never contains half an operation. sfs_jbegin sets
+ * aside SFS_JRESERVE blocks of the transaction for the operation,
+ * committing first if there isn't room, so the transaction never
+ * fills up in mid-operation and no metadata bypasses it.
+ *
+ * File data is not journaled; it's written in place as before.
+ * Blocks that are freed are not reused until the transaction that
+ * frees them has been committed (see sfs_bfree), so a crash can't
+ * leave an old inode or indirect block pointing at some other file's
+ * new data.
+ */
+
+#include <types.h>
+#include <kern/errno.h>
+#include <lib.h>
+#include <bitmap.h>
+#include <uio.h>
+#include <synch.h>
+#include <current.h>
+#include <clock.h>
+#include <vfs.h>
+#include <sfs.h>
+
+/*
+ * For testing replay: if set, the next commit panics right after
+ * writing the journal header, before any block is put in place. The
+ * "jcrash" menu command sets it. For example, on a scratch volume:
+ *
+ *	sys161 kernel "mount sfs lhd1; p /testbin/bigfile lhd1:f 50000;
+ *	    jcrash; sync"
+ *	sys161 kernel "mount sfs lhd1; pf lhd1:f; unmount lhd1; q"
+ *
+ * then run sfsck on the disk image. The second boot should report
+ * replaying the transaction, and sfsck should find nothing wrong.
+ */
+bool sfs_jcrash;
+
+/*
+ * A block in the running transaction.
+ */
+struct sfs_jblock {
+	uint32_t jb_home;		/* where it belongs */
+	void *jb_data;			/* its new contents */
+};
+
+/*
+ * The number of blocks an operation may put in the transaction. The
+ * rest is left for the bitmap and superblock, which only go in at
+ * commit time.
+ */
+static
+uint32_t
+sfs_jopmax(struct sfs_fs *sfs)
+{
+	return sfs->sfs_jmax - SFS_FS_BITBLOCKS(sfs) - 1;
+}
+
+/*
+ * Fold N words into a journal checksum.
+ */
+static
+uint32_t
+sfs_jchecksum(uint32_t sum, const uint32_t *words, unsigned n)
+{
+	unsigned i;
+
+	for (i=0; i<n; i++) {
+		sum = ((sum << 1) | (sum >> 31)) + words[i];
+	}
+	return sum;
+}
+
+/*
+ * Find block BLOCK in the running transaction. Returns its index, or
+ * -1 if it isn't there.
+ */
+static
+int
+sfs_jfind(struct sfs_fs *sfs, uint32_t block)
+{
+	uint32_t i;
+
+	KASSERT(lock_do_i_hold(sfs->sfs_jlock));
+
+	for (i=0; i<sfs->sfs_jnum; i++) {
+		if (sfs->sfs_jblocks[i].jb_home == block) {
+			return i;
+		}
+	}
+	return -1;
+}
+
+/*
+ * Check if the current thread is in the middle of an operation.
+ */
+static
+bool
+sfs_jinop(struct sfs_fs *sfs)
+{
+	struct sfs_jhandle *h;
+
+	KASSERT(lock_do_i_hold(sfs->sfs_jlock));
+
+	for (h = sfs->sfs_jops; h != NULL; h = h->jh_next) {
+		if (h->jh_thread == curthread) {
+			return true;
+		}
+	}
+	return false;
+}
+
+/*
+ * Count the free blocks. The caller must hold sfs_freemaplock.
+ */
+static
+uint32_t
+sfs_nfree(struct sfs_fs *sfs)
+{
+	uint32_t j, n = 0;
+
+	KASSERT(lock_do_i_hold(sfs->sfs_freemaplock));
+
+	for (j=0; j<SFS_FS_BITBLOCKS(sfs); j++) {
+		n += sfs->sfs_mapfree[j];
+	}
+	return n;
+}
+
+////////////////////////////////////////////////////////////
+//
+// Mount and unmount
+
+/*
+ * Write a journal header with nothing to replay.
+ */
+static
+int
+sfs_jclean(struct sfs_fs *sfs, struct sfs_jheader *jh)
+{
+	bzero(jh, sizeof(*jh));
+	jh->jh_magic = SFS_JMAGIC;
+	jh->jh_seq = sfs->sfs_jseq;
+	jh->jh_nblocks = 0;
+	return sfs_wblock(sfs, jh, sfs->sfs_super.sp_journalstart);
+}
+
+/*
+ * Replay the transaction in the journal, if there's a complete one.
+ */
+static
+int
+sfs_jreplay(struct sfs_fs *sfs)
+{
+	struct sfs_super *sp = &sfs->sfs_super;
+	struct sfs_jheader *jh;
+	uint32_t *buf;
+	uint32_t i, n, home, sum;
+	int result;
+
+	jh = kmalloc(sizeof(*jh));
+	buf = kmalloc(SFS_BLOCKSIZE);
+	if (jh == NULL || buf == NULL) {
+		kfree(jh);
+		kfree(buf);
+		return ENOMEM;
+	}
+
+	result = sfs_rblock(sfs, jh, sp->sp_journalstart);
+	if (result) {
+		goto out;
+	}
+	if (jh->jh_magic != SFS_JMAGIC ||
+	    jh->jh_nblocks > sp->sp_journalblocks - 1 ||
+	    jh->jh_nblocks > SFS_JMAXBLOCKS) {
+		kprintf("sfs: %s: Bad journal header; run sfsck\n",
+			sp->sp_volname);
+		result = EINVAL;
+		goto out;
+	}
+	sfs->sfs_jseq = jh->jh_seq + 1;
+	n = jh->jh_nblocks;
+	if (n == 0) {
+		/* Clean */
+		goto out;
+	}
+
+	/*
+	 * Make sure the whole transaction made it to disk before
+	 * believing any of it.
+	 */
+	sum = sfs_jchecksum(0, &jh->jh_seq, 2);
+	sum = sfs_jchecksum(sum, jh->jh_home, n);
+	for (i=0; i<n; i++) {
+		result = sfs_rblock(sfs, buf, sp->sp_journalstart + 1 + i);
+		if (result) {
+			goto out;
+		}
+		sum = sfs_jchecksum(sum, buf, SFS_BLOCKSIZE/sizeof(uint32_t));
+	}
+
+	if (sum != jh->jh_checksum) {
+		kprintf("sfs: %s: Discarding incomplete journal "
+			"transaction %u\n", sp->sp_volname, jh->jh_seq);
+	}
+	else {
+		for (i=0; i<n; i++) {
+			home = jh->jh_home[i];
+			if (home >= sp->sp_nblocks ||
+			    (home >= sp->sp_journalstart &&
+			     home < sp->sp_journalstart +
+			     sp->sp_journalblocks)) {
+				kprintf("sfs: %s: Bad block %u in journal; "
+					"run sfsck\n", sp->sp_volname, home);
+				result = EINVAL;
+				goto out;
+			}
+		}
+		for (i=0; i<n; i++) {
+			result = sfs_rblock(sfs, buf,
+					    sp->sp_journalstart + 1 + i);
+			if (result) {
+				goto out;
+			}
+			result = sfs_wblock(sfs, buf, jh->jh_home[i]);
+			if (result) {
+				goto out;
+			}
+		}
+		kprintf("sfs: %s: Replayed %u blocks from journal\n",
+			sp->sp_volname, n);
+
+		/* The superblock may have been among them */
+		result = sfs_rblock(sfs, sp, SFS_SB_LOCATION);
+		if (result) {
+			goto out;
+		}
+		sp->sp_volname[sizeof(sp->sp_volname)-1] = 0;
+	}
+
+	/* Either way, there's nothing left to replay */
+	result = sfs_jclean(sfs, jh);
+
+ out:
+	kfree(jh);
+	kfree(buf);
+	return result;
+}
+
+/*
+ * Set up the journal at mount time, replaying it first if the
+ * system went down with a committed transaction in it. If the volume
+ * has no journal, sfs_jmax is left 0 and everything is written in
+ * place.
+ */
+int
+sfs_jmount(struct sfs_fs *sfs)
+{
+	struct sfs_super *sp = &sfs->sfs_super;
+	uint32_t max;
+	int result;
+
+	sfs->sfs_jmax = 0;
+	sfs->sfs_jseq = 0;
+	sfs->sfs_jblocks = NULL;
+	sfs->sfs_jnum = 0;
+	sfs->sfs_jlock = NULL;
+	sfs->sfs_jcv = NULL;
+	sfs->sfs_jops = NULL;
+	sfs->sfs_jreserved = 0;
+	sfs->sfs_jcommitter = NULL;
+	sfs->sfs_jfreed = NULL;
+	sfs->sfs_jnfreed = 0;
+
+	if (sp->sp_journalblocks == 0) {
+		return 0;
+	}
+	if (sp->sp_journalblocks < 2 ||
+	    sp->sp_journalstart < SFS_MAP_LOCATION + SFS_FS_BITBLOCKS(sfs) ||
+	    sp->sp_journalstart + sp->sp_journalblocks > sp->sp_nblocks) {
+		kprintf("sfs: %s: Invalid journal location; run sfsck\n",
+			sp->sp_volname);
+		return EINVAL;
+	}
+
+	result = sfs_jreplay(sfs);
+	if (result) {
+		return result;
+	}
+
+	max = sp->sp_journalblocks - 1;
+	if (max > SFS_JMAXBLOCKS) {
+		max = SFS_JMAXBLOCKS;
+	}
+	if (max < SFS_FS_BITBLOCKS(sfs) + 1 + SFS_JRESERVE) {
+		kprintf("sfs: %s: Journal too small, not using it\n",
+			sp->sp_volname);
+		return 0;
+	}
+
+	sfs->sfs_jblocks = kmalloc(max * sizeof(struct sfs_jblock));
+	sfs->sfs_jlock = lock_create("sfs_jlock");
+	sfs->sfs_jcv = cv_create("sfs_jcv");
+	sfs->sfs_jfreed = bitmap_create(SFS_FS_BITMAPSIZE(sfs));
+	if (sfs->sfs_jblocks == NULL || sfs->sfs_jlock == NULL ||
+	    sfs->sfs_jcv == NULL || sfs->sfs_jfreed == NULL) {
+		sfs_jdestroy(sfs);
+		return ENOMEM;
+	}
+	sfs->sfs_jmax = max;
+	return 0;
+}
+
+/*
+ * Release the journal's in-memory structures.
+ */
+void
+sfs_jdestroy(struct sfs_fs *sfs)
+{
+	uint32_t i;
+
+	KASSERT(sfs->sfs_jops == NULL);
+	KASSERT(sfs->sfs_jreserved == 0);
+	KASSERT(sfs->sfs_jcommitter == NULL);
+
+	for (i=0; i<sfs->sfs_jnum; i++) {
+		kfree(sfs->sfs_jblocks[i].jb_data);
+	}
+	sfs->sfs_jnum = 0;
+	kfree(sfs->sfs_jblocks);
+	sfs->sfs_jblocks = NULL;
+	if (sfs->sfs_jlock != NULL) {
+		lock_destroy(sfs->sfs_jlock);
+		sfs->sfs_jlock = NULL;
+	}
+	if (sfs->sfs_jcv != NULL) {
+		cv_destroy(sfs->sfs_jcv);
+		sfs->sfs_jcv = NULL;
+	}
+	if (sfs->sfs_jfreed != NULL) {
+		bitmap_destroy(sfs->sfs_jfreed);
+		sfs->sfs_jfreed = NULL;
+	}
+	sfs->sfs_jnfreed = 0;
+	sfs->sfs_jmax = 0;
+}
+
+/*
+ * Shut down the journal at unmount time. The filesystem has just
+ * been synced, so the transaction is empty; mark the journal clean
+ * so offline tools see nothing to replay.
+ */
+int
+sfs_junmount(struct sfs_fs *sfs)
+{
+	struct sfs_jheader *jh;
+	int result;
+
+	if (sfs->sfs_jmax == 0) {
+		return 0;
+	}
+	KASSERT(sfs->sfs_jnum == 0);
+	KASSERT(sfs->sfs_jnfreed == 0);
+
+	jh = kmalloc(sizeof(*jh));
+	if (jh == NULL) {
+		return ENOMEM;
+	}
+	result = sfs_jclean(sfs, jh);
+	kfree(jh);
+	if (result) {
+		return result;
+	}
+
+	sfs_jdestroy(sfs);
+	return 0;
+}
+
+////////////////////////////////////////////////////////////
+//
+// Operations and commits
+
+/*
+ * Start an operation that changes metadata. Call before taking any
+ * of the filesystem's locks, and call sfs_jend with the same handle
+ * when done. An operation started inside another one (as when
+ * sfs_remove drops the last reference to a file and it gets
+ * reclaimed) is just part of the outer one.
+ *
+ * Waits until SFS_JRESERVE blocks of the running transaction can be
+ * set aside for the operation, committing the transaction to make
+ * room.
+ */
+void
+sfs_jbegin(struct sfs_fs *sfs, struct sfs_jhandle *jh)
+{
+	bool lowspace;
+	int result;
+
+	jh->jh_thread = curthread;
+	jh->jh_nested = false;
+	jh->jh_next = NULL;
+
+	if (sfs->sfs_jmax == 0) {
+		return;
+	}
+
+	/*
+	 * If there are more blocks waiting for a commit to free them
+	 * than there are free blocks, commit now so we don't run out
+	 * of space for no good reason.
+	 */
+	lock_acquire(sfs->sfs_freemaplock);
+	lowspace = sfs->sfs_jnfreed > 0 && sfs->sfs_jnfreed >= sfs_nfree(sfs);
+	lock_release(sfs->sfs_freemaplock);
+
+	lock_acquire(sfs->sfs_jlock);
+	if (sfs->sfs_jcommitter == curthread || sfs_jinop(sfs)) {
+		jh->jh_nested = true;
+		lock_release(sfs->sfs_jlock);
+		return;
+	}
+
+	while (1) {
+		while (sfs->sfs_jcommitter != NULL) {
+			cv_wait(sfs->sfs_jcv, sfs->sfs_jlock);
+			/* That commit took care of the freed blocks */
+			lowspace = false;
+		}
+		if (!lowspace && sfs->sfs_jnum + sfs->sfs_jreserved +
+		    SFS_JRESERVE <= sfs_jopmax(sfs)) {
+			break;
+		}
+
+		/* Commit the running transaction before starting */
+		lock_release(sfs->sfs_jlock);
+		result = FSOP_SYNC(&sfs->sfs_absfs);
+		if (result) {
+			/*
+			 * The transaction is kept, so try again in a
+			 * moment rather than write anything in place.
+			 */
+			kprintf("sfs: %s: journal commit failed: %s\n",
+				sfs->sfs_super.sp_volname, strerror(result));
+			clock_sleep(HZ);
+		}
+		lock_acquire(sfs->sfs_jlock);
+		lowspace = false;
+	}
+
+	sfs->sfs_jreserved += SFS_JRESERVE;
+	jh->jh_next = sfs->sfs_jops;
+	sfs->sfs_jops = jh;
+	lock_release(sfs->sfs_jlock);
+}
+
+/*
+ * Finish an operation.
+ */
+void
+sfs_jend(struct sfs_fs *sfs, struct sfs_jhandle *jh)
+{
+	struct sfs_jhandle **hp;
+
+	if (sfs->sfs_jmax == 0 || jh->jh_nested) {
+		return;
+	}
+
+	lock_acquire(sfs->sfs_jlock);
+	for (hp = &sfs->sfs_jops; *hp != jh; hp = &(*hp)->jh_next) {
+		KASSERT(*hp != NULL);
+	}
+	*hp = jh->jh_next;
+	KASSERT(sfs->sfs_jreserved >= SFS_JRESERVE);
+	sfs->sfs_jreserved -= SFS_JRESERVE;
+	if (sfs->sfs_jops == NULL) {
+		cv_broadcast(sfs->sfs_jcv, sfs->sfs_jlock);
+	}
+	lock_release(sfs->sfs_jlock);
+}
+
+/*
+ * Start a commit: keep new operations from starting, and wait for
+ * the ones in progress to finish. Must not be called from inside an
+ * operation.
+ */
+void
+sfs_jcommit_begin(struct sfs_fs *sfs)
+{
+	if (sfs->sfs_jmax == 0) {
+		return;
+	}
+
+	lock_acquire(sfs->sfs_jlock);
+	KASSERT(sfs->sfs_jcommitter != curthread);
+	KASSERT(!sfs_jinop(sfs));
+	while (sfs->sfs_jcommitter != NULL) {
+		cv_wait(sfs->sfs_jcv, sfs->sfs_jlock);
+	}
+	sfs->sfs_jcommitter = curthread;
+	while (sfs->sfs_jops != NULL) {
+		cv_wait(sfs->sfs_jcv, sfs->sfs_jlock);
+	}
+	lock_release(sfs->sfs_jlock);
+}
+
+/*
+ * Let operations start again.
+ */
+void
+sfs_jcommit_end(struct sfs_fs *sfs)
+{
+	if (sfs->sfs_jmax == 0) {
+		return;
+	}
+
+	lock_acquire(sfs->sfs_jlock);
+	KASSERT(sfs->sfs_jcommitter == curthread);
+	sfs->sfs_jcommitter = NULL;
+	cv_broadcast(sfs->sfs_jcv, sfs->sfs_jlock);
+	lock_release(sfs->sfs_jlock);
+}
+
+/*
+ * Write blocks FIRST through FIRST+N-1 of the running transaction to
+ * consecutive disk blocks starting at DISKBLOCK, in one transfer.
+ */
+static
+int
+sfs_jwriterun(struct sfs_fs *sfs, struct iovec *iov, uint32_t first,
+	      uint32_t n, uint32_t diskblock)
+{
+	struct uio ku;
+	uint32_t i;
+
+	for (i=0; i<n; i++) {
+		iov[i].iov_kbase = sfs->sfs_jblocks[first+i].jb_data;
+		iov[i].iov_len = SFS_BLOCKSIZE;
+	}
+	ku.uio_iov = iov;
+	ku.uio_iovcnt = n;
+	ku.uio_offset = (off_t)diskblock * SFS_BLOCKSIZE;
+	ku.uio_resid = n * SFS_BLOCKSIZE;
+	ku.uio_segflg = UIO_SYSSPACE;
+	ku.uio_rw = UIO_WRITE;
+	ku.uio_space = NULL;
+	return sfs_rwblock(sfs, &ku);
+}
+
+/*
+ * Commit the running transaction. Called by sfs_sync between
+ * sfs_jcommit_begin and sfs_jcommit_end, after everything that
+ * should go in has been written to it.
+ */
+int
+sfs_jcommit(struct sfs_fs *sfs)
+{
+	struct sfs_super *sp = &sfs->sfs_super;
+	struct sfs_jheader *jh;
+	struct sfs_jblock tmp;
+	struct iovec *iov;
+	uint32_t i, j, n, sum;
+	int result;
+
+	if (sfs->sfs_jmax == 0) {
+		return 0;
+	}
+
+	lock_acquire(sfs->sfs_jlock);
+	KASSERT(sfs->sfs_jcommitter == curthread);
+
+	n = sfs->sfs_jnum;
+	if (n == 0) {
+		lock_release(sfs->sfs_jlock);
+		return 0;
+	}
+
+	jh = kmalloc(sizeof(*jh));
+	iov = kmalloc(n * sizeof(struct iovec));
+	if (jh == NULL || iov == NULL) {
+		result = ENOMEM;
+		goto out;
+	}
+
+	/* Sort by home location so the checkpoint goes in disk order */
+	for (i=1; i<n; i++) {
+		tmp = sfs->sfs_jblocks[i];
+		for (j=i; j>0 && sfs->sfs_jblocks[j-1].jb_home > tmp.jb_home;
+		     j--) {
+			sfs->sfs_jblocks[j] = sfs->sfs_jblocks[j-1];
+		}
+		sfs->sfs_jblocks[j] = tmp;
+	}
+
+	bzero(jh, sizeof(*jh));
+	jh->jh_magic = SFS_JMAGIC;
+	jh->jh_seq = sfs->sfs_jseq;
+	jh->jh_nblocks = n;
+	for (i=0; i<n; i++) {
+		jh->jh_home[i] = sfs->sfs_jblocks[i].jb_home;
+	}
+	sum = sfs_jchecksum(0, &jh->jh_seq, 2);
+	sum = sfs_jchecksum(sum, jh->jh_home, n);
+	for (i=0; i<n; i++) {
+		sum = sfs_jchecksum(sum, sfs->sfs_jblocks[i].jb_data,
+				    SFS_BLOCKSIZE/sizeof(uint32_t));
+	}
+	jh->jh_checksum = sum;
+
+	/* Write the copies into the journal... */
+	result = sfs_jwriterun(sfs, iov, 0, n, sp->sp_journalstart + 1);
+	if (result) {
+		goto out;
+	}
+
+	/* ...then the header, which commits them... */
+	result = sfs_wblock(sfs, jh, sp->sp_journalstart);
+	if (result) {
+		goto out;
+	}
+	if (sfs_jcrash) {
+		panic("sfs: %s: jcrash: stopping after committing "
+		      "transaction %u\n", sp->sp_volname, jh->jh_seq);
+	}
+
+	/* ...then put them in place, adjacent ones together. */
+	for (i=0; i<n; i=j) {
+		for (j=i+1; j<n && sfs->sfs_jblocks[j].jb_home ==
+			     sfs->sfs_jblocks[j-1].jb_home + 1; j++);
+		result = sfs_jwriterun(sfs, iov, i, j-i,
+				       sfs->sfs_jblocks[i].jb_home);
+		if (result) {
+			/*
+			 * Keep the transaction; it's committed, so
+			 * it'll be replayed if need be, and it's the
+			 * only up-to-date copy of these blocks.
+			 */
+			goto out;
+		}
+	}
+
+	for (i=0; i<n; i++) {
+		kfree(sfs->sfs_jblocks[i].jb_data);
+	}
+	sfs->sfs_jnum = 0;
+	sfs->sfs_jseq++;
+
+ out:
+	lock_release(sfs->sfs_jlock);
+	kfree(jh);
+	kfree(iov);
+	return result;
+}
+
+////////////////////////////////////////////////////////////
+//
+// Metadata block I/O
+
+/*
+ * Read a metadata block, from the running transaction if it's there.
+ */
+int
+sfs_jrblock(struct sfs_fs *sfs, void *data, uint32_t block)
+{
+	int ix;
+
+	if (sfs->sfs_jmax == 0) {
+		return sfs_rblock(sfs, data, block);
+	}
+
+	lock_acquire(sfs->sfs_jlock);
+	ix = sfs_jfind(sfs, block);
+	if (ix >= 0) {
+		memcpy(data, sfs->sfs_jblocks[ix].jb_data, SFS_BLOCKSIZE);
+		lock_release(sfs->sfs_jlock);
+		return 0;
+	}
+	lock_release(sfs->sfs_jlock);
+
+	/*
+	 * The caller's locks keep anyone from putting the block in
+	 * the transaction while we read it.
+	 */
+	return sfs_rblock(sfs, data, block);
+}
+
+/*
+ * Write a metadata block into the running transaction.
+ *
+ * sfs_jbegin keeps room for every operation in progress, so the
+ * transaction can only be full if an operation writes more than
+ * SFS_JRESERVE blocks, which is a bug. Then, or if there's no memory
+ * for the copy, fail like a disk error would; writing the block in
+ * place instead could leave a crash with half an operation on disk.
+ */
+int
+sfs_jwblock(struct sfs_fs *sfs, void *data, uint32_t block)
+{
+	struct sfs_jblock *jb;
+	uint32_t max;
+	void *copy;
+	int ix;
+
+	if (sfs->sfs_jmax == 0) {
+		return sfs_wblock(sfs, data, block);
+	}
+
+	lock_acquire(sfs->sfs_jlock);
+	ix = sfs_jfind(sfs, block);
+	if (ix >= 0) {
+		memcpy(sfs->sfs_jblocks[ix].jb_data, data, SFS_BLOCKSIZE);
+		lock_release(sfs->sfs_jlock);
+		return 0;
+	}
+
+	/* The committer needs the room kept for the bitmap */
+	max = (sfs->sfs_jcommitter == curthread) ?
+		sfs->sfs_jmax : sfs_jopmax(sfs);
+
+	if (sfs->sfs_jnum >= max) {
+		lock_release(sfs->sfs_jlock);
+		kprintf("sfs: %s: journal transaction full\n",
+			sfs->sfs_super.sp_volname);
+		return ENOSPC;
+	}
+	copy = kmalloc(SFS_BLOCKSIZE);
+	if (copy == NULL) {
+		lock_release(sfs->sfs_jlock);
+		return ENOMEM;
+	}
+
+	memcpy(copy, data, SFS_BLOCKSIZE);
+	jb = &sfs->sfs_jblocks[sfs->sfs_jnum++];
+	jb->jb_home = block;
+	jb->jb_data = copy;
+	lock_release(sfs->sfs_jlock);
+	return 0;
+}
+
+/*
+ * Drop block BLOCK from the running transaction, because it's being
+ * freed and its new contents no longer matter.
+ */
+void
+sfs_jforget(struct sfs_fs *sfs, uint32_t block)
+{
+	int ix;
+
+	if (sfs->sfs_jmax == 0) {
+		return;
+	}
+
+	lock_acquire(sfs->sfs_jlock);
+	ix = sfs_jfind(sfs, block);
+	if (ix >= 0) {
+		kfree(sfs->sfs_jblocks[ix].jb_data);
+		sfs->sfs_jnum--;
+		sfs->sfs_jblocks[ix] = sfs->sfs_jblocks[sfs->sfs_jnum];
+	}
+	lock_release(sfs->sfs_jlock);
+}
@@ -35,6 +35,7 @@
 #include <types.h>
 #include <kern/errno.h>
 #include <kern/fcntl.h>
+#include <kern/dirent.h>
 #include <stat.h>
 #include <lib.h>
 #include <array.h>
@@ -49,6 +50,9 @@
 static int sfs_loadvnode(struct sfs_fs *sfs, uint32_t ino, int type,
 			 struct sfs_vnode **ret);
 
+/* Further down */
+static int sfs_itrunc(struct sfs_vnode *sv, off_t len);
+
 ////////////////////////////////////////////////////////////
 //
 // Simple stuff
@@ -63,14 +67,14 @@ sfs_clearblock(struct sfs_fs *sfs, uint32_t block)
 	return sfs_wblock(sfs, zeros, block);
 }
 
-/* Write an on-disk inode structure back out to disk. */
+/* Write an on-disk inode structure back out to disk (or the journal). */
 static
 int
 sfs_sync_inode(struct sfs_vnode *sv)
 {
 	if (sv->sv_dirty) {
 		struct sfs_fs *sfs = sv->sv_v.vn_fs->fs_data;
-		int result = sfs_wblock(sfs, &sv->sv_i, sv->sv_ino);
+		int result = sfs_jwblock(sfs, &sv->sv_i, sv->sv_ino);
 		if (result) {
 			return result;
 		}
@@ -79,28 +83,136 @@ sfs_sync_inode(struct sfs_vnode *sv)
 	return 0;
 }
 
+/*
+ * If there's a journal, put a dirty inode into the running
+ * transaction now, so it's committed together with the rest of the
+ * operation that changed it. (If this fails, the inode stays dirty
+ * and goes out with the next sync.)
+ */
+static
+void
+sfs_jinode(struct sfs_vnode *sv)
+{
+	struct sfs_fs *sfs = sv->sv_v.vn_fs->fs_data;
+
+	KASSERT(lock_do_i_hold(sv->sv_lock));
+
+	if (sfs->sfs_jmax > 0) {
+		(void)sfs_sync_inode(sv);
+	}
+}
+
 ////////////////////////////////////////////////////////////
 //
 // Space allocation
+//
+// The free map, its per-block counts, and the preallocation windows'
+// claim on it are protected by sfs_freemaplock. The _locked functions
+// expect the caller to hold it. A file's own preallocation window
+// fields are protected by its sv_lock.
+
+/*
+ * Note that block DISKBLOCK has just been marked used (if USED) or
+ * free in the freemap: update the free count of the bitmap block
+ * that covers it, and mark that bitmap block dirty.
+ */
+static
+void
+sfs_mapchanged(struct sfs_fs *sfs, uint32_t diskblock, bool used)
+{
+	uint32_t mapblock = diskblock / SFS_BLOCKBITS;
+
+	KASSERT(lock_do_i_hold(sfs->sfs_freemaplock));
+
+	if (used) {
+		KASSERT(sfs->sfs_mapfree[mapblock] > 0);
+		sfs->sfs_mapfree[mapblock]--;
+	}
+	else {
+		KASSERT(sfs->sfs_mapfree[mapblock] < SFS_BLOCKBITS);
+		sfs->sfs_mapfree[mapblock]++;
+	}
+	sfs->sfs_mapdirty[mapblock] = true;
+	sfs->sfs_freemapdirty = true;
+}
 
 /*
- * Allocate a block.
+ * Mark a block in use in the freemap. The first free block at or
+ * after GOAL is used if there is one; pass 0 if you don't care where
+ * it goes.
+ *
+ * Bitmap blocks with no free bits are skipped using the free counts
+ * in sfs_mapfree, so a mostly full disk doesn't mean scanning every
+ * bit of the map.
  */
 static
 int
-sfs_balloc(struct sfs_fs *sfs, uint32_t *diskblock)
+sfs_balloc_locked(struct sfs_fs *sfs, uint32_t goal, uint32_t *diskblock)
 {
-	int result;
+	uint32_t i, first, mapblock, mapsize, start, end;
+	unsigned index;
+	int result = ENOSPC;
+
+	KASSERT(lock_do_i_hold(sfs->sfs_freemaplock));
 
-	result = bitmap_alloc(sfs->sfs_freemap, diskblock);
+	if (goal >= sfs->sfs_super.sp_nblocks) {
+		goal = 0;
+	}
+
+	/*
+	 * Search each bitmap block in turn starting with the one that
+	 * holds GOAL, and come back around to the part of that block
+	 * before GOAL at the end. Each search is confined to its own
+	 * block, so full blocks are never scanned.
+	 */
+	mapsize = SFS_FS_BITBLOCKS(sfs);
+	first = goal / SFS_BLOCKBITS;
+	for (i=0; i<=mapsize; i++) {
+		mapblock = (first + i) % mapsize;
+		if (sfs->sfs_mapfree[mapblock] == 0) {
+			continue;
+		}
+		start = mapblock * SFS_BLOCKBITS;
+		end = start + SFS_BLOCKBITS;
+		if (i == 0) {
+			start = goal;
+		}
+		else if (i == mapsize) {
+			end = goal;
+		}
+		result = bitmap_alloc_range(sfs->sfs_freemap, start, end,
+					    &index);
+		if (result == 0) {
+			break;
+		}
+	}
 	if (result) {
 		return result;
 	}
-	sfs->sfs_freemapdirty = true;
+	*diskblock = index;
+	sfs_mapchanged(sfs, *diskblock, true);
 
 	if (*diskblock >= sfs->sfs_super.sp_nblocks) {
 		panic("sfs: balloc: invalid block %u\n", *diskblock);
 	}
+	return 0;
+}
+
+/*
+ * Allocate a block, near GOAL if possible, and clear it.
+ */
+static
+int
+sfs_balloc(struct sfs_fs *sfs, uint32_t goal, uint32_t *diskblock)
+{
+	int result;
+
+	lock_acquire(sfs->sfs_freemaplock);
+	result = sfs_balloc_locked(sfs, goal, diskblock);
+	lock_release(sfs->sfs_freemaplock);
+	if (result) {
+		return result;
+	}
 
 	/* Clear block before returning it */
 	return sfs_clearblock(sfs, *diskblock);
@@ -108,17 +220,63 @@ sfs_balloc(struct sfs_fs *sfs, uint32_t *diskblock)
 
 /*
  * Free a block.
+ *
+ * With a journal, the block stays marked in use until the next
+ * commit (see sfs_bfree_flush). If it were handed out again right
+ * away and got new data, a crash before the commit would leave its
+ * old owner, still on disk, pointing at that data.
  */
 static
 void
-sfs_bfree(struct sfs_fs *sfs, uint32_t diskblock)
+sfs_bfree_locked(struct sfs_fs *sfs, uint32_t diskblock)
 {
+	KASSERT(lock_do_i_hold(sfs->sfs_freemaplock));
+
+	if (sfs->sfs_jmax > 0) {
+		KASSERT(!bitmap_isset(sfs->sfs_jfreed, diskblock));
+		bitmap_mark(sfs->sfs_jfreed, diskblock);
+		sfs->sfs_jnfreed++;
+		sfs_jforget(sfs, diskblock);
+		return;
+	}
+
 	bitmap_unmark(sfs->sfs_freemap, diskblock);
-	sfs->sfs_freemapdirty = true;
+	sfs_mapchanged(sfs, diskblock, false);
+}
+
+static
+void
+sfs_bfree(struct sfs_fs *sfs, uint32_t diskblock)
+{
+	lock_acquire(sfs->sfs_freemaplock);
+	sfs_bfree_locked(sfs, diskblock);
+	lock_release(sfs->sfs_freemaplock);
+}
+
+/*
+ * Actually free the blocks sfs_bfree_locked put off freeing. Called
+ * by sfs_sync during a commit, with sfs_freemaplock held.
+ */
+void
+sfs_bfree_flush(struct sfs_fs *sfs)
+{
+	uint32_t i;
+
+	KASSERT(lock_do_i_hold(sfs->sfs_freemaplock));
+
+	for (i=0; sfs->sfs_jnfreed > 0 && i<sfs->sfs_super.sp_nblocks; i++) {
+		if (bitmap_isset(sfs->sfs_jfreed, i)) {
+			bitmap_unmark(sfs->sfs_jfreed, i);
+			sfs->sfs_jnfreed--;
+			bitmap_unmark(sfs->sfs_freemap, i);
+			sfs_mapchanged(sfs, i, false);
+		}
+	}
 }
 
 /*
- * Check if a block is in use.
+ * Check if a block is in use. Callers that act on the answer need to
+ * hold sfs_freemaplock; the sanity checks elsewhere don't bother.
  */
 static
 int
@@ -131,159 +289,414 @@ sfs_bused(struct sfs_fs *sfs, uint32_t diskblock)
 	return bitmap_isset(sfs->sfs_freemap, diskblock);
 }
 
-////////////////////////////////////////////////////////////
-//
-// Block mapping/inode maintenance
+/*
+ * Give back whatever is left of a file's preallocation window.
+ */
+static
+void
+sfs_prealloc_release(struct sfs_vnode *sv)
+{
+	struct sfs_fs *sfs = sv->sv_v.vn_fs->fs_data;
+	uint32_t i;
+
+	if (sv->sv_prealloc_len == 0) {
+		return;
+	}
+
+	/* Nothing was ever written to these, so they can be reused now */
+	lock_acquire(sfs->sfs_freemaplock);
+	for (i=0; i<sv->sv_prealloc_len; i++) {
+		bitmap_unmark(sfs->sfs_freemap, sv->sv_prealloc_start + i);
+		sfs_mapchanged(sfs, sv->sv_prealloc_start + i, false);
+	}
+	lock_release(sfs->sfs_freemaplock);
+
+	sv->sv_prealloc_start = 0;
+	sv->sv_prealloc_len = 0;
+}
 
 /*
- * Look up the disk block number (from 0 up to the number of blocks on
- * the disk) given a file and the logical block number within that
- * file. If DOALLOC is set, and no such block exists, one will be
- * allocated.
+ * Set up a new preallocation window for a file, starting at block
+ * START and running up to SFS_PREALLOC blocks or the next block that
+ * isn't free. The blocks are marked in use so nobody else gets them,
+ * but aren't cleared until they're actually handed to the file.
  */
 static
-int
-sfs_bmap(struct sfs_vnode *sv, uint32_t fileblock, int doalloc,
-	 uint32_t *diskblock)
+void
+sfs_prealloc_fill_locked(struct sfs_vnode *sv, uint32_t start)
 {
-	/*
-	 * I/O buffer for handling indirect blocks.
-	 *
-	 * Note: in real life (and when you've done the fs assignment)
-	 * you would get space from the disk buffer cache for this,
-	 * not use a static area.
-	 */
-	static uint32_t idbuf[SFS_DBPERIDB];
+	struct sfs_fs *sfs = sv->sv_v.vn_fs->fs_data;
+	uint32_t n;
+
+	KASSERT(lock_do_i_hold(sfs->sfs_freemaplock));
+	KASSERT(sv->sv_prealloc_len == 0);
 
+	for (n=0; n<SFS_PREALLOC; n++) {
+		if (start + n >= sfs->sfs_super.sp_nblocks ||
+		    sfs_bused(sfs, start + n)) {
+			break;
+		}
+		bitmap_mark(sfs->sfs_freemap, start + n);
+		sfs_mapchanged(sfs, start + n, true);
+	}
+	if (n > 0) {
+		sv->sv_prealloc_start = start;
+		sv->sv_prealloc_len = n;
+	}
+}
+
+/*
+ * Figure out where the next block of a file should go: right after
+ * the last one we gave it, or failing that, right after its inode.
+ */
+static
+uint32_t
+sfs_alloc_goal(struct sfs_vnode *sv)
+{
+	if (sv->sv_nextblock != 0) {
+		return sv->sv_nextblock;
+	}
+	return sv->sv_ino + 1;
+}
+
+/*
+ * Allocate a block for file SV, as close to block GOAL as we can.
+ * Blocks come out of the file's preallocation window first; when
+ * that runs dry a new one is set up after the block handed out.
+ *
+ * If EXACT is set, only block GOAL itself will do; if it isn't
+ * available, *DISKBLOCK is set to 0 instead.
+ */
+static
+int
+sfs_file_balloc(struct sfs_vnode *sv, uint32_t goal, bool exact,
+		uint32_t *diskblock)
+{
 	struct sfs_fs *sfs = sv->sv_v.vn_fs->fs_data;
 	uint32_t block;
-	uint32_t idblock;
-	uint32_t idnum, idoff;
-	int result;
+	int result = 0;
+
+	KASSERT(lock_do_i_hold(sv->sv_lock));
+
+	lock_acquire(sfs->sfs_freemaplock);
+	if (sv->sv_prealloc_len > 0 &&
+	    (!exact || sv->sv_prealloc_start == goal)) {
+		/* Already marked in use */
+		block = sv->sv_prealloc_start;
+		sv->sv_prealloc_start++;
+		sv->sv_prealloc_len--;
+	}
+	else if (exact) {
+		if (goal >= sfs->sfs_super.sp_nblocks ||
+		    sfs_bused(sfs, goal)) {
+			lock_release(sfs->sfs_freemaplock);
+			*diskblock = 0;
+			return 0;
+		}
+		block = goal;
+		bitmap_mark(sfs->sfs_freemap, block);
+		sfs_mapchanged(sfs, block, true);
+	}
+	else {
+		result = sfs_balloc_locked(sfs, goal, &block);
+	}
+	if (result == 0 && sv->sv_prealloc_len == 0) {
+		sfs_prealloc_fill_locked(sv, block + 1);
+	}
+	lock_release(sfs->sfs_freemaplock);
+	if (result) {
+		return result;
+	}
 
-	KASSERT(sizeof(idbuf)==SFS_BLOCKSIZE);
+	sv->sv_nextblock = block + 1;
 
-	/*
-	 * If the block we want is one of the direct blocks...
-	 */
-	if (fileblock < SFS_NDIRECT) {
-		/*
-		 * Get the block number
-		 */
-		block = sv->sv_i.sfi_direct[fileblock];
+	/* Clear block before handing it out */
+	result = sfs_clearblock(sfs, block);
+	if (result) {
+		return result;
+	}
 
-		/*
-		 * Do we need to allocate?
-		 */
-		if (block==0 && doalloc) {
-			result = sfs_balloc(sfs, &block);
-			if (result) {
-				return result;
+	*diskblock = block;
+	return 0;
+}
+
+////////////////////////////////////////////////////////////
+//
+// Block mapping/inode maintenance
+
+/*
+ * Find the extent in the inode, if any, that maps file block
+ * FILEBLOCK. Returns its index, or -1 if there isn't one.
+ */
+static
+int
+sfs_extent_find(const struct sfs_inode *sfi, uint32_t fileblock)
+{
+	const struct sfs_extent *ext;
+	int i;
+
+	for (i=0; i<SFS_NEXTENTS; i++) {
+		ext = &sfi->sfi_extents[i];
+		if (ext->sfe_nblocks > 0 &&
+		    fileblock >= ext->sfe_fileblock &&
+		    fileblock - ext->sfe_fileblock < ext->sfe_nblocks) {
+			return i;
+		}
+	}
+	return -1;
+}
+
+/*
+ * Allocate a disk block for file block FILEBLOCK, which must not be
+ * mapped yet, using the extent table.
+ *
+ * If an extent ends just before FILEBLOCK and the disk block right
+ * after it is free (or reserved for this file), that extent is grown
+ * by one. Otherwise, if there
+ * is an unused extent, a new run is started in it. If neither works,
+ * *DISKBLOCK is set to 0 and the caller should fall back to the
+ * direct/indirect blocks.
+ */
+static
+int
+sfs_extent_alloc(struct sfs_vnode *sv, uint32_t fileblock,
+		 uint32_t *diskblock)
+{
+	struct sfs_extent *ext, *freeext = NULL;
+	uint32_t next;
+	int i, result;
+
+	for (i=0; i<SFS_NEXTENTS; i++) {
+		ext = &sv->sv_i.sfi_extents[i];
+		if (ext->sfe_nblocks == 0) {
+			if (freeext == NULL) {
+				freeext = ext;
 			}
+			continue;
+		}
+		if (ext->sfe_fileblock + ext->sfe_nblocks != fileblock) {
+			continue;
+		}
 
-			/* Remember what we allocated; mark inode dirty */
-			sv->sv_i.sfi_direct[fileblock] = block;
+		next = ext->sfe_diskblock + ext->sfe_nblocks;
+		result = sfs_file_balloc(sv, next, true, diskblock);
+		if (result) {
+			return result;
+		}
+		if (*diskblock != 0) {
+			ext->sfe_nblocks++;
 			sv->sv_dirty = true;
+			return 0;
 		}
+	}
 
-		/*
-		 * Hand back the block
-		 */
-		if (block != 0 && !sfs_bused(sfs, block)) {
-			panic("sfs: Data block %u (block %u of file %u) "
-			      "marked free\n", block, fileblock, sv->sv_ino);
-		}
-		*diskblock = block;
+	if (freeext == NULL) {
+		/* Extent table is full */
+		*diskblock = 0;
 		return 0;
 	}
 
-	/*
-	 * It's not a direct block; it must be in the indirect block.
-	 * Subtract off the number of direct blocks, so FILEBLOCK is
-	 * now the offset into the indirect block space.
-	 */
+	result = sfs_file_balloc(sv, sfs_alloc_goal(sv), false, diskblock);
+	if (result) {
+		return result;
+	}
+	freeext->sfe_fileblock = fileblock;
+	freeext->sfe_diskblock = *diskblock;
+	freeext->sfe_nblocks = 1;
+	sv->sv_dirty = true;
+	return 0;
+}
 
-	fileblock -= SFS_NDIRECT;
+/*
+ * Look up a file block in the direct/indirect block tree. Works like
+ * sfs_bmap (below) but does not consult the extents.
+ */
+static
+int
+sfs_bmap_tree(struct sfs_vnode *sv, uint32_t fileblock, int doalloc,
+	      uint32_t *diskblock)
+{
+	struct sfs_fs *sfs = sv->sv_v.vn_fs->fs_data;
+	uint32_t *idbuf;
+	uint32_t *slot;
+	uint32_t block, child, span, idx;
+	int level, indirection;
+	bool fresh = false;
+	int result;
 
-	/* Get the indirect block number and offset w/i that indirect block */
-	idnum = fileblock / SFS_DBPERIDB;
-	idoff = fileblock % SFS_DBPERIDB;
+	KASSERT(lock_do_i_hold(sv->sv_lock));
 
 	/*
-	 * We only have one indirect block. If the offset we were asked for
-	 * is too large, we can't handle it, so fail.
+	 * Figure out which pointer in the inode leads to the block we
+	 * want, and how many levels of indirect blocks hang off it.
+	 * Subtract off the blocks covered by the earlier pointers as we
+	 * go, so FILEBLOCK ends up as the offset under that pointer.
 	 */
-	if (idnum > 0) {
+	if (fileblock < SFS_NDIRECT) {
+		slot = &sv->sv_i.sfi_direct[fileblock];
+		indirection = 0;
+	}
+	else if ((fileblock -= SFS_NDIRECT) < SFS_DBPERIDB) {
+		slot = &sv->sv_i.sfi_indirect;
+		indirection = 1;
+	}
+	else if ((fileblock -= SFS_DBPERIDB) < SFS_DBPERIDB*SFS_DBPERIDB) {
+		slot = &sv->sv_i.sfi_dindirect;
+		indirection = 2;
+	}
+	else if ((fileblock -= SFS_DBPERIDB*SFS_DBPERIDB) <
+		 SFS_DBPERIDB*SFS_DBPERIDB*SFS_DBPERIDB) {
+		slot = &sv->sv_i.sfi_tindirect;
+		indirection = 3;
+	}
+	else {
 		return EFBIG;
 	}
 
-	/* Get the disk block number of the indirect block. */
-	idblock = sv->sv_i.sfi_indirect;
-
-	if (idblock==0 && !doalloc) {
-		/*
-		 * There's no indirect block allocated. We weren't
-		 * asked to allocate anything, so pretend the indirect
-		 * block was filled with all zeros.
-		 */
-		*diskblock = 0;
-		return 0;
-	}
-	else if (idblock==0) {
-		/*
-		 * There's no indirect block allocated, but we need to
-		 * allocate a block whose number needs to be stored in
-		 * the indirect block. Thus, we need to allocate an
-		 * indirect block.
-		 */
-		result = sfs_balloc(sfs, &idblock);
+	block = *slot;
+	if (block == 0) {
+		if (!doalloc) {
+			*diskblock = 0;
+			return 0;
+		}
+		result = sfs_file_balloc(sv, sfs_alloc_goal(sv), false,
+					 &block);
 		if (result) {
 			return result;
 		}
 
-		/* Remember the block we just allocated */
-		sv->sv_i.sfi_indirect = idblock;
-
-		/* Mark the inode dirty */
+		/* Remember what we allocated; mark inode dirty */
+		*slot = block;
 		sv->sv_dirty = true;
+		fresh = true;
+	}
 
-		/* Clear the indirect block buffer */
-		bzero(idbuf, sizeof(idbuf));
+	if (indirection == 0) {
+		*diskblock = block;
+		return 0;
 	}
-	else {
-		/*
-		 * We already have an indirect block allocated; load it.
-		 */
-		result = sfs_rblock(sfs, idbuf, idblock);
-		if (result) {
-			return result;
-		}
+
+	/*
+	 * I/O buffer for handling indirect blocks. This can't be a
+	 * static area because other files may be doing the same thing
+	 * at the same time.
+	 *
+	 * Note: in real life (and when you've done the fs assignment)
+	 * you would get space from the disk buffer cache for this.
+	 */
+	idbuf = kmalloc(SFS_BLOCKSIZE);
+	if (idbuf == NULL) {
+		return ENOMEM;
 	}
 
-	/* Get the block out of the indirect block buffer */
-	block = idbuf[idoff];
+	/*
+	 * Walk down through the indirect blocks. At each level, BLOCK
+	 * is the indirect block and SPAN is the number of file blocks
+	 * covered by each of its entries.
+	 */
+	result = 0;
+	for (level = indirection; level > 0; level--) {
+		for (span = 1, idx = 1; idx < (uint32_t)level; idx++) {
+			span *= SFS_DBPERIDB;
+		}
+		idx = fileblock / span;
+		fileblock %= span;
 
-	/* If there's no block there, allocate one */
-	if (block==0 && doalloc) {
-		result = sfs_balloc(sfs, &block);
-		if (result) {
-			return result;
+		if (fresh) {
+			/* Just allocated, so it's all zeros */
+			bzero(idbuf, SFS_BLOCKSIZE);
 		}
+		else {
+			result = sfs_jrblock(sfs, idbuf, block);
+			if (result) {
+				break;
+			}
+		}
+
+		child = idbuf[idx];
+		fresh = false;
+		if (child == 0) {
+			if (!doalloc) {
+				break;
+			}
+			result = sfs_file_balloc(sv, sfs_alloc_goal(sv),
+						 false, &child);
+			if (result) {
+				break;
+			}
 
-		/* Remember the block we allocated */
-		idbuf[idoff] = block;
+			/* The indirect block is now dirty; write it back */
+			idbuf[idx] = child;
+			result = sfs_jwblock(sfs, idbuf, block);
+			if (result) {
+				break;
+			}
+			fresh = true;
+		}
+		block = child;
+	}
+	kfree(idbuf);
+
+	if (result) {
+		return result;
+	}
+	/* If we stopped early, there's a hole here */
+	*diskblock = (level == 0) ? block : 0;
+	return 0;
+}
 
-		/* The indirect block is now dirty; write it back */
-		result = sfs_wblock(sfs, idbuf, idblock);
+/*
+ * Look up the disk block number (from 0 up to the number of blocks on
+ * the disk) given a file and the logical block number within that
+ * file. If DOALLOC is set, and no such block exists, one will be
+ * allocated.
+ *
+ * The extents are checked first, then the direct and indirect
+ * blocks. New blocks go into the extents when possible so that
+ * sequentially written files end up as a few long runs on disk.
+ */
+static
+int
+sfs_bmap(struct sfs_vnode *sv, uint32_t fileblock, int doalloc,
+	 uint32_t *diskblock)
+{
+	struct sfs_fs *sfs = sv->sv_v.vn_fs->fs_data;
+	struct sfs_extent *ext;
+	uint32_t block;
+	int ix, result;
+
+	ix = sfs_extent_find(&sv->sv_i, fileblock);
+	if (ix >= 0) {
+		ext = &sv->sv_i.sfi_extents[ix];
+		block = ext->sfe_diskblock + (fileblock - ext->sfe_fileblock);
+	}
+	else {
+		result = sfs_bmap_tree(sv, fileblock, 0, &block);
 		if (result) {
 			return result;
 		}
+
+		if (block == 0 && doalloc) {
+			result = sfs_extent_alloc(sv, fileblock, &block);
+			if (result) {
+				return result;
+			}
+			if (block == 0) {
+				result = sfs_bmap_tree(sv, fileblock, 1,
+						       &block);
+				if (result) {
+					return result;
+				}
+			}
+		}
 	}
 
-	/* Hand back the result and return. */
+	/*
+	 * Hand back the block
+	 */
 	if (block != 0 && !sfs_bused(sfs, block)) {
-		panic("sfs: Data block %u (block %u of file %u) marked free\n",
-		      block, fileblock, sv->sv_ino);
+		panic("sfs: Data block %u (block %u of file %u) "
+		      "marked free\n", block, fileblock, sv->sv_ino);
 	}
 	*diskblock = block;
 	return 0;
@@ -302,24 +715,19 @@ sfs_bmap(struct sfs_vnode *sv, uint32_t fileblock, int doalloc,
  * skipstart is the number of bytes to skip past at the beginning of
  * the sector; len is the number of bytes to actually read or write.
  * uio is the area to do the I/O into.
+ *
+ * Directory blocks are metadata, and go through the journal.
  */
 static
 int
 sfs_partialio(struct sfs_vnode *sv, struct uio *uio,
 	      uint32_t skipstart, uint32_t len)
 {
-	/*
-	 * I/O buffer for handling partial sectors.
-	 *
-	 * Note: in real life (and when you've done the fs assignment)
-	 * you would get space from the disk buffer cache for this,
-	 * not use a static area.
-	 */
-	static char iobuf[SFS_BLOCKSIZE];
-
 	struct sfs_fs *sfs = sv->sv_v.vn_fs->fs_data;
+	char *iobuf;
 	uint32_t diskblock;
 	uint32_t fileblock;
+	bool meta = (sv->sv_i.sfi_type == SFS_TYPE_DIR);
 	int result;
 	
 	/* Allocate missing blocks if and only if we're writing */
@@ -336,20 +744,35 @@ sfs_partialio(struct sfs_vnode *sv, struct uio *uio,
 		return result;
 	}
 
+	/*
+	 * I/O buffer for handling partial sectors. This can't be a
+	 * static area because other files may be doing the same thing
+	 * at the same time.
+	 *
+	 * Note: in real life (and when you've done the fs assignment)
+	 * you would get space from the disk buffer cache for this.
+	 */
+	iobuf = kmalloc(SFS_BLOCKSIZE);
+	if (iobuf == NULL) {
+		return ENOMEM;
+	}
+
 	if (diskblock == 0) {
 		/*
 		 * There was no block mapped at this point in the file.
 		 * Zero the buffer.
 		 */
 		KASSERT(uio->uio_rw == UIO_READ);
-		bzero(iobuf, sizeof(iobuf));
+		bzero(iobuf, SFS_BLOCKSIZE);
 	}
 	else {
 		/*
 		 * Read the block.
 		 */
-		result = sfs_rblock(sfs, iobuf, diskblock);
+		result = meta ? sfs_jrblock(sfs, iobuf, diskblock) :
+			sfs_rblock(sfs, iobuf, diskblock);
 		if (result) {
+			kfree(iobuf);
 			return result;
 		}
 	}
@@ -359,6 +782,7 @@ sfs_partialio(struct sfs_vnode *sv, struct uio *uio,
 	 */
 	result = uiomove(iobuf+skipstart, len, uio);
 	if (result) {
+		kfree(iobuf);
 		return result;
 	}
 
@@ -366,25 +790,27 @@ sfs_partialio(struct sfs_vnode *sv, struct uio *uio,
 	 * If it was a write, write back the modified block.
 	 */
 	if (uio->uio_rw == UIO_WRITE) {
-		result = sfs_wblock(sfs, iobuf, diskblock);
-		if (result) {
-			return result;
-		}
+		result = meta ? sfs_jwblock(sfs, iobuf, diskblock) :
+			sfs_wblock(sfs, iobuf, diskblock);
 	}
 
-	return 0;
+	kfree(iobuf);
+	return result;
 }
 
 /*
- * Do I/O (either read or write) of a single whole block.
+ * Do I/O (either read or write) of whole blocks, at most MAXBLOCKS of
+ * them. As many blocks as are contiguous on disk are transferred in
+ * one device operation; the caller should call again for the rest.
  */
 static
 int
-sfs_blockio(struct sfs_vnode *sv, struct uio *uio)
+sfs_blockio(struct sfs_vnode *sv, struct uio *uio, uint32_t maxblocks)
 {
 	struct sfs_fs *sfs = sv->sv_v.vn_fs->fs_data;
-	uint32_t diskblock;
+	uint32_t diskblock, nextblock;
 	uint32_t fileblock;
+	uint32_t run;
 	int result;
 	int doalloc = (uio->uio_rw==UIO_WRITE);
 	off_t saveoff;
@@ -392,6 +818,8 @@ sfs_blockio(struct sfs_vnode *sv, struct uio *uio)
 	off_t saveres;
 	off_t diskres;
 
+	KASSERT(maxblocks > 0);
+
 	/* Get the block number within the file */
 	fileblock = uio->uio_offset / SFS_BLOCKSIZE;
 
@@ -412,20 +840,41 @@ sfs_blockio(struct sfs_vnode *sv, struct uio *uio)
 		return uiomovezeros(SFS_BLOCKSIZE, uio);
 	}
 
+	/*
+	 * If the block came from an extent, see how many of the
+	 * following blocks are contiguous with it on disk. (Blocks
+	 * mapped by the indirect blocks are hardly ever contiguous, so
+	 * don't bother looking there.)
+	 */
+	run = 1;
+	if (sfs_extent_find(&sv->sv_i, fileblock) >= 0) {
+		while (run < maxblocks) {
+			result = sfs_bmap(sv, fileblock + run, doalloc,
+					  &nextblock);
+			if (result) {
+				return result;
+			}
+			if (nextblock != diskblock + run) {
+				break;
+			}
+			run++;
+		}
+	}
+
 	/*
 	 * Do the I/O directly to the uio region. Save the uio_offset,
 	 * and substitute one that makes sense to the device.
 	 */
 	saveoff = uio->uio_offset;
-	diskoff = diskblock * SFS_BLOCKSIZE;
+	diskoff = (off_t)diskblock * SFS_BLOCKSIZE;
 	uio->uio_offset = diskoff;
 
 	/*
-	 * Temporarily set the residue to be one block size.
+	 * Temporarily set the residue to be the size of the run.
 	 */
-	KASSERT(uio->uio_resid >= SFS_BLOCKSIZE);
+	KASSERT(uio->uio_resid >= run * SFS_BLOCKSIZE);
 	saveres = uio->uio_resid;
-	diskres = SFS_BLOCKSIZE;
+	diskres = run * SFS_BLOCKSIZE;
 	uio->uio_resid = diskres;
 	
 	result = sfs_rwblock(sfs, uio);
@@ -448,10 +897,11 @@ int
 sfs_io(struct sfs_vnode *sv, struct uio *uio)
 {
 	uint32_t blkoff;
-	uint32_t nblocks, i;
 	int result = 0;
 	uint32_t extraresid = 0;
 
+	KASSERT(lock_do_i_hold(sv->sv_lock));
+
 	/*
 	 * If reading, check for EOF. If we can read a partial area,
 	 * remember how much extra there was in EXTRARESID so we can
@@ -472,6 +922,12 @@ sfs_io(struct sfs_vnode *sv, struct uio *uio)
 			uio->uio_resid -= extraresid;
 		}
 	}
+	else {
+		/* The size field in the inode is only 32 bits */
+		if (uio->uio_offset + uio->uio_resid > (off_t)0xffffffff) {
+			return EFBIG;
+		}
+	}
 
 	/*
 	 * First, do any leading partial block.
@@ -503,11 +959,18 @@ sfs_io(struct sfs_vnode *sv, struct uio *uio)
 
 	/*
 	 * Now we should be block-aligned. Do the remaining whole blocks.
+	 * (Directories go a block at a time through sfs_partialio, so
+	 * they use the journal.)
 	 */
 	KASSERT(uio->uio_offset % SFS_BLOCKSIZE == 0);
-	nblocks = uio->uio_resid / SFS_BLOCKSIZE;
-	for (i=0; i<nblocks; i++) {
-		result = sfs_blockio(sv, uio);
+	while (uio->uio_resid >= SFS_BLOCKSIZE) {
+		if (sv->sv_i.sfi_type == SFS_TYPE_DIR) {
+			result = sfs_partialio(sv, uio, 0, SFS_BLOCKSIZE);
+		}
+		else {
+			result = sfs_blockio(sv, uio,
+					     uio->uio_resid / SFS_BLOCKSIZE);
+		}
 		if (result) {
 			goto out;
 		}
@@ -636,10 +1099,84 @@ sfs_dir_nentries(struct sfs_vnode *sv)
 	return size / sizeof(struct sfs_dir);
 }
 
+/*
+ * Build the in-memory name index for a directory, if it doesn't
+ * have one yet. The directory is read a whole block at a time.
+ */
+static
+int
+sfs_dir_loadhash(struct sfs_vnode *sv)
+{
+	const int perblock = SFS_BLOCKSIZE / sizeof(struct sfs_dir);
+
+	struct sfs_dir *sdbuf;
+	struct sfs_dirhash *dh;
+	struct iovec iov;
+	struct uio ku;
+	int nentries = sfs_dir_nentries(sv);
+	int i, j, n, result;
+
+	if (sv->sv_dirhash != NULL) {
+		return 0;
+	}
+
+	sdbuf = kmalloc(SFS_BLOCKSIZE);
+	if (sdbuf == NULL) {
+		return ENOMEM;
+	}
+	dh = sfs_dirhash_create();
+	if (dh == NULL) {
+		kfree(sdbuf);
+		return ENOMEM;
+	}
+	result = sfs_dirhash_setslots(dh, nentries);
+
+	for (i=0; result == 0 && i<nentries; i+=n) {
+		n = nentries - i;
+		if (n > perblock) {
+			n = perblock;
+		}
+
+		/* Read the next block's worth of entries */
+		uio_kinit(&iov, &ku, sdbuf, n * sizeof(struct sfs_dir),
+			  i * sizeof(struct sfs_dir), UIO_READ);
+		result = sfs_io(sv, &ku);
+		if (result) {
+			break;
+		}
+		if (ku.uio_resid > 0) {
+			panic("sfs: loadhash: Short read (inode %u)\n",
+			      sv->sv_ino);
+		}
+
+		/* and index them */
+		for (j=0; j<n && result == 0; j++) {
+			if (sdbuf[j].sfd_ino == SFS_NOINO) {
+				continue;
+			}
+			/* Ensure null termination, just in case */
+			sdbuf[j].sfd_name[sizeof(sdbuf[j].sfd_name)-1] = 0;
+			result = sfs_dirhash_add(dh, sdbuf[j].sfd_name,
+						 sdbuf[j].sfd_ino, i+j);
+		}
+	}
+	kfree(sdbuf);
+	if (result) {
+		sfs_dirhash_destroy(dh);
+		return result;
+	}
+
+	sv->sv_dirhash = dh;
+	return 0;
+}
+
 /*
  * Search a directory for a particular filename in a directory, and
  * return its inode number, its slot, and/or the slot number of an
  * empty directory slot if one is found.
+ *
+ * This normally goes through the directory's name index. If there
+ * isn't memory for one, we fall back to reading every slot.
  */
 
 static
@@ -652,6 +1189,20 @@ sfs_dir_findname(struct sfs_vnode *sv, const char *name,
 	int nentries = sfs_dir_nentries(sv);
 	int i, result;
 
+	result = sfs_dir_loadhash(sv);
+	if (result == 0) {
+		if (emptyslot != NULL) {
+			i = sfs_dirhash_emptyslot(sv->sv_dirhash);
+			if (i >= 0) {
+				*emptyslot = i;
+			}
+		}
+		return sfs_dirhash_lookup(sv->sv_dirhash, name, ino, slot);
+	}
+	if (result != ENOMEM) {
+		return result;
+	}
+
 	/* For each slot... */
 	for (i=0; i<nentries; i++) {
 
@@ -729,8 +1280,18 @@ sfs_dir_link(struct sfs_vnode *sv, const char *name, uint32_t ino, int *slot)
 	}
 
 	/* Write the entry. */
-	return sfs_writedir(sv, &sd, emptyslot);
-	
+	result = sfs_writedir(sv, &sd, emptyslot);
+	if (result) {
+		return result;
+	}
+
+	/* Update the name index; if we can't, drop it and rebuild later. */
+	if (sv->sv_dirhash != NULL &&
+	    sfs_dirhash_add(sv->sv_dirhash, name, ino, emptyslot)) {
+		sfs_dirhash_destroy(sv->sv_dirhash);
+		sv->sv_dirhash = NULL;
+	}
+	return 0;
 }
 
 /*
@@ -741,13 +1302,23 @@ int
 sfs_dir_unlink(struct sfs_vnode *sv, int slot)
 {
 	struct sfs_dir sd;
+	int result;
 
 	/* Initialize a suitable directory entry... */ 
 	bzero(&sd, sizeof(sd));
 	sd.sfd_ino = SFS_NOINO;
 
 	/* ... and write it */
-	return sfs_writedir(sv, &sd, slot);
+	result = sfs_writedir(sv, &sd, slot);
+	if (result) {
+		return result;
+	}
+
+	/* ... and drop it from the name index */
+	if (sv->sv_dirhash != NULL) {
+		sfs_dirhash_remove(sv->sv_dirhash, slot);
+	}
+	return 0;
 }
 
 /*
@@ -787,11 +1358,14 @@ sfs_lookonce(struct sfs_vnode *sv, const char *name,
 // Object creation
 
 /*
- * Create a new filesystem object and hand back its vnode.
+ * Create a new filesystem object and hand back its vnode. The inode
+ * is put near that of DIR, the directory it's going into, so that
+ * the inodes of a directory's files tend to be close together.
  */
 static
 int
-sfs_makeobj(struct sfs_fs *sfs, int type, struct sfs_vnode **ret)
+sfs_makeobj(struct sfs_fs *sfs, struct sfs_vnode *dir, int type,
+	    struct sfs_vnode **ret)
 {
 	uint32_t ino;
 	int result;
@@ -801,7 +1375,7 @@ sfs_makeobj(struct sfs_fs *sfs, int type, struct sfs_vnode **ret)
 	 * number is the block number, so just get a block.)
 	 */
 
-	result = sfs_balloc(sfs, &ino);
+	result = sfs_balloc(sfs, dir->sv_ino + 1, &ino);
 	if (result) {
 		return result;
 	}
@@ -875,125 +1449,403 @@ static
 int
 sfs_close(struct vnode *v)
 {
-	/* Sync it. */
-	return VOP_FSYNC(v);
+	struct sfs_vnode *sv = v->vn_data;
+	struct sfs_fs *sfs = v->vn_fs->fs_data;
+	struct sfs_jhandle jh;
+	int result;
+
+	sfs_jbegin(sfs, &jh);
+	lock_acquire(sv->sv_lock);
+
+	/* Nobody's going to be writing it; give back reserved blocks. */
+	sfs_prealloc_release(sv);
+
+	/*
+	 * Sync it. (Without a journal this writes the inode; with one,
+	 * the inode waits for the next commit like everything else.)
+	 */
+	result = sfs_sync_inode(sv);
+
+	lock_release(sv->sv_lock);
+	sfs_jend(sfs, &jh);
+
+	return result;
+}
+
+/*
+ * Called when the vnode refcount (in-memory usage count) hits zero.
+ *
+ * This function should try to avoid returning errors other than EBUSY.
+ */
+static
+int
+sfs_doreclaim(struct vnode *v)
+{
+	struct sfs_vnode *sv = v->vn_data;
+	struct sfs_fs *sfs = v->vn_fs->fs_data;
+	struct sfs_vnode **svp;
+	unsigned ix, num;
+	int result;
+
+	lock_acquire(sv->sv_lock);
+
+	/*
+	 * If the file still has names, write the inode back before
+	 * taking it out of the table: once it's gone from there, a
+	 * lookup can load the inode from disk again, and must not see
+	 * stale contents. Nothing here does any harm if we turn out to
+	 * be EBUSY below.
+	 */
+	if (sv->sv_i.sfi_linkcount > 0) {
+		/* Give back any blocks held for the file */
+		sfs_prealloc_release(sv);
+
+		result = sfs_sync_inode(sv);
+		if (result) {
+			lock_release(sv->sv_lock);
+			return result;
+		}
+	}
+
+	/*
+	 * Make sure someone else hasn't picked up the vnode since the
+	 * decision was made to reclaim it. Holding sfs_vnlock keeps
+	 * sfs_loadvnode from finding it while we take it out of the
+	 * tables; the slow disk work afterwards is done without it.
+	 */
+	lock_acquire(sfs->sfs_vnlock);
+	spinlock_acquire(&v->vn_countlock);
+	if (v->vn_refcount != 1) {
+
+		/* consume the reference VOP_DECREF gave us */
+		KASSERT(v->vn_refcount>1);
+		v->vn_refcount--;
+
+		spinlock_release(&v->vn_countlock);
+		lock_release(sfs->sfs_vnlock);
+		lock_release(sv->sv_lock);
+		return EBUSY;
+	}
+	spinlock_release(&v->vn_countlock);
+
+	/*
+	 * Remove the vnode structure from the tables in the struct
+	 * sfs_fs. Take it off its hash chain, then fill its spot in
+	 * the array with the last entry so nothing has to shift.
+	 */
+	svp = &sfs->sfs_vnhash[SFS_VNHASH(sv->sv_ino)];
+	while (*svp != sv) {
+		if (*svp == NULL) {
+			panic("sfs: reclaim vnode %u not in vnode pool\n",
+			      sv->sv_ino);
+		}
+		svp = &(*svp)->sv_hashnext;
+	}
+	*svp = sv->sv_hashnext;
+
+	num = vnodearray_num(sfs->sfs_vnodes);
+	ix = sv->sv_index;
+	KASSERT(ix < num && vnodearray_get(sfs->sfs_vnodes, ix) == v);
+	if (ix != num-1) {
+		struct vnode *v2 = vnodearray_get(sfs->sfs_vnodes, num-1);
+		struct sfs_vnode *sv2 = v2->vn_data;
+		vnodearray_set(sfs->sfs_vnodes, ix, v2);
+		sv2->sv_index = ix;
+	}
+	result = vnodearray_setsize(sfs->sfs_vnodes, num-1);
+	/* shrinking the array doesn't allocate, so it can't fail */
+	KASSERT(result == 0);
+
+	lock_release(sfs->sfs_vnlock);
+
+	/*
+	 * If there are no on-disk references to the file either, erase
+	 * it and discard the inode. There are no names left to look it
+	 * up by, so nobody can load it again while we do this. If the
+	 * truncate fails, the vnode goes away anyway and the inode is
+	 * left for fsck to clean up.
+	 */
+	if (sv->sv_i.sfi_linkcount==0) {
+		result = sfs_itrunc(sv, 0);
+		if (result == 0) {
+			sfs_prealloc_release(sv);
+			result = sfs_sync_inode(sv);
+		}
+		if (result == 0) {
+			sfs_bfree(sfs, sv->sv_ino);
+		}
+	}
+
+	if (sv->sv_dirhash != NULL) {
+		sfs_dirhash_destroy(sv->sv_dirhash);
+	}
+
+	VOP_CLEANUP(&sv->sv_v);
+
+	/* Nobody else can be waiting for this; they'd have a reference */
+	lock_release(sv->sv_lock);
+	lock_destroy(sv->sv_lock);
+
+	/* Release the storage for the vnode structure itself. */
+	kfree(sv);
+
+	/* Done */
+	return result;
+}
+
+static
+int
+sfs_reclaim(struct vnode *v)
+{
+	struct sfs_fs *sfs = v->vn_fs->fs_data;
+	struct sfs_jhandle jh;
+	int result;
+
+	sfs_jbegin(sfs, &jh);
+	result = sfs_doreclaim(v);
+	sfs_jend(sfs, &jh);
+
+	return result;
+}
+
+/*
+ * Called for read(). sfs_io() does the work.
+ */
+static
+int
+sfs_read(struct vnode *v, struct uio *uio)
+{
+	struct sfs_vnode *sv = v->vn_data;
+	int result;
+
+	KASSERT(uio->uio_rw==UIO_READ);
+
+	lock_acquire(sv->sv_lock);
+	result = sfs_io(sv, uio);
+	lock_release(sv->sv_lock);
+
+	return result;
 }
 
 /*
- * Called when the vnode refcount (in-memory usage count) hits zero.
- *
- * This function should try to avoid returning errors other than EBUSY.
+ * Called for write(). sfs_io() does the work.
  */
 static
 int
-sfs_reclaim(struct vnode *v)
+sfs_write(struct vnode *v, struct uio *uio)
 {
 	struct sfs_vnode *sv = v->vn_data;
 	struct sfs_fs *sfs = v->vn_fs->fs_data;
-	unsigned ix, i, num;
+	struct sfs_jhandle jh;
+	size_t extra, left;
 	int result;
 
-	vfs_biglock_acquire();
+	KASSERT(uio->uio_rw==UIO_WRITE);
 
 	/*
-	 * Make sure someone else hasn't picked up the vnode since the
-	 * decision was made to reclaim it. (You must also synchronize
-	 * this with sfs_loadvnode.)
+	 * Write at most SFS_WRITECHUNK bytes per operation, so one
+	 * big write can't overflow the journal transaction. Hide the
+	 * rest from sfs_io the way it hides a read past EOF.
 	 */
-	if (v->vn_refcount != 1) {
+	do {
+		extra = 0;
+		if (uio->uio_resid > SFS_WRITECHUNK) {
+			extra = uio->uio_resid - SFS_WRITECHUNK;
+			uio->uio_resid = SFS_WRITECHUNK;
+		}
 
-		/* consume the reference VOP_DECREF gave us */
-		KASSERT(v->vn_refcount>1);
-		v->vn_refcount--;
+		sfs_jbegin(sfs, &jh);
+		lock_acquire(sv->sv_lock);
+		result = sfs_io(sv, uio);
+		sfs_jinode(sv);
+		lock_release(sv->sv_lock);
+		sfs_jend(sfs, &jh);
 
-		vfs_biglock_release();
-		return EBUSY;
+		left = uio->uio_resid;
+		uio->uio_resid += extra;
+	} while (result == 0 && left == 0 && extra > 0);
+
+	return result;
+}
+
+/*
+ * Called for getdirentry(). The offset is the slot number; empty
+ * slots are skipped.
+ */
+static
+int
+sfs_getdirentry(struct vnode *v, struct uio *uio)
+{
+	struct sfs_vnode *sv = v->vn_data;
+	struct sfs_dir sd;
+	int slot, nentries;
+	off_t pos;
+	int result = 0;
+
+	KASSERT(uio->uio_rw==UIO_READ);
+
+	lock_acquire(sv->sv_lock);
+
+	nentries = sfs_dir_nentries(sv);
+	pos = uio->uio_offset;
+	if (pos < 0) {
+		lock_release(sv->sv_lock);
+		return EINVAL;
 	}
 
-	/* If there are no on-disk references to the file either, erase it. */
-	if (sv->sv_i.sfi_linkcount==0) {
-		result = VOP_TRUNCATE(&sv->sv_v, 0);
+	for (slot = pos; slot < nentries; slot++) {
+		result = sfs_readdir(sv, &sd, slot);
 		if (result) {
-			vfs_biglock_release();
+			lock_release(sv->sv_lock);
 			return result;
 		}
+		if (sd.sfd_ino != SFS_NOINO) {
+			sd.sfd_name[sizeof(sd.sfd_name)-1] = 0;
+			result = uiomove(sd.sfd_name, strlen(sd.sfd_name), uio);
+			slot++;
+			break;
+		}
 	}
 
-	/* Sync the inode to disk */
-	result = sfs_sync_inode(sv);
-	if (result) {
-		vfs_biglock_release();
-		return result;
-	}
+	/* uiomove moved the offset; put back the slot number */
+	uio->uio_offset = slot;
 
-	/* If there are no on-disk references, discard the inode */
-	if (sv->sv_i.sfi_linkcount==0) {
-		sfs_bfree(sfs, sv->sv_ino);
-	}
+	lock_release(sv->sv_lock);
+	return result;
+}
 
-	/* Remove the vnode structure from the table in the struct sfs_fs. */
-	num = vnodearray_num(sfs->sfs_vnodes);
-	ix = num;
-	for (i=0; i<num; i++) {
-		struct vnode *v2 = vnodearray_get(sfs->sfs_vnodes, i);
-		struct sfs_vnode *sv2 = v2->vn_data;
-		if (sv2 == sv) {
-			ix = i;
+/*
+ * Get the type of inode INO, for struct dirent. If it's loaded, use
+ * the copy in memory; otherwise read the inode into SCRATCH. That
+ * read is done without sfs_vnlock, which is safe because reclaim
+ * writes an inode back before it leaves the table and the type of
+ * an inode never changes. Returns 0 (unknown) if the read fails.
+ */
+static
+uint8_t
+sfs_dirent_type(struct sfs_fs *sfs, uint32_t ino, struct sfs_inode *scratch)
+{
+	struct sfs_vnode *sv;
+	uint16_t sfstype = SFS_TYPE_INVAL;
+	bool found = false;
+
+	lock_acquire(sfs->sfs_vnlock);
+	for (sv = sfs->sfs_vnhash[SFS_VNHASH(ino)]; sv != NULL;
+	     sv = sv->sv_hashnext) {
+		if (sv->sv_ino == ino) {
+			sfstype = sv->sv_i.sfi_type;
+			found = true;
 			break;
 		}
 	}
-	if (ix == num) {
-		panic("sfs: reclaim vnode %u not in vnode pool\n",
-		      sv->sv_ino);
-	}
-	vnodearray_remove(sfs->sfs_vnodes, ix);
-
-	VOP_CLEANUP(&sv->sv_v);
-
-	vfs_biglock_release();
+	lock_release(sfs->sfs_vnlock);
 
-	/* Release the storage for the vnode structure itself. */
-	kfree(sv);
+	if (!found) {
+		if (sfs_jrblock(sfs, scratch, ino)) {
+			return 0;
+		}
+		sfstype = scratch->sfi_type;
+	}
 
-	/* Done */
+	switch (sfstype) {
+	    case SFS_TYPE_FILE: return S_IFREG >> 12;
+	    case SFS_TYPE_DIR: return S_IFDIR >> 12;
+	}
 	return 0;
 }
 
 /*
- * Called for read(). sfs_io() does the work.
+ * Called for getdirentries(). Reads the directory a block at a time
+ * and hands back as many records as fit, so a listing costs one disk
+ * read per directory block rather than one per entry.
  */
 static
 int
-sfs_read(struct vnode *v, struct uio *uio)
+sfs_getdirentries(struct vnode *v, struct uio *uio)
 {
+	const unsigned perblock = SFS_BLOCKSIZE / sizeof(struct sfs_dir);
 	struct sfs_vnode *sv = v->vn_data;
-	int result;
+	struct sfs_fs *sfs = v->vn_fs->fs_data;
+	struct sfs_dir *block, *sd;
+	struct sfs_inode *inodebuf;
+	struct dirent de;
+	struct iovec iov;
+	struct uio ku;
+	unsigned slot, first, nread, nentries;
+	size_t namlen, reclen;
+	bool any = false;
+	int result = 0;
 
 	KASSERT(uio->uio_rw==UIO_READ);
 
-	vfs_biglock_acquire();
-	result = sfs_io(sv, uio);
-	vfs_biglock_release();
+	if (uio->uio_offset < 0) {
+		return EINVAL;
+	}
 
-	return result;
-}
+	block = kmalloc(SFS_BLOCKSIZE);
+	if (block == NULL) {
+		return ENOMEM;
+	}
+	inodebuf = kmalloc(sizeof(struct sfs_inode));
+	if (inodebuf == NULL) {
+		kfree(block);
+		return ENOMEM;
+	}
 
-/*
- * Called for write(). sfs_io() does the work.
- */
-static
-int
-sfs_write(struct vnode *v, struct uio *uio)
-{
-	struct sfs_vnode *sv = v->vn_data;
-	int result;
+	lock_acquire(sv->sv_lock);
 
-	KASSERT(uio->uio_rw==UIO_WRITE);
+	nentries = sfs_dir_nentries(sv);
+	slot = uio->uio_offset;
+	while (slot < nentries) {
+		first = slot - slot % perblock;
+		uio_kinit(&iov, &ku, block, SFS_BLOCKSIZE,
+			  (off_t)first * sizeof(struct sfs_dir), UIO_READ);
+		result = sfs_io(sv, &ku);
+		if (result) {
+			goto out;
+		}
+		nread = (SFS_BLOCKSIZE - ku.uio_resid) / sizeof(struct sfs_dir);
+		KASSERT(nread > slot - first);
 
-	vfs_biglock_acquire();
-	result = sfs_io(sv, uio);
-	vfs_biglock_release();
+		for (; slot < first + nread; slot++) {
+			sd = &block[slot - first];
+			if (sd->sfd_ino == SFS_NOINO) {
+				continue;
+			}
+			sd->sfd_name[sizeof(sd->sfd_name)-1] = 0;
+			namlen = strlen(sd->sfd_name);
+			reclen = _DIRENT_RECLEN(namlen);
+			if (reclen > uio->uio_resid) {
+				if (!any) {
+					result = EINVAL;
+				}
+				goto out;
+			}
+
+			de.d_ino = sd->sfd_ino;
+			de.d_type = sfs_dirent_type(sfs, sd->sfd_ino,
+						    inodebuf);
+			de.d_reclen = reclen;
+			de.d_namlen = namlen;
+			memcpy(de.d_name, sd->sfd_name, namlen);
+			bzero(de.d_name + namlen,
+			      reclen - _DIRENT_HDRSIZE - namlen);
+
+			result = uiomove(&de, reclen, uio);
+			if (result) {
+				goto out;
+			}
+			any = true;
+		}
+	}
+
+ out:
+	/* uiomove moved the offset; put back the slot number */
+	uio->uio_offset = slot;
 
+	lock_release(sv->sv_lock);
+	kfree(inodebuf);
+	kfree(block);
 	return result;
 }
 
@@ -1033,10 +1885,15 @@ sfs_stat(struct vnode *v, struct stat *statbuf)
 		return result;
 	}
 
+	lock_acquire(sv->sv_lock);
 	statbuf->st_size = sv->sv_i.sfi_size;
+	statbuf->st_nlink = sv->sv_i.sfi_linkcount;
+	lock_release(sv->sv_lock);
 
-	/* We don't support these yet; you get to implement them */
-	statbuf->st_nlink = 0;
+	statbuf->st_ino = sv->sv_ino;
+	statbuf->st_blksize = SFS_BLOCKSIZE;
+
+	/* We don't support this yet; you get to implement it */
 	statbuf->st_blocks = 0;
 
 	/* Fill in other field as desired/possible... */
@@ -1053,16 +1910,13 @@ sfs_gettype(struct vnode *v, uint32_t *ret)
 {
 	struct sfs_vnode *sv = v->vn_data;
 
-	vfs_biglock_acquire();
-
+	/* The type never changes once the vnode is loaded; no lock needed */
 	switch (sv->sv_i.sfi_type) {
 	case SFS_TYPE_FILE:
 		*ret = S_IFREG;
-		vfs_biglock_release();
 		return 0;
 	case SFS_TYPE_DIR:
 		*ret = S_IFDIR;
-		vfs_biglock_release();
 		return 0;
 	}
 	panic("sfs: gettype: Invalid inode type (inode %u, type %u)\n",
@@ -1092,19 +1946,37 @@ sfs_tryseek(struct vnode *v, off_t pos)
 }
 
 /*
- * Called for fsync(), and also on filesystem unmount, global sync(),
- * and some other cases.
+ * Write back a vnode's inode. Used by fsync, and by sfs_sync for
+ * each loaded vnode.
  */
-static
 int
-sfs_fsync(struct vnode *v)
+sfs_writeinode(struct vnode *v)
 {
 	struct sfs_vnode *sv = v->vn_data;
 	int result;
 
-	vfs_biglock_acquire();
+	lock_acquire(sv->sv_lock);
 	result = sfs_sync_inode(sv);
-	vfs_biglock_release();
+	lock_release(sv->sv_lock);
+
+	return result;
+}
+
+/*
+ * Called for fsync(). With a journal, the inode only goes as far as
+ * the running transaction, so commit it too.
+ */
+static
+int
+sfs_fsync(struct vnode *v)
+{
+	struct sfs_fs *sfs = v->vn_fs->fs_data;
+	int result;
+
+	result = sfs_writeinode(v);
+	if (result == 0 && sfs->sfs_jmax > 0) {
+		result = FSOP_SYNC(v->vn_fs);
+	}
 
 	return result;
 }
@@ -1121,97 +1993,177 @@ sfs_mmap(struct vnode *v   /* add stuff as needed */)
 }
 
 /*
- * Called for ftruncate() and from sfs_reclaim.
+ * Helper for sfs_truncate: discard the parts of a block tree that lie
+ * at or past file block BLOCKLEN.
+ *
+ * *BLOCKP is a data block (INDIRECTION 0) or an indirect block of the
+ * given level, and covers file blocks starting at BASEBLOCK. If
+ * everything under it goes away, the block itself is freed and *BLOCKP
+ * is cleared; in that case *CHANGED is set so the caller knows to
+ * write back whatever *BLOCKP lives in.
  */
 static
 int
-sfs_truncate(struct vnode *v, off_t len)
+sfs_discard_tree(struct sfs_fs *sfs, uint32_t *blockp, int indirection,
+		 uint32_t baseblock, uint32_t blocklen, bool *changed)
 {
-	/*
-	 * I/O buffer for handling the indirect block.
-	 *
-	 * Note: in real life (and when you've done the fs assignment)
-	 * you would get space from the disk buffer cache for this,
-	 * not use a static area.
-	 */
-	static uint32_t idbuf[SFS_DBPERIDB];
+	uint32_t *idbuf;
+	uint32_t span, j;
+	bool hasnonzero, iddirty;
+	int result;
 
-	struct sfs_vnode *sv = v->vn_data;
-	struct sfs_fs *sfs = sv->sv_v.vn_fs->fs_data;
+	if (*blockp == 0) {
+		return 0;
+	}
 
-	/* Length in blocks (divide rounding up) */
-	uint32_t blocklen = DIVROUNDUP(len, SFS_BLOCKSIZE);
+	if (indirection == 0) {
+		/* Discard the block if it's past the new EOF */
+		if (baseblock >= blocklen) {
+			sfs_bfree(sfs, *blockp);
+			*blockp = 0;
+			*changed = true;
+		}
+		return 0;
+	}
 
-	uint32_t i, j, block;
-	uint32_t idblock, baseblock, highblock;
-	int result;
-	int hasnonzero, iddirty;
+	KASSERT(indirection <= 3);
 
-	KASSERT(sizeof(idbuf)==SFS_BLOCKSIZE);
+	/* Number of file blocks under each entry */
+	for (span = 1, j = 1; j < (uint32_t)indirection; j++) {
+		span *= SFS_DBPERIDB;
+	}
 
-	vfs_biglock_acquire();
+	if (baseblock + span*SFS_DBPERIDB <= blocklen) {
+		/* All of it is before the new EOF */
+		return 0;
+	}
 
 	/*
-	 * Go through the direct blocks. Discard any that are
-	 * past the limit we're truncating to.
+	 * Read the indirect block. (As in sfs_bmap_tree, the buffer
+	 * can't be static.)
 	 */
-	for (i=0; i<SFS_NDIRECT; i++) {
-		block = sv->sv_i.sfi_direct[i];
-		if (i >= blocklen && block != 0) {
-			sfs_bfree(sfs, block);
-			sv->sv_i.sfi_direct[i] = 0;
-			sv->sv_dirty = true;
+	idbuf = kmalloc(SFS_BLOCKSIZE);
+	if (idbuf == NULL) {
+		return ENOMEM;
+	}
+	result = sfs_jrblock(sfs, idbuf, *blockp);
+	if (result) {
+		kfree(idbuf);
+		return result;
+	}
+
+	hasnonzero = false;
+	iddirty = false;
+	for (j=0; j<SFS_DBPERIDB; j++) {
+		result = sfs_discard_tree(sfs, &idbuf[j], indirection-1,
+					  baseblock + j*span, blocklen,
+					  &iddirty);
+		if (result) {
+			kfree(idbuf);
+			return result;
 		}
+		/* Remember if we see any nonzero blocks in here */
+		if (idbuf[j] != 0) {
+			hasnonzero = true;
+		}
+	}
+
+	if (!hasnonzero) {
+		/* The whole indirect block is empty now; free it */
+		sfs_bfree(sfs, *blockp);
+		*blockp = 0;
+		*changed = true;
+	}
+	else if (iddirty) {
+		/* The indirect block is dirty; write it back */
+		result = sfs_jwblock(sfs, idbuf, *blockp);
 	}
+	kfree(idbuf);
+	return result;
+}
+
+/*
+ * Change the length of a file. The caller must hold the file's lock.
+ * Used by sfs_truncate and sfs_reclaim.
+ */
+static
+int
+sfs_itrunc(struct sfs_vnode *sv, off_t len)
+{
+	struct sfs_fs *sfs = sv->sv_v.vn_fs->fs_data;
+	struct sfs_extent *ext;
 
-	/* Indirect block number */
-	idblock = sv->sv_i.sfi_indirect;
+	/* Length in blocks (divide rounding up) */
+	uint32_t blocklen = DIVROUNDUP(len, SFS_BLOCKSIZE);
 
-	/* The lowest block in the indirect block */
-	baseblock = SFS_NDIRECT;
+	uint32_t i, j, keep;
+	bool changed = false;
+	int result;
 
-	/* The highest block in the indirect block */
-	highblock = baseblock + SFS_DBPERIDB - 1;
+	KASSERT(lock_do_i_hold(sv->sv_lock));
 
-	if (blocklen < highblock && idblock != 0) {
-		/* We're past the proposed EOF; may need to free stuff */
+	/* The reserved blocks are probably in the wrong place now */
+	sfs_prealloc_release(sv);
+	sv->sv_nextblock = 0;
 
-		/* Read the indirect block */
-		result = sfs_rblock(sfs, idbuf, idblock);
-		if (result) {
-			vfs_biglock_release();
-			return result;
+	/*
+	 * Go through the extents. Cut back any that run past the
+	 * limit we're truncating to.
+	 */
+	for (i=0; i<SFS_NEXTENTS; i++) {
+		ext = &sv->sv_i.sfi_extents[i];
+		if (ext->sfe_nblocks == 0) {
+			continue;
 		}
-		
-		hasnonzero = 0;
-		iddirty = 0;
-		for (j=0; j<SFS_DBPERIDB; j++) {
-			/* Discard any blocks that are past the new EOF */
-			if (blocklen < baseblock+j && idbuf[j] != 0) {
-				sfs_bfree(sfs, idbuf[j]);
-				idbuf[j] = 0;
-				iddirty = 1;
-			}
-			/* Remember if we see any nonzero blocks in here */
-			if (idbuf[j]!=0) {
-				hasnonzero=1;
+		if (ext->sfe_fileblock >= blocklen) {
+			keep = 0;
+		}
+		else {
+			keep = blocklen - ext->sfe_fileblock;
+			if (keep >= ext->sfe_nblocks) {
+				continue;
 			}
 		}
-
-		if (!hasnonzero) {
-			/* The whole indirect block is empty now; free it */
-			sfs_bfree(sfs, idblock);
-			sv->sv_i.sfi_indirect = 0;
-			sv->sv_dirty = true;
+		for (j=keep; j<ext->sfe_nblocks; j++) {
+			sfs_bfree(sfs, ext->sfe_diskblock + j);
 		}
-		else if (iddirty) {
-			/* The indirect block is dirty; write it back */
-			result = sfs_wblock(sfs, idbuf, idblock);
-			if (result) {
-				vfs_biglock_release();
-				return result;
-			}
+		ext->sfe_nblocks = keep;
+		if (keep == 0) {
+			ext->sfe_fileblock = 0;
+			ext->sfe_diskblock = 0;
 		}
+		sv->sv_dirty = true;
+	}
+
+	/*
+	 * Go through the direct blocks. Discard any that are
+	 * past the limit we're truncating to.
+	 */
+	for (i=0; i<SFS_NDIRECT; i++) {
+		result = sfs_discard_tree(sfs, &sv->sv_i.sfi_direct[i], 0,
+					  i, blocklen, &changed);
+		KASSERT(result == 0);
+	}
+
+	/* Then the indirect, double indirect, and triple indirect trees */
+	result = sfs_discard_tree(sfs, &sv->sv_i.sfi_indirect, 1,
+				  SFS_NDIRECT, blocklen, &changed);
+	if (result == 0) {
+		result = sfs_discard_tree(sfs, &sv->sv_i.sfi_dindirect, 2,
+					  SFS_NDIRECT + SFS_DBPERIDB,
+					  blocklen, &changed);
+	}
+	if (result == 0) {
+		result = sfs_discard_tree(sfs, &sv->sv_i.sfi_tindirect, 3,
+					  SFS_NDIRECT + SFS_DBPERIDB +
+					  SFS_DBPERIDB*SFS_DBPERIDB,
+					  blocklen, &changed);
+	}
+	if (changed) {
+		sv->sv_dirty = true;
+	}
+	if (result) {
+		return result;
 	}
 
 	/* Set the file size */
@@ -1220,10 +2172,31 @@ sfs_truncate(struct vnode *v, off_t len)
 	/* Mark the inode dirty */
 	sv->sv_dirty = true;
 
-	vfs_biglock_release();
 	return 0;
 }
 
+/*
+ * Called for ftruncate().
+ */
+static
+int
+sfs_truncate(struct vnode *v, off_t len)
+{
+	struct sfs_vnode *sv = v->vn_data;
+	struct sfs_fs *sfs = v->vn_fs->fs_data;
+	struct sfs_jhandle jh;
+	int result;
+
+	sfs_jbegin(sfs, &jh);
+	lock_acquire(sv->sv_lock);
+	result = sfs_itrunc(sv, len);
+	sfs_jinode(sv);
+	lock_release(sv->sv_lock);
+	sfs_jend(sfs, &jh);
+
+	return result;
+}
+
 /*
  * Get the full pathname for a file. This only needs to work on directories.
  * Since we don't support subdirectories, assume it's the root directory
@@ -1250,8 +2223,8 @@ sfs_namefile(struct vnode *vv, struct uio *uio)
  */
 static
 int
-sfs_creat(struct vnode *v, const char *name, bool excl, mode_t mode,
-	  struct vnode **ret)
+sfs_docreat(struct vnode *v, const char *name, bool excl, mode_t mode,
+	    struct vnode **ret)
 {
 	struct sfs_fs *sfs = v->vn_fs->fs_data;
 	struct sfs_vnode *sv = v->vn_data;
@@ -1259,18 +2232,18 @@ sfs_creat(struct vnode *v, const char *name, bool excl, mode_t mode,
 	uint32_t ino;
 	int result;
 
-	vfs_biglock_acquire();
+	lock_acquire(sv->sv_lock);
 
 	/* Look up the name */
 	result = sfs_dir_findname(sv, name, &ino, NULL, NULL);
 	if (result!=0 && result!=ENOENT) {
-		vfs_biglock_release();
+		lock_release(sv->sv_lock);
 		return result;
 	}
 
 	/* If it exists and we didn't want it to, fail */
 	if (result==0 && excl) {
-		vfs_biglock_release();
+		lock_release(sv->sv_lock);
 		return EEXIST;
 	}
 
@@ -1278,18 +2251,18 @@ sfs_creat(struct vnode *v, const char *name, bool excl, mode_t mode,
 		/* We got a file; load its vnode and return */
 		result = sfs_loadvnode(sfs, ino, SFS_TYPE_INVAL, &newguy);
 		if (result) {
-			vfs_biglock_release();
+			lock_release(sv->sv_lock);
 			return result;
 		}
 		*ret = &newguy->sv_v;
-		vfs_biglock_release();
+		lock_release(sv->sv_lock);
 		return 0;
 	}
 
 	/* Didn't exist - create it */
-	result = sfs_makeobj(sfs, SFS_TYPE_FILE, &newguy);
+	result = sfs_makeobj(sfs, sv, SFS_TYPE_FILE, &newguy);
 	if (result) {
-		vfs_biglock_release();
+		lock_release(sv->sv_lock);
 		return result;
 	}
 
@@ -1300,22 +2273,42 @@ sfs_creat(struct vnode *v, const char *name, bool excl, mode_t mode,
 	result = sfs_dir_link(sv, name, newguy->sv_ino, NULL);
 	if (result) {
 		VOP_DECREF(&newguy->sv_v);
-		vfs_biglock_release();
+		lock_release(sv->sv_lock);
 		return result;
 	}
 
 	/* Update the linkcount of the new file */
+	lock_acquire(newguy->sv_lock);
 	newguy->sv_i.sfi_linkcount++;
 
 	/* and consequently mark it dirty. */
 	newguy->sv_dirty = true;
+	sfs_jinode(newguy);
+	lock_release(newguy->sv_lock);
 
 	*ret = &newguy->sv_v;
 	
-	vfs_biglock_release();
+	sfs_jinode(sv);
+	lock_release(sv->sv_lock);
 	return 0;
 }
 
+static
+int
+sfs_creat(struct vnode *v, const char *name, bool excl, mode_t mode,
+	  struct vnode **ret)
+{
+	struct sfs_fs *sfs = v->vn_fs->fs_data;
+	struct sfs_jhandle jh;
+	int result;
+
+	sfs_jbegin(sfs, &jh);
+	result = sfs_docreat(v, name, excl, mode, ret);
+	sfs_jend(sfs, &jh);
+
+	return result;
+}
+
 /*
  * Make a hard link to a file.
  * The VFS layer should prevent this being called unless both
@@ -1327,24 +2320,33 @@ sfs_link(struct vnode *dir, const char *name, struct vnode *file)
 {
 	struct sfs_vnode *sv = dir->vn_data;
 	struct sfs_vnode *f = file->vn_data;
+	struct sfs_fs *sfs = dir->vn_fs->fs_data;
+	struct sfs_jhandle jh;
 	int result;
 
 	KASSERT(file->vn_fs == dir->vn_fs);
 
-	vfs_biglock_acquire();
+	sfs_jbegin(sfs, &jh);
+	lock_acquire(sv->sv_lock);
 
 	/* Just create a link */
 	result = sfs_dir_link(sv, name, f->sv_ino, NULL);
 	if (result) {
-		vfs_biglock_release();
+		lock_release(sv->sv_lock);
+		sfs_jend(sfs, &jh);
 		return result;
 	}
 
 	/* and update the link count, marking the inode dirty */
+	lock_acquire(f->sv_lock);
 	f->sv_i.sfi_linkcount++;
 	f->sv_dirty = true;
+	sfs_jinode(f);
+	lock_release(f->sv_lock);
 
-	vfs_biglock_release();
+	sfs_jinode(sv);
+	lock_release(sv->sv_lock);
+	sfs_jend(sfs, &jh);
 	return 0;
 }
 
@@ -1356,16 +2358,20 @@ int
 sfs_remove(struct vnode *dir, const char *name)
 {
 	struct sfs_vnode *sv = dir->vn_data;
+	struct sfs_fs *sfs = dir->vn_fs->fs_data;
 	struct sfs_vnode *victim;
+	struct sfs_jhandle jh;
 	int slot;
 	int result;
 
-	vfs_biglock_acquire();
+	sfs_jbegin(sfs, &jh);
+	lock_acquire(sv->sv_lock);
 
 	/* Look for the file and fetch a vnode for it. */
 	result = sfs_lookonce(sv, name, &victim, &slot);
 	if (result) {
-		vfs_biglock_release();
+		lock_release(sv->sv_lock);
+		sfs_jend(sfs, &jh);
 		return result;
 	}
 
@@ -1373,15 +2379,20 @@ sfs_remove(struct vnode *dir, const char *name)
 	result = sfs_dir_unlink(sv, slot);
 	if (result==0) {
 		/* If we succeeded, decrement the link count. */
+		lock_acquire(victim->sv_lock);
 		KASSERT(victim->sv_i.sfi_linkcount > 0);
 		victim->sv_i.sfi_linkcount--;
 		victim->sv_dirty = true;
+		sfs_jinode(victim);
+		lock_release(victim->sv_lock);
 	}
 
 	/* Discard the reference that sfs_lookonce got us */
 	VOP_DECREF(&victim->sv_v);
 
-	vfs_biglock_release();
+	sfs_jinode(sv);
+	lock_release(sv->sv_lock);
+	sfs_jend(sfs, &jh);
 	return result;
 }
 
@@ -1393,15 +2404,15 @@ sfs_remove(struct vnode *dir, const char *name)
  */
 static
 int
-sfs_rename(struct vnode *d1, const char *n1, 
-	   struct vnode *d2, const char *n2)
+sfs_dorename(struct vnode *d1, const char *n1, 
+	     struct vnode *d2, const char *n2)
 {
 	struct sfs_vnode *sv = d1->vn_data;
 	struct sfs_vnode *g1;
 	int slot1, slot2;
 	int result, result2;
 
-	vfs_biglock_acquire();
+	lock_acquire(sv->sv_lock);
 
 	KASSERT(d1==d2);
 	KASSERT(sv->sv_ino == SFS_ROOT_LOCATION);
@@ -1409,7 +2420,7 @@ sfs_rename(struct vnode *d1, const char *n1,
 	/* Look up the old name of the file and get its inode and slot number*/
 	result = sfs_lookonce(sv, n1, &g1, &slot1);
 	if (result) {
-		vfs_biglock_release();
+		lock_release(sv->sv_lock);
 		return result;
 	}
 
@@ -1430,8 +2441,10 @@ sfs_rename(struct vnode *d1, const char *n1,
 	}
 	
 	/* Increment the link count, and mark inode dirty */
+	lock_acquire(g1->sv_lock);
 	g1->sv_i.sfi_linkcount++;
 	g1->sv_dirty = true;
+	lock_release(g1->sv_lock);
 
 	/* Unlink the old slot */
 	result = sfs_dir_unlink(sv, slot1);
@@ -1443,14 +2456,18 @@ sfs_rename(struct vnode *d1, const char *n1,
 	 * Decrement the link count again, and mark the inode dirty again,
 	 * in case it's been synced behind our back.
 	 */
+	lock_acquire(g1->sv_lock);
 	KASSERT(g1->sv_i.sfi_linkcount>0);
 	g1->sv_i.sfi_linkcount--;
 	g1->sv_dirty = true;
+	sfs_jinode(g1);
+	lock_release(g1->sv_lock);
 
 	/* Let go of the reference to g1 */
 	VOP_DECREF(&g1->sv_v);
 
-	vfs_biglock_release();
+	sfs_jinode(sv);
+	lock_release(sv->sv_lock);
 	return 0;
 
  puke_harder:
@@ -1464,11 +2481,29 @@ sfs_rename(struct vnode *d1, const char *n1,
 			strerror(result2));
 		panic("sfs: rename: Cannot recover\n");
 	}
+	lock_acquire(g1->sv_lock);
 	g1->sv_i.sfi_linkcount--;
+	lock_release(g1->sv_lock);
  puke:
 	/* Let go of the reference to g1 */
 	VOP_DECREF(&g1->sv_v);
-	vfs_biglock_release();
+	lock_release(sv->sv_lock);
+	return result;
+}
+
+static
+int
+sfs_rename(struct vnode *d1, const char *n1, 
+	   struct vnode *d2, const char *n2)
+{
+	struct sfs_fs *sfs = d1->vn_fs->fs_data;
+	struct sfs_jhandle jh;
+	int result;
+
+	sfs_jbegin(sfs, &jh);
+	result = sfs_dorename(d1, n1, d2, n2);
+	sfs_jend(sfs, &jh);
+
 	return result;
 }
 
@@ -1486,15 +2521,11 @@ sfs_lookparent(struct vnode *v, char *path, struct vnode **ret,
 {
 	struct sfs_vnode *sv = v->vn_data;
 
-	vfs_biglock_acquire();
-
 	if (sv->sv_i.sfi_type != SFS_TYPE_DIR) {
-		vfs_biglock_release();
 		return ENOTDIR;
 	}
 
 	if (strlen(path)+1 > buflen) {
-		vfs_biglock_release();
 		return ENAMETOOLONG;
 	}
 	strcpy(buf, path);
@@ -1502,7 +2533,6 @@ sfs_lookparent(struct vnode *v, char *path, struct vnode **ret,
 	VOP_INCREF(&sv->sv_v);
 	*ret = &sv->sv_v;
 
-	vfs_biglock_release();
 	return 0;
 }
 
@@ -1520,22 +2550,22 @@ sfs_lookup(struct vnode *v, char *path, struct vnode **ret)
 	struct sfs_vnode *final;
 	int result;
 
-	vfs_biglock_acquire();
+	lock_acquire(sv->sv_lock);
 
 	if (sv->sv_i.sfi_type != SFS_TYPE_DIR) {
-		vfs_biglock_release();
+		lock_release(sv->sv_lock);
 		return ENOTDIR;
 	}
 	
 	result = sfs_lookonce(sv, path, &final, NULL);
 	if (result) {
-		vfs_biglock_release();
+		lock_release(sv->sv_lock);
 		return result;
 	}
 
 	*ret = &final->sv_v;
 
-	vfs_biglock_release();
+	lock_release(sv->sv_lock);
 	return 0;
 }
 
@@ -1585,6 +2615,7 @@ static const struct vnode_ops sfs_fileops = {
 	sfs_read,
 	NOTDIR,  /* readlink */
 	NOTDIR,  /* getdirentry */
+	NOTDIR,  /* getdirentries */
 	sfs_write,
 	sfs_ioctl,
 	sfs_stat,
@@ -1619,7 +2650,8 @@ static const struct vnode_ops sfs_dirops = {
 	
 	ISDIR,   /* read */
 	ISDIR,   /* readlink */
-	UNIMP,   /* getdirentry */
+	sfs_getdirentry,
+	sfs_getdirentries,
 	ISDIR,   /* write */
 	sfs_ioctl,
 	sfs_stat,
@@ -1651,19 +2683,17 @@ int
 sfs_loadvnode(struct sfs_fs *sfs, uint32_t ino, int forcetype,
 		 struct sfs_vnode **ret)
 {
-	struct vnode *v;
 	struct sfs_vnode *sv;
 	const struct vnode_ops *ops = NULL;
-	unsigned i, num;
+	const struct sfs_extent *last;
+	unsigned i;
 	int result;
 
-	/* Look in the vnodes table */
-	num = vnodearray_num(sfs->sfs_vnodes);
+	lock_acquire(sfs->sfs_vnlock);
 
-	/* Linear search. Is this too slow? You decide. */
-	for (i=0; i<num; i++) {
-		v = vnodearray_get(sfs->sfs_vnodes, i);
-		sv = v->vn_data;
+	/* Look in the vnodes table */
+	for (sv = sfs->sfs_vnhash[SFS_VNHASH(ino)]; sv != NULL;
+	     sv = sv->sv_hashnext) {
 
 		/* Every inode in memory must be in an allocated block */
 		if (!sfs_bused(sfs, sv->sv_ino)) {
@@ -1678,15 +2708,20 @@ sfs_loadvnode(struct sfs_fs *sfs, uint32_t ino, int forcetype,
 			KASSERT(forcetype==SFS_TYPE_INVAL);
 
 			VOP_INCREF(&sv->sv_v);
+			lock_release(sfs->sfs_vnlock);
 			*ret = sv;
 			return 0;
 		}
 	}
 
-	/* Didn't have it loaded; load it */
+	/*
+	 * Didn't have it loaded; load it. We keep holding the table
+	 * lock so nobody else loads it at the same time.
+	 */
 
 	sv = kmalloc(sizeof(struct sfs_vnode));
 	if (sv==NULL) {
+		lock_release(sfs->sfs_vnlock);
 		return ENOMEM;
 	}
 
@@ -1697,15 +2732,40 @@ sfs_loadvnode(struct sfs_fs *sfs, uint32_t ino, int forcetype,
 	}
 
 	/* Read the block the inode is in */
-	result = sfs_rblock(sfs, &sv->sv_i, ino);
+	result = sfs_jrblock(sfs, &sv->sv_i, ino);
 	if (result) {
 		kfree(sv);
+		lock_release(sfs->sfs_vnlock);
 		return result;
 	}
 
+	sv->sv_lock = lock_create("sfs_vnode");
+	if (sv->sv_lock == NULL) {
+		kfree(sv);
+		lock_release(sfs->sfs_vnlock);
+		return ENOMEM;
+	}
+
 	/* Not dirty yet */
 	sv->sv_dirty = false;
 
+	/* Nothing reserved yet; new blocks go after the last extent */
+	sv->sv_nextblock = 0;
+	sv->sv_prealloc_start = 0;
+	sv->sv_prealloc_len = 0;
+	sv->sv_dirhash = NULL;
+	last = NULL;
+	for (i=0; i<SFS_NEXTENTS; i++) {
+		const struct sfs_extent *ext = &sv->sv_i.sfi_extents[i];
+		if (ext->sfe_nblocks > 0 &&
+		    (last == NULL || ext->sfe_fileblock > last->sfe_fileblock)) {
+			last = ext;
+		}
+	}
+	if (last != NULL) {
+		sv->sv_nextblock = last->sfe_diskblock + last->sfe_nblocks;
+	}
+
 	/*
 	 * FORCETYPE is set if we're creating a new file, because the
 	 * block on disk will have been zeroed out and thus the type
@@ -1736,20 +2796,28 @@ sfs_loadvnode(struct sfs_fs *sfs, uint32_t ino, int forcetype,
 	/* Call the common vnode initializer */
 	result = VOP_INIT(&sv->sv_v, ops, &sfs->sfs_absfs, sv);
 	if (result) {
+		lock_destroy(sv->sv_lock);
 		kfree(sv);
+		lock_release(sfs->sfs_vnlock);
 		return result;
 	}
 
 	/* Set the other fields in our vnode structure */
 	sv->sv_ino = ino;
 
-	/* Add it to our table */
-	result = vnodearray_add(sfs->sfs_vnodes, &sv->sv_v, NULL);
+	/* Add it to our tables */
+	result = vnodearray_add(sfs->sfs_vnodes, &sv->sv_v, &sv->sv_index);
 	if (result) {
 		VOP_CLEANUP(&sv->sv_v);
+		lock_destroy(sv->sv_lock);
 		kfree(sv);
+		lock_release(sfs->sfs_vnlock);
 		return result;
 	}
+	sv->sv_hashnext = sfs->sfs_vnhash[SFS_VNHASH(ino)];
+	sfs->sfs_vnhash[SFS_VNHASH(ino)] = sv;
+
+	lock_release(sfs->sfs_vnlock);
 
 	/* Hand it back */
 	*ret = sv;
@@ -1767,14 +2835,10 @@ sfs_getroot(struct fs *fs)
 	struct sfs_vnode *sv;
 	int result;
 
-	vfs_biglock_acquire();
-
 	result = sfs_loadvnode(sfs, SFS_ROOT_LOCATION, SFS_TYPE_INVAL, &sv);
 	if (result) {
 		panic("sfs: getroot: Cannot load root vnode\n");
 	}
 
-	vfs_biglock_release();
-
 	return &sv->sv_v;
 }
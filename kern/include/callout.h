@@ -0,0 +1,106 @@
+/*
+ * Copyright (c) 2000, 2001, 2002, 2003, 2004, 2005, 2008, 2009
+ *	The President and Fellows of Harvard College.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the University nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE UNIVERSITY AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE UNIVERSITY OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+#ifndef _CALLOUT_H_
+#define _CALLOUT_H_
+
+/*
+ * Callouts: functions called after a given number of clock ticks.
+ *
+ * Each cpu keeps a hierarchical timer wheel, advanced from
+ * hardclock(). A callout goes on the wheel of the cpu that schedules
+ * it, and its function is called there, from the timer interrupt, so
+ * it must not sleep. Resolution is one hardclock (1/HZ seconds).
+ *
+ *    callout_init     - set up a callout to call FUNC(ARG).
+ *
+ *    callout_schedule - arrange for the call in TICKS ticks (at least
+ *                       1). If it was already pending, it's moved.
+ *
+ *    callout_stop     - cancel the call. Returns true if it was still
+ *                       pending. If the function is running on
+ *                       another cpu right now, waits for it to
+ *                       finish; so once this returns, the callout
+ *                       (and whatever ARG points to) may be freed.
+ *                       Must not be called from the function itself.
+ *
+ *    callout_pending  - check if the call is still to come.
+ */
+
+#include <spinlock.h>
+
+struct cpu;
+
+/* Wheel geometry: CALLWHEEL_LEVELS levels of 2^CALLWHEEL_BITS slots */
+#define CALLWHEEL_BITS		6
+#define CALLWHEEL_SIZE		(1U << CALLWHEEL_BITS)
+#define CALLWHEEL_LEVELS	4
+/* Longest delay; longer requests are clamped to this */
+#define CALLOUT_MAXTICKS \
+	((1U << (CALLWHEEL_BITS * CALLWHEEL_LEVELS)) - 1)
+
+struct callout {
+	struct callout *co_next;	/* link in wheel slot */
+	struct callout **co_prevp;	/* pointer to us, or NULL if idle */
+	unsigned co_expire;		/* c_hardclocks when due */
+	struct cpu *co_cpu;		/* wheel we were last put on */
+	void (*co_func)(void *);
+	void *co_arg;
+};
+
+/* Per-cpu wheel, protected by cw_lock. Lives in struct cpu. */
+struct callwheel {
+	struct spinlock cw_lock;
+	unsigned cw_now;		/* last tick processed */
+	unsigned cw_count;		/* callouts pending */
+	struct callout *cw_running;	/* callout whose func is running */
+	struct callout *cw_slots[CALLWHEEL_LEVELS][CALLWHEEL_SIZE];
+};
+
+void callout_init(struct callout *co, void (*func)(void *), void *arg);
+void callout_schedule(struct callout *co, unsigned ticks);
+bool callout_stop(struct callout *co);
+bool callout_pending(struct callout *co);
+
+/*
+ * For the clock and scheduler code:
+ *
+ *    callwheel_init     - initialize a cpu's wheel.
+ *    callwheel_run      - run everything due on this cpu, up to
+ *                         c_hardclocks. Called from hardclock().
+ *    callwheel_nexttick - ticks until this cpu next needs to run its
+ *                         wheel (possibly early, never late), or 0
+ *                         if nothing is pending.
+ */
+void callwheel_init(struct callwheel *cw);
+void callwheel_run(void);
+unsigned callwheel_nexttick(void);
+
+
+#endif /* _CALLOUT_H_ */
@@ -36,10 +36,12 @@
  * Time-related definitions.
  *
  * hardclock() is called on every CPU HZ times a second, possibly only
- * when the CPU is not idle, for scheduling.
+ * when the CPU is not idle, for scheduling. The scheduler can ask for
+ * fewer with hardclock_settimer(); skipped ticks are still counted in
+ * c_hardclocks.
  *
- * timerclock() is called on one CPU once a second to allow simple
- * timed operations. (This is a fairly simpleminded interface.)
+ * timerclock() is called on one CPU once a second. It's a leftover
+ * hook; for timed operations use callouts (<callout.h>).
  *
  * gettime() may be used to fetch the current time of day.
  * getinterval() computes the time from time1 to time2.
@@ -56,9 +58,13 @@
 #define HZ  100
 #endif
 
+/* nanoseconds per hardclock */
+#define NSEC_PER_HARDCLOCK  (1000000000 / HZ)
+
 void hardclock_bootstrap(void);
 
 void hardclock(void);
+void hardclock_settimer(unsigned ticks);
 void timerclock(void);
 
 void gettime(time_t *seconds, uint32_t *nanoseconds);
@@ -68,9 +74,20 @@ void getinterval(time_t secs1, uint32_t nsecs,
                  time_t *rsecs, uint32_t *rnsecs);
 
 /*
- * clocksleep() suspends execution for the requested number of seconds,
- * like userlevel sleep(3). (Don't confuse it with wchan_sleep.)
+ * clock_nstoticks() converts SECS seconds and NSECS nanoseconds to
+ * hardclocks, rounding up, for use with callouts and timed sleeps.
+ */
+unsigned clock_nstoticks(time_t secs, uint32_t nsecs);
+
+/*
+ * clock_sleep() suspends execution for the requested number of
+ * hardclocks (at most CALLOUT_MAXTICKS); clock_sleepns() for the
+ * requested seconds and nanoseconds, however long; clocksleep() for
+ * the requested number of seconds, like userlevel sleep(3). (Don't
+ * confuse them with wchan_sleep.)
  */
+void clock_sleep(unsigned ticks);
+void clock_sleepns(time_t secs, uint32_t nsecs);
 void clocksleep(int seconds);
 
 
@@ -33,9 +33,18 @@
 
 #include <spinlock.h>
 #include <threadlist.h>
+#include <callout.h>
+#include <cputime.h>
 #include <machine/vm.h>  /* for TLBSHOOTDOWN_MAX */
 
 
+/*
+ * Number of scheduling priority levels, each with its own run queue.
+ * Level 0 is the highest priority. The default scheduler puts
+ * everything at level 0.
+ */
+#define SCHED_NLEVELS	4
+
 /*
  * Per-cpu structure
  *
@@ -59,16 +68,37 @@ struct cpu {
 	 */
 	struct thread *c_curthread;	/* Current thread on cpu */
 	struct threadlist c_zombies;	/* List of exited threads */
-	unsigned c_hardclocks;		/* Counter of hardclock() calls */
+	unsigned c_hardclocks;		/* Counter of clock ticks */
+	unsigned c_lastschedule;	/* c_hardclocks at last schedule() */
+	unsigned c_lastboost;		/* c_hardclocks at last MLFQ boost */
+	unsigned c_timerdue;		/* c_hardclocks at next timer intr */
+	struct cputime c_cputime;	/* Time spent in each state */
+	unsigned c_cpustate;		/* Current CPUTIME_* state */
+	uint64_t c_cpustamp;		/* mainbus_cputime at last change */
+
+	/*
+	 * Queue nodes for queued spinlocks this cpu holds or is
+	 * waiting for. Only this cpu allocates them (with interrupts
+	 * off), but other cpus write mn_next and mn_wait.
+	 */
+	struct spinlock_mcsnode c_mcsnodes[SPINLOCK_MCSNODES];
+	unsigned c_mcsnodes_inuse;	/* Bitmap of nodes in use */
 
 	/*
 	 * Accessed by other cpus.
 	 * Protected by the runqueue lock.
 	 */
 	bool c_isidle;			/* True if this cpu is idle */
-	struct threadlist c_runqueue;	/* Run queue for this cpu */
+	bool c_tickless;		/* True if not taking regular ticks */
+	struct threadlist c_runqueue[SCHED_NLEVELS]; /* Run queues, by level */
 	struct spinlock c_runqueue_lock;
 
+	/*
+	 * Accessed by other cpus (to cancel callouts).
+	 * Protected by its own lock.
+	 */
+	struct callwheel c_callwheel;	/* Callouts scheduled here */
+
 	/*
 	 * Accessed by other cpus.
 	 * Protected by the IPI lock.
@@ -114,6 +144,12 @@ void cpu_hatch(unsigned software_number);
  */
 const char *cpu_identify(void);
 
+/*
+ * Print each cpu's time accounting figures (see <cputime.h>). Other
+ * cpus' figures are read unlocked and may be slightly stale.
+ */
+void cpu_printtimes(void);
+
 /*
  * Hardware-level interrupt on/off, for the current CPU.
  *
@@ -0,0 +1,72 @@
+/*
+ * Copyright (c) 2000, 2001, 2002, 2003, 2004, 2005, 2008, 2009
+ *	The President and Fellows of Harvard College.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the University nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE UNIVERSITY AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE UNIVERSITY OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+#ifndef _CPUTIME_H_
+#define _CPUTIME_H_
+
+/*
+ * CPU time accounting.
+ *
+ * Each cpu is always in one of the CPUTIME_* states, and the time
+ * since it last changed state is charged to that state, both on the
+ * cpu and on the thread running there (except idle time, which
+ * belongs to no thread). Time comes from the cpu's cycle counter
+ * (mainbus_cputime), so it's precise rather than sampled at
+ * hardclock.
+ *
+ *    cputime_switch - charge the time so far to the current state
+ *                     and enter NEWSTATE. Returns the state we were
+ *                     in, so the caller can go back to it. Must be
+ *                     called with interrupts off.
+ *
+ * The states are switched in mips_trap (kernel or interrupt on
+ * entry, back on exit), mips_usermode (user), thread_switch, and
+ * its idle loop (idle around cpu_idle).
+ *
+ * Context switches are counted in thread_switch: involuntary if the
+ * thread was preempted from an interrupt, voluntary otherwise.
+ */
+
+#define CPUTIME_USER	0	/* running user code */
+#define CPUTIME_SYS	1	/* running in the kernel for a thread */
+#define CPUTIME_INTR	2	/* handling an interrupt */
+#define CPUTIME_IDLE	3	/* idle loop */
+#define CPUTIME_NSTATES	4
+
+struct cputime {
+	uint64_t ct_ns[CPUTIME_NSTATES];	/* nanoseconds in each state */
+	unsigned ct_vcsw;			/* voluntary context switches */
+	unsigned ct_ivcsw;			/* involuntary context switches */
+};
+
+void cputime_init(struct cputime *ct);
+void cputime_add(struct cputime *to, const struct cputime *from);
+unsigned cputime_switch(unsigned newstate);
+
+#endif /* _CPUTIME_H_ */
@@ -45,6 +45,21 @@ struct emufs_vnode {
 	struct vnode ev_v;		/* abstract vnode structure */
 	struct emu_softc *ev_emu;	/* device */
 	uint32_t ev_handle;		/* file handle */
+
+	/*
+	 * One-chunk data cache for regular files, protected by
+	 * ev_lock. When clean it holds the bytes at [ev_bufoff,
+	 * ev_bufoff+ev_buflen) as last read; when dirty it holds
+	 * writes not yet sent to the device. ev_buf is allocated on
+	 * first use and freed at last close; directories never have
+	 * one.
+	 */
+	struct lock *ev_lock;
+	char *ev_buf;
+	off_t ev_bufoff;
+	size_t ev_buflen;
+	bool ev_dirty;			/* buffer holds unwritten data */
+	bool ev_bufeof;			/* clean buffer ends at EOF */
 };
 
 struct emufs_fs {
@@ -52,6 +67,7 @@ struct emufs_fs {
 	struct emu_softc *ef_emu;	/* device */
 	struct emufs_vnode *ef_root;	/* root vnode */
 	struct vnodearray *ef_vnodes;	/* table of loaded vnodes */
+	struct lock *ef_vnlock;		/* protects ef_vnodes */
 };
 
 
@@ -8,6 +8,9 @@
 
 #include <types.h>
 
+struct iovec;
+struct stat;
+
 struct File {
   char *name;
   int flags;
@@ -20,10 +23,23 @@ struct File {
 
 int sys_open(const char *filename, int flags, int mode, int32_t *retval);
 int sys_close(int fd);
+void file_closeall(void);
 int sys_read(int fd, void *buf, size_t buflen, int32_t *retval);
 int sys_write(int fd, const void *buf, size_t nbytes, int32_t *retval);
+int sys_pread(int fd, void *buf, size_t nbytes, off_t pos, int32_t *retval);
+int sys_pwrite(int fd, const void *buf, size_t nbytes, off_t pos, int32_t *retval);
+int sys_readv(int fd, const struct iovec *iov, int iovcnt, int32_t *retval);
+int sys_writev(int fd, const struct iovec *iov, int iovcnt, int32_t *retval);
+int sys_getdirentry(int fd, char *buf, size_t buflen, int32_t *retval);
+int sys_getdirentries(int fd, char *buf, size_t buflen, int32_t *retval);
+int sys_fstat(int fd, struct stat *statbuf);
+int sys_copy_file_range(int infd, int outfd, size_t len, unsigned flags,
+                        int32_t *retval);
+int sys_pipe(int *fds);
 int sys_dup2(int oldfd, int newfd);
 int sys_chdir(const_userptr_t *pathname);
+int sys_remove(const_userptr_t pathname);
+int sys_rename(const_userptr_t oldpath, const_userptr_t newpath);
 int sys__getcwd(char *buf, size_t buflen);
 off_t sys_lseek(int fd, off_t pos, int whence, off_t *retval);
 
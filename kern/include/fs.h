@@ -58,6 +58,11 @@
  * however, the filesystem object and all storage associated with the
  * filesystem should have been discarded/released.
  *
+ * fs_ncache says whether the VFS name cache may remember lookups on
+ * the filesystem. It should be false for filesystems whose names can
+ * change without going through the VFS (such as emufs, which shows
+ * the host's directories), since the cache would then go stale.
+ *
  * fs_data is a pointer to filesystem-specific data.
  */
 
@@ -67,6 +72,7 @@ struct fs {
 	struct vnode *(*fs_getroot)(struct fs *);
 	int           (*fs_unmount)(struct fs *);
 
+	bool fs_ncache;
 	void *fs_data;
 };
 
@@ -0,0 +1,100 @@
+/*
+ * Copyright (c) 2000, 2001, 2002, 2003, 2004, 2005, 2008, 2009
+ *	The President and Fellows of Harvard College.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the University nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE UNIVERSITY AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE UNIVERSITY OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+#ifndef _KERN_AIO_H_
+#define _KERN_AIO_H_
+
+/*
+ * Asynchronous I/O rings.
+ *
+ * A process hands the kernel a struct aio_ring in its own memory with
+ * aio_setup(). The ring holds a header followed by NENTRIES
+ * submission entries and then NENTRIES completion entries; NENTRIES
+ * must be a power of two no larger than AIO_MAXENTRIES.
+ *
+ * To start I/O, fill in submission entries at ar_sqtail (mod
+ * nentries), advance ar_sqtail, and call aio_enter(). The kernel
+ * consumes entries from ar_sqhead. When a request finishes, the
+ * kernel stores a completion entry at ar_cqtail and then advances
+ * ar_cqtail; the process reads completions from ar_cqhead and
+ * advances ar_cqhead when done with them. Completions are not
+ * necessarily in submission order.
+ *
+ * Indexes are free-running counters; only the low bits select a slot.
+ * The kernel keeps its own copies of the fields it owns, so scribbling
+ * on them achieves nothing.
+ */
+
+#define AIO_MAXENTRIES	256
+
+/* Operations (sqe_op) */
+#define AIO_OP_READ	0	/* pread into sqe_buf */
+#define AIO_OP_WRITE	1	/* pwrite from sqe_buf */
+
+struct aio_sqe {
+	uint32_t sqe_op;		/* AIO_OP_* */
+	int32_t sqe_fd;			/* file handle */
+	off_t sqe_offset;		/* position in file */
+#ifdef _KERNEL
+	userptr_t sqe_buf;		/* user buffer */
+	userptr_t sqe_data;		/* passed back in cqe_data */
+#else
+	void *sqe_buf;			/* user buffer */
+	void *sqe_data;			/* passed back in cqe_data */
+#endif
+	uint32_t sqe_len;		/* length of buffer */
+	uint32_t sqe_reserved;		/* must be 0 */
+};
+
+struct aio_cqe {
+#ifdef _KERNEL
+	userptr_t cqe_data;		/* sqe_data of the request */
+#else
+	void *cqe_data;			/* sqe_data of the request */
+#endif
+	int32_t cqe_result;		/* bytes transferred, or -errno */
+};
+
+struct aio_ring {
+	volatile uint32_t ar_sqhead;	/* next entry the kernel takes */
+	volatile uint32_t ar_sqtail;	/* next entry the process fills */
+	volatile uint32_t ar_cqhead;	/* next completion to read */
+	volatile uint32_t ar_cqtail;	/* next completion the kernel posts */
+	uint32_t ar_nentries;		/* set by aio_setup */
+	uint32_t ar_reserved[3];
+};
+
+/* Where the entries are, and how much memory a ring needs */
+#define AIO_SQES(r) ((struct aio_sqe *)((struct aio_ring *)(r) + 1))
+#define AIO_CQES(r, n) ((struct aio_cqe *)(AIO_SQES(r) + (n)))
+#define AIO_RINGSIZE(n) (sizeof(struct aio_ring) + \
+	(n) * (sizeof(struct aio_sqe) + sizeof(struct aio_cqe)))
+
+
+#endif /* _KERN_AIO_H_ */
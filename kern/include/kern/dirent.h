@@ -0,0 +1,66 @@
+/*
+ * Copyright (c) 2000, 2001, 2002, 2003, 2004, 2005, 2008
+ *	The President and Fellows of Harvard College.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the University nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE UNIVERSITY AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE UNIVERSITY OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+#ifndef _KERN_DIRENT_H_
+#define _KERN_DIRENT_H_
+
+#include <kern/limits.h>
+
+/*
+ * Directory records returned by getdirentries().
+ *
+ * Each call fills the buffer with as many records as fit. Records
+ * are variable-length: d_reclen is the distance to the next record,
+ * which is the header, the name and its terminating null, rounded
+ * up to a multiple of 4. (So only the first _DIRENT_RECLEN(d_namlen)
+ * bytes of a record are actually there; don't copy the struct.)
+ *
+ * d_type is the file type from <kern/stattypes.h> shifted right by 12
+ * (so _S_IFDIR >> 12 for a directory), or 0 if the file system
+ * couldn't tell without looking at the file. d_ino is 0 if the file
+ * system has no inode numbers.
+ */
+
+struct dirent {
+	uint32_t d_ino;			/* inode number */
+	uint16_t d_reclen;		/* length of this record */
+	uint8_t d_type;			/* type of file, or 0 */
+	uint8_t d_namlen;		/* length of d_name */
+	char d_name[__NAME_MAX+1];	/* null-terminated filename */
+};
+
+/* Size of the fixed part of struct dirent */
+#define _DIRENT_HDRSIZE  8
+
+/* Length of a record holding a name of length NAMLEN */
+#define _DIRENT_RECLEN(namlen) \
+	((_DIRENT_HDRSIZE + (namlen) + 1 + 3) & ~3)
+
+
+#endif /* _KERN_DIRENT_H_ */
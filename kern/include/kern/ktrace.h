@@ -0,0 +1,110 @@
+/*
+ * Copyright (c) 2000, 2001, 2002, 2003, 2004, 2005, 2008, 2009
+ *	The President and Fellows of Harvard College.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the University nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE UNIVERSITY AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE UNIVERSITY OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+#ifndef _KERN_KTRACE_H_
+#define _KERN_KTRACE_H_
+
+
+/*
+ * Kernel trace definitions visible to userspace. This covers the
+ * format of the trace files written by the kernel's "kt dump" menu
+ * command, and is used by the host tool that decodes them
+ * (ktracedump). All fields are stored big-endian, as on the MIPS.
+ *
+ * A trace file is a struct ktrace_header, then for each cpu a
+ * struct ktrace_cpuheader followed by that cpu's events, oldest
+ * first.
+ *
+ * Timestamps are nanoseconds from each cpu's own cycle counter. The
+ * counters aren't synchronized, so events on different cpus can be
+ * ordered only roughly (to within however far apart the cpus
+ * started).
+ */
+
+#define KTRACE_MAGIC      0x6b747263    /* "ktrc" */
+#define KTRACE_VERSION    1             /* file format revision */
+
+/* Event types (kte_type) */
+#define KTE_SWITCH        1     /* context switch: arg0 next pid,
+                                   arg1 state we left in (S_*) */
+#define KTE_SYSCALL       2     /* syscall entry: arg0 call number */
+#define KTE_SYSRET        3     /* syscall exit: arg0 call number,
+                                   arg1 error (0 on success) */
+#define KTE_VMFAULT       4     /* vm_fault: arg0 type, arg1 vaddr */
+#define KTE_VMFAULTDONE   5     /* vm_fault return: arg0 result,
+                                   arg1 vaddr */
+#define KTE_TLBREFILL     6     /* TLB entry loaded: arg0 vaddr,
+                                   arg1 TLB slot */
+#define KTE_DISKREAD      7     /* disk read started: arg0 unit,
+                                   arg1 sector */
+#define KTE_DISKWRITE     8     /* disk write started: arg0 unit,
+                                   arg1 sector */
+#define KTE_DISKDONE      9     /* disk I/O complete: arg0 unit,
+                                   arg1 error */
+#define KTE_SPINWAIT      10    /* spinlock got after spinning:
+                                   arg0 lock address */
+#define KTE_LOCKWAIT      11    /* sleeping for a lock: arg0 lock
+                                   address */
+#define KTE_LOCKACQ       12    /* lock got after sleeping: arg0 lock
+                                   address */
+#define KTE_NTYPES        13
+
+/*
+ * File header
+ */
+struct ktrace_header {
+	uint32_t kth_magic;		/* KTRACE_MAGIC */
+	uint32_t kth_version;		/* KTRACE_VERSION */
+	uint32_t kth_ncpus;		/* number of cpu sections */
+	uint32_t kth_evsize;		/* sizeof(struct ktrace_event) */
+};
+
+/*
+ * Per-cpu section header
+ */
+struct ktrace_cpuheader {
+	uint32_t ktc_cpu;		/* cpu number */
+	uint32_t ktc_nevents;		/* events following */
+	uint32_t ktc_lost;		/* older events overwritten */
+};
+
+/*
+ * One event
+ */
+struct ktrace_event {
+	uint32_t kte_timehi;		/* timestamp (ns), high word */
+	uint32_t kte_timelo;		/* timestamp (ns), low word */
+	uint32_t kte_type;		/* KTE_* */
+	int32_t kte_pid;		/* thread that was running */
+	uint32_t kte_arg0;
+	uint32_t kte_arg1;
+};
+
+
+#endif /* _KERN_KTRACE_H_ */
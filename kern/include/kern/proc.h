@@ -23,7 +23,6 @@ struct Proc {
 
 void child_fork_entry(void *data1, unsigned long data2);
 
-struct thread * get_thread_by_pid(pid_t pid);
 pid_t get_next_pid(struct thread *new_thread);
 void free_this_pid(pid_t pid);
 
@@ -37,15 +37,26 @@
  */
 
 #define SFS_MAGIC         0xabadf001    /* magic number identifying us */
-#define SFS_BLOCKSIZE     512           /* size of our blocks */
+#define SFS_VERSION       2             /* on-disk format revision */
+#define SFS_BLOCKSIZE     4096          /* size of our blocks */
 #define SFS_VOLNAME_SIZE  32            /* max length of volume name */
 #define SFS_NDIRECT       15            /* # of direct blocks in inode */
-#define SFS_DBPERIDB      128           /* # direct blks per indirect blk */
+#define SFS_NEXTENTS      8             /* # of extents in inode */
+#define SFS_DBPERIDB      1024          /* # direct blks per indirect blk */
 #define SFS_NAMELEN       60            /* max length of filename */
 #define SFS_SB_LOCATION    0            /* block the superblock lives in */
 #define SFS_ROOT_LOCATION  1            /* loc'n of the root dir inode */
 #define SFS_MAP_LOCATION   2            /* 1st block of the freemap */
 #define SFS_NOINO          0            /* inode # for free dir entry */
+#define SFS_JOURNAL_BLOCKS 64           /* default size of the journal */
+#define SFS_JMAGIC        0x6a726e6c    /* magic number of journal header */
+
+/*
+ * The inode has one each of single, double, and triple indirect
+ * blocks. (sfsck keys off these.)
+ */
+#define HAS_DIDIRECT
+#define HAS_TIDIRECT
 
 /* Number of bits in a block */
 #define SFS_BLOCKBITS (SFS_BLOCKSIZE * CHAR_BIT)
@@ -66,12 +77,67 @@
 
 /*
  * On-disk superblock
+ *
+ * Filesystems made before the format revision have zero in
+ * sp_version (it was part of the reserved area) and use 512-byte
+ * blocks; they must be remade with mksfs.
+ *
+ * sp_journalblocks is zero on filesystems without a journal
+ * (including all those made before it existed).
  */
 struct sfs_super {
 	uint32_t sp_magic;		/* Magic number, should be SFS_MAGIC */
 	uint32_t sp_nblocks;			/* Number of blocks in fs */
 	char sp_volname[SFS_VOLNAME_SIZE];	/* Name of this volume */
-	uint32_t reserved[118];
+	uint32_t sp_version;			/* Should be SFS_VERSION */
+	uint32_t sp_blocksize;			/* Should be SFS_BLOCKSIZE */
+	uint32_t sp_journalstart;		/* First block of journal */
+	uint32_t sp_journalblocks;		/* Size of journal, or 0 */
+	uint32_t reserved[SFS_BLOCKSIZE/4-14];
+};
+
+/*
+ * Metadata journal
+ *
+ * The journal is a run of sp_journalblocks blocks. The first holds
+ * this header; the rest hold copies of the metadata blocks (inodes,
+ * indirect blocks, directory blocks, bitmap blocks, superblock) of
+ * the last committed transaction, in order. jh_home[i] is where the
+ * i'th copy belongs.
+ *
+ * A transaction is committed by writing the copies and then the
+ * header. If the header's checksum matches the copies, the
+ * transaction is complete and may be replayed (copied to the home
+ * locations); otherwise the system went down before the header got
+ * out and the transaction is ignored. Replaying more than once is
+ * harmless. jh_nblocks is zero when there is nothing to replay.
+ *
+ * The checksum starts at 0; for each 32-bit word of jh_seq,
+ * jh_nblocks, the used entries of jh_home, and then the copies in
+ * order, it is rotated left by one bit and the word is added.
+ */
+#define SFS_JMAXBLOCKS (SFS_BLOCKSIZE/4-4)
+
+struct sfs_jheader {
+	uint32_t jh_magic;			/* Should be SFS_JMAGIC */
+	uint32_t jh_seq;			/* Transaction number */
+	uint32_t jh_nblocks;			/* Number of blocks in it */
+	uint32_t jh_checksum;			/* See above */
+	uint32_t jh_home[SFS_JMAXBLOCKS];	/* Home location of each */
+};
+
+/*
+ * On-disk extent: a run of sfe_nblocks disk blocks starting at
+ * sfe_diskblock, holding the file's blocks starting at
+ * sfe_fileblock. An extent with sfe_nblocks == 0 is unused.
+ *
+ * A file block is mapped either by one extent or by the direct and
+ * indirect blocks, never both. Extents are consulted first.
+ */
+struct sfs_extent {
+	uint32_t sfe_fileblock;			/* First file block covered */
+	uint32_t sfe_diskblock;			/* First disk block */
+	uint32_t sfe_nblocks;			/* Length of the run */
 };
 
 /*
@@ -83,7 +149,11 @@ struct sfs_inode {
 	uint16_t sfi_linkcount;			/* # hard links to this file */
 	uint32_t sfi_direct[SFS_NDIRECT];	/* Direct blocks */
 	uint32_t sfi_indirect;			/* Indirect block */
-	uint32_t sfi_waste[128-3-SFS_NDIRECT];	/* unused space, set to 0 */
+	uint32_t sfi_dindirect;			/* Double indirect block */
+	uint32_t sfi_tindirect;			/* Triple indirect block */
+	struct sfs_extent sfi_extents[SFS_NEXTENTS];	/* Extents */
+	uint32_t sfi_waste[SFS_BLOCKSIZE/4-5-SFS_NDIRECT-3*SFS_NEXTENTS];
+						/* unused space, set to 0 */
 };
 
 /*
@@ -0,0 +1,99 @@
+/*
+ * Copyright (c) 2000, 2001, 2002, 2003, 2004, 2005, 2008, 2009
+ *	The President and Fellows of Harvard College.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the University nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE UNIVERSITY AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE UNIVERSITY OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+#ifndef _KTRACE_H_
+#define _KTRACE_H_
+
+/*
+ * Kernel event tracing.
+ *
+ * With "options ktrace", each cpu has a ring of KTRACE_NEVENTS binary
+ * event records (see <kern/ktrace.h> for the events and the file
+ * format). While tracing is switched on (ktrace_enable; it starts
+ * off), KTRACE() appends a timestamped event to the current cpu's
+ * ring, overwriting the oldest once it's full. Only the cpu itself
+ * writes its ring, with interrupts off, so recording takes no locks
+ * and never waits; it costs a test of ktrace_on when tracing is off.
+ * The "kt" menu command switches tracing on and off and dumps the
+ * rings to a file, which the host tool ktracedump decodes.
+ *
+ * KTRACE raises the spl, so it must not be used in mips_trap before
+ * the interrupt state has been sorted out.
+ *
+ * Without the option, KTRACE() compiles to nothing.
+ */
+
+#include <kern/ktrace.h>
+#include "opt-ktrace.h"
+
+struct cpu;
+
+#if OPT_KTRACE
+
+/* Events kept per cpu */
+#define KTRACE_NEVENTS	2048
+
+/* Most cpus we keep rings for */
+#define KTRACE_MAXCPUS	32
+
+extern volatile bool ktrace_on;
+
+#define KTRACE(type, arg0, arg1) \
+	(ktrace_on ? ktrace_record(type, arg0, arg1) : (void)0)
+
+void ktrace_record(unsigned type, uint32_t arg0, uint32_t arg1);
+
+/*
+ * For cpu_create: set up the ring for cpu C.
+ */
+void ktrace_cpuinit(struct cpu *c);
+
+/*
+ * For the menu:
+ *
+ *    ktrace_enable - switch tracing on or off.
+ *    ktrace_clear  - empty all the rings.
+ *    ktrace_stats  - print how many events each ring holds.
+ *    ktrace_dump   - stop tracing and write the rings to the file
+ *                    PATH, replacing it.
+ */
+void ktrace_enable(bool on);
+void ktrace_clear(void);
+void ktrace_stats(void);
+int ktrace_dump(const char *path);
+
+#else
+
+#define KTRACE(type, arg0, arg1)	((void)(arg0), (void)(arg1))
+#define ktrace_cpuinit(c)		((void)(c))
+
+#endif /* OPT_KTRACE */
+
+
+#endif /* _KTRACE_H_ */
@@ -0,0 +1,127 @@
+/*
+ * Copyright (c) 2000, 2001, 2002, 2003, 2004, 2005, 2008, 2009
+ *	The President and Fellows of Harvard College.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the University nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE UNIVERSITY AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE UNIVERSITY OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+#ifndef _LOCKPROF_H_
+#define _LOCKPROF_H_
+
+/*
+ * Lock contention profiling.
+ *
+ * With "options lockprof", every sleep lock and semaphore, and any
+ * spinlock named with lockprof_spinlock, carries a struct lockprof.
+ * While profiling is switched on (lockprof_enable; it starts off)
+ * this counts acquisitions and contended acquisitions, adds up the
+ * time spent waiting and holding, and keeps the call sites that
+ * waited longest. The "lp" menu command shows and resets it.
+ *
+ * Each record is updated only by whoever holds the lock it describes,
+ * so it needs no locking of its own.
+ *
+ * Without the option, none of this is compiled in.
+ */
+
+#include "opt-lockprof.h"
+
+struct spinlock;
+
+#if OPT_LOCKPROF
+
+/* Call sites kept per lock */
+#define LOCKPROF_NSITES	4
+
+struct lockprof_site {
+	const void *ls_pc;		/* where lock was called from */
+	unsigned ls_count;		/* contended acquisitions */
+	uint64_t ls_waitns;		/* total time waited */
+};
+
+struct lockprof {
+	struct lockprof *lp_next;	/* registry link */
+	struct lockprof **lp_prevp;	/* registry link */
+	const char *lp_kind;		/* "lock", "sem", "spin" */
+	const char *lp_name;
+	unsigned lp_acquires;
+	unsigned lp_contended;
+	uint64_t lp_waitns, lp_maxwaitns;
+	uint64_t lp_holdns, lp_maxholdns;
+	uint64_t lp_since;		/* when acquired, or 0 */
+	bool lp_hashold;		/* hold time means something */
+	struct lockprof_site lp_sites[LOCKPROF_NSITES];
+};
+
+/*
+ * For the lock code:
+ *
+ *    lockprof_init     - set up and register a record. NAME must stay
+ *                        valid until lockprof_cleanup.
+ *    lockprof_cleanup  - unregister it.
+ *    lockprof_now      - current time in ns, for passing to
+ *                        lockprof_acquired; 0 if profiling is off.
+ *    lockprof_acquired - note an acquisition by the code at PC, which
+ *                        started at time START and had to wait if
+ *                        CONTENDED.
+ *    lockprof_released - note the lock being let go (call before
+ *                        actually letting go).
+ *
+ * Semaphores ("sem") have no owner, and whoever calls V is often not
+ * whoever called P, so no hold time is kept for them.
+ */
+void lockprof_init(struct lockprof *lp, const char *kind, const char *name);
+void lockprof_cleanup(struct lockprof *lp);
+uint64_t lockprof_now(void);
+void lockprof_acquired(struct lockprof *lp, uint64_t start, bool contended,
+		       const void *pc);
+void lockprof_released(struct lockprof *lp);
+
+/*
+ * Profile spinlock LK under NAME. Spinlocks are too numerous, and too
+ * often embedded in structures that are freed without cleanup, to
+ * profile all of them; name the ones worth watching.
+ */
+void lockprof_spinlock(struct spinlock *lk, const char *name);
+
+/*
+ * For the menu:
+ *
+ *    lockprof_enable - switch profiling on or off.
+ *    lockprof_reset  - zero all the statistics.
+ *    lockprof_report - print the N locks with the most waiting.
+ */
+void lockprof_enable(bool on);
+void lockprof_reset(void);
+void lockprof_report(unsigned n);
+
+#else
+
+#define lockprof_spinlock(lk, name)	((void)(lk), (void)(name))
+
+#endif /* OPT_LOCKPROF */
+
+
+#endif /* _LOCKPROF_H_ */
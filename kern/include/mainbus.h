@@ -55,6 +55,21 @@ size_t mainbus_ramsize(void);
 /* Switch on an inter-processor interrupt. (Low-level.) */
 void mainbus_send_ipi(struct cpu *target);
 
+/*
+ * Arrange for this cpu's next timer interrupt (and so hardclock) in
+ * HARDCLOCKS clock ticks, or as late as possible if 0. Returns the
+ * number of whole ticks since the timer was last set. (Low-level;
+ * use hardclock_settimer.)
+ */
+unsigned mainbus_settimer(unsigned hardclocks);
+
+/*
+ * Nanoseconds of running time on this cpu, with cycle resolution;
+ * for CPU time accounting. Not synchronized between cpus.
+ * (Low-level; use cputime_switch.)
+ */
+uint64_t mainbus_cputime(void);
+
 /*
  * The various ways to shut down the system. (These are very low-level
  * and should generally not be called directly - md_poweroff, for
@@ -0,0 +1,64 @@
+/*
+ * Copyright (c) 2009
+ *	The President and Fellows of Harvard College.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the University nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE UNIVERSITY AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE UNIVERSITY OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+#ifndef _MEMBAR_H_
+#define _MEMBAR_H_
+
+/*
+ * Memory barriers. These order this CPU's loads and stores as seen by
+ * other CPUs; they're needed by code that shares memory without
+ * holding a spinlock (which provides the ordering itself).
+ *
+ *    membar_any_any     - all earlier loads and stores before all later ones
+ *    membar_load_load   - earlier loads before later loads
+ *    membar_store_store - earlier stores before later stores
+ *    membar_store_any   - earlier stores before later loads and stores
+ *    membar_any_store   - earlier loads and stores before later stores
+ *
+ * All of them are also compiler barriers.
+ */
+
+#include <cdefs.h>
+
+/* Inlining support - for making sure an out-of-line copy gets built */
+#ifndef MEMBAR_INLINE
+#define MEMBAR_INLINE INLINE
+#endif
+
+void membar_any_any(void);
+void membar_load_load(void);
+void membar_store_store(void);
+void membar_store_any(void);
+void membar_any_store(void);
+
+/* Get the machine-dependent bits. */
+#include <machine/membar.h>
+
+
+#endif /* _MEMBAR_H_ */
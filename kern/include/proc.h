@@ -4,6 +4,7 @@
 #include <types.h>
 #include <mips/trapframe.h>
 #include <synch.h>
+#include <cputime.h>
 
 #ifndef _PROC_H
 #define _PROC_H
@@ -23,10 +24,15 @@ struct Proc {
 
 void child_fork_entry(void *data1, unsigned long data2);
 
+void proc_bootstrap(void);
+
 int assign_pid(struct thread *new_thread);
 void free_this_pid(pid_t pid);
 struct Proc * get_process_by_pid(pid_t pid);
-struct thread * get_thread_by_pid(pid_t pid);
+
+void proc_thread_exit(struct thread *t);
+void proc_childtime(struct cputime *ct);
+void proc_printtimes(void);
 
 pid_t sys_getpid(void);
 int sys_fork(struct trapframe *tf, pid_t *retval);
@@ -48,21 +48,108 @@
  */
 #include <kern/sfs.h>
 
+/*
+ * Number of blocks past the last one allocated that are held back for
+ * a file while it's in memory, so that it keeps growing contiguously
+ * even when other files are being written at the same time.
+ */
+#define SFS_PREALLOC 8
+
+/*
+ * Number of journal blocks set aside in the running transaction for
+ * each operation in progress. An operation doesn't start until there
+ * is that much room (committing first if need be), and must not
+ * write more new blocks than this to the transaction.
+ */
+#define SFS_JRESERVE 16
+
+/*
+ * Most bytes of a write() done as one journaled operation; longer
+ * writes are split. Each SFS_DBPERIDB data blocks can dirty another
+ * indirect block, so this keeps a write well inside SFS_JRESERVE.
+ */
+#define SFS_WRITECHUNK (256*SFS_BLOCKSIZE)
+
+struct sfs_dirhash;  /* Opaque; see sfs_dirhash.c */
+struct sfs_jblock;   /* Opaque; see sfs_journal.c */
+struct lock;
+struct cv;
+struct thread;
+
+/*
+ * Locking:
+ *
+ * sv_lock protects everything about one file: the in-memory inode,
+ * the file's blocks and contents, its preallocation window, and (for
+ * directories) the name index. The vnode table (sfs_vnodes and
+ * sfs_vnhash) is protected by sfs_vnlock, and the free map and
+ * superblock by sfs_freemaplock.
+ *
+ * The running journal transaction is protected by sfs_jlock.
+ *
+ * The order is: sv_lock of a directory, sv_lock of a file in it,
+ * sfs_vnlock, sfs_freemaplock, sfs_jlock, and last the vnode's
+ * vn_countlock. Operations that change metadata call sfs_jbegin
+ * before taking any of these.
+ */
+
 struct sfs_vnode {
 	struct vnode sv_v;              /* abstract vnode structure */
 	struct sfs_inode sv_i;		/* on-disk inode */
 	uint32_t sv_ino;                /* inode number */
 	bool sv_dirty;                  /* true if sv_i modified */
+	struct lock *sv_lock;           /* lock for this file */
+	uint32_t sv_nextblock;          /* where the next block should go */
+	uint32_t sv_prealloc_start;     /* blocks reserved for this file */
+	uint32_t sv_prealloc_len;       /* number of blocks reserved */
+	struct sfs_dirhash *sv_dirhash; /* name index (directories only) */
+	struct sfs_vnode *sv_hashnext;  /* next in sfs_vnhash chain */
+	unsigned sv_index;              /* position in sfs_vnodes */
 };
 
+/*
+ * Number of chains in the hash table of loaded vnodes (must be a
+ * power of 2).
+ */
+#define SFS_VNHASHSIZE 256
+#define SFS_VNHASH(ino) ((ino) & (SFS_VNHASHSIZE - 1))
+
 struct sfs_fs {
 	struct fs sfs_absfs;            /* abstract filesystem structure */
 	struct sfs_super sfs_super;	/* on-disk superblock */
 	bool sfs_superdirty;            /* true if superblock modified */
 	struct device *sfs_device;      /* device mounted on */
 	struct vnodearray *sfs_vnodes;  /* vnodes loaded into memory */
+	struct sfs_vnode *sfs_vnhash[SFS_VNHASHSIZE]; /* same, by inode */
+	struct lock *sfs_vnlock;        /* lock for vnode table */
 	struct bitmap *sfs_freemap;     /* blocks in use are marked 1 */
 	bool sfs_freemapdirty;          /* true if freemap modified */
+	bool *sfs_mapdirty;             /* per bitmap block: modified */
+	uint32_t *sfs_mapfree;          /* per bitmap block: free bits */
+	struct lock *sfs_freemaplock;   /* lock for freemap and superblock */
+	struct bitmap *sfs_jfreed;      /* blocks to free at next commit */
+	uint32_t sfs_jnfreed;           /* number of them */
+
+	/* Journal (sfs_journal.c); sfs_jmax is 0 if there isn't one */
+	uint32_t sfs_jmax;              /* max blocks in a transaction */
+	uint32_t sfs_jseq;              /* number of next transaction */
+	struct sfs_jblock *sfs_jblocks; /* blocks in running transaction */
+	uint32_t sfs_jnum;              /* number of them */
+	struct lock *sfs_jlock;         /* lock for journal */
+	struct cv *sfs_jcv;             /* for waiting on commits and ops */
+	struct sfs_jhandle *sfs_jops;   /* operations in progress */
+	uint32_t sfs_jreserved;         /* blocks set aside for them */
+	struct thread *sfs_jcommitter;  /* thread committing, if any */
+};
+
+/*
+ * Record of a metadata-changing operation in progress; see
+ * sfs_jbegin. Lives on the caller's stack.
+ */
+struct sfs_jhandle {
+	struct thread *jh_thread;       /* thread doing the operation */
+	bool jh_nested;                 /* inside another operation */
+	struct sfs_jhandle *jh_next;    /* next in sfs_jops */
 };
 
 /*
@@ -79,11 +166,44 @@ int sfs_mount(const char *device);
 #define SFSUIO(iov, uio, ptr, block, rw) \
     uio_kinit(iov, uio, ptr, SFS_BLOCKSIZE, ((off_t)(block))*SFS_BLOCKSIZE, rw)
 
+/* Shortcuts for the size macros in kern/sfs.h */
+#define SFS_FS_BITMAPSIZE(sfs)  SFS_BITMAPSIZE((sfs)->sfs_super.sp_nblocks)
+#define SFS_FS_BITBLOCKS(sfs)   SFS_BITBLOCKS((sfs)->sfs_super.sp_nblocks)
+
 /* Convenience functions for block I/O */
 int sfs_rwblock(struct sfs_fs *sfs, struct uio *uio);
 int sfs_rblock(struct sfs_fs *sfs, void *data, uint32_t block);
 int sfs_wblock(struct sfs_fs *sfs, void *data, uint32_t block);
 
+/* Metadata journal */
+int sfs_jmount(struct sfs_fs *sfs);
+int sfs_junmount(struct sfs_fs *sfs);
+void sfs_jdestroy(struct sfs_fs *sfs);
+void sfs_jbegin(struct sfs_fs *sfs, struct sfs_jhandle *jh);
+void sfs_jend(struct sfs_fs *sfs, struct sfs_jhandle *jh);
+void sfs_jcommit_begin(struct sfs_fs *sfs);
+int sfs_jcommit(struct sfs_fs *sfs);
+void sfs_jcommit_end(struct sfs_fs *sfs);
+int sfs_jrblock(struct sfs_fs *sfs, void *data, uint32_t block);
+int sfs_jwblock(struct sfs_fs *sfs, void *data, uint32_t block);
+void sfs_jforget(struct sfs_fs *sfs, uint32_t block);
+extern bool sfs_jcrash;
+
+/* In sfs_vnode.c, for sfs_sync */
+int sfs_writeinode(struct vnode *v);
+void sfs_bfree_flush(struct sfs_fs *sfs);
+
+/* In-memory directory name index */
+struct sfs_dirhash *sfs_dirhash_create(void);
+void sfs_dirhash_destroy(struct sfs_dirhash *dh);
+int sfs_dirhash_setslots(struct sfs_dirhash *dh, unsigned nslots);
+int sfs_dirhash_lookup(struct sfs_dirhash *dh, const char *name,
+		       uint32_t *ino, int *slot);
+int sfs_dirhash_add(struct sfs_dirhash *dh, const char *name, uint32_t ino,
+		    int slot);
+void sfs_dirhash_remove(struct sfs_dirhash *dh, int slot);
+int sfs_dirhash_emptyslot(struct sfs_dirhash *dh);
+
 /* Get root vnode */
 struct vnode *sfs_getroot(struct fs *fs);
 
@@ -45,29 +45,73 @@
 /* Get the machine-dependent bits. */
 #include <machine/spinlock.h>
 
+#include <lockprof.h>
+
 /*
  * Basic spinlock.
  *
  * Note that spinlocks are held by CPUs, not by threads.
  *
+ * Waiters are served in FIFO order. An ordinary spinlock is a ticket
+ * lock: each CPU takes the next number from lk_next and waits until
+ * lk_owner reaches it. A queued spinlock is an MCS lock: each waiting
+ * CPU spins on a flag in its own queue node (see struct cpu), and the
+ * holder passes the lock on by clearing the next one's flag, so on a
+ * heavily contended lock the waiters aren't all pulling the same
+ * cache line around. Queued locks cost a bit more when uncontended.
+ *
+ * lk_acquires and lk_contended count acquisitions, and how many of
+ * them had to wait. They're updated by the holder, under the lock.
+ *
  * This structure is made public so spinlocks do not have to be
  * malloc'd; however, code that uses spinlocks should not look inside
  * the structure directly but always use the spinlock API functions.
  */
+struct spinlock_mcsnode {
+	struct spinlock_mcsnode *volatile mn_next; /* Next in queue */
+	volatile bool mn_wait;		/* Spin while true */
+};
+
 struct spinlock {
-	volatile spinlock_data_t lk_lock; /* The memory word where we spin. */
+	volatile spinlock_data_t lk_next;  /* Ticket: next to hand out */
+	volatile spinlock_data_t lk_owner; /* Ticket: now being served */
+	volatile spinlock_data_t lk_tail;  /* MCS: last node in queue */
+	struct spinlock_mcsnode *lk_mcsnode; /* MCS: holder's node */
+	bool lk_queued;			/* MCS rather than ticket lock */
 	struct cpu *lk_holder;		/* CPU holding this lock. */
+	unsigned lk_acquires;		/* Times acquired */
+	unsigned lk_contended;		/* Times acquired after waiting */
+#if OPT_LOCKPROF
+	struct lockprof *lk_prof;	/* Profiling, if named */
+#endif
 };
 
+#if OPT_LOCKPROF
+#define SPINLOCK_PROF_INITIALIZER	, NULL
+#else
+#define SPINLOCK_PROF_INITIALIZER
+#endif
+
 /*
- * Initializer for cases where a spinlock needs to be static or global.
+ * Initializers for cases where a spinlock needs to be static or global.
  */
-#define SPINLOCK_INITIALIZER	{ SPINLOCK_DATA_INITIALIZER, NULL }
+#define SPINLOCK_INITIALIZER	\
+	{ SPINLOCK_DATA_INITIALIZER, SPINLOCK_DATA_INITIALIZER, \
+	  SPINLOCK_DATA_INITIALIZER, NULL, false, NULL, 0, 0 \
+	  SPINLOCK_PROF_INITIALIZER }
+#define SPINLOCK_QUEUED_INITIALIZER	\
+	{ SPINLOCK_DATA_INITIALIZER, SPINLOCK_DATA_INITIALIZER, \
+	  SPINLOCK_DATA_INITIALIZER, NULL, true, NULL, 0, 0 \
+	  SPINLOCK_PROF_INITIALIZER }
+
+/* Queue nodes per CPU; the most queued spinlocks one CPU can hold */
+#define SPINLOCK_MCSNODES	8
 
 /*
  * Spinlock functions.
  *
  * init		Initialize the contents of a spinlock.
+ * init_queued	Same, for a queued spinlock.
  * cleanup	Opposite of init. Lock must be unlocked.
  *
  * acquire	Get the lock, spinning as necessary. Also disables interrupts.
@@ -77,6 +121,7 @@ struct spinlock {
  */
 
 void spinlock_init(struct spinlock *lk);
+void spinlock_init_queued(struct spinlock *lk);
 void spinlock_cleanup(struct spinlock *lk);
 
 void spinlock_acquire(struct spinlock *lk);
@@ -36,6 +36,7 @@
 
 
 #include <spinlock.h>
+#include <lockprof.h>
 
 /*
  * Dijkstra-style semaphore.
@@ -48,6 +49,9 @@ struct semaphore {
 	struct wchan *sem_wchan;
 	struct spinlock sem_lock;
         volatile int sem_count;
+#if OPT_LOCKPROF
+	struct lockprof sem_prof;
+#endif
 };
 
 struct semaphore *sem_create(const char *name, int initial_count);
@@ -58,9 +62,13 @@ void sem_destroy(struct semaphore *);
  *     P (proberen): decrement count. If the count is 0, block until
  *                   the count is 1 again before decrementing.
  *     V (verhogen): increment count.
+ *
+ * P_timeout is P, but gives up after TICKS hardclocks; it returns 0
+ * or ETIMEDOUT.
  */
 void P(struct semaphore *);
 void V(struct semaphore *);
+int P_timeout(struct semaphore *, unsigned ticks);
 
 
 /*
@@ -80,21 +88,32 @@ struct lock {
   char *lk_name;
   struct wchan *lk_wchan;
   struct spinlock lk_spinlock;
-  volatile struct thread *lk_curthread;
+  struct thread *volatile lk_curthread;  // the pointer, not the thread, is volatile
   volatile int lk_hold;
+  volatile unsigned lk_nwaiters;  // threads asleep in lock_acquire
+  volatile bool lk_handoff;       // released straight to a sleeper
+#if OPT_LOCKPROF
+  struct lockprof lk_prof;
+#endif
 };
 
 struct lock *lock_create(const char *name);
 void lock_acquire(struct lock *);
+void lock_acquire_from(struct lock *, const void *site);
 
 /*
  * Operations:
  *    lock_acquire - Get the lock. Only one thread can hold the lock at the
- *                   same time.
+ *                   same time. Spins while the holder is running on
+ *                   another cpu, and sleeps otherwise.
  *    lock_release - Free the lock. Only the thread holding the lock may do
- *                   this.
+ *                   this. If anyone is asleep waiting for it, it goes
+ *                   to the one that's been waiting longest.
  *    lock_do_i_hold - Return true if the current thread holds the lock; 
  *                   false otherwise.
+ *    lock_acquire_from - lock_acquire, but for lock profiling count the
+ *                   wait against SITE rather than the caller. For
+ *                   wrappers like vfs_biglock_acquire.
  *
  * These operations must be atomic. You get to write them.
  */
@@ -136,6 +155,9 @@ void cv_destroy(struct cv *);
  *                   waking up again, re-acquire the lock.
  *    cv_signal    - Wake up one thread that's sleeping on this CV.
  *    cv_broadcast - Wake up all threads sleeping on this CV.
+ *    cv_timedwait - cv_wait, but give up waiting after TICKS hardclocks.
+ *                   Returns 0, or ETIMEDOUT if it gave up. The lock is
+ *                   re-acquired either way.
  *
  * For all three operations, the current thread must hold the lock passed 
  * in. Note that under normal circumstances the same lock should be used
@@ -146,20 +168,36 @@ void cv_destroy(struct cv *);
 void cv_wait(struct cv *cv, struct lock *lock);
 void cv_signal(struct cv *cv, struct lock *lock);
 void cv_broadcast(struct cv *cv, struct lock *lock);
+int cv_timedwait(struct cv *cv, struct lock *lock, unsigned ticks);
 
 /*
  * 13 Feb 2012 : GWA : Reader-writer locks.
+ *
+ * Any number of readers, or one writer. Writers get preference: a
+ * reader that comes along while a writer is waiting waits too. So
+ * a thread holding a read lock must not try to get it again.
+ *
+ * Operations:
+ *    rwlock_acquire_read   - Get the lock for reading.
+ *    rwlock_release_read   - Give up a read lock.
+ *    rwlock_acquire_write  - Get the lock for writing.
+ *    rwlock_release_write  - Give up the write lock.
+ *    rwlock_do_i_hold_write - Return true if the current thread holds
+ *                           the write lock.
+ *
+ * The name field is for easier debugging. A copy of the name is made
+ * internally.
  */
 
 struct rwlock {
 
-  char              *rwl_name;
-  struct spinlock    rwl_spinlock;
-  struct wchan      *rwl_rwchan;
-  struct wchan      *rwl_wwchan;
-  int                mode;
-  struct semaphore  *rwl_rsem;
-  struct semaphone  *rwl_wsem;
+  char                    *rwl_name;
+  struct spinlock          rwl_spinlock;
+  struct wchan            *rwl_rwchan;          // readers wait here
+  struct wchan            *rwl_wwchan;          // writers wait here
+  volatile unsigned        rwl_readers;         // readers holding it
+  volatile unsigned        rwl_writers_waiting;
+  volatile struct thread  *rwl_writer;          // writer holding it
 };
 
 struct rwlock * rwlock_create(const char *);
@@ -169,5 +207,6 @@ void rwlock_acquire_read(struct rwlock *);
 void rwlock_release_read(struct rwlock *);
 void rwlock_acquire_write(struct rwlock *);
 void rwlock_release_write(struct rwlock *);
+bool rwlock_do_i_hold_write(struct rwlock *);
 
 #endif /* _SYNCH_H_ */
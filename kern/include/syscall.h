@@ -59,6 +59,10 @@ void enter_new_process(int argc, userptr_t argv, vaddr_t stackptr,
 
 int sys_reboot(int code);
 int sys___time(userptr_t user_seconds, userptr_t user_nanoseconds);
+int sys_nanosleep(const_userptr_t user_req, userptr_t user_rem);
+int sys_getrusage(int who, userptr_t user_usage);
+int sys_aio_setup(userptr_t ring, unsigned nentries);
+int sys_aio_enter(unsigned to_submit, unsigned min_complete, int32_t *retval);
 
 // File System Calls
 /*int sys_open(const char *filename, int flags, int mode, int32_t *retval);
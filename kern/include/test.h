@@ -94,6 +94,9 @@ int semtest(int, char **);
 int locktest(int, char **);
 int cvtest(int, char **);
 int cvtest2(int, char **);
+int lockhandofftest(int, char **);
+int spinlocktest(int, char **);
+int rwlocktest(int, char **);
 
 /* filesystem tests */
 int fstest(int, char **);
@@ -38,6 +38,7 @@
 
 #include <spinlock.h>
 #include <threadlist.h>
+#include <cputime.h>
 #include <limits.h>
 
 #include <file.h>
@@ -45,6 +46,7 @@
 struct addrspace;
 struct cpu;
 struct vnode;
+struct aioctx;
 
 /* get machine-dependent defs */
 #include <machine/thread.h>
@@ -86,6 +88,12 @@ struct thread {
 	void *t_stack;			/* Kernel-level stack */
 	struct switchframe *t_context;	/* Saved register context (on stack) */
 	struct cpu *t_cpu;		/* CPU thread runs on */
+	unsigned t_priority;		/* Scheduling level; 0 is highest */
+	unsigned t_ticks;		/* Hardclocks used at this level */
+	unsigned t_lastrun;		/* t_cpu's c_hardclocks when last run */
+	struct wchan *t_wchan;		/* Wait channel, if sleeping */
+	struct cputime t_cputime;	/* Time used, by CPUTIME_* state */
+	struct cputime t_childtime;	/* Time used by exited children */
 
 	/*
 	 * Interrupt state fields.
@@ -119,6 +127,9 @@ struct thread {
   // File descriptor table.
   struct File *file_desctable[OPEN_MAX];
 
+  // Async I/O ring, if set up (see aio.c).
+  struct aioctx *t_aio;
+
   // PIDs
   pid_t ppid;
 
@@ -151,6 +162,20 @@ int thread_fork(const char *name,
                 void *data1, unsigned long data2, 
                 struct thread **ret);
 
+/*
+ * The two halves of thread_fork, for callers (fork) that need to
+ * finish setting up the new thread before it can run. thread_prepare
+ * makes the thread and hands it back; thread_start makes it runnable.
+ * A prepared thread that won't be started is freed with
+ * thread_discard.
+ */
+int thread_prepare(const char *name,
+                   void (*func)(void *, unsigned long),
+                   void *data1, unsigned long data2,
+                   struct thread **ret);
+void thread_start(struct thread *t);
+void thread_discard(struct thread *t);
+
 /*
  * Cause the current thread to exit.
  * Interrupts need not be disabled.
@@ -165,15 +190,15 @@ void thread_exit(void);
 void thread_yield(void);
 
 /*
- * Reshuffle the run queue. Called from the timer interrupt.
+ * Charge TICKS clock ticks to the current thread, and preempt it if
+ * its quantum is used up. Called from the timer interrupt.
  */
-void schedule(void);
+void thread_tick(unsigned ticks);
 
 /*
- * Potentially migrate ready threads to other CPUs. Called from the
- * timer interrupt.
+ * Reshuffle the run queue. Called from the timer interrupt.
  */
-void thread_consider_migration(void);
+void schedule(void);
 
 
 #endif /* _THREAD_H_ */
@@ -81,6 +81,34 @@ int vfs_lookup(char *path, struct vnode **result);
 int vfs_lookparent(char *path, struct vnode **result,
 		   char *buf, size_t buflen);
 
+/*
+ * Name cache (vfscache.c), used by vfs_lookup and the operations in
+ * vfspath.c.
+ *
+ *    vfs_ncache_lookup  - Look up a single name in a directory. Returns 0
+ *                         and a new reference on a hit, ENOENT if the
+ *                         name is cached as nonexistent, and EAGAIN on a
+ *                         miss, with a generation number in *GEN.
+ *    vfs_ncache_enter   - Record the result of a lookup after a miss;
+ *                         VN is NULL if the name does not exist.
+ *    vfs_ncache_begin   - Forget a name; call before creating, removing,
+ *                         or renaming it, so nobody sees the old entry
+ *                         while that is going on.
+ *    vfs_ncache_end     - Forget it again, and allow entering results;
+ *                         call afterwards, whether the change worked.
+ *    vfs_ncache_purgefs - Forget every name on a filesystem (all names
+ *                         if FS is NULL), e.g. before unmounting it.
+ */
+
+void vfs_ncache_bootstrap(void);
+int vfs_ncache_lookup(struct vnode *dir, const char *name,
+		      struct vnode **ret, unsigned *gen);
+void vfs_ncache_enter(struct vnode *dir, const char *name, struct vnode *vn,
+		      unsigned gen);
+void vfs_ncache_begin(struct vnode *dir, const char *name);
+void vfs_ncache_end(struct vnode *dir, const char *name);
+void vfs_ncache_purgefs(struct fs *fs);
+
 /*
  * VFS layer high-level operations on pathnames
  * Because namei may destroy pathnames, these all may too.
@@ -99,10 +127,14 @@ int vfs_lookparent(char *path, struct vnode **result,
  *
  *    vfs_close  - Close a vnode opened with vfs_open. Does not fail.
  *                 (See vfspath.c for a discussion of why.)
+ *
+ *    vfs_pipe   - Create a pipe. Hands back its read end and write end,
+ *                 both already open; close each with vfs_close.
  */
 
 int vfs_open(char *path, int openflags, mode_t mode, struct vnode **ret);
 void vfs_close(struct vnode *vn);
+int vfs_pipe(struct vnode **ret_read, struct vnode **ret_write);
 int vfs_readlink(char *path, struct uio *data);
 int vfs_symlink(const char *contents, char *path);
 int vfs_mkdir(char *path, mode_t mode);
@@ -185,8 +217,9 @@ DECLARRAY(vnode);
 DEFARRAY(vnode, VFSINLINE);
 
 /*
- * Global one-big-lock for all filesystem operations.
- * You must remove this for the filesystem assignment.
+ * Lock for the list of known devices and mounted filesystems, and
+ * for bootfs_vnode. File operations don't take it; filesystems do
+ * their own locking (see e.g. struct sfs_fs and struct sfs_vnode).
  */
 void vfs_biglock_acquire(void);
 void vfs_biglock_release(void);
@@ -71,6 +71,12 @@ void wchan_unlock(struct wchan *wc);
  */
 void wchan_sleep(struct wchan *wc);
 
+/*
+ * Same, but give up after TICKS hardclocks (at least 1). Returns 0 if
+ * awakened, ETIMEDOUT if the time ran out.
+ */
+int wchan_sleep_timeout(struct wchan *wc, unsigned ticks);
+
 /*
  * Wake up one thread, or all threads, sleeping on a wait channel.
  * The queue should not already be locked.
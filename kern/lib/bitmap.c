@@ -120,6 +120,77 @@ bitmap_alloc(struct bitmap *b, unsigned *index)
         return ENOSPC;
 }
 
+/*
+ * Like bitmap_alloc, but start looking at bit GOAL instead of at the
+ * beginning, wrapping around at the end. This returns the first
+ * cleared bit at or after GOAL if there is one, which lets callers
+ * keep related allocations close together.
+ */
+int
+bitmap_alloc_near(struct bitmap *b, unsigned goal, unsigned *index)
+{
+        unsigned i, ix, startix;
+        unsigned maxix = DIVROUNDUP(b->nbits, BITS_PER_WORD);
+        unsigned offset, startoffset;
+
+        if (goal >= b->nbits) {
+                goal = 0;
+        }
+        startix = goal / BITS_PER_WORD;
+        startoffset = goal % BITS_PER_WORD;
+
+        /*
+         * Go one word past a full lap so the low bits of the starting
+         * word (the ones before GOAL) get looked at last.
+         */
+        for (i=0; i<=maxix; i++) {
+                ix = (startix + i) % maxix;
+                if (b->v[ix]==WORD_ALLBITS) {
+                        continue;
+                }
+                offset = (i == 0) ? startoffset : 0;
+                for (; offset < BITS_PER_WORD; offset++) {
+                        WORD_TYPE mask = ((WORD_TYPE)1) << offset;
+
+                        if ((b->v[ix] & mask)==0) {
+                                b->v[ix] |= mask;
+                                *index = (ix*BITS_PER_WORD)+offset;
+                                KASSERT(*index < b->nbits);
+                                return 0;
+                        }
+                }
+        }
+        return ENOSPC;
+}
+
+int
+bitmap_alloc_range(struct bitmap *b, unsigned start, unsigned end,
+                   unsigned *index)
+{
+        unsigned bit, ix, offset;
+
+        KASSERT(start <= end);
+        KASSERT(end <= b->nbits);
+
+        bit = start;
+        while (bit < end) {
+                ix = bit / BITS_PER_WORD;
+                offset = bit % BITS_PER_WORD;
+                if (offset == 0 && b->v[ix]==WORD_ALLBITS) {
+                        /* Whole word in use; skip it */
+                        bit += BITS_PER_WORD;
+                        continue;
+                }
+                if ((b->v[ix] & ((WORD_TYPE)1 << offset))==0) {
+                        b->v[ix] |= (WORD_TYPE)1 << offset;
+                        *index = bit;
+                        return 0;
+                }
+                bit++;
+        }
+        return ENOSPC;
+}
+
 static
 inline
 void
@@ -48,6 +48,8 @@
 #include <vfs.h>
 #include <device.h>
 #include <syscall.h>
+#include <aio.h>
+#include <proc.h>
 #include <test.h>
 #include <version.h>
 #include "autoconf.h"  // for pseudoconfig
@@ -109,6 +111,7 @@ boot(void)
 	/* Early initialization. */
 	ram_bootstrap();
 	thread_bootstrap();
+	proc_bootstrap();
 	hardclock_bootstrap();
 	vfs_bootstrap();
 
@@ -124,6 +127,7 @@ boot(void)
 	/* Late phase of initialization. */
 	vm_bootstrap();
 	kprintf_bootstrap();
+	aio_bootstrap();
 	thread_start_cpus();
 
 	/* Default bootfs - but ignore failure, in case emu0 doesn't exist */
@@ -35,11 +35,14 @@
 #include <lib.h>
 #include <uio.h>
 #include <clock.h>
+#include <cpu.h>
 #include <thread.h>
 #include <vfs.h>
 #include <sfs.h>
 #include <syscall.h>
 #include <test.h>
+#include <lockprof.h>
+#include <ktrace.h>
 #include "opt-synchprobs.h"
 #include "opt-sfs.h"
 #include "opt-net.h"
@@ -255,6 +258,25 @@ cmd_sync(int nargs, char **args)
   return 0;
 }
 
+#if OPT_SFS
+/*
+ * Command to make the next SFS journal commit panic once it's
+ * committed, for testing replay. See sfs_journal.c.
+ */
+static
+int
+cmd_jcrash(int nargs, char **args)
+{
+  (void)nargs;
+  (void)args;
+
+  sfs_jcrash = true;
+  kprintf("The next SFS journal commit will panic\n");
+
+  return 0;
+}
+#endif
+
 /*
  * Command for doing an intentional panic.
  */
@@ -392,6 +414,99 @@ cmd_kheapstats(int nargs, char **args)
   return 0;
 }
 
+/*
+ * Command for a snapshot of where CPU time has gone: per cpu, then
+ * per thread. Times are in milliseconds since boot (or since the
+ * thread started).
+ */
+static
+int
+cmd_top(int nargs, char **args)
+{
+  (void)nargs;
+  (void)args;
+
+  cpu_printtimes();
+  kprintf("\n");
+  proc_printtimes();
+
+  return 0;
+}
+
+#if OPT_LOCKPROF
+/*
+ * Command for lock profiling: "lp on", "lp off", "lp reset", or
+ * "lp [N]" to show the N (default 10) locks waited for the longest.
+ */
+static
+int
+cmd_lockprof(int nargs, char **args)
+{
+  if (nargs > 2) {
+    kprintf("Usage: lp [on | off | reset | count]\n");
+    return EINVAL;
+  }
+
+  if (nargs == 1) {
+    lockprof_report(10);
+  }
+  else if (!strcmp(args[1], "on")) {
+    lockprof_enable(true);
+  }
+  else if (!strcmp(args[1], "off")) {
+    lockprof_enable(false);
+  }
+  else if (!strcmp(args[1], "reset")) {
+    lockprof_reset();
+  }
+  else {
+    lockprof_report(atoi(args[1]));
+  }
+
+  return 0;
+}
+#endif
+
+#if OPT_KTRACE
+/*
+ * Command for event tracing: "kt on", "kt off", "kt clear", "kt dump
+ * FILE" (which also switches tracing off), or "kt" to show how full
+ * the buffers are.
+ */
+static
+int
+cmd_ktrace(int nargs, char **args)
+{
+  int result;
+
+  if (nargs == 1) {
+    ktrace_stats();
+  }
+  else if (nargs == 2 && !strcmp(args[1], "on")) {
+    ktrace_enable(true);
+  }
+  else if (nargs == 2 && !strcmp(args[1], "off")) {
+    ktrace_enable(false);
+  }
+  else if (nargs == 2 && !strcmp(args[1], "clear")) {
+    ktrace_clear();
+  }
+  else if (nargs == 3 && !strcmp(args[1], "dump")) {
+    result = ktrace_dump(args[2]);
+    if (result) {
+      kprintf("kt dump: %s\n", strerror(result));
+      return result;
+    }
+  }
+  else {
+    kprintf("Usage: kt [on | off | clear | dump file]\n");
+    return EINVAL;
+  }
+
+  return 0;
+}
+#endif
+
 ////////////////////////////////////////
 //
 // Menus.
@@ -431,6 +546,9 @@ static const char *opsmenu[] = {
   "[cd]      Change directory          ",
   "[pwd]     Print current directory   ",
   "[sync]    Sync filesystems          ",
+#if OPT_SFS
+  "[jcrash]  Panic at next SFS commit  ",
+#endif
   "[panic]   Intentional panic         ",
   "[q]       Quit and shut down        ",
   NULL
@@ -462,6 +580,9 @@ static const char *testmenu[] = {
   "[sy2] Lock test             (1)     ",
   "[sy3] CV test               (1)     ",
   "[sy5] CV test 2             (1)     ",
+  "[sy6] Lock handoff test             ",
+  "[sy7] Spinlock stress test          ",
+  "[sy8] Reader-writer lock test       ",
   "[sp1] Whalematching Driver  (1)     ",
   "[sp2] Stoplight Driver      (1)     ",
   "[fs1] Filesystem test               ",
@@ -493,6 +614,13 @@ static const char *mainmenu[] = {
   "[?o] Operations menu                ",
   "[?t] Tests menu                     ",
   "[kh] Kernel heap stats              ",
+  "[top] CPU time by cpu and thread    ",
+#if OPT_LOCKPROF
+  "[lp] Lock contention profile        ",
+#endif
+#if OPT_KTRACE
+  "[kt] Kernel event trace             ",
+#endif
   "[q] Quit and shut down              ",
   NULL
 };
@@ -533,6 +661,9 @@ static struct {
   { "cd",   cmd_chdir },
   { "pwd",  cmd_pwd },
   { "sync", cmd_sync },
+#if OPT_SFS
+  { "jcrash", cmd_jcrash },
+#endif
   { "panic",  cmd_panic },
   { "q",    cmd_quit },
   { "exit", cmd_quit },
@@ -541,6 +672,13 @@ static struct {
 
   /* stats */
   { "kh",         cmd_kheapstats },
+  { "top",        cmd_top },
+#if OPT_LOCKPROF
+  { "lp",         cmd_lockprof },
+#endif
+#if OPT_KTRACE
+  { "kt",         cmd_ktrace },
+#endif
 
   /* base system tests */
   { "at",   arraytest },
@@ -559,6 +697,9 @@ static struct {
   { "sy2",  locktest },
   { "sy3",  cvtest },
   { "sy5",  cvtest2 },
+  { "sy6",  lockhandofftest },
+  { "sy7",  spinlocktest },
+  { "sy8",  rwlocktest },
 
 #if OPT_SYNCHPROBS
   /* synchronization problem tests */
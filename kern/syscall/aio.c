@@ -0,0 +1,534 @@
+/*
+ * Copyright (c) 2000, 2001, 2002, 2003, 2004, 2005, 2008, 2009
+ *	The President and Fellows of Harvard College.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the University nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE UNIVERSITY AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE UNIVERSITY OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+/*
+ * Asynchronous I/O.
+ *
+ * A process that has set up a ring (see <kern/aio.h>) queues reads
+ * and writes with aio_enter(); a small pool of kernel worker threads
+ * carries them out and posts completions back into the ring. So one
+ * process can have several requests going at once (on different
+ * disks, or a disk and the emulator) while it keeps computing.
+ *
+ * The workers do the I/O straight to and from the process's buffers:
+ * a worker borrows the address space of the request's process for the
+ * duration. That means the address space must outlive every request
+ * using it, which aio_detach() guarantees by draining the context
+ * before exit() or execv() throws the address space away.
+ */
+
+#include <types.h>
+#include <kern/errno.h>
+#include <kern/fcntl.h>
+#include <kern/aio.h>
+#include <lib.h>
+#include <membar.h>
+#include <synch.h>
+#include <thread.h>
+#include <current.h>
+#include <addrspace.h>
+#include <copyinout.h>
+#include <uio.h>
+#include <vnode.h>
+#include <file.h>
+#include <aio.h>
+#include <syscall.h>
+
+/* Number of worker threads, and so of requests in progress at once */
+#define AIO_NWORKERS	4
+
+/*
+ * Per-process state. ac_lock protects everything here, and also
+ * serializes the kernel's updates to the process's ring.
+ */
+struct aioctx {
+	struct lock *ac_lock;
+	struct cv *ac_cv;		/* signalled on each completion */
+	struct addrspace *ac_as;	/* where the ring and buffers are */
+	userptr_t ac_ring;		/* the ring, in ac_as */
+	unsigned ac_nentries;		/* ring size, a power of two */
+	uint32_t ac_sqhead;		/* our copy of ar_sqhead */
+	uint32_t ac_cqtail;		/* our copy of ar_cqtail */
+	unsigned ac_inflight;		/* requests queued or running */
+};
+
+/* One queued request */
+struct aioreq {
+	struct aioreq *ar_next;
+	struct aioctx *ar_ctx;
+	struct vnode *ar_vn;		/* referenced */
+	struct aio_sqe ar_sqe;
+};
+
+/* The work queue, shared by all processes */
+static struct lock *aio_qlock;
+static struct cv *aio_qcv;
+static struct aioreq *aio_qhead, *aio_qtail;
+
+/* User addresses of the pieces of a ring */
+#define RING_FIELD(ctx, f) \
+	((userptr_t)&((struct aio_ring *)(ctx)->ac_ring)->f)
+#define RING_SQE(ctx, i) ((userptr_t)AIO_SQES((ctx)->ac_ring) + \
+	((i) & ((ctx)->ac_nentries - 1)) * sizeof(struct aio_sqe))
+#define RING_CQE(ctx, i) ((userptr_t)AIO_CQES((ctx)->ac_ring, \
+	(ctx)->ac_nentries) + \
+	((i) & ((ctx)->ac_nentries - 1)) * sizeof(struct aio_cqe))
+
+////////////////////////////////////////////////////////////
+// Completions
+
+/*
+ * Post a completion to the ring. Must be called with ac_lock held, in
+ * the address space the ring belongs to. Room for the entry was
+ * reserved at submit time, so this can't overflow.
+ *
+ * The entry is stored before the tail moves, so a process polling
+ * ar_cqtail never sees a half-written completion.
+ */
+static
+void
+aio_post(struct aioctx *ctx, userptr_t data, int32_t result)
+{
+	struct aio_cqe cqe;
+
+	KASSERT(lock_do_i_hold(ctx->ac_lock));
+
+	cqe.cqe_data = data;
+	cqe.cqe_result = result;
+
+	/*
+	 * The ring was checked at setup and user memory doesn't go
+	 * away underneath us, so these can only fail if the process
+	 * has done something strange; it then just loses completions.
+	 */
+	(void)copyout(&cqe, RING_CQE(ctx, ctx->ac_cqtail), sizeof(cqe));
+	membar_store_store();
+	ctx->ac_cqtail++;
+	(void)copyout(&ctx->ac_cqtail, RING_FIELD(ctx, ar_cqtail),
+		      sizeof(uint32_t));
+
+	cv_broadcast(ctx->ac_cv, ctx->ac_lock);
+}
+
+////////////////////////////////////////////////////////////
+// Workers
+
+/*
+ * Carry out one request. Runs in a worker thread that has borrowed
+ * the process's address space.
+ */
+static
+int32_t
+aio_doio(struct aioreq *req)
+{
+	struct iovec iov;
+	struct uio u;
+	int result;
+
+	iov.iov_ubase = req->ar_sqe.sqe_buf;
+	iov.iov_len = req->ar_sqe.sqe_len;
+	u.uio_iov = &iov;
+	u.uio_iovcnt = 1;
+	u.uio_offset = req->ar_sqe.sqe_offset;
+	u.uio_resid = req->ar_sqe.sqe_len;
+	u.uio_segflg = UIO_USERSPACE;
+	u.uio_space = req->ar_ctx->ac_as;
+
+	if (req->ar_sqe.sqe_op == AIO_OP_READ) {
+		u.uio_rw = UIO_READ;
+		result = VOP_READ(req->ar_vn, &u);
+	}
+	else {
+		u.uio_rw = UIO_WRITE;
+		result = VOP_WRITE(req->ar_vn, &u);
+	}
+	if (result) {
+		return -result;
+	}
+	return req->ar_sqe.sqe_len - u.uio_resid;
+}
+
+static
+void
+aio_worker(void *unused1, unsigned long unused2)
+{
+	struct aioreq *req;
+	struct aioctx *ctx;
+	int32_t result;
+
+	(void)unused1;
+	(void)unused2;
+
+	while (1) {
+		lock_acquire(aio_qlock);
+		while (aio_qhead == NULL) {
+			cv_wait(aio_qcv, aio_qlock);
+		}
+		req = aio_qhead;
+		aio_qhead = req->ar_next;
+		if (aio_qhead == NULL) {
+			aio_qtail = NULL;
+		}
+		lock_release(aio_qlock);
+
+		ctx = req->ar_ctx;
+
+		/*
+		 * Borrow the address space. thread_switch reactivates
+		 * t_addrspace, so it stays in effect if we sleep.
+		 */
+		KASSERT(curthread->t_addrspace == NULL);
+		curthread->t_addrspace = ctx->ac_as;
+		as_activate(ctx->ac_as);
+
+		result = aio_doio(req);
+		VOP_DECREF(req->ar_vn);
+
+		lock_acquire(ctx->ac_lock);
+		aio_post(ctx, req->ar_sqe.sqe_data, result);
+		KASSERT(ctx->ac_inflight > 0);
+		ctx->ac_inflight--;
+
+		/*
+		 * Give the address space back before releasing the lock:
+		 * once it's released, aio_detach can return and the
+		 * address space can be destroyed along with ctx.
+		 */
+		curthread->t_addrspace = NULL;
+		as_activate(NULL);
+		lock_release(ctx->ac_lock);
+
+		kfree(req);
+	}
+}
+
+/*
+ * Set up the work queue and start the workers.
+ */
+void
+aio_bootstrap(void)
+{
+	char name[16];
+	int i, result;
+
+	aio_qlock = lock_create("aio queue");
+	aio_qcv = cv_create("aio queue");
+	if (aio_qlock == NULL || aio_qcv == NULL) {
+		panic("aio_bootstrap: out of memory\n");
+	}
+
+	for (i=0; i<AIO_NWORKERS; i++) {
+		snprintf(name, sizeof(name), "aio%d", i);
+		result = thread_fork(name, aio_worker, NULL, 0, NULL);
+		if (result) {
+			panic("aio_bootstrap: thread_fork: %s\n",
+			      strerror(result));
+		}
+	}
+}
+
+////////////////////////////////////////////////////////////
+// Contexts
+
+static
+struct aioctx *
+aioctx_create(userptr_t ring, unsigned nentries)
+{
+	struct aioctx *ctx;
+
+	ctx = kmalloc(sizeof(*ctx));
+	if (ctx == NULL) {
+		return NULL;
+	}
+	ctx->ac_lock = lock_create("aioctx");
+	if (ctx->ac_lock == NULL) {
+		kfree(ctx);
+		return NULL;
+	}
+	ctx->ac_cv = cv_create("aioctx");
+	if (ctx->ac_cv == NULL) {
+		lock_destroy(ctx->ac_lock);
+		kfree(ctx);
+		return NULL;
+	}
+	ctx->ac_as = curthread->t_addrspace;
+	ctx->ac_ring = ring;
+	ctx->ac_nentries = nentries;
+	ctx->ac_sqhead = 0;
+	ctx->ac_cqtail = 0;
+	ctx->ac_inflight = 0;
+	return ctx;
+}
+
+/*
+ * Drop the current process's ring, first waiting for everything it
+ * has in flight. Called on exit and exec, before the address space
+ * goes away, and by aio_setup().
+ */
+void
+aio_detach(void)
+{
+	struct aioctx *ctx = curthread->t_aio;
+
+	if (ctx == NULL) {
+		return;
+	}
+
+	lock_acquire(ctx->ac_lock);
+	while (ctx->ac_inflight > 0) {
+		cv_wait(ctx->ac_cv, ctx->ac_lock);
+	}
+	lock_release(ctx->ac_lock);
+
+	curthread->t_aio = NULL;
+	cv_destroy(ctx->ac_cv);
+	lock_destroy(ctx->ac_lock);
+	kfree(ctx);
+}
+
+////////////////////////////////////////////////////////////
+// System calls
+
+/*
+ * aio_setup: register RING, with NENTRIES entries, as the process's
+ * ring. Any previous ring is drained and dropped first; a null RING
+ * just does that.
+ */
+int
+sys_aio_setup(userptr_t ring, unsigned nentries)
+{
+	struct aio_ring hdr;
+	struct aio_cqe *cqes;
+	struct aioctx *ctx;
+	int result;
+
+	aio_detach();
+
+	if (ring == NULL) {
+		return 0;
+	}
+	if (nentries == 0 || nentries > AIO_MAXENTRIES ||
+	    (nentries & (nentries - 1)) != 0) {
+		return EINVAL;
+	}
+	if ((vaddr_t)ring % sizeof(off_t) != 0) {
+		return EINVAL;
+	}
+
+	/*
+	 * Clear the header and the completion entries. Besides setting
+	 * things up, this checks that both ends of the ring are valid
+	 * writable memory.
+	 */
+	bzero(&hdr, sizeof(hdr));
+	hdr.ar_nentries = nentries;
+	result = copyout(&hdr, ring, sizeof(hdr));
+	if (result) {
+		return result;
+	}
+	cqes = kmalloc(nentries * sizeof(struct aio_cqe));
+	if (cqes == NULL) {
+		return ENOMEM;
+	}
+	bzero(cqes, nentries * sizeof(struct aio_cqe));
+	result = copyout(cqes, (userptr_t)AIO_CQES(ring, nentries),
+			 nentries * sizeof(struct aio_cqe));
+	kfree(cqes);
+	if (result) {
+		return result;
+	}
+
+	ctx = aioctx_create(ring, nentries);
+	if (ctx == NULL) {
+		return ENOMEM;
+	}
+	curthread->t_aio = ctx;
+	return 0;
+}
+
+/*
+ * Check a submission entry and get a reference to the vnode it's
+ * for. Like pread/pwrite, this needs a seekable object.
+ */
+static
+int
+aio_check(const struct aio_sqe *sqe, struct vnode **ret)
+{
+	struct File *file;
+	int accmode;
+
+	if (sqe->sqe_fd < 0 || sqe->sqe_fd >= OPEN_MAX) {
+		return EBADF;
+	}
+	file = curthread->file_desctable[sqe->sqe_fd];
+	if (file == NULL) {
+		return EBADF;
+	}
+
+	accmode = file->flags & O_ACCMODE;
+	switch (sqe->sqe_op) {
+	    case AIO_OP_READ:
+		if (accmode == O_WRONLY) {
+			return EBADF;
+		}
+		break;
+	    case AIO_OP_WRITE:
+		if (accmode == O_RDONLY) {
+			return EBADF;
+		}
+		break;
+	    default:
+		return EINVAL;
+	}
+
+	if (sqe->sqe_reserved != 0 || sqe->sqe_len > 0x7fffffff ||
+	    sqe->sqe_offset < 0) {
+		return EINVAL;
+	}
+	if (VOP_TRYSEEK(file->vn, sqe->sqe_offset)) {
+		return ESPIPE;
+	}
+
+	VOP_INCREF(file->vn);
+	*ret = file->vn;
+	return 0;
+}
+
+/*
+ * aio_enter: take up to TO_SUBMIT entries off the submission queue
+ * and start them, then wait until at least MIN_COMPLETE completions
+ * are waiting to be read (or nothing is left in flight). Returns the
+ * number of entries consumed.
+ *
+ * Entries that fail their checks complete at once with a negative
+ * errno rather than failing the call. Submission also stops early if
+ * the completion queue couldn't hold the result; reaping completions
+ * makes room.
+ */
+int
+sys_aio_enter(unsigned to_submit, unsigned min_complete, int32_t *retval)
+{
+	struct aioctx *ctx = curthread->t_aio;
+	struct aioreq *req;
+	struct aio_sqe sqe;
+	struct vnode *vn;
+	uint32_t sqtail, cqhead;
+	unsigned submitted;
+	int result;
+
+	if (ctx == NULL) {
+		return EINVAL;
+	}
+	if (min_complete > ctx->ac_nentries) {
+		return EINVAL;
+	}
+
+	lock_acquire(ctx->ac_lock);
+
+	result = copyin(RING_FIELD(ctx, ar_sqtail), &sqtail, sizeof(sqtail));
+	if (result) {
+		goto out;
+	}
+	result = copyin(RING_FIELD(ctx, ar_cqhead), &cqhead, sizeof(cqhead));
+	if (result) {
+		goto out;
+	}
+	if (ctx->ac_cqtail - cqhead > ctx->ac_nentries ||
+	    sqtail - ctx->ac_sqhead > ctx->ac_nentries) {
+		/* Process has trashed its ring indexes */
+		result = EINVAL;
+		goto out;
+	}
+
+	for (submitted = 0; submitted < to_submit; submitted++) {
+		if (ctx->ac_sqhead == sqtail) {
+			break;
+		}
+		/* Every request ends up with a completion entry */
+		if (ctx->ac_inflight + (ctx->ac_cqtail - cqhead)
+		    >= ctx->ac_nentries) {
+			break;
+		}
+
+		result = copyin(RING_SQE(ctx, ctx->ac_sqhead),
+				&sqe, sizeof(sqe));
+		if (result) {
+			break;
+		}
+		ctx->ac_sqhead++;
+
+		result = aio_check(&sqe, &vn);
+		if (result == 0) {
+			req = kmalloc(sizeof(*req));
+			if (req == NULL) {
+				VOP_DECREF(vn);
+				result = ENOMEM;
+			}
+		}
+		if (result) {
+			aio_post(ctx, sqe.sqe_data, -result);
+			result = 0;
+			continue;
+		}
+
+		req->ar_next = NULL;
+		req->ar_ctx = ctx;
+		req->ar_vn = vn;
+		req->ar_sqe = sqe;
+		ctx->ac_inflight++;
+
+		lock_acquire(aio_qlock);
+		if (aio_qtail == NULL) {
+			aio_qhead = req;
+		}
+		else {
+			aio_qtail->ar_next = req;
+		}
+		aio_qtail = req;
+		cv_signal(aio_qcv, aio_qlock);
+		lock_release(aio_qlock);
+	}
+
+	(void)copyout(&ctx->ac_sqhead, RING_FIELD(ctx, ar_sqhead),
+		      sizeof(uint32_t));
+	if (result && submitted == 0) {
+		goto out;
+	}
+
+	while (ctx->ac_cqtail - cqhead < min_complete &&
+	       ctx->ac_inflight > 0) {
+		cv_wait(ctx->ac_cv, ctx->ac_lock);
+	}
+
+	*retval = submitted;
+	result = 0;
+ out:
+	lock_release(ctx->ac_lock);
+	return result;
+}
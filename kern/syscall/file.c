@@ -146,9 +146,10 @@ int sys_open(const char *filename, int flags, int mode, int32_t *retval) {
 int sys_close(int fd) {
 
   struct File *temp_file;
+  bool last;
   int errno;
 
-  if (fd < 0 || fd > OPEN_MAX) {
+  if (fd < 0 || fd >= OPEN_MAX) {
     errno = EBADF;
     return -1;
   }
@@ -159,144 +160,452 @@ int sys_close(int fd) {
     return -1;
   }
 
-  if(curthread->file_desctable[fd]->ref_count == 1) {
-    VOP_CLOSE(curthread->file_desctable[fd]->vn);
-    temp_file = curthread->file_desctable[fd];
-    curthread->file_desctable[fd] = NULL;
+  // The slot is ours alone; the File may be shared with other
+  // processes (fork) or other slots (dup2), so only the last
+  // reference actually closes it.
+  temp_file = curthread->file_desctable[fd];
+  curthread->file_desctable[fd] = NULL;
+
+  lock_acquire(temp_file->lock);
+  temp_file->ref_count--;
+  last = (temp_file->ref_count == 0);
+  lock_release(temp_file->lock);
+
+  if (last) {
+    // vfs_close, not VOP_CLOSE, so the vnode's open count and
+    // reference go away too (pipes rely on that to see EOF).
+    vfs_close(temp_file->vn);
     lock_destroy(temp_file->lock);
     kfree(temp_file);
   }
-  else {
-    curthread->file_desctable[fd]->ref_count--;
-  }
 
   return 0;
 }
 
-int sys_read(int fd, void *buf, size_t buflen, int32_t *retval) {
+// Close every descriptor the current thread has open. Called on the
+// way out of sys__exit and thread_exit, so a process that never
+// closes its end of a pipe still lets the other end see EOF.
+void file_closeall(void) {
 
-  struct uio *read_uio;
-  struct iovec *read_iovec;
-  char *k_buf;
-  int errno;
+  int fd;
 
-  if (fd < 0 || fd > OPEN_MAX) {
-    errno = EBADF;
-    return -1;
+  for (fd = 0; fd < OPEN_MAX; fd++) {
+    if (curthread->file_desctable[fd] != NULL) {
+      sys_close(fd);
+    }
   }
+}
 
-  // Read from the console. Open everytime.
-  if (fd == 0)
-    sys_open("con:", O_RDONLY, 0664, &fd);
+/*
+ * Common code for read, write, pread, pwrite, readv and writev. These
+ * return the error code itself (0 on success), which syscall() hands
+ * back to the user as errno.
+ *
+ * The user's buffers go straight into one uio (UIO_USERSPACE), so
+ * data moves once, between the file system and the user's memory,
+ * and a whole vector is handed over in a single VOP call. Bad
+ * pointers come back as EFAULT from uiomove.
+ *
+ * Positional calls use pos and leave the File's offset alone, so they
+ * don't take the File lock at all - several threads or processes
+ * sharing a descriptor can have reads in flight at once.
+ */
+static int file_uio(int fd, struct iovec *iov, int iovcnt, bool positional,
+                    off_t pos, enum uio_rw rw, int32_t *retval) {
+
+  struct File *file;
+  struct uio u;
+  size_t total;
+  int i, console, result;
+
+  if (fd < 0 || fd >= OPEN_MAX)
+    return EBADF;
+
+  // The console is opened per call when nothing else is on 0-2.
+  console = 0;
+  if (curthread->file_desctable[fd] == NULL && fd <= 2) {
+    if (positional)
+      return ESPIPE;
+    if (fd == 0)
+      sys_open("con:", O_RDONLY, 0664, &fd);
+    else if (fd == 1)
+      sys_open("con:", O_WRONLY, 0664, &fd);
+    else
+      sys_open("con:", O_WRONLY, 0665, &fd);
+    console = 1;
+  }
 
-  // Check if the normal file was opened before
-  if (curthread->file_desctable[fd] == NULL) {
-    errno = EBADF;
-    return -1;
+  file = curthread->file_desctable[fd];
+  if (file == NULL)
+    return EBADF;
+
+  if ((rw == UIO_READ && (file->flags & O_ACCMODE) == O_WRONLY) ||
+      (rw == UIO_WRITE && (file->flags & O_ACCMODE) == O_RDONLY)) {
+    result = EBADF;
+    goto out;
   }
 
-  // Check for valid flags
-  if (curthread->file_desctable[fd]->flags == O_WRONLY) {
-    errno = EBADF;
-    return -1;
+  // The total has to fit in the ssize_t we return.
+  total = 0;
+  for (i = 0; i < iovcnt; i++) {
+    if (iov[i].iov_len > (size_t)0x7fffffff - total) {
+      result = EINVAL;
+      goto out;
+    }
+    total += iov[i].iov_len;
   }
 
-  lock_acquire(curthread->file_desctable[fd]->lock);
+  u.uio_iov = iov;
+  u.uio_iovcnt = iovcnt;
+  u.uio_resid = total;
+  u.uio_segflg = UIO_USERSPACE;
+  u.uio_rw = rw;
+  u.uio_space = curthread->t_addrspace;
 
-  read_uio = (struct uio *)kmalloc(sizeof(struct uio));
-  read_iovec = (struct iovec *)kmalloc(sizeof(struct iovec));
+  if (positional) {
+    if (pos < 0) {
+      result = EINVAL;
+      goto out;
+    }
+    // Devices that can't seek can't do positional I/O either.
+    if (VOP_TRYSEEK(file->vn, pos)) {
+      result = ESPIPE;
+      goto out;
+    }
+    u.uio_offset = pos;
+  }
+  else {
+    lock_acquire(file->lock);
+    u.uio_offset = file->offset;
+  }
 
-  k_buf = (char *)kmalloc(buflen * sizeof(char));
+  if (rw == UIO_READ)
+    result = VOP_READ(file->vn, &u);
+  else
+    result = VOP_WRITE(file->vn, &u);
 
-  uio_kinit(read_iovec, read_uio, (void *)k_buf, buflen, curthread->file_desctable[fd]->offset, UIO_READ);
+  if (!positional) {
+    file->offset = u.uio_offset;
+    lock_release(file->lock);
+  }
 
-  if(VOP_READ(curthread->file_desctable[fd]->vn, read_uio))
-    return -1;
+  *retval = total - u.uio_resid;
 
-  *retval = buflen - read_uio->uio_resid;
+ out:
+  if (console)
+    sys_close(fd);
 
-  //curthread->file_desctable[fd]->offset += *retval;
-  curthread->file_desctable[fd]->offset = read_uio->uio_offset;
+  return result;
+}
 
-  // This is not needed.
-  /*if(VOP_STAT(curthread->file_desctable[fd]->vn, &file_stat))
-    return -1;
-  if (curthread->file_desctable[fd]->offset == file_stat.st_size)
-    *retval = 0;*/
+int sys_read(int fd, void *buf, size_t buflen, int32_t *retval) {
 
-  lock_release(curthread->file_desctable[fd]->lock);
+  struct iovec iov;
 
-  if (fd == 0)
-    sys_close(fd);
+  iov.iov_ubase = (userptr_t)buf;
+  iov.iov_len = buflen;
 
-  if(copyout((const void *)k_buf, (void *)buf, buflen))
-    return -1;
+  return file_uio(fd, &iov, 1, false, 0, UIO_READ, retval);
+}
 
-  kfree(k_buf);
-  kfree(read_uio);
-  kfree(read_iovec);
+int sys_write(int fd, const void *buf, size_t nbytes, int32_t *retval) {
 
-  return 0;
+  struct iovec iov;
+
+  iov.iov_ubase = (userptr_t)buf;
+  iov.iov_len = nbytes;
+
+  return file_uio(fd, &iov, 1, false, 0, UIO_WRITE, retval);
 }
 
-int sys_write(int fd, const void *buf, size_t nbytes, int32_t *retval) {
+int sys_pread(int fd, void *buf, size_t nbytes, off_t pos, int32_t *retval) {
 
-  struct uio *write_uio;
-  struct iovec *write_iovec;
-  char *k_buf;
-  int errno;
+  struct iovec iov;
 
-  if (fd < 0 || fd > OPEN_MAX) {
-    errno = EBADF;
-    return -1;
-  }
+  iov.iov_ubase = (userptr_t)buf;
+  iov.iov_len = nbytes;
 
-  if (fd == 1) {
-    sys_open("con:", O_WRONLY, 0664, &fd);
-  }
-  else if (fd == 2) {
-    sys_open("con:", O_WRONLY, 0665, &fd);
+  return file_uio(fd, &iov, 1, true, pos, UIO_READ, retval);
+}
+
+int sys_pwrite(int fd, const void *buf, size_t nbytes, off_t pos, int32_t *retval) {
+
+  struct iovec iov;
+
+  iov.iov_ubase = (userptr_t)buf;
+  iov.iov_len = nbytes;
+
+  return file_uio(fd, &iov, 1, true, pos, UIO_WRITE, retval);
+}
+
+// Copy in the user's iovec array and do the whole vector as one uio.
+static int file_vector(int fd, const struct iovec *user_iov, int iovcnt,
+                       enum uio_rw rw, int32_t *retval) {
+
+  struct iovec *k_iov;
+  int result;
+
+  if (iovcnt <= 0 || iovcnt > IOV_MAX)
+    return EINVAL;
+
+  k_iov = kmalloc(iovcnt * sizeof(struct iovec));
+  if (k_iov == NULL)
+    return ENOMEM;
+
+  result = copyin((const_userptr_t)user_iov, k_iov, iovcnt * sizeof(struct iovec));
+  if (result) {
+    kfree(k_iov);
+    return result;
   }
 
-  if (curthread->file_desctable[fd] == NULL) {
-    errno = EBADF;
-    return -1;
+  result = file_uio(fd, k_iov, iovcnt, false, 0, rw, retval);
+
+  kfree(k_iov);
+  return result;
+}
+
+int sys_readv(int fd, const struct iovec *iov, int iovcnt, int32_t *retval) {
+  return file_vector(fd, iov, iovcnt, UIO_READ, retval);
+}
+
+int sys_writev(int fd, const struct iovec *iov, int iovcnt, int32_t *retval) {
+  return file_vector(fd, iov, iovcnt, UIO_WRITE, retval);
+}
+
+// getdirentry and getdirentries differ only in the vnode op; the offset
+// is a position the filesystem picks, not a byte count, so it's stored
+// back as-is.
+static int file_dirread(int fd, void *buf, size_t buflen, bool batched,
+                        int32_t *retval) {
+
+  struct File *file;
+  struct iovec iov;
+  struct uio u;
+  int result;
+
+  if (fd < 0 || fd >= OPEN_MAX)
+    return EBADF;
+
+  file = curthread->file_desctable[fd];
+  if (file == NULL)
+    return EBADF;
+
+  if ((file->flags & O_ACCMODE) == O_WRONLY)
+    return EBADF;
+
+  if (buflen > 0x7fffffff)
+    return EINVAL;
+
+  iov.iov_ubase = (userptr_t)buf;
+  iov.iov_len = buflen;
+  u.uio_iov = &iov;
+  u.uio_iovcnt = 1;
+  u.uio_resid = buflen;
+  u.uio_segflg = UIO_USERSPACE;
+  u.uio_rw = UIO_READ;
+  u.uio_space = curthread->t_addrspace;
+
+  lock_acquire(file->lock);
+  u.uio_offset = file->offset;
+
+  if (batched)
+    result = VOP_GETDIRENTRIES(file->vn, &u);
+  else
+    result = VOP_GETDIRENTRY(file->vn, &u);
+
+  if (!result) {
+    file->offset = u.uio_offset;
+    *retval = buflen - u.uio_resid;
   }
+  lock_release(file->lock);
 
-  if (curthread->file_desctable[fd]->flags == O_RDONLY) {
-    errno = EBADF;
-    return -1;
+  return result;
+}
+
+int sys_getdirentry(int fd, char *buf, size_t buflen, int32_t *retval) {
+  return file_dirread(fd, buf, buflen, false, retval);
+}
+
+// Packs as many struct dirent records into buf as fit.
+int sys_getdirentries(int fd, char *buf, size_t buflen, int32_t *retval) {
+  return file_dirread(fd, buf, buflen, true, retval);
+}
+
+// Size of the kernel buffer copy_file_range moves data through.
+#define COPY_CHUNK (4 * PAGE_SIZE)
+
+// Copy up to len bytes from infd to outfd, starting at and advancing
+// both Files' offsets, without the data ever going out to userspace.
+// Returns the number of bytes copied, which is short only at EOF or
+// if an error happens partway (the error is then dropped, as with a
+// short write).
+int sys_copy_file_range(int infd, int outfd, size_t len, unsigned flags,
+                        int32_t *retval) {
+
+  struct File *in, *out, *first, *second;
+  struct iovec iov;
+  struct uio u;
+  char *buf;
+  size_t copied, chunk, got, put, n;
+  int result;
+
+  if (infd < 0 || infd >= OPEN_MAX || outfd < 0 || outfd >= OPEN_MAX)
+    return EBADF;
+
+  in = curthread->file_desctable[infd];
+  out = curthread->file_desctable[outfd];
+  if (in == NULL || out == NULL)
+    return EBADF;
+
+  if ((in->flags & O_ACCMODE) == O_WRONLY ||
+      (out->flags & O_ACCMODE) == O_RDONLY)
+    return EBADF;
+
+  // Copying a file onto itself would need overlap handling; don't.
+  if (flags != 0 || in->vn == out->vn)
+    return EINVAL;
+
+  if (len > 0x7fffffff)
+    len = 0x7fffffff;
+
+  buf = kmalloc(COPY_CHUNK);
+  if (buf == NULL)
+    return ENOMEM;
+
+  // Always take the two File locks in the same order.
+  first = in < out ? in : out;
+  second = in < out ? out : in;
+  lock_acquire(first->lock);
+  lock_acquire(second->lock);
+
+  result = 0;
+  copied = 0;
+  while (copied < len) {
+    chunk = len - copied < COPY_CHUNK ? len - copied : COPY_CHUNK;
+
+    uio_kinit(&iov, &u, buf, chunk, in->offset, UIO_READ);
+    result = VOP_READ(in->vn, &u);
+    if (result)
+      break;
+    got = chunk - u.uio_resid;
+    if (got == 0)
+      break;
+
+    // Writes can come up short too; keep going until it's all out.
+    put = 0;
+    while (put < got) {
+      uio_kinit(&iov, &u, buf + put, got - put, out->offset, UIO_WRITE);
+      result = VOP_WRITE(out->vn, &u);
+      n = (got - put) - u.uio_resid;
+      put += n;
+      out->offset = u.uio_offset;
+      if (result || n == 0)
+        break;
+    }
+
+    // Only what made it out counts as read.
+    in->offset += put;
+    copied += put;
+    if (result || put < got)
+      break;
   }
 
-  lock_acquire(curthread->file_desctable[fd]->lock);
+  lock_release(second->lock);
+  lock_release(first->lock);
+  kfree(buf);
 
-  k_buf = (char *)kmalloc(nbytes * sizeof(char));
+  if (result && copied == 0)
+    return result;
 
-  //copyinstr((const_userptr_t)buf, k_buf, nbytes, &length); Does not work.
-  copyin((const_userptr_t)buf, k_buf, nbytes);
+  *retval = copied;
+  return 0;
+}
 
-  write_uio = (struct uio *)kmalloc(sizeof(struct uio));
+int sys_fstat(int fd, struct stat *statbuf) {
 
-  write_iovec = (struct iovec *)kmalloc(sizeof(struct iovec));
+  struct File *file;
+  struct stat st;
+  int result;
 
-  // offset was zero before.
-  uio_kinit(write_iovec, write_uio, (void *)k_buf, nbytes, curthread->file_desctable[fd]->offset, UIO_WRITE);
+  if (fd < 0 || fd >= OPEN_MAX)
+    return EBADF;
 
-  if(VOP_WRITE(curthread->file_desctable[fd]->vn, write_uio))
-    return -1;
+  file = curthread->file_desctable[fd];
+  if (file == NULL)
+    return EBADF;
 
-  *retval = nbytes - write_uio->uio_resid;
+  result = VOP_STAT(file->vn, &st);
+  if (result)
+    return result;
 
-  curthread->file_desctable[fd]->offset = write_uio->uio_offset;
+  return copyout(&st, (userptr_t)statbuf, sizeof(st));
+}
 
-  lock_release(curthread->file_desctable[fd]->lock);
+// Hand out a File for one end of a pipe.
+static int pipe_file(struct vnode *vn, int flags, int *ret) {
+
+  struct File *file;
+  int fd;
+
+  fd = 3;
+  while (fd < OPEN_MAX && curthread->file_desctable[fd] != NULL)
+    fd++;
+  if (fd == OPEN_MAX)
+    return EMFILE;
+
+  file = kmalloc(sizeof(struct File));
+  if (file == NULL)
+    return ENOMEM;
+  file->lock = lock_create("File Lock");
+  if (file->lock == NULL) {
+    kfree(file);
+    return ENOMEM;
+  }
+  file->name = NULL;
+  file->flags = flags;
+  file->offset = 0;
+  file->ref_count = 1;
+  file->vn = vn;
+
+  curthread->file_desctable[fd] = file;
+  *ret = fd;
+  return 0;
+}
 
-  if (fd == 1 || fd == 2)
-    sys_close(fd);
+/*
+ * Make a pipe and put its read and write ends in the file table.
+ * Like the calls above it returns the error code itself.
+ */
+int sys_pipe(int *fds) {
+
+  struct vnode *rd, *wr;
+  int k_fds[2];
+  int result;
+
+  result = vfs_pipe(&rd, &wr);
+  if (result)
+    return result;
 
-  kfree(k_buf);
-  kfree(write_uio);
-  kfree(write_iovec);
+  result = pipe_file(rd, O_RDONLY, &k_fds[0]);
+  if (result) {
+    vfs_close(rd);
+    vfs_close(wr);
+    return result;
+  }
+
+  result = pipe_file(wr, O_WRONLY, &k_fds[1]);
+  if (result) {
+    sys_close(k_fds[0]);
+    vfs_close(wr);
+    return result;
+  }
+
+  result = copyout(k_fds, (userptr_t)fds, sizeof(k_fds));
+  if (result) {
+    sys_close(k_fds[0]);
+    sys_close(k_fds[1]);
+    return result;
+  }
 
   return 0;
 }
@@ -322,7 +631,9 @@ int sys_dup2(int oldfd, int newfd) {
   }
 
   curthread->file_desctable[newfd] = curthread->file_desctable[oldfd];
+  lock_acquire(curthread->file_desctable[newfd]->lock);
   curthread->file_desctable[newfd]->ref_count++;
+  lock_release(curthread->file_desctable[newfd]->lock);
 
   //lock_release(&curthread->file_desctable[oldfd]->lock);
 
@@ -355,6 +666,62 @@ int sys_chdir(const_userptr_t *pathname) {
   return 0;
 }
 
+// Copy a user pathname into a new kernel buffer, which the caller
+// frees. vfs_* may scribble on the path, so each call needs its own.
+static int file_copyinpath(const_userptr_t upath, char **ret) {
+
+  char *path;
+  int result;
+
+  path = kmalloc(PATH_MAX);
+  if (path == NULL) {
+    return ENOMEM;
+  }
+  result = copyinstr(upath, path, PATH_MAX, NULL);
+  if (result) {
+    kfree(path);
+    return result;
+  }
+  *ret = path;
+  return 0;
+}
+
+int sys_remove(const_userptr_t pathname) {
+
+  char *path;
+  int result;
+
+  result = file_copyinpath(pathname, &path);
+  if (result) {
+    return result;
+  }
+  result = vfs_remove(path);
+  kfree(path);
+  return result;
+}
+
+// mv relies on getting EXDEV back for a rename across filesystems,
+// so it can fall back to copying; vfs_rename already returns that.
+int sys_rename(const_userptr_t oldpath, const_userptr_t newpath) {
+
+  char *from, *to;
+  int result;
+
+  result = file_copyinpath(oldpath, &from);
+  if (result) {
+    return result;
+  }
+  result = file_copyinpath(newpath, &to);
+  if (result) {
+    kfree(from);
+    return result;
+  }
+  result = vfs_rename(from, to);
+  kfree(from);
+  kfree(to);
+  return result;
+}
+
 int sys__getcwd(char *buf, size_t buflen) {
 
   char *k_buf;
@@ -26,26 +26,48 @@
 #include <synch.h>
 #include <kern/wait.h>
 #include <syscall.h>
+#include <aio.h>
 
 #define ARGSIZE 20
 
 // System processes.
 static struct Proc * process_table[PID_MAX];
 
+// Lookups are read-locked, so they can go on in parallel. assign_pid
+// and free_this_pid write-lock.
+static struct rwlock *proctable_lock;
+
 // Zombie table. Double tap to be sure. Bad idea.
 //static struct thread * zombie_table[PID_MAX];
 
+void proc_bootstrap(void) {
+
+  proctable_lock = rwlock_create("Process table");
+  if (proctable_lock == NULL) {
+    panic("proc_bootstrap: Could not create process table lock\n");
+  }
+}
+
 int assign_pid(struct thread *new_thread) {
 
   pid_t pid;
   int errno;
   struct Proc *entry;
 
+  // The boot thread gets here before proc_bootstrap, when there's
+  // nobody else around and no curthread to hold a lock.
+  if (proctable_lock != NULL) {
+    rwlock_acquire_write(proctable_lock);
+  }
+
   pid = PID_MIN;
-  while (process_table[pid] != NULL)
+  while (pid < PID_MAX && process_table[pid] != NULL)
     pid++;
 
   if (pid == PID_MAX) {
+    if (proctable_lock != NULL) {
+      rwlock_release_write(proctable_lock);
+    }
     errno = ENPROC;
     return -1;
   }
@@ -63,17 +85,20 @@ int assign_pid(struct thread *new_thread) {
 
   process_table[pid] = entry;
 
+  if (proctable_lock != NULL) {
+    rwlock_release_write(proctable_lock);
+  }
+
   return pid;
 }
 
 void free_this_pid(pid_t pid) {
 
   struct Proc *proc;
-  int a;
 
-  a = splhigh();
+  rwlock_acquire_write(proctable_lock);
 
-  proc = get_process_by_pid(pid);
+  proc = process_table[pid];
 
   if (proc != NULL) {
     sem_destroy(proc->exit);
@@ -81,15 +106,82 @@ void free_this_pid(pid_t pid) {
     process_table[pid] = NULL;
   }
 
-  splx(a);
+  rwlock_release_write(proctable_lock);
 }
 
 struct Proc * get_process_by_pid(pid_t pid) {
-    return process_table[pid];
+
+  struct Proc *proc;
+
+  rwlock_acquire_read(proctable_lock);
+  proc = process_table[pid];
+  rwlock_release_read(proctable_lock);
+
+  return proc;
+}
+
+// Called from thread_exit. Hands the thread's CPU time (and its
+// children's) to its parent for getrusage(RUSAGE_CHILDREN), and
+// clears the table's pointer to it, which is about to dangle.
+void proc_thread_exit(struct thread *t) {
+
+  struct Proc *proc, *parentp;
+
+  if (t->pid < PID_MIN || t->pid >= PID_MAX) {
+    return;
+  }
+
+  rwlock_acquire_write(proctable_lock);
+
+  proc = process_table[t->pid];
+  if (proc != NULL && proc->self == t) {
+    proc->self = NULL;
+  }
+
+  if (t->ppid >= PID_MIN && t->ppid < PID_MAX) {
+    parentp = process_table[t->ppid];
+    if (parentp != NULL && parentp->self != NULL) {
+      cputime_add(&parentp->self->t_childtime, &t->t_cputime);
+      cputime_add(&parentp->self->t_childtime, &t->t_childtime);
+    }
+  }
+
+  rwlock_release_write(proctable_lock);
+}
+
+// Our exited children's CPU time. Children add to it as they exit,
+// under the table lock, so copy it out under the lock too.
+void proc_childtime(struct cputime *ct) {
+
+  rwlock_acquire_read(proctable_lock);
+  *ct = curthread->t_childtime;
+  rwlock_release_read(proctable_lock);
 }
 
-struct thread * get_thread_by_pid(pid_t pid) {
-  return process_table[pid]->self;
+// Per-thread CPU time, for the "top" menu command. Other threads'
+// figures are read on the fly and may be a little behind.
+void proc_printtimes(void) {
+
+  struct thread *t;
+  struct cputime ct;
+  pid_t pid;
+
+  kprintf("  pid     user      sys     intr     vcsw    ivcsw  name\n");
+
+  rwlock_acquire_read(proctable_lock);
+  for (pid = PID_MIN; pid < PID_MAX; pid++) {
+    if (process_table[pid] == NULL || process_table[pid]->self == NULL)
+      continue;
+
+    t = process_table[pid]->self;
+    ct = t->t_cputime;
+    kprintf("%5d %8llu %8llu %8llu %8u %8u  %s\n", pid,
+            ct.ct_ns[CPUTIME_USER] / 1000000,
+            ct.ct_ns[CPUTIME_SYS] / 1000000,
+            ct.ct_ns[CPUTIME_INTR] / 1000000,
+            ct.ct_vcsw, ct.ct_ivcsw, t->t_name);
+  }
+  rwlock_release_read(proctable_lock);
 }
 
 void child_fork_entry(void *data1, unsigned long data2) {
@@ -126,84 +218,95 @@ pid_t sys_getpid() {
 int sys_fork(struct trapframe *tf, pid_t *retval) {
 
   struct addrspace *new_addrspace;
-  int result, errno, i, a;
+  int result, errno, i;
   struct trapframe *new_tf;
   struct thread *child;
+  struct File *file;
 
-  a = splhigh();
-
-  //new_addrspace = kmalloc(sizeof(struct addrspace));
   if((result = as_copy(curthread->t_addrspace, &new_addrspace))) {
     errno = ENOMEM;
-    splx(a);
     return result;
   }
 
   new_tf = kmalloc(sizeof(struct trapframe));
+  if (new_tf == NULL) {
+    as_destroy(new_addrspace);
+    return ENOMEM;
+  }
   *new_tf = *tf;
 
-  splx(a);
-  if((result = thread_fork("child", child_fork_entry, (struct trapframe *)new_tf, (unsigned long)new_addrspace, &child))) {
+  // Build the child but don't let it run until it's a whole process:
+  // once it's runnable another cpu can pick it up straight away.
+  if((result = thread_prepare("child", child_fork_entry, (struct trapframe *)new_tf, (unsigned long)new_addrspace, &child))) {
+    kfree(new_tf);
+    as_destroy(new_addrspace);
     return result;
   }
-  a = splhigh();
 
-  i = 3;
-  // Increase the reference count.
-  while (curthread->file_desctable[i] != NULL) {
-    curthread->file_desctable[i]->ref_count += 1;
-    child->file_desctable[i] = curthread->file_desctable[i];
+  // thread_create took a pid for it; no pid means a full table.
+  if (child->pid < PID_MIN) {
+    thread_discard(child);
+    kfree(new_tf);
+    as_destroy(new_addrspace);
+    return ENPROC;
   }
 
-  child->ppid = curthread->pid;
+  // Share every open File with the child and increase the
+  // reference count. (Pipes are no use unless the ends survive fork.)
+  for (i = 0; i < OPEN_MAX; i++) {
+    file = curthread->file_desctable[i];
+    if (file != NULL) {
+      lock_acquire(file->lock);
+      file->ref_count += 1;
+      lock_release(file->lock);
+      child->file_desctable[i] = file;
+    }
+  }
 
-  assign_pid(child);
+  // Make it our child in the table before it can exit or be waited on.
+  child->ppid = curthread->pid;
+  rwlock_acquire_write(proctable_lock);
+  process_table[child->pid]->ppid = curthread->pid;
+  rwlock_release_write(proctable_lock);
 
   *retval = child->pid;
 
-  splx(a);
+  thread_start(child);
 
   return 0;
 }
 
 int sys_waitpid(pid_t pid, int *status, int options, int *retval) {
 
-  int errno, a;
+  int errno;
   struct Proc *childp;
 
-  a = splhigh();
-
   if (options != 0) {
     errno = EINVAL;
-    splx(a);
     return -1;
   }
 
   // Waiting for yourself.
   if (pid == curthread->pid) {
     errno = ECHILD;
-    splx(a);
     return -1;
   }
 
   childp = get_process_by_pid(pid);
   if (childp == NULL) {
     errno = ESRCH;
-    splx(a);
     return -1;
   }
 
   // Check that we are not waiting on a parent
   if (childp->pid == curthread->ppid) {
     errno = ECHILD;
-    splx(a);
     return -1;
   }
 
   // Check that the parent is waiting on the child
   if (childp->ppid != curthread->pid) {
     errno = ECHILD;
-    splx(a);
     return -1;
   }
 
@@ -218,17 +321,16 @@ int sys_waitpid(pid_t pid, int *status, int options, int *retval) {
 
   free_this_pid(pid);
 
-  splx(a);
-
   return 0;
 }
 
 void sys__exit(int exitcode) {
 
   struct Proc *childp, *parentp;
-  int a;
 
-  a = splhigh();
+  // Close our files before the parent hears we're gone, so when
+  // waitpid returns, any pipe we were writing has seen EOF.
+  file_closeall();
 
   if (curthread->ppid >= 2) {
 
@@ -255,8 +357,6 @@ void sys__exit(int exitcode) {
     }
   }
 
-  splx(a);
-
   thread_exit();
 }
 
@@ -312,6 +412,9 @@ int sys_execv(const char *program, char **args) {
     return result;
   }
 
+  // Async I/O in flight still points into the old addrspace.
+  aio_detach();
+
   // Prepare addrspace.
   //KASSERT(curthread->t_addrspace == NULL);
   struct addrspace *tempaddr;
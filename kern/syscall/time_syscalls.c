@@ -28,7 +28,15 @@
  */
 
 #include <types.h>
+#include <kern/errno.h>
+#include <kern/time.h>
+#include <kern/resource.h>
+#include <lib.h>
+#include <spl.h>
 #include <clock.h>
+#include <cputime.h>
+#include <thread.h>
+#include <current.h>
 #include <copyinout.h>
 #include <syscall.h>
 
@@ -56,3 +64,82 @@ sys___time(userptr_t user_seconds_ptr, userptr_t user_nanoseconds_ptr)
 
 	return 0;
 }
+
+/*
+ * Sleep for the time in USER_REQ, to the next hardclock or so. Nothing
+ * can interrupt the sleep, so if USER_REM is given it gets zero.
+ */
+int
+sys_nanosleep(const_userptr_t user_req, userptr_t user_rem)
+{
+	struct timespec req, rem;
+	int result;
+
+	result = copyin(user_req, &req, sizeof(req));
+	if (result) {
+		return result;
+	}
+	if (req.tv_sec < 0 || req.tv_nsec < 0 || req.tv_nsec >= 1000000000) {
+		return EINVAL;
+	}
+
+	clock_sleepns(req.tv_sec, req.tv_nsec);
+
+	if (user_rem != NULL) {
+		rem.tv_sec = 0;
+		rem.tv_nsec = 0;
+		result = copyout(&rem, user_rem, sizeof(rem));
+		if (result) {
+			return result;
+		}
+	}
+	return 0;
+}
+
+/*
+ * Convert nanoseconds to a struct timeval.
+ */
+static
+void
+ns_to_timeval(uint64_t ns, struct timeval *tv)
+{
+	tv->tv_sec = ns / 1000000000;
+	tv->tv_usec = (ns % 1000000000) / 1000;
+}
+
+/*
+ * getrusage: CPU time and context switches for the current thread
+ * (which is the whole process here) or its exited children. Time in
+ * interrupts counts as system time; the other fields are zero.
+ */
+int
+sys_getrusage(int who, userptr_t user_usage)
+{
+	struct rusage ru;
+	struct cputime ct;
+	int spl;
+
+	switch (who) {
+	    case RUSAGE_SELF:
+		/* Bring our own figures up to now. */
+		spl = splhigh();
+		cputime_switch(CPUTIME_SYS);
+		ct = curthread->t_cputime;
+		splx(spl);
+		break;
+	    case RUSAGE_CHILDREN:
+		proc_childtime(&ct);
+		break;
+	    default:
+		return EINVAL;
+	}
+
+	bzero(&ru, sizeof(ru));
+	ns_to_timeval(ct.ct_ns[CPUTIME_USER], &ru.ru_utime);
+	ns_to_timeval(ct.ct_ns[CPUTIME_SYS] + ct.ct_ns[CPUTIME_INTR],
+		      &ru.ru_stime);
+	ru.ru_nvcsw = ct.ct_vcsw;
+	ru.ru_nivcsw = ct.ct_ivcsw;
+
+	return copyout(&ru, user_usage, sizeof(ru));
+}
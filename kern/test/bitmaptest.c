@@ -40,7 +40,7 @@ bitmaptest(int nargs, char **args)
 	struct bitmap *b;
 	char data[TESTSIZE];
 	uint32_t x;
-	int i;
+	int i, j, k;
 
 	(void)nargs;
 	(void)args;
@@ -89,6 +89,39 @@ bitmaptest(int nargs, char **args)
 		}
 	}
 
+	/*
+	 * bitmap_alloc_near should find the first clear bit at or
+	 * after the goal, wrapping around. Put each one back after.
+	 */
+	for (i=0; i<TESTSIZE; i+=37) {
+		for (j=i; j<TESTSIZE && !data[j]; j++);
+		if (j == TESTSIZE) {
+			for (j=0; j<i && !data[j]; j++);
+		}
+		if (bitmap_alloc_near(b, i, &x)==0) {
+			KASSERT(x == (uint32_t)j);
+			KASSERT(data[x]==1);
+			bitmap_unmark(b, x);
+		}
+	}
+
+	/*
+	 * bitmap_alloc_range should find the first clear bit in the
+	 * range, or nothing. Put each one back after.
+	 */
+	for (i=0; i<TESTSIZE; i+=37) {
+		k = i + 100 < TESTSIZE ? i + 100 : TESTSIZE;
+		for (j=i; j<k && !data[j]; j++);
+		if (bitmap_alloc_range(b, i, k, &x)==0) {
+			KASSERT(x == (uint32_t)j);
+			KASSERT(data[x]==1);
+			bitmap_unmark(b, x);
+		}
+		else {
+			KASSERT(j == k);
+		}
+	}
+
 	while (bitmap_alloc(b, &x)==0) {
 		KASSERT(x < TESTSIZE);
 		KASSERT(bitmap_isset(b, x));
@@ -34,6 +34,7 @@
 #include <types.h>
 #include <lib.h>
 #include <clock.h>
+#include <spinlock.h>
 #include <thread.h>
 #include <synch.h>
 #include <test.h>
@@ -41,6 +42,7 @@
 #define NSEMLOOPS     63
 #define NLOCKLOOPS    120
 #define NCVLOOPS      5
+#define NSPINLOOPS    200
 #define NTHREADS      32
 
 static volatile unsigned long testval1;
@@ -357,3 +359,405 @@ cvtest2(int nargs, char **args)
 
 	return 0;
 }
+
+static
+void
+handofftestthread(void *junk, unsigned long num)
+{
+	(void)junk;
+
+	lock_acquire(testlock);
+	if (testval1 != num) {
+		kprintf("Thread %lu got the lock in turn %lu\n", num,
+			testval1);
+		testval2++;
+	}
+	testval1++;
+	lock_release(testlock);
+	V(donesem);
+}
+
+/*
+ * Queue NTHREADS threads on a held lock one at a time, so we know the
+ * order they went to sleep in, and check that they get the lock in
+ * that order. Then, once the first of them has it, queue up behind
+ * them ourselves: since the lock is handed straight from each holder
+ * to the next sleeper, we must not get it until they've all had it.
+ */
+int
+lockhandofftest(int nargs, char **args)
+{
+	int i, result;
+
+	(void)nargs;
+	(void)args;
+
+	inititems();
+	kprintf("Starting lock handoff test...\n");
+
+	testval1 = 0;
+	testval2 = 0;
+
+	lock_acquire(testlock);
+	for (i=0; i<NTHREADS; i++) {
+		result = thread_fork("synchtest", handofftestthread, NULL, i,
+				     NULL);
+		if (result) {
+			panic("lockhandofftest: thread_fork failed: %s\n",
+			      strerror(result));
+		}
+		/*
+		 * Sleep rather than spin while waiting, so the new
+		 * thread doesn't see us running and spin instead of
+		 * going to sleep on the lock.
+		 */
+		while (testlock->lk_nwaiters < (unsigned)i+1) {
+			clock_sleep(1);
+		}
+	}
+	lock_release(testlock);
+
+	lock_acquire(testlock);
+	if (testval1 != NTHREADS) {
+		kprintf("Main thread got the lock after %lu of %d threads\n",
+			testval1, NTHREADS);
+		testval2++;
+	}
+	lock_release(testlock);
+
+	for (i=0; i<NTHREADS; i++) {
+		P(donesem);
+	}
+
+	if (testval2 != 0) {
+		kprintf("Test failed\n");
+	}
+	kprintf("Lock handoff test done.\n");
+
+	return 0;
+}
+
+static struct spinlock testspin;
+static struct spinlock testqspin;
+
+/*
+ * Bump VAL by hand, slowly, so that two CPUs in here at once would
+ * very likely lose an update.
+ */
+static
+void
+spinbump(volatile unsigned long *val)
+{
+	unsigned long v;
+	volatile int j;
+
+	v = *val;
+	for (j=0; j<20; j++);
+	*val = v + 1;
+}
+
+static
+void
+spintestthread(void *junk, unsigned long num)
+{
+	int i;
+
+	(void)junk;
+	(void)num;
+
+	for (i=0; i<NSPINLOOPS; i++) {
+		spinlock_acquire(&testspin);
+		spinbump(&testval1);
+		spinlock_release(&testspin);
+
+		spinlock_acquire(&testqspin);
+		spinbump(&testval2);
+		spinlock_release(&testqspin);
+
+		/* Both kinds at once, nested */
+		spinlock_acquire(&testspin);
+		spinlock_acquire(&testqspin);
+		spinbump(&testval3);
+		spinlock_release(&testqspin);
+		spinlock_release(&testspin);
+	}
+	V(donesem);
+}
+
+/*
+ * Hammer a ticket spinlock and a queued one from NTHREADS threads and
+ * check that no updates made under them were lost, and that their
+ * acquisition counters add up.
+ */
+int
+spinlocktest(int nargs, char **args)
+{
+	const unsigned long expect = NTHREADS * NSPINLOOPS;
+	int i, result;
+	bool ok = true;
+
+	(void)nargs;
+	(void)args;
+
+	inititems();
+	kprintf("Starting spinlock test...\n");
+
+	spinlock_init(&testspin);
+	spinlock_init_queued(&testqspin);
+	testval1 = testval2 = testval3 = 0;
+
+	for (i=0; i<NTHREADS; i++) {
+		result = thread_fork("synchtest", spintestthread, NULL, i,
+				     NULL);
+		if (result) {
+			panic("spinlocktest: thread_fork failed: %s\n",
+			      strerror(result));
+		}
+	}
+	for (i=0; i<NTHREADS; i++) {
+		P(donesem);
+	}
+
+	if (testval1 != expect || testval2 != expect ||
+	    testval3 != expect) {
+		kprintf("Lost updates: ticket %lu, queued %lu, nested %lu; "
+			"expected %lu\n", testval1, testval2, testval3,
+			expect);
+		ok = false;
+	}
+	if (testspin.lk_acquires != 2*expect ||
+	    testqspin.lk_acquires != 2*expect) {
+		kprintf("Acquire counts: ticket %u, queued %u; expected %lu\n",
+			testspin.lk_acquires, testqspin.lk_acquires,
+			2*expect);
+		ok = false;
+	}
+	if (testspin.lk_contended > testspin.lk_acquires ||
+	    testqspin.lk_contended > testqspin.lk_acquires) {
+		kprintf("More contended acquires than acquires\n");
+		ok = false;
+	}
+	kprintf("Contended: ticket %u of %u, queued %u of %u\n",
+		testspin.lk_contended, testspin.lk_acquires,
+		testqspin.lk_contended, testqspin.lk_acquires);
+
+	spinlock_cleanup(&testspin);
+	spinlock_cleanup(&testqspin);
+
+	if (!ok) {
+		kprintf("Test failed\n");
+	}
+	kprintf("Spinlock test done.\n");
+
+	return 0;
+}
+
+static struct rwlock *testrwlock;
+static struct spinlock rwtestspin = SPINLOCK_INITIALIZER;
+static volatile unsigned long rwtesterrs;
+
+/* How long (in hardclocks) to wait for something before calling it stuck */
+#define RWTEST_PATIENCE	200
+
+/*
+ * Atomically add to a counter.
+ */
+static
+void
+rwtestbump(volatile unsigned long *val)
+{
+	spinlock_acquire(&rwtestspin);
+	(*val)++;
+	spinlock_release(&rwtestspin);
+}
+
+/*
+ * Reader for the concurrency part: get in, say so, get out. The main
+ * thread holds a read lock the whole time, so we must not block.
+ */
+static
+void
+rwtestreader(void *junk, unsigned long num)
+{
+	(void)junk;
+	(void)num;
+
+	rwlock_acquire_read(testrwlock);
+	rwtestbump(&testval1);
+	rwlock_release_read(testrwlock);
+	V(donesem);
+}
+
+/*
+ * Writer for the preference part. Readers that arrived after us must
+ * still be waiting when we get in.
+ */
+static
+void
+rwtestwriter(void *junk, unsigned long num)
+{
+	(void)junk;
+	(void)num;
+
+	rwlock_acquire_write(testrwlock);
+	if (testval2 != 0) {
+		kprintf("A reader got in ahead of a waiting writer\n");
+		rwtestbump(&rwtesterrs);
+	}
+	testval3 = 1;
+	rwlock_release_write(testrwlock);
+	V(donesem);
+}
+
+/*
+ * Reader for the preference part, started after the writer is
+ * waiting.
+ */
+static
+void
+rwtestlatereader(void *junk, unsigned long num)
+{
+	(void)junk;
+	(void)num;
+
+	rwlock_acquire_read(testrwlock);
+	testval2 = 1;
+	if (testval3 != 1) {
+		kprintf("Reader got in before the waiting writer\n");
+		rwtestbump(&rwtesterrs);
+	}
+	rwlock_release_read(testrwlock);
+	V(donesem);
+}
+
+/*
+ * Reader for the batch part: once in, wait for all the others to be
+ * in too, which can only happen if releasing the write lock woke
+ * all of us.
+ */
+static
+void
+rwtestbatchreader(void *junk, unsigned long num)
+{
+	int i;
+
+	(void)junk;
+
+	rwtestbump(&testval1);
+	rwlock_acquire_read(testrwlock);
+	rwtestbump(&testval2);
+	for (i=0; i<RWTEST_PATIENCE && testval2 < NTHREADS; i++) {
+		clock_sleep(1);
+	}
+	if (testval2 < NTHREADS) {
+		kprintf("Reader %lu: only %lu of %d readers got in\n",
+			num, testval2, NTHREADS);
+		rwtestbump(&rwtesterrs);
+	}
+	rwlock_release_read(testrwlock);
+	V(donesem);
+}
+
+static
+void
+rwtestfork(const char *what, void (*func)(void *, unsigned long),
+	   unsigned long num)
+{
+	int result;
+
+	result = thread_fork("rwlocktest", func, NULL, num, NULL);
+	if (result) {
+		panic("rwlocktest: thread_fork (%s) failed: %s\n", what,
+		      strerror(result));
+	}
+}
+
+/*
+ * Reader-writer lock test, in three parts:
+ *    - readers share: NTHREADS readers get in while we hold a read lock;
+ *    - writers are preferred: a reader that arrives while a writer is
+ *      waiting waits behind it, even though only readers hold the lock;
+ *    - batch wakeup: releasing a write lock lets in every reader that
+ *      queued up behind it, not just one.
+ */
+int
+rwlocktest(int nargs, char **args)
+{
+	int i;
+
+	(void)nargs;
+	(void)args;
+
+	inititems();
+	if (testrwlock == NULL) {
+		testrwlock = rwlock_create("testrwlock");
+		if (testrwlock == NULL) {
+			panic("rwlocktest: rwlock_create failed\n");
+		}
+	}
+	rwtesterrs = 0;
+
+	kprintf("Starting rwlock test...\n");
+
+	/* Readers share */
+	kprintf("If this hangs, readers can't share: ");
+	testval1 = 0;
+	rwlock_acquire_read(testrwlock);
+	for (i=0; i<NTHREADS; i++) {
+		rwtestfork("reader", rwtestreader, i);
+	}
+	for (i=0; i<NTHREADS; i++) {
+		P(donesem);
+	}
+	rwlock_release_read(testrwlock);
+	if (testval1 != NTHREADS) {
+		kprintf("only %lu of %d readers counted\n", testval1,
+			NTHREADS);
+		rwtesterrs++;
+	}
+	else {
+		kprintf("ok\n");
+	}
+
+	/* Writers are preferred */
+	testval2 = 0;
+	testval3 = 0;
+	rwlock_acquire_read(testrwlock);
+	rwtestfork("writer", rwtestwriter, 0);
+	while (testrwlock->rwl_writers_waiting == 0) {
+		clock_sleep(1);
+	}
+	rwtestfork("reader", rwtestlatereader, 0);
+	clock_sleep(RWTEST_PATIENCE / 10);
+	if (testval2 != 0) {
+		kprintf("Reader didn't wait for the waiting writer\n");
+		rwtesterrs++;
+	}
+	rwlock_release_read(testrwlock);
+	P(donesem);
+	P(donesem);
+
+	/* Batch wakeup */
+	testval1 = 0;
+	testval2 = 0;
+	rwlock_acquire_write(testrwlock);
+	for (i=0; i<NTHREADS; i++) {
+		rwtestfork("reader", rwtestbatchreader, i);
+	}
+	while (testval1 < NTHREADS) {
+		clock_sleep(1);
+	}
+	/* Give the last of them time to get to sleep */
+	clock_sleep(RWTEST_PATIENCE / 10);
+	rwlock_release_write(testrwlock);
+	for (i=0; i<NTHREADS; i++) {
+		P(donesem);
+	}
+
+	if (rwtesterrs != 0) {
+		kprintf("Test failed\n");
+	}
+	kprintf("Rwlock test done.\n");
+
+	return 0;
+}
@@ -0,0 +1,303 @@
+/*
+ * Copyright (c) 2000, 2001, 2002, 2003, 2004, 2005, 2008, 2009
+ *	The President and Fellows of Harvard College.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the University nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE UNIVERSITY AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE UNIVERSITY OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+/*
+ * Callouts, on a per-cpu hierarchical timer wheel.
+ *
+ * Level 0 of the wheel has a slot for each of the next CALLWHEEL_SIZE
+ * ticks. Each slot of level L > 0 covers CALLWHEEL_SIZE^L ticks;
+ * callouts further out than level 0 can hold wait on a higher level,
+ * and whenever the low bits of the current tick roll over to zero,
+ * the slot of the level above for the block just starting is emptied
+ * back down ("cascaded") into the lower levels. So scheduling and
+ * cancelling are O(1), and each callout is handled at most once per
+ * level on its way down.
+ *
+ * The wheel's idea of the time, cw_now, trails the cpu's c_hardclocks
+ * and catches up each time hardclock runs callwheel_run. Because a
+ * cpu can skip ticks (see thread_nexttick), it also has to make sure
+ * its timer goes off in time for the next callout; see
+ * callwheel_nexttick and callout_schedule.
+ */
+
+#include <types.h>
+#include <lib.h>
+#include <cpu.h>
+#include <clock.h>
+#include <current.h>
+#include <callout.h>
+
+#define LEVELSHIFT(l)	(CALLWHEEL_BITS * (l))
+#define SLOTMASK	(CALLWHEEL_SIZE - 1)
+
+void
+callwheel_init(struct callwheel *cw)
+{
+	unsigned l, i;
+
+	spinlock_init(&cw->cw_lock);
+	cw->cw_now = 0;
+	cw->cw_count = 0;
+	cw->cw_running = NULL;
+	for (l=0; l<CALLWHEEL_LEVELS; l++) {
+		for (i=0; i<CALLWHEEL_SIZE; i++) {
+			cw->cw_slots[l][i] = NULL;
+		}
+	}
+}
+
+/*
+ * Link CO into the right slot for its expiry time. Wheel locked.
+ */
+static
+void
+callwheel_insert(struct callwheel *cw, struct callout *co)
+{
+	struct callout **head;
+	unsigned delta, level;
+
+	delta = co->co_expire - cw->cw_now;
+	if ((int)delta < 0) {
+		/* Already late; do it at the next tick */
+		co->co_expire = cw->cw_now + 1;
+		delta = 1;
+	}
+	for (level = 0; level < CALLWHEEL_LEVELS - 1; level++) {
+		if (delta < 1U << LEVELSHIFT(level + 1)) {
+			break;
+		}
+	}
+
+	head = &cw->cw_slots[level][(co->co_expire >> LEVELSHIFT(level))
+				    & SLOTMASK];
+	co->co_next = *head;
+	if (co->co_next != NULL) {
+		co->co_next->co_prevp = &co->co_next;
+	}
+	co->co_prevp = head;
+	*head = co;
+}
+
+/*
+ * Unlink CO from whatever slot it's in. Wheel locked.
+ */
+static
+void
+callwheel_remove(struct callout *co)
+{
+	*co->co_prevp = co->co_next;
+	if (co->co_next != NULL) {
+		co->co_next->co_prevp = co->co_prevp;
+	}
+	co->co_next = NULL;
+	co->co_prevp = NULL;
+}
+
+/*
+ * Move everything in one slot back down the wheel. Wheel locked.
+ */
+static
+void
+callwheel_cascade(struct callwheel *cw, unsigned level)
+{
+	struct callout *co;
+	unsigned slot;
+
+	slot = (cw->cw_now >> LEVELSHIFT(level)) & SLOTMASK;
+	while ((co = cw->cw_slots[level][slot]) != NULL) {
+		callwheel_remove(co);
+		callwheel_insert(cw, co);
+	}
+}
+
+/*
+ * Catch the current cpu's wheel up to c_hardclocks, calling
+ * everything that comes due. Called from hardclock.
+ */
+void
+callwheel_run(void)
+{
+	struct callwheel *cw = &curcpu->c_callwheel;
+	struct callout *co;
+	unsigned l, now;
+
+	spinlock_acquire(&cw->cw_lock);
+	while (cw->cw_now != curcpu->c_hardclocks) {
+		if (cw->cw_count == 0) {
+			/* Nothing to do; skip ahead */
+			cw->cw_now = curcpu->c_hardclocks;
+			break;
+		}
+		now = ++cw->cw_now;
+
+		for (l = CALLWHEEL_LEVELS - 1; l > 0; l--) {
+			if ((now & ((1U << LEVELSHIFT(l)) - 1)) == 0) {
+				callwheel_cascade(cw, l);
+			}
+		}
+
+		while ((co = cw->cw_slots[0][now & SLOTMASK]) != NULL) {
+			callwheel_remove(co);
+			cw->cw_count--;
+			cw->cw_running = co;
+			spinlock_release(&cw->cw_lock);
+
+			co->co_func(co->co_arg);
+
+			spinlock_acquire(&cw->cw_lock);
+			cw->cw_running = NULL;
+		}
+	}
+	spinlock_release(&cw->cw_lock);
+}
+
+/*
+ * How long until the current cpu next has to run its wheel. If the
+ * next callout is beyond level 0 we don't go looking for it; the
+ * next cascade is soon enough.
+ */
+unsigned
+callwheel_nexttick(void)
+{
+	struct callwheel *cw = &curcpu->c_callwheel;
+	unsigned i, due, ret;
+
+	spinlock_acquire(&cw->cw_lock);
+	if (cw->cw_count == 0) {
+		spinlock_release(&cw->cw_lock);
+		return 0;
+	}
+
+	due = (cw->cw_now | SLOTMASK) + 1;
+	for (i=1; i<CALLWHEEL_SIZE; i++) {
+		if (cw->cw_slots[0][(cw->cw_now + i) & SLOTMASK] != NULL) {
+			due = cw->cw_now + i;
+			break;
+		}
+	}
+	spinlock_release(&cw->cw_lock);
+
+	ret = due - curcpu->c_hardclocks;
+	if ((int)ret <= 0) {
+		ret = 1;
+	}
+	return ret;
+}
+
+////////////////////////////////////////////////////////////
+
+void
+callout_init(struct callout *co, void (*func)(void *), void *arg)
+{
+	co->co_next = NULL;
+	co->co_prevp = NULL;
+	co->co_expire = 0;
+	co->co_cpu = NULL;
+	co->co_func = func;
+	co->co_arg = arg;
+}
+
+void
+callout_schedule(struct callout *co, unsigned ticks)
+{
+	struct callwheel *cw;
+
+	callout_stop(co);
+
+	if (ticks == 0) {
+		ticks = 1;
+	}
+	if (ticks > CALLOUT_MAXTICKS) {
+		ticks = CALLOUT_MAXTICKS;
+	}
+
+	cw = &curcpu->c_callwheel;
+	spinlock_acquire(&cw->cw_lock);
+	co->co_cpu = curcpu->c_self;
+	co->co_expire = curcpu->c_hardclocks + ticks;
+	callwheel_insert(cw, co);
+	cw->cw_count++;
+
+	/*
+	 * If our timer won't go off in time, take a tick next time
+	 * round; hardclock will reprogram it from there. (Setting 1
+	 * doesn't look at the wheel, so it's OK to hold its lock.)
+	 */
+	if ((int)(co->co_expire - curcpu->c_timerdue) < 0) {
+		hardclock_settimer(1);
+	}
+	spinlock_release(&cw->cw_lock);
+}
+
+bool
+callout_stop(struct callout *co)
+{
+	struct callwheel *cw;
+	struct cpu *c;
+
+	while (1) {
+		c = co->co_cpu;
+		if (c == NULL) {
+			/* never scheduled */
+			return false;
+		}
+		cw = &c->c_callwheel;
+
+		spinlock_acquire(&cw->cw_lock);
+		if (co->co_cpu != c) {
+			/* moved meanwhile */
+			spinlock_release(&cw->cw_lock);
+			continue;
+		}
+		if (co->co_prevp != NULL) {
+			callwheel_remove(co);
+			cw->cw_count--;
+			spinlock_release(&cw->cw_lock);
+			return true;
+		}
+		if (cw->cw_running != co) {
+			spinlock_release(&cw->cw_lock);
+			return false;
+		}
+		spinlock_release(&cw->cw_lock);
+
+		/*
+		 * It's running on cpu C. That can't be us: callouts
+		 * run with interrupts off, so we'd have to be inside
+		 * it, which isn't allowed.
+		 */
+		KASSERT(c != curcpu->c_self);
+	}
+}
+
+bool
+callout_pending(struct callout *co)
+{
+	return co->co_prevp != NULL;
+}
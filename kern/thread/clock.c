@@ -34,13 +34,14 @@
 #include <clock.h>
 #include <thread.h>
 #include <current.h>
+#include <mainbus.h>
+#include <callout.h>
 
 /*
  * Time handling.
  *
- * This is pretty primitive. A real kernel will typically have some
- * kind of support for scheduling callbacks to happen at specific
- * points in the future, usually with more resolution that one second.
+ * Timed events are callouts (see callout.c), run from hardclock() on
+ * a per-cpu timer wheel, so their resolution is one hardclock.
  *
  * A real kernel also has to maintain the time of day; in OS/161 we
  * skimp on that because we have a known-good hardware clock.
@@ -51,12 +52,12 @@
  * the scheduler.
  */
 #define SCHEDULE_HARDCLOCKS	4	/* Reschedule every 4 hardclocks. */
-#define MIGRATE_HARDCLOCKS	16	/* Migrate every 16 hardclocks. */
 
 /*
- * Once a second, everything waiting on lbolt is awakened by CPU 0.
+ * Threads in clock_sleep wait here. Each one has its own timeout, and
+ * nothing ever wakes the channel as a whole.
  */
-static struct wchan *lbolt;
+static struct wchan *sleepchan;
 
 /*
  * Setup.
@@ -64,42 +65,142 @@ static struct wchan *lbolt;
 void
 hardclock_bootstrap(void)
 {
-	lbolt = wchan_create("lbolt");
-	if (lbolt == NULL) {
-		panic("Couldn't create lbolt\n");
+	sleepchan = wchan_create("sleep");
+	if (sleepchan == NULL) {
+		panic("Couldn't create sleep channel\n");
 	}
 }
 
 /*
  * This is called once per second, on one processor, by the timer
- * code.
+ * code. Nothing uses it any more; timed events are callouts.
  */
 void
 timerclock(void)
 {
-	/* Just broadcast on lbolt */
-	wchan_wakeall(lbolt);
 }
 
 /*
- * This is called HZ times a second (on each processor) by the timer
- * code.
+ * Set when this cpu's next hardclock happens, TICKS ticks from now,
+ * or not until something else changes if TICKS is 0. The time since
+ * the timer was last set is added to c_hardclocks. Interrupts must be
+ * off.
+ */
+void
+hardclock_settimer(unsigned ticks)
+{
+	unsigned due;
+
+	KASSERT(curthread->t_curspl > 0);
+
+	if (ticks != 1) {
+		/*
+		 * Don't sleep through a callout. Catch c_hardclocks up
+		 * first so callwheel_nexttick counts from now.
+		 */
+		curcpu->c_hardclocks += mainbus_settimer(1);
+		due = callwheel_nexttick();
+		if (due != 0 && (ticks == 0 || due < ticks)) {
+			ticks = due;
+		}
+	}
+	curcpu->c_hardclocks += mainbus_settimer(ticks);
+	curcpu->c_timerdue = curcpu->c_hardclocks +
+		(ticks == 0 ? CALLOUT_MAXTICKS : ticks);
+}
+
+/*
+ * This is called by the timer code on each processor, nominally HZ
+ * times a second. But the scheduler only asks for a tick when it has
+ * something to do at that point (see thread_nexttick), so a cpu
+ * that's idle or has only one thread to run takes very few.
  */
 void
 hardclock(void)
 {
+	unsigned then, ticks;
+
 	/*
 	 * Collect statistics here as desired.
 	 */
 
-	curcpu->c_hardclocks++;
-	if ((curcpu->c_hardclocks % SCHEDULE_HARDCLOCKS) == 0) {
+	/* Re-arm for one tick for now; the scheduler may change that. */
+	then = curcpu->c_hardclocks;
+	hardclock_settimer(1);
+	ticks = curcpu->c_hardclocks - then;
+	if (ticks == 0) {
+		/*
+		 * The timer only fires when what we asked for is up, so
+		 * a tick is due even if the cycle count (see
+		 * mainbus_settimer) says otherwise. Don't let the clock
+		 * stop.
+		 */
+		curcpu->c_hardclocks++;
+		curcpu->c_timerdue++;
+		ticks = 1;
+	}
+
+	callwheel_run();
+
+	if (curcpu->c_hardclocks - curcpu->c_lastschedule
+	    >= SCHEDULE_HARDCLOCKS) {
+		curcpu->c_lastschedule = curcpu->c_hardclocks;
 		schedule();
 	}
-	if ((curcpu->c_hardclocks % MIGRATE_HARDCLOCKS) == 0) {
-		thread_consider_migration();
+	thread_tick(ticks);
+}
+
+/*
+ * Convert a time interval to hardclocks, rounding up, but with a
+ * ceiling of CALLOUT_MAXTICKS.
+ */
+unsigned
+clock_nstoticks(time_t secs, uint32_t nsecs)
+{
+	uint64_t ticks;
+
+	if (secs < 0) {
+		return 0;
+	}
+	if ((uint64_t)secs >= CALLOUT_MAXTICKS / HZ) {
+		return CALLOUT_MAXTICKS;
+	}
+	ticks = (uint64_t)secs * HZ;
+	ticks += (nsecs + NSEC_PER_HARDCLOCK - 1) / NSEC_PER_HARDCLOCK;
+	return ticks > CALLOUT_MAXTICKS ? CALLOUT_MAXTICKS : ticks;
+}
+
+/*
+ * Suspend execution for TICKS hardclocks.
+ */
+void
+clock_sleep(unsigned ticks)
+{
+	if (ticks == 0) {
+		return;
+	}
+	wchan_lock(sleepchan);
+	wchan_sleep_timeout(sleepchan, ticks);
+}
+
+/*
+ * Suspend execution for SECS seconds and NSECS nanoseconds, rounded up
+ * to hardclocks. A single timed sleep can't be longer than
+ * CALLOUT_MAXTICKS, so sleep in pieces until the whole time is up.
+ */
+void
+clock_sleepns(time_t secs, uint32_t nsecs)
+{
+	const time_t maxsecs = CALLOUT_MAXTICKS / HZ;
+
+	if (secs < 0) {
+		return;
+	}
+	while (secs >= maxsecs) {
+		clock_sleep(maxsecs * HZ);
+		secs -= maxsecs;
 	}
-	thread_yield();
+	clock_sleep(clock_nstoticks(secs, nsecs));
 }
 
 /*
@@ -108,9 +209,7 @@ hardclock(void)
 void
 clocksleep(int num_secs)
 {
-	while (num_secs > 0) {
-		wchan_lock(lbolt);
-		wchan_sleep(lbolt);
-		num_secs--;
+	if (num_secs > 0) {
+		clock_sleepns(num_secs, 0);
 	}
 }
@@ -0,0 +1,94 @@
+/*
+ * Copyright (c) 2000, 2001, 2002, 2003, 2004, 2005, 2008, 2009
+ *	The President and Fellows of Harvard College.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the University nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE UNIVERSITY AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE UNIVERSITY OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+/*
+ * CPU time accounting. See cputime.h.
+ */
+
+#include <types.h>
+#include <lib.h>
+#include <cpu.h>
+#include <thread.h>
+#include <current.h>
+#include <mainbus.h>
+#include <cputime.h>
+
+void
+cputime_init(struct cputime *ct)
+{
+	unsigned i;
+
+	for (i=0; i<CPUTIME_NSTATES; i++) {
+		ct->ct_ns[i] = 0;
+	}
+	ct->ct_vcsw = 0;
+	ct->ct_ivcsw = 0;
+}
+
+void
+cputime_add(struct cputime *to, const struct cputime *from)
+{
+	unsigned i;
+
+	for (i=0; i<CPUTIME_NSTATES; i++) {
+		to->ct_ns[i] += from->ct_ns[i];
+	}
+	to->ct_vcsw += from->ct_vcsw;
+	to->ct_ivcsw += from->ct_ivcsw;
+}
+
+/*
+ * Charge the time since the last switch to the state we're leaving
+ * and move to NEWSTATE.
+ *
+ * This is on every trap path, so keep it short: one counter read and
+ * two additions. Idle time isn't charged to the thread; while idle,
+ * curthread is just whoever switched out last.
+ */
+unsigned
+cputime_switch(unsigned newstate)
+{
+	struct cpu *c = curcpu;
+	unsigned oldstate;
+	uint64_t now, delta;
+
+	KASSERT(newstate < CPUTIME_NSTATES);
+
+	now = mainbus_cputime();
+	delta = now - c->c_cpustamp;
+	c->c_cpustamp = now;
+
+	oldstate = c->c_cpustate;
+	c->c_cputime.ct_ns[oldstate] += delta;
+	if (oldstate != CPUTIME_IDLE && !c->c_isidle) {
+		c->c_curthread->t_cputime.ct_ns[oldstate] += delta;
+	}
+	c->c_cpustate = newstate;
+	return oldstate;
+}
@@ -0,0 +1,295 @@
+/*
+ * Copyright (c) 2000, 2001, 2002, 2003, 2004, 2005, 2008, 2009
+ *	The President and Fellows of Harvard College.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the University nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE UNIVERSITY AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE UNIVERSITY OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+/*
+ * Kernel event tracing. See ktrace.h.
+ */
+
+#include <types.h>
+#include <kern/errno.h>
+#include <kern/fcntl.h>
+#include <lib.h>
+#include <spl.h>
+#include <membar.h>
+#include <uio.h>
+#include <cpu.h>
+#include <thread.h>
+#include <current.h>
+#include <mainbus.h>
+#include <vfs.h>
+#include <vnode.h>
+#include <ktrace.h>
+
+/*
+ * One cpu's ring. kb_next counts every event ever recorded, so the
+ * ring holds the last min(kb_next, KTRACE_NEVENTS) of them. kb_busy
+ * is set while an event is being written, so ktrace_dump can wait
+ * for stragglers after switching tracing off.
+ */
+struct ktracebuf {
+	unsigned kb_next;
+	volatile bool kb_busy;
+	struct ktrace_event kb_events[KTRACE_NEVENTS];
+};
+
+/* Rings, by cpu number */
+static struct ktracebuf *ktrace_bufs[KTRACE_MAXCPUS];
+static unsigned ktrace_ncpus;
+
+volatile bool ktrace_on;
+
+void
+ktrace_cpuinit(struct cpu *c)
+{
+	struct ktracebuf *kb;
+
+	if (c->c_number >= KTRACE_MAXCPUS) {
+		/* No ring; this cpu's events are dropped. */
+		return;
+	}
+
+	kb = kmalloc(sizeof(*kb));
+	if (kb == NULL) {
+		panic("ktrace: Out of memory for cpu%u\n", c->c_number);
+	}
+	kb->kb_next = 0;
+	kb->kb_busy = false;
+
+	ktrace_bufs[c->c_number] = kb;
+	if (c->c_number >= ktrace_ncpus) {
+		ktrace_ncpus = c->c_number + 1;
+	}
+}
+
+void
+ktrace_record(unsigned type, uint32_t arg0, uint32_t arg1)
+{
+	struct ktracebuf *kb;
+	struct ktrace_event *ev;
+	uint64_t now;
+	int spl;
+
+	/* Spinlocks trace too, and are used before curcpu exists. */
+	if (!CURCPU_EXISTS()) {
+		return;
+	}
+
+	spl = splhigh();
+	kb = curcpu->c_number < KTRACE_MAXCPUS ?
+		ktrace_bufs[curcpu->c_number] : NULL;
+	if (kb == NULL) {
+		splx(spl);
+		return;
+	}
+
+	/* Pairs with the barrier in ktrace_dump. */
+	kb->kb_busy = true;
+	membar_any_any();
+	if (ktrace_on) {
+		now = mainbus_cputime();
+		ev = &kb->kb_events[kb->kb_next % KTRACE_NEVENTS];
+		ev->kte_timehi = now >> 32;
+		ev->kte_timelo = now & 0xffffffff;
+		ev->kte_type = type;
+		ev->kte_pid = curthread->pid;
+		ev->kte_arg0 = arg0;
+		ev->kte_arg1 = arg1;
+		kb->kb_next++;
+	}
+	membar_store_store();
+	kb->kb_busy = false;
+
+	splx(spl);
+}
+
+void
+ktrace_enable(bool on)
+{
+	ktrace_on = on;
+	membar_any_any();
+}
+
+/*
+ * Wait until no cpu is partway through writing an event. Tracing
+ * must be off already.
+ */
+static
+void
+ktrace_quiesce(void)
+{
+	unsigned i;
+
+	KASSERT(!ktrace_on);
+	membar_any_any();
+	for (i=0; i<ktrace_ncpus; i++) {
+		if (ktrace_bufs[i] == NULL) {
+			continue;
+		}
+		while (ktrace_bufs[i]->kb_busy) {
+			/* spin; it's a handful of stores */
+		}
+	}
+	membar_any_any();
+}
+
+void
+ktrace_clear(void)
+{
+	unsigned i;
+	bool was;
+
+	was = ktrace_on;
+	ktrace_enable(false);
+	ktrace_quiesce();
+	for (i=0; i<ktrace_ncpus; i++) {
+		if (ktrace_bufs[i] != NULL) {
+			ktrace_bufs[i]->kb_next = 0;
+		}
+	}
+	ktrace_enable(was);
+}
+
+void
+ktrace_stats(void)
+{
+	unsigned i, n;
+
+	kprintf("ktrace: %s, %u events per cpu\n",
+		ktrace_on ? "on" : "off", KTRACE_NEVENTS);
+	for (i=0; i<ktrace_ncpus; i++) {
+		if (ktrace_bufs[i] == NULL) {
+			continue;
+		}
+		n = ktrace_bufs[i]->kb_next;
+		kprintf("cpu%u: %u events, %u overwritten\n", i,
+			n < KTRACE_NEVENTS ? n : KTRACE_NEVENTS,
+			n < KTRACE_NEVENTS ? 0 : n - KTRACE_NEVENTS);
+	}
+}
+
+/*
+ * Write LEN bytes from BUF at *POS in VN, and advance *POS.
+ */
+static
+int
+ktrace_write(struct vnode *vn, const void *buf, size_t len, off_t *pos)
+{
+	struct iovec iov;
+	struct uio ku;
+	int result;
+
+	uio_kinit(&iov, &ku, (void *)buf, len, *pos, UIO_WRITE);
+	result = VOP_WRITE(vn, &ku);
+	if (result) {
+		return result;
+	}
+	if (ku.uio_resid != 0) {
+		return ENOSPC;
+	}
+	*pos = ku.uio_offset;
+	return 0;
+}
+
+/*
+ * Write one cpu's section: header, then the events from oldest to
+ * newest, which is two runs if the ring has wrapped.
+ */
+static
+int
+ktrace_dumpcpu(struct vnode *vn, unsigned cpu, off_t *pos)
+{
+	struct ktracebuf *kb = ktrace_bufs[cpu];
+	struct ktrace_cpuheader kc;
+	unsigned n, first, run;
+	int result;
+
+	n = kb == NULL ? 0 : kb->kb_next;
+
+	kc.ktc_cpu = cpu;
+	kc.ktc_nevents = n < KTRACE_NEVENTS ? n : KTRACE_NEVENTS;
+	kc.ktc_lost = n - kc.ktc_nevents;
+	result = ktrace_write(vn, &kc, sizeof(kc), pos);
+	if (result || kc.ktc_nevents == 0) {
+		return result;
+	}
+
+	first = kc.ktc_lost % KTRACE_NEVENTS;
+	run = KTRACE_NEVENTS - first;
+	if (run > kc.ktc_nevents) {
+		run = kc.ktc_nevents;
+	}
+	result = ktrace_write(vn, &kb->kb_events[first],
+			      run * sizeof(struct ktrace_event), pos);
+	if (result || run == kc.ktc_nevents) {
+		return result;
+	}
+	return ktrace_write(vn, &kb->kb_events[0],
+			    (kc.ktc_nevents - run) * sizeof(struct ktrace_event),
+			    pos);
+}
+
+int
+ktrace_dump(const char *path)
+{
+	struct ktrace_header kh;
+	struct vnode *vn;
+	char *pathcopy;
+	off_t pos;
+	unsigned i;
+	int result;
+
+	/* Stop, so the rings hold still while we write them out. */
+	ktrace_enable(false);
+	ktrace_quiesce();
+
+	/* vfs_open destroys the string it's passed. */
+	pathcopy = kstrdup(path);
+	if (pathcopy == NULL) {
+		return ENOMEM;
+	}
+	result = vfs_open(pathcopy, O_WRONLY|O_CREAT|O_TRUNC, 0664, &vn);
+	kfree(pathcopy);
+	if (result) {
+		return result;
+	}
+
+	kh.kth_magic = KTRACE_MAGIC;
+	kh.kth_version = KTRACE_VERSION;
+	kh.kth_ncpus = ktrace_ncpus;
+	kh.kth_evsize = sizeof(struct ktrace_event);
+
+	pos = 0;
+	result = ktrace_write(vn, &kh, sizeof(kh), &pos);
+	for (i=0; result == 0 && i<ktrace_ncpus; i++) {
+		result = ktrace_dumpcpu(vn, i, &pos);
+	}
+
+	vfs_close(vn);
+	return result;
+}
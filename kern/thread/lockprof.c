@@ -0,0 +1,353 @@
+/*
+ * Copyright (c) 2000, 2001, 2002, 2003, 2004, 2005, 2008, 2009
+ *	The President and Fellows of Harvard College.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the University nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE UNIVERSITY AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE UNIVERSITY OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+/*
+ * Lock contention profiling. See lockprof.h.
+ */
+
+#include <types.h>
+#include <lib.h>
+#include <spl.h>
+#include <spinlock.h>
+#include <membar.h>
+#include <clock.h>
+#include <lockprof.h>
+
+/* Most locks lockprof_report will show */
+#define LOCKPROF_MAXREPORT	32
+
+/* Longest lock name shown */
+#define LOCKPROF_NAMELEN	24
+
+/*
+ * All the records. This can't be protected with a struct spinlock,
+ * as spinlocks themselves call in here, so it's a bare lock word
+ * used the way spinlocks used to be.
+ */
+static struct lockprof *lockprof_list;
+static volatile spinlock_data_t lockprof_listlock;
+
+static volatile bool lockprof_on;
+
+static
+int
+lockprof_lock(void)
+{
+	int spl;
+
+	spl = splhigh();
+	while (spinlock_data_get(&lockprof_listlock) != 0 ||
+	       spinlock_data_testandset(&lockprof_listlock) != 0) {
+		/* spin */
+	}
+	membar_any_any();
+	return spl;
+}
+
+static
+void
+lockprof_unlock(int spl)
+{
+	membar_any_store();
+	spinlock_data_set(&lockprof_listlock, 0);
+	splx(spl);
+}
+
+static
+void
+lockprof_zero(struct lockprof *lp)
+{
+	unsigned i;
+
+	lp->lp_acquires = 0;
+	lp->lp_contended = 0;
+	lp->lp_waitns = lp->lp_maxwaitns = 0;
+	lp->lp_holdns = lp->lp_maxholdns = 0;
+	lp->lp_since = 0;
+	for (i=0; i<LOCKPROF_NSITES; i++) {
+		lp->lp_sites[i].ls_pc = NULL;
+		lp->lp_sites[i].ls_count = 0;
+		lp->lp_sites[i].ls_waitns = 0;
+	}
+}
+
+void
+lockprof_init(struct lockprof *lp, const char *kind, const char *name)
+{
+	int spl;
+
+	lp->lp_kind = kind;
+	lp->lp_name = name;
+	lp->lp_hashold = strcmp(kind, "sem") != 0;
+	lockprof_zero(lp);
+
+	spl = lockprof_lock();
+	lp->lp_next = lockprof_list;
+	if (lp->lp_next != NULL) {
+		lp->lp_next->lp_prevp = &lp->lp_next;
+	}
+	lp->lp_prevp = &lockprof_list;
+	lockprof_list = lp;
+	lockprof_unlock(spl);
+}
+
+void
+lockprof_cleanup(struct lockprof *lp)
+{
+	int spl;
+
+	spl = lockprof_lock();
+	*lp->lp_prevp = lp->lp_next;
+	if (lp->lp_next != NULL) {
+		lp->lp_next->lp_prevp = lp->lp_prevp;
+	}
+	lockprof_unlock(spl);
+}
+
+void
+lockprof_spinlock(struct spinlock *lk, const char *name)
+{
+	struct lockprof *lp;
+
+	KASSERT(lk->lk_prof == NULL);
+	lp = kmalloc(sizeof(*lp));
+	if (lp == NULL) {
+		/* Not worth failing over */
+		return;
+	}
+	lockprof_init(lp, "spin", name);
+	lk->lk_prof = lp;
+}
+
+uint64_t
+lockprof_now(void)
+{
+	time_t secs;
+	uint32_t nsecs;
+
+	if (!lockprof_on) {
+		return 0;
+	}
+	gettime(&secs, &nsecs);
+	return (uint64_t)secs * 1000000000 + nsecs;
+}
+
+/*
+ * Charge WAIT to the call site PC. If PC isn't already one of the
+ * kept sites, it replaces the one that's waited least so far.
+ */
+static
+void
+lockprof_site(struct lockprof *lp, const void *pc, uint64_t wait)
+{
+	struct lockprof_site *ls, *least;
+	unsigned i;
+
+	least = &lp->lp_sites[0];
+	for (i=0; i<LOCKPROF_NSITES; i++) {
+		ls = &lp->lp_sites[i];
+		if (ls->ls_pc == pc) {
+			ls->ls_count++;
+			ls->ls_waitns += wait;
+			return;
+		}
+		if (ls->ls_waitns < least->ls_waitns) {
+			least = ls;
+		}
+	}
+	least->ls_pc = pc;
+	least->ls_count = 1;
+	least->ls_waitns = wait;
+}
+
+void
+lockprof_acquired(struct lockprof *lp, uint64_t start, bool contended,
+		  const void *pc)
+{
+	uint64_t now, wait;
+
+	if (start == 0) {
+		/* Profiling was off when we started */
+		return;
+	}
+	now = lockprof_now();
+	if (now == 0) {
+		return;
+	}
+
+	lp->lp_acquires++;
+	if (lp->lp_hashold) {
+		lp->lp_since = now;
+	}
+	if (contended) {
+		wait = now - start;
+		lp->lp_contended++;
+		lp->lp_waitns += wait;
+		if (wait > lp->lp_maxwaitns) {
+			lp->lp_maxwaitns = wait;
+		}
+		lockprof_site(lp, pc, wait);
+	}
+}
+
+void
+lockprof_released(struct lockprof *lp)
+{
+	uint64_t now, hold;
+
+	if (lp->lp_since == 0) {
+		return;
+	}
+	now = lockprof_now();
+	if (now != 0) {
+		hold = now - lp->lp_since;
+		lp->lp_holdns += hold;
+		if (hold > lp->lp_maxholdns) {
+			lp->lp_maxholdns = hold;
+		}
+	}
+	lp->lp_since = 0;
+}
+
+void
+lockprof_enable(bool on)
+{
+	lockprof_on = on;
+}
+
+/*
+ * The counters aren't updated atomically with respect to this, so a
+ * lock in use at the time may come out slightly off.
+ */
+void
+lockprof_reset(void)
+{
+	struct lockprof *lp;
+	int spl;
+
+	spl = lockprof_lock();
+	for (lp = lockprof_list; lp != NULL; lp = lp->lp_next) {
+		lockprof_zero(lp);
+	}
+	lockprof_unlock(spl);
+}
+
+/* A copy of a record for lockprof_report, as it may go away */
+struct lockprof_copy {
+	char lc_name[LOCKPROF_NAMELEN];
+	struct lockprof lc_prof;
+};
+
+/* Nanoseconds to microseconds, for printing */
+static
+unsigned long
+lockprof_us(uint64_t ns)
+{
+	return ns / 1000;
+}
+
+void
+lockprof_report(unsigned n)
+{
+	struct lockprof_copy *top;
+	struct lockprof *lp;
+	struct lockprof_site *ls;
+	unsigned num, i, j;
+	int spl;
+
+	if (n > LOCKPROF_MAXREPORT) {
+		n = LOCKPROF_MAXREPORT;
+	}
+	if (n == 0) {
+		return;
+	}
+	top = kmalloc(n * sizeof(*top));
+	if (top == NULL) {
+		kprintf("lockprof: Out of memory\n");
+		return;
+	}
+
+	/* Insertion-sort the worst N by total wait into TOP */
+	num = 0;
+	spl = lockprof_lock();
+	for (lp = lockprof_list; lp != NULL; lp = lp->lp_next) {
+		if (lp->lp_acquires == 0) {
+			continue;
+		}
+		for (i = num; i > 0; i--) {
+			if (top[i-1].lc_prof.lp_waitns >= lp->lp_waitns) {
+				break;
+			}
+			if (i < n) {
+				top[i] = top[i-1];
+			}
+		}
+		if (i < n) {
+			top[i].lc_prof = *lp;
+			snprintf(top[i].lc_name, sizeof(top[i].lc_name),
+				 "%s", lp->lp_name);
+			if (num < n) {
+				num++;
+			}
+		}
+	}
+	lockprof_unlock(spl);
+
+	kprintf("lockprof: %s\n", lockprof_on ? "on" : "off");
+	kprintf("%-4s %-24s %9s %9s %10s %8s %10s %8s\n",
+		"kind", "name", "acquires", "contended",
+		"wait(us)", "max", "hold(us)", "max");
+	for (i=0; i<num; i++) {
+		lp = &top[i].lc_prof;
+		kprintf("%-4s %-24s %9u %9u %10lu %8lu ",
+			lp->lp_kind, top[i].lc_name,
+			lp->lp_acquires, lp->lp_contended,
+			lockprof_us(lp->lp_waitns),
+			lockprof_us(lp->lp_maxwaitns));
+		if (lp->lp_hashold) {
+			kprintf("%10lu %8lu\n",
+				lockprof_us(lp->lp_holdns),
+				lockprof_us(lp->lp_maxholdns));
+		}
+		else {
+			kprintf("%10s %8s\n", "-", "-");
+		}
+		for (j=0; j<LOCKPROF_NSITES; j++) {
+			ls = &lp->lp_sites[j];
+			if (ls->ls_pc == NULL) {
+				continue;
+			}
+			kprintf("       waited from %p: %u times, %lu us\n",
+				ls->ls_pc, ls->ls_count,
+				lockprof_us(ls->ls_waitns));
+		}
+	}
+
+	kfree(top);
+}
@@ -30,17 +30,25 @@
 /* Make sure to build out-of-line versions of spinlock inline functions */
 #define SPINLOCK_INLINE   /* empty */
 
+/* And of the memory barriers, which live with them */
+#define MEMBAR_INLINE   /* empty */
+
 #include <types.h>
 #include <lib.h>
 #include <cpu.h>
 #include <spl.h>
 #include <spinlock.h>
+#include <membar.h>
 #include <current.h>	/* for curcpu */
+#include <ktrace.h>
 
 /*
  * Spinlocks.
  */
 
+/* MCS queue nodes for use before curcpu exists (one cpu only then) */
+static struct spinlock_mcsnode spinlock_bootnodes[SPINLOCK_MCSNODES];
+static unsigned spinlock_bootnodes_inuse;
 
 /*
  * Initialize spinlock.
@@ -48,8 +56,24 @@
 void
 spinlock_init(struct spinlock *lk)
 {
-	spinlock_data_set(&lk->lk_lock, 0);
+	spinlock_data_set(&lk->lk_next, 0);
+	spinlock_data_set(&lk->lk_owner, 0);
+	spinlock_data_set(&lk->lk_tail, 0);
+	lk->lk_mcsnode = NULL;
+	lk->lk_queued = false;
 	lk->lk_holder = NULL;
+	lk->lk_acquires = 0;
+	lk->lk_contended = 0;
+#if OPT_LOCKPROF
+	lk->lk_prof = NULL;
+#endif
+}
+
+void
+spinlock_init_queued(struct spinlock *lk)
+{
+	spinlock_init(lk);
+	lk->lk_queued = true;
 }
 
 /*
@@ -59,20 +83,160 @@ void
 spinlock_cleanup(struct spinlock *lk)
 {
 	KASSERT(lk->lk_holder == NULL);
-	KASSERT(spinlock_data_get(&lk->lk_lock) == 0);
+	KASSERT(spinlock_data_get(&lk->lk_next) ==
+		spinlock_data_get(&lk->lk_owner));
+	KASSERT(spinlock_data_get(&lk->lk_tail) == 0);
+#if OPT_LOCKPROF
+	if (lk->lk_prof != NULL) {
+		lockprof_cleanup(lk->lk_prof);
+		kfree(lk->lk_prof);
+		lk->lk_prof = NULL;
+	}
+#endif
+}
+
+/*
+ * Get an MCS queue node from the current cpu's set, or give one
+ * back. Interrupts must be off.
+ */
+static
+struct spinlock_mcsnode *
+spinlock_mcsnode_get(void)
+{
+	struct spinlock_mcsnode *nodes;
+	unsigned *inuse;
+	unsigned i;
+
+	if (CURCPU_EXISTS()) {
+		nodes = curcpu->c_mcsnodes;
+		inuse = &curcpu->c_mcsnodes_inuse;
+	}
+	else {
+		nodes = spinlock_bootnodes;
+		inuse = &spinlock_bootnodes_inuse;
+	}
+
+	for (i=0; i<SPINLOCK_MCSNODES; i++) {
+		if ((*inuse & (1U << i)) == 0) {
+			*inuse |= 1U << i;
+			return &nodes[i];
+		}
+	}
+	panic("Too many queued spinlocks held\n");
+}
+
+static
+void
+spinlock_mcsnode_put(struct spinlock_mcsnode *node)
+{
+	struct spinlock_mcsnode *nodes;
+	unsigned *inuse;
+
+	nodes = spinlock_bootnodes;
+	inuse = &spinlock_bootnodes_inuse;
+	if (CURCPU_EXISTS() && (node < nodes ||
+				node >= nodes + SPINLOCK_MCSNODES)) {
+		nodes = curcpu->c_mcsnodes;
+		inuse = &curcpu->c_mcsnodes_inuse;
+	}
+	KASSERT(node >= nodes && node < nodes + SPINLOCK_MCSNODES);
+	*inuse &= ~(1U << (node - nodes));
+}
+
+/*
+ * Wait for a ticket lock. Returns true if we had to wait.
+ */
+static
+bool
+spinlock_ticket_acquire(struct spinlock *lk)
+{
+	spinlock_data_t ticket;
+
+	/*
+	 * Take a number. Then, like the old test-test-and-set, just
+	 * read until it comes up; the only write is the holder's
+	 * when it moves lk_owner along.
+	 */
+	ticket = spinlock_data_fetchadd(&lk->lk_next, 1);
+	if (spinlock_data_get(&lk->lk_owner) == ticket) {
+		return false;
+	}
+	while (spinlock_data_get(&lk->lk_owner) != ticket) {
+		/* spin */
+	}
+	return true;
+}
+
+/*
+ * Wait for an MCS lock. Returns true if we had to wait.
+ */
+static
+bool
+spinlock_mcs_acquire(struct spinlock *lk)
+{
+	struct spinlock_mcsnode *node, *pred;
+
+	node = spinlock_mcsnode_get();
+	node->mn_next = NULL;
+	node->mn_wait = true;
+	membar_store_any();
+
+	/* Join the end of the queue. If it was empty, it's ours. */
+	pred = (struct spinlock_mcsnode *)
+		spinlock_data_swap(&lk->lk_tail, (spinlock_data_t)node);
+	if (pred != NULL) {
+		/* Tell our predecessor who's next, and wait for it */
+		pred->mn_next = node;
+		while (node->mn_wait) {
+			/* spin */
+		}
+	}
+	lk->lk_mcsnode = node;
+	return pred != NULL;
+}
+
+static
+void
+spinlock_mcs_release(struct spinlock *lk)
+{
+	struct spinlock_mcsnode *node, *next;
+
+	node = lk->lk_mcsnode;
+	lk->lk_mcsnode = NULL;
+
+	next = node->mn_next;
+	if (next == NULL) {
+		/* Nobody visibly waiting; try to close the queue */
+		if (spinlock_data_cas(&lk->lk_tail, (spinlock_data_t)node, 0)
+		    == (spinlock_data_t)node) {
+			spinlock_mcsnode_put(node);
+			return;
+		}
+		/* Someone is joining; wait until they've linked in */
+		while ((next = node->mn_next) == NULL) {
+			/* spin */
+		}
+	}
+	membar_any_store();
+	next->mn_wait = false;
+	spinlock_mcsnode_put(node);
 }
 
 /*
  * Get the lock.
  *
  * First disable interrupts (otherwise, if we get a timer interrupt we
- * might come back to this lock and deadlock), then use a machine-level
- * atomic operation to wait for the lock to be free.
+ * might come back to this lock and deadlock), then use machine-level
+ * atomic operations to wait our turn.
  */
 void
 spinlock_acquire(struct spinlock *lk)
 {
 	struct cpu *mycpu;
+	bool waited;
+#if OPT_LOCKPROF
+	uint64_t start;
+#endif
 
 	splraise(IPL_NONE, IPL_HIGH);
 
@@ -87,27 +251,30 @@ spinlock_acquire(struct spinlock *lk)
 		mycpu = NULL;
 	}
 
-	while (1) {
-		/*
-		 * Do test-test-and-set, that is, read first before
-		 * doing test-and-set, to reduce bus contention.
-		 *
-		 * Test-and-set is a machine-level atomic operation
-		 * that writes 1 into the lock word and returns the
-		 * previous value. If that value was 0, the lock was
-		 * previously unheld and we now own it. If it was 1,
-		 * we don't.
-		 */
-		if (spinlock_data_get(&lk->lk_lock) != 0) {
-			continue;
-		}
-		if (spinlock_data_testandset(&lk->lk_lock) != 0) {
-			continue;
-		}
-		break;
+#if OPT_LOCKPROF
+	start = lk->lk_prof != NULL ? lockprof_now() : 0;
+#endif
+
+	if (lk->lk_queued) {
+		waited = spinlock_mcs_acquire(lk);
+	}
+	else {
+		waited = spinlock_ticket_acquire(lk);
 	}
+	membar_any_any();
 
 	lk->lk_holder = mycpu;
+	lk->lk_acquires++;
+	if (waited) {
+		lk->lk_contended++;
+		KTRACE(KTE_SPINWAIT, (vaddr_t)lk, 0);
+	}
+#if OPT_LOCKPROF
+	if (start != 0) {
+		lockprof_acquired(lk->lk_prof, start, waited,
+				  __builtin_return_address(0));
+	}
+#endif
 }
 
 /*
@@ -123,8 +290,22 @@ spinlock_release(struct spinlock *lk)
 	}
 
 
+#if OPT_LOCKPROF
+	if (lk->lk_prof != NULL) {
+		lockprof_released(lk->lk_prof);
+	}
+#endif
+
 	lk->lk_holder = NULL;
-	spinlock_data_set(&lk->lk_lock, 0);
+	if (lk->lk_queued) {
+		spinlock_mcs_release(lk);
+	}
+	else {
+		/* Only the holder writes lk_owner, so no atomic op needed */
+		membar_any_store();
+		spinlock_data_set(&lk->lk_owner,
+				  spinlock_data_get(&lk->lk_owner) + 1);
+	}
 	spllower(IPL_HIGH, IPL_NONE);
 }
 
@@ -33,12 +33,16 @@
  */
 
 #include <types.h>
+#include <kern/errno.h>
 #include <lib.h>
+#include <clock.h>
 #include <spinlock.h>
 #include <wchan.h>
 #include <thread.h>
+#include <cpu.h>
 #include <current.h>
 #include <synch.h>
+#include <ktrace.h>
 
 ////////////////////////////////////////////////////////////
 //
@@ -71,6 +75,9 @@ sem_create(const char *name, int initial_count)
 
   spinlock_init(&sem->sem_lock);
         sem->sem_count = initial_count;
+#if OPT_LOCKPROF
+  lockprof_init(&sem->sem_prof, "sem", sem->sem_name);
+#endif
 
         return sem;
 }
@@ -81,6 +88,9 @@ sem_destroy(struct semaphore *sem)
         KASSERT(sem != NULL);
 
   /* wchan_cleanup will assert if anyone's waiting on it */
+#if OPT_LOCKPROF
+  lockprof_cleanup(&sem->sem_prof);
+#endif
   spinlock_cleanup(&sem->sem_lock);
   wchan_destroy(sem->sem_wchan);
         kfree(sem->sem_name);
@@ -90,6 +100,11 @@ sem_destroy(struct semaphore *sem)
 void 
 P(struct semaphore *sem)
 {
+#if OPT_LOCKPROF
+        uint64_t start;
+        bool contended;
+#endif
+
         KASSERT(sem != NULL);
 
         /*
@@ -100,7 +115,13 @@ P(struct semaphore *sem)
          */
         KASSERT(curthread->t_in_interrupt == false);
 
+#if OPT_LOCKPROF
+  start = lockprof_now();
+#endif
   spinlock_acquire(&sem->sem_lock);
+#if OPT_LOCKPROF
+  contended = sem->sem_count == 0;
+#endif
         while (sem->sem_count == 0) {
     /*
      * Bridge to the wchan lock, so if someone else comes
@@ -126,7 +147,70 @@ P(struct semaphore *sem)
         }
         KASSERT(sem->sem_count > 0);
         sem->sem_count--;
+#if OPT_LOCKPROF
+  lockprof_acquired(&sem->sem_prof, start, contended,
+                    __builtin_return_address(0));
+#endif
+  spinlock_release(&sem->sem_lock);
+}
+
+// Hardclocks from now until DSECS/DNSECS, or 0 if that's passed.
+static unsigned
+ticks_until(time_t dsecs, uint32_t dnsecs)
+{
+  time_t secs;
+  uint32_t nsecs;
+
+  gettime(&secs, &nsecs);
+  if (secs > dsecs || (secs == dsecs && nsecs >= dnsecs)) {
+    return 0;
+  }
+  if (dnsecs < nsecs) {
+    dnsecs += 1000000000;
+    dsecs--;
+  }
+  return clock_nstoticks(dsecs - secs, dnsecs - nsecs);
+}
+
+int
+P_timeout(struct semaphore *sem, unsigned ticks)
+{
+  time_t dsecs;
+  uint32_t dnsecs;
+  unsigned left;
+
+  KASSERT(sem != NULL);
+  KASSERT(curthread->t_in_interrupt == false);
+
+  // Work out when to give up. Someone else can get in ahead of us
+  // after a V, so we may have to sleep more than once.
+  gettime(&dsecs, &dnsecs);
+  dsecs += ticks / HZ;
+  dnsecs += (ticks % HZ) * NSEC_PER_HARDCLOCK;
+  if (dnsecs >= 1000000000) {
+    dnsecs -= 1000000000;
+    dsecs++;
+  }
+
+  spinlock_acquire(&sem->sem_lock);
+  while (sem->sem_count == 0) {
+    left = ticks_until(dsecs, dnsecs);
+    if (left == 0) {
+      spinlock_release(&sem->sem_lock);
+      return ETIMEDOUT;
+    }
+    // Same bridging as in P.
+    wchan_lock(sem->sem_wchan);
+    spinlock_release(&sem->sem_lock);
+    wchan_sleep_timeout(sem->sem_wchan, left);
+
+    spinlock_acquire(&sem->sem_lock);
+  }
+  KASSERT(sem->sem_count > 0);
+  sem->sem_count--;
   spinlock_release(&sem->sem_lock);
+
+  return 0;
 }
 
 void
@@ -175,6 +259,11 @@ lock_create(const char *name)
         spinlock_init(&lock->lk_spinlock);
         lock->lk_curthread = NULL;
         lock->lk_hold = 0;
+        lock->lk_nwaiters = 0;
+        lock->lk_handoff = false;
+#if OPT_LOCKPROF
+        lockprof_init(&lock->lk_prof, "lock", lock->lk_name);
+#endif
 
         //end
 
@@ -189,6 +278,9 @@ lock_destroy(struct lock *lock)
         // add stuff here as needed
 
         if (lock->lk_hold == 0) {
+#if OPT_LOCKPROF
+          lockprof_cleanup(&lock->lk_prof);
+#endif
           spinlock_cleanup(&lock->lk_spinlock);
           wchan_destroy(lock->lk_wchan);
         }
@@ -199,57 +291,112 @@ lock_destroy(struct lock *lock)
         kfree(lock);
 }
 
+// True if OWNER is running right now on some other cpu. This is a
+// hint, read without any locks: OWNER could stop running, or even exit,
+// at any point. Exiting while holding a lock is a bug anyway, and
+// thread structures live in kernel memory that stays mapped.
+static bool
+lock_owner_running(volatile struct thread *owner)
+{
+        return owner != NULL && owner->t_state == S_RUN &&
+          owner->t_cpu != curcpu->c_self;
+}
+
 void
 lock_acquire(struct lock *lock)
 {
-        // Write this
+        lock_acquire_from(lock, __builtin_return_address(0));
+}
+
+void
+lock_acquire_from(struct lock *lock, const void *site)
+{
+        volatile struct thread *owner;
+#if OPT_LOCKPROF
+        uint64_t start;
+        bool contended;
+#endif
+
+        KASSERT(lock != NULL);
+        KASSERT(curthread->t_in_interrupt == false);
 
+#if OPT_LOCKPROF
+        start = lockprof_now();
+#endif
         spinlock_acquire(&lock->lk_spinlock);
+#if OPT_LOCKPROF
+        contended = lock->lk_hold == 1;
+#else
+        (void)site;
+#endif
 
         while(lock->lk_hold == 1) {
 
+          // Adaptive part: if the holder is running on another cpu
+          // it'll probably let go soon, so wait for that rather than
+          // paying for a sleep and a wakeup. Not if others are already
+          // asleep, though; it goes to them first.
+          owner = lock->lk_curthread;
+          if (lock->lk_nwaiters == 0 && lock_owner_running(owner)) {
+            spinlock_release(&lock->lk_spinlock);
+            while (lock->lk_hold == 1 && lock->lk_curthread == owner &&
+                   lock_owner_running(owner)) {
+              // spin
+            }
+            spinlock_acquire(&lock->lk_spinlock);
+            continue;
+          }
+
+          lock->lk_nwaiters++;
+          KTRACE(KTE_LOCKWAIT, (vaddr_t)lock, 0);
           wchan_lock(lock->lk_wchan);
           spinlock_release(&lock->lk_spinlock);
           wchan_sleep(lock->lk_wchan);
           spinlock_acquire(&lock->lk_spinlock);
+
+          // lock_release hands the lock straight to whoever it wakes,
+          // so there's no race to lose once we're up.
+          if (lock->lk_handoff) {
+            lock->lk_handoff = false;
+            KTRACE(KTE_LOCKACQ, (vaddr_t)lock, 0);
+            break;
+          }
         }
 
         lock->lk_hold = 1;
         lock->lk_curthread = curthread;
+#if OPT_LOCKPROF
+        lockprof_acquired(&lock->lk_prof, start, contended, site);
+#endif
 
         spinlock_release(&lock->lk_spinlock);
-
-        //end
-
-        //(void)lock;  // suppress warning until code gets written
 }
 
 void
 lock_release(struct lock *lock)
 {
-        // Write this
-
         KASSERT(lock != NULL);
 
-        //spinlock_acquire(&lock->lk_spinlock);
-
         if (lock_do_i_hold(lock)) {
 
           spinlock_acquire(&lock->lk_spinlock);
+#if OPT_LOCKPROF
+          lockprof_released(&lock->lk_prof);
+#endif
           lock->lk_curthread = NULL;
-          lock->lk_hold = 0;
-          // Two days of struggle and me not
-          // reading the code right was the
-          // problem!!! wchan will not wake
-          // someone up randomly. This is there
-          // in the wchan include file.
-          wchan_wakeone(lock->lk_wchan);
+          if (lock->lk_nwaiters > 0) {
+            // Hand off to the oldest sleeper (the wchan is FIFO)
+            // without ever letting go, so it can't starve. Anyone
+            // spinning or arriving meanwhile sees it still held.
+            lock->lk_nwaiters--;
+            lock->lk_handoff = true;
+            wchan_wakeone(lock->lk_wchan);
+          }
+          else {
+            lock->lk_hold = 0;
+          }
           spinlock_release(&lock->lk_spinlock);
         }
-
-        //end
-
-        //(void)lock;  // suppress warning until code gets written
 }
 
 bool
@@ -362,6 +509,26 @@ cv_wait(struct cv *cv, struct lock *lock)
   // (void)lock;  // suppress warning until code gets written
 }
 
+int
+cv_timedwait(struct cv *cv, struct lock *lock, unsigned ticks)
+{
+  int result;
+
+  KASSERT(curthread->t_in_interrupt == false);
+  KASSERT(lock_do_i_hold(lock));
+
+  // Same as cv_wait, except for the sleep.
+  spinlock_acquire(&cv->cv_spinlock);
+  lock_release(lock);
+  wchan_lock(cv->cv_wchan);
+  spinlock_release(&cv->cv_spinlock);
+
+  result = wchan_sleep_timeout(cv->cv_wchan, ticks);
+  lock_acquire(lock);
+
+  return result;
+}
+
 void
 cv_signal(struct cv *cv, struct lock *lock)
 {
@@ -376,7 +543,6 @@ cv_signal(struct cv *cv, struct lock *lock)
 
   if (lock_do_i_hold(lock)) {
 
-    spinlock_acquire(&cv->cv_spinlock);
     wchan_wakeone(cv->cv_wchan);
     spinlock_flag = 1;
     spinlock_release(&cv->cv_spinlock);
@@ -425,69 +591,137 @@ cv_broadcast(struct cv *cv, struct lock *lock)
 /////////////////////////////////////////////////////
 // RW Locks
 //
-
-/*struct rwlock * rwlock_create(const char *name) {
-
+// Readers only ever touch the spinlock unless there's a writer about.
+// Writers get preference: once one is waiting, new readers wait too,
+// so a steady stream of readers can't starve it. When a writer lets
+// go and no other writer is waiting, all the waiting readers are let
+// in at once.
+
+struct rwlock *
+rwlock_create(const char *name)
+{
   struct rwlock *rwlock;
 
   rwlock = kmalloc(sizeof(struct rwlock));
-  if (rwlock == NULL) return NULL;
+  if (rwlock == NULL) {
+    return NULL;
+  }
 
   rwlock->rwl_name = kstrdup(name);
   if (rwlock->rwl_name == NULL) {
-    kfree(lock);
+    kfree(rwlock);
     return NULL;
   }
 
-  rwlock->rwl_rwchan = wchan_create("RWLock Reader Wait Channel");
-  rwlock->rwl_wwchan = wchan_create("RWLock Writer Wait Channel");
-  if (rwlock->rwl_rwchan == NULL || rwlock->rwl_rwchan == NULL) {
-    kfree (rwlock->rwl_name);
-    kfree (rwlock);
+  rwlock->rwl_rwchan = wchan_create("RWLock reader wchan");
+  if (rwlock->rwl_rwchan == NULL) {
+    kfree(rwlock->rwl_name);
+    kfree(rwlock);
     return NULL;
   }
 
-  spinlock_init(&rwlock->rwl_spinlock);
+  rwlock->rwl_wwchan = wchan_create("RWLock writer wchan");
+  if (rwlock->rwl_wwchan == NULL) {
+    wchan_destroy(rwlock->rwl_rwchan);
+    kfree(rwlock->rwl_name);
+    kfree(rwlock);
+    return NULL;
+  }
 
-  mode = -1;
+  spinlock_init(&rwlock->rwl_spinlock);
+  rwlock->rwl_readers = 0;
+  rwlock->rwl_writers_waiting = 0;
+  rwlock->rwl_writer = NULL;
 
-  sem_create(rwlock->rwl_rsem);
-  sem_create(rwlock->rwl_wsem);
-  if (rwlock->rwl_rsem == NULL || rwlock->rwl_wsem == NULL) {
-    kfree (rwlock->rwl_name);
-    kfree (rwlock);
-  }
   return rwlock;
 }
 
-void rwlock_destory(struct rwlock *rwlock) {
+void
+rwlock_destroy(struct rwlock *rwlock)
+{
+  KASSERT(rwlock != NULL);
+  KASSERT(rwlock->rwl_readers == 0);
+  KASSERT(rwlock->rwl_writer == NULL);
+  KASSERT(rwlock->rwl_writers_waiting == 0);
+
+  spinlock_cleanup(&rwlock->rwl_spinlock);
+  wchan_destroy(rwlock->rwl_rwchan);
+  wchan_destroy(rwlock->rwl_wwchan);
+  kfree(rwlock->rwl_name);
+  kfree(rwlock);
+}
 
+void
+rwlock_acquire_read(struct rwlock *rwlock)
+{
   KASSERT(rwlock != NULL);
 
-  spinlock_cleanup (&rwlock->rwl_spinlock);
-  wchan_destroy (rwlock->rwl_rwchan);
-  wchan_destroy (rwlock->rwl_wwchan);
-  sem_destory (rwlock->rsem);
-  sem_destory (rwlock->wsem);
-  kfree (rwlock->rwl_name);
-  kfree (rwlock);
+  spinlock_acquire(&rwlock->rwl_spinlock);
+  while (rwlock->rwl_writer != NULL || rwlock->rwl_writers_waiting > 0) {
+    KASSERT(curthread->t_in_interrupt == false);
+    wchan_lock(rwlock->rwl_rwchan);
+    spinlock_release(&rwlock->rwl_spinlock);
+    wchan_sleep(rwlock->rwl_rwchan);
+    spinlock_acquire(&rwlock->rwl_spinlock);
+  }
+  rwlock->rwl_readers++;
+  spinlock_release(&rwlock->rwl_spinlock);
 }
 
-void rwlock_acquire_read(struct rwlock *rwlock) {
-
-  KASSERT(rwlock != NULL)
+void
+rwlock_release_read(struct rwlock *rwlock)
+{
+  KASSERT(rwlock != NULL);
 
+  spinlock_acquire(&rwlock->rwl_spinlock);
+  KASSERT(rwlock->rwl_readers > 0);
+  rwlock->rwl_readers--;
+  if (rwlock->rwl_readers == 0 && rwlock->rwl_writers_waiting > 0) {
+    wchan_wakeone(rwlock->rwl_wwchan);
+  }
+  spinlock_release(&rwlock->rwl_spinlock);
 }
 
-void rwlock_read_release(struct rwlock * rwlock) {
-
+void
+rwlock_acquire_write(struct rwlock *rwlock)
+{
   KASSERT(rwlock != NULL);
 
+  spinlock_acquire(&rwlock->rwl_spinlock);
+  KASSERT(rwlock->rwl_writer != curthread);
+  rwlock->rwl_writers_waiting++;
+  while (rwlock->rwl_writer != NULL || rwlock->rwl_readers > 0) {
+    KASSERT(curthread->t_in_interrupt == false);
+    wchan_lock(rwlock->rwl_wwchan);
+    spinlock_release(&rwlock->rwl_spinlock);
+    wchan_sleep(rwlock->rwl_wwchan);
+    spinlock_acquire(&rwlock->rwl_spinlock);
+  }
+  rwlock->rwl_writers_waiting--;
+  rwlock->rwl_writer = curthread;
+  spinlock_release(&rwlock->rwl_spinlock);
 }
 
-void rwlock_acquire_write(struct rwlock *rwlock) {
+void
+rwlock_release_write(struct rwlock *rwlock)
+{
+  KASSERT(rwlock != NULL);
 
-  (void) rwlock;
+  spinlock_acquire(&rwlock->rwl_spinlock);
+  KASSERT(rwlock->rwl_writer == curthread);
+  rwlock->rwl_writer = NULL;
+  if (rwlock->rwl_writers_waiting > 0) {
+    wchan_wakeone(rwlock->rwl_wwchan);
+  }
+  else {
+    // Batch: everyone who queued up behind us.
+    wchan_wakeall(rwlock->rwl_rwchan);
+  }
+  spinlock_release(&rwlock->rwl_spinlock);
+}
 
-  return;
-}*/
+bool
+rwlock_do_i_hold_write(struct rwlock *rwlock)
+{
+  return rwlock->rwl_writer == curthread;
+}
@@ -44,7 +44,11 @@
 #include <threadprivate.h>
 #include <current.h>
 #include <synch.h>
+#include <clock.h>
+#include <callout.h>
 #include <addrspace.h>
+#include <aio.h>
+#include <ktrace.h>
 #include <mainbus.h>
 #include <vnode.h>
 
@@ -146,6 +150,12 @@ thread_create(const char *name)
 	thread->t_stack = NULL;
 	thread->t_context = NULL;
 	thread->t_cpu = NULL;
+	thread->t_priority = 0;
+	thread->t_ticks = 0;
+	thread->t_lastrun = 0;
+	thread->t_wchan = NULL;
+	cputime_init(&thread->t_cputime);
+	cputime_init(&thread->t_childtime);
 
 	/* Interrupt state fields */
 	thread->t_in_interrupt = false;
@@ -164,8 +174,12 @@ thread_create(const char *name)
   for (i = 0; i < OPEN_MAX; i++)
       thread->file_desctable[i] = NULL;
 
+  thread->t_aio = NULL;
+
   // Process syscall stuff
   // init's favourite song is Name (that and slide for me).
+  // pid stays 0 (not a real pid) if the table is full.
+  thread->pid = 0;
   thread->ppid = 2;
   assign_pid(thread);
 
@@ -184,7 +198,7 @@ struct cpu *
 cpu_create(unsigned hardware_number)
 {
 	struct cpu *c;
-	int result;
+	int result, i;
 	char namebuf[16];
 
 	c = kmalloc(sizeof(*c));
@@ -198,10 +212,24 @@ cpu_create(unsigned hardware_number)
 	c->c_curthread = NULL;
 	threadlist_init(&c->c_zombies);
 	c->c_hardclocks = 0;
+	c->c_lastschedule = 0;
+	c->c_lastboost = 0;
+	c->c_timerdue = 0;
+	cputime_init(&c->c_cputime);
+	c->c_cpustate = CPUTIME_SYS;
+	c->c_cpustamp = 0;
+	c->c_mcsnodes_inuse = 0;
 
 	c->c_isidle = false;
-	threadlist_init(&c->c_runqueue);
-	spinlock_init(&c->c_runqueue_lock);
+	c->c_tickless = false;
+	for (i=0; i<SCHED_NLEVELS; i++) {
+		threadlist_init(&c->c_runqueue[i]);
+	}
+	/* Hot, and contended once cpus steal from each other */
+	spinlock_init_queued(&c->c_runqueue_lock);
+	lockprof_spinlock(&c->c_runqueue_lock, "runqueue");
+
+	callwheel_init(&c->c_callwheel);
 
 	c->c_ipi_pending = 0;
 	c->c_numshootdown = 0;
@@ -211,6 +239,7 @@ cpu_create(unsigned hardware_number)
 	if (result != 0) {
 		panic("cpu_create: array_add: %s\n", strerror(result));
 	}
+	ktrace_cpuinit(c);
 
 	snprintf(namebuf, sizeof(namebuf), "<boot #%d>", c->c_number);
 	c->c_curthread = thread_create(namebuf);
@@ -309,6 +338,8 @@ exorcise(void)
 void
 thread_panic(void)
 {
+	unsigned i;
+
 	/*
 	 * Kill off other CPUs.
 	 *
@@ -323,9 +354,11 @@ thread_panic(void)
 	 * to.  Instead, blat the list structure by hand, and take the
 	 * risk that it might not be quite atomic.
 	 */
-	curcpu->c_runqueue.tl_count = 0;
-	curcpu->c_runqueue.tl_head.tln_next = NULL;
-	curcpu->c_runqueue.tl_tail.tln_prev = NULL;
+	for (i=0; i<SCHED_NLEVELS; i++) {
+		curcpu->c_runqueue[i].tl_count = 0;
+		curcpu->c_runqueue[i].tl_head.tln_next = NULL;
+		curcpu->c_runqueue[i].tl_tail.tln_prev = NULL;
+	}
 
 	/*
 	 * Ideally, we want to make sure sleeping threads don't wake
@@ -443,6 +476,262 @@ thread_start_cpus(void)
 	cpu_startup_sem = NULL;
 }
 
+/*
+ * Print each cpu's time accounting, in milliseconds.
+ */
+void
+cpu_printtimes(void)
+{
+	unsigned i;
+	struct cpu *c;
+	struct cputime ct;
+	int spl;
+
+	/* Bring our own figures up to now. */
+	spl = splhigh();
+	cputime_switch(cputime_switch(CPUTIME_SYS));
+	splx(spl);
+
+	kprintf("cpu     user      sys     intr     idle"
+		"     vcsw    ivcsw\n");
+	for (i=0; i < cpuarray_num(&allcpus); i++) {
+		c = cpuarray_get(&allcpus, i);
+		ct = c->c_cputime;
+		kprintf("%3u %8llu %8llu %8llu %8llu %8u %8u\n", i,
+			ct.ct_ns[CPUTIME_USER] / 1000000,
+			ct.ct_ns[CPUTIME_SYS] / 1000000,
+			ct.ct_ns[CPUTIME_INTR] / 1000000,
+			ct.ct_ns[CPUTIME_IDLE] / 1000000,
+			ct.ct_vcsw, ct.ct_ivcsw);
+	}
+}
+
+/*
+ * Run queue operations. A cpu's run queue is really SCHED_NLEVELS
+ * queues, one per priority level; threads are taken from the highest
+ * priority (lowest numbered) nonempty level, round-robin within it.
+ * The caller must hold the cpu's run queue lock.
+ */
+
+/* Total number of threads on the run queues. */
+static
+unsigned
+runqueue_count(struct cpu *c)
+{
+	unsigned i, count;
+
+	count = 0;
+	for (i=0; i<SCHED_NLEVELS; i++) {
+		count += c->c_runqueue[i].tl_count;
+	}
+	return count;
+}
+
+/* Check if anything at level MAXLEVEL or better is waiting to run. */
+static
+bool
+runqueue_hasready(struct cpu *c, unsigned maxlevel)
+{
+	unsigned i;
+
+	for (i=0; i<=maxlevel && i<SCHED_NLEVELS; i++) {
+		if (!threadlist_isempty(&c->c_runqueue[i])) {
+			return true;
+		}
+	}
+	return false;
+}
+
+/* Add a thread at the end of its level. */
+static
+void
+runqueue_add(struct cpu *c, struct thread *t)
+{
+	KASSERT(t->t_priority < SCHED_NLEVELS);
+	threadlist_addtail(&c->c_runqueue[t->t_priority], t);
+}
+
+/* Take the next thread to run, or NULL if there isn't one. */
+static
+struct thread *
+runqueue_remnext(struct cpu *c)
+{
+	unsigned i;
+
+	for (i=0; i<SCHED_NLEVELS; i++) {
+		if (!threadlist_isempty(&c->c_runqueue[i])) {
+			return threadlist_remhead(&c->c_runqueue[i]);
+		}
+	}
+	return NULL;
+}
+
+#if !OPT_DEFAULTSCHEDULER
+/* MLFQ quantum at each level, in hardclocks. (See "Scheduler" below.) */
+static const unsigned sched_quantum[SCHED_NLEVELS] = { 1, 2, 4, 8 };
+
+/* How often to put everything back at the top. */
+#define SCHED_BOOST_HARDCLOCKS	HZ
+#endif
+
+/*
+ * Tickless operation.
+ *
+ * A cpu only takes a timer interrupt when the scheduler will have
+ * something to do then: when the thread about to run (T) will have
+ * used up its quantum, and only if something else is waiting to run.
+ * Otherwise the tick is switched off (c_tickless), and
+ * thread_make_runnable kicks the cpu with an IPI when that changes.
+ * An idle cpu switches its tick off too.
+ *
+ * Call with the cpu's run queue locked.
+ */
+static
+void
+thread_nexttick(struct thread *t)
+{
+	unsigned ticks;
+
+	if (!runqueue_hasready(curcpu, SCHED_NLEVELS - 1)) {
+		/* Nobody to preempt T for */
+		curcpu->c_tickless = true;
+		hardclock_settimer(0);
+		return;
+	}
+
+#if OPT_DEFAULTSCHEDULER
+	(void)t;
+	ticks = 1;
+#else
+	ticks = sched_quantum[t->t_priority];
+	ticks = t->t_ticks < ticks ? ticks - t->t_ticks : 1;
+#endif
+	curcpu->c_tickless = false;
+	hardclock_settimer(ticks);
+}
+
+/*
+ * Make an idle cpu other than TARGET wake up, so it can steal the
+ * work just queued on TARGET. The idle flags are read unlocked; this
+ * is only a hint.
+ */
+static
+void
+thread_kick_idle(struct cpu *target)
+{
+	unsigned i, numcpus;
+	struct cpu *c;
+
+	numcpus = cpuarray_num(&allcpus);
+	for (i=0; i<numcpus; i++) {
+		c = cpuarray_get(&allcpus, i);
+		if (c != target && c->c_isidle) {
+			ipi_send(c, IPI_UNIDLE);
+			return;
+		}
+	}
+}
+
+/*
+ * Work stealing.
+ *
+ * New and woken threads go on the run queue of the cpu they last ran
+ * on. Instead of pushing threads around periodically, a cpu that runs
+ * out of work looks for the busiest other cpu and takes a thread from
+ * the end of its run queue (the one it would have run last). Only the
+ * idle cpu pays for this, and it takes one other run queue lock, not
+ * all of them.
+ *
+ * Migrating threads isn't free because of cache affinity; a thread's
+ * working cache set will end up having to be moved to the other CPU.
+ * So a thread that ran on its cpu within the last STEAL_HOT_HARDCLOCKS
+ * counts as cache-hot, and is only taken if the victim has at least
+ * STEAL_HOT_MINQUEUE threads waiting, that is, when it would have to
+ * wait a while anyway.
+ */
+#define STEAL_HOT_HARDCLOCKS	2
+#define STEAL_HOT_MINQUEUE	2
+
+/* Is T worth taking from its cpu C? C's run queue lock is held. */
+static
+bool
+thread_stealable(struct cpu *c, struct thread *t, unsigned queued)
+{
+	/*
+	 * Ordinarily, a cpu's curthread will not appear on its run
+	 * queue. However, it can if it went to sleep, the cpu went
+	 * idle so it remained curthread, it was woken up, and the cpu
+	 * hasn't fully unidled yet. Migrating it then would be a
+	 * disaster, because it's still on that cpu's stack.
+	 */
+	if (t == c->c_curthread) {
+		return false;
+	}
+	if (c->c_hardclocks - t->t_lastrun < STEAL_HOT_HARDCLOCKS) {
+		return queued >= STEAL_HOT_MINQUEUE;
+	}
+	return true;
+}
+
+/*
+ * Try to find a thread for the current (idle) cpu on another cpu's
+ * run queue. If one is found, it has been moved to this cpu (but not
+ * put on its run queue) and is returned.
+ *
+ * Called with no run queue locks held, so that we never hold two.
+ */
+static
+struct thread *
+thread_steal(void)
+{
+	unsigned i, numcpus, count, bestcount, level;
+	struct cpu *c, *victim;
+	struct thread *t;
+
+	/*
+	 * Pick the cpu with the most waiting. The counts are read
+	 * without locking, so they're only a hint; it's rechecked
+	 * below. A cpu that is idle will run its own queue shortly.
+	 */
+	victim = NULL;
+	bestcount = 0;
+	numcpus = cpuarray_num(&allcpus);
+	for (i=0; i<numcpus; i++) {
+		c = cpuarray_get(&allcpus, i);
+		if (c == curcpu->c_self || c->c_isidle) {
+			continue;
+		}
+		count = runqueue_count(c);
+		if (count > bestcount) {
+			victim = c;
+			bestcount = count;
+		}
+	}
+	if (victim == NULL) {
+		return NULL;
+	}
+
+	spinlock_acquire(&victim->c_runqueue_lock);
+	count = runqueue_count(victim);
+	for (level = SCHED_NLEVELS; level-- > 0; ) {
+		THREADLIST_FORALL_REV(t, victim->c_runqueue[level]) {
+			if (thread_stealable(victim, t, count)) {
+				threadlist_remove(&victim->c_runqueue[level],
+						  t);
+				t->t_cpu = curcpu->c_self;
+				spinlock_release(&victim->c_runqueue_lock);
+				DEBUG(DB_THREADS,
+				      "Stole thread %s: cpu %u -> %u",
+				      t->t_name, victim->c_number,
+				      curcpu->c_number);
+				return t;
+			}
+		}
+	}
+	spinlock_release(&victim->c_runqueue_lock);
+	return NULL;
+}
+
 /*
  * Make a thread runnable.
  *
@@ -467,7 +756,7 @@ thread_make_runnable(struct thread *target, bool already_have_lock)
 	}
 
 	isidle = targetcpu->c_isidle;
-	threadlist_addtail(&targetcpu->c_runqueue, target);
+	runqueue_add(targetcpu, target);
 	if (isidle) {
 		/*
 		 * Other processor is idle; send interrupt to make
@@ -475,6 +764,25 @@ thread_make_runnable(struct thread *target, bool already_have_lock)
 		 */
 		ipi_send(targetcpu, IPI_UNIDLE);
 	}
+	else {
+		/*
+		 * If the cpu has switched its tick off, or is running
+		 * something less important, it needs a tick soon to
+		 * reconsider. And some idle cpu could steal this.
+		 */
+		if (targetcpu->c_tickless ||
+		    target->t_priority <
+		    targetcpu->c_curthread->t_priority) {
+			if (targetcpu == curcpu->c_self) {
+				hardclock_settimer(1);
+			}
+			else {
+				ipi_send(targetcpu, IPI_UNIDLE);
+			}
+			targetcpu->c_tickless = false;
+		}
+		thread_kick_idle(targetcpu);
+	}
 
 	if (!already_have_lock) {
 		spinlock_release(&targetcpu->c_runqueue_lock);
@@ -482,21 +790,23 @@ thread_make_runnable(struct thread *target, bool already_have_lock)
 }
 
 /*
- * Create a new thread based on an existing one.
+ * Create a new thread based on an existing one, but don't start it.
  *
- * The new thread has name NAME, and starts executing in function
- * ENTRYPOINT. DATA1 and DATA2 are passed to ENTRYPOINT.
+ * The new thread has name NAME, and will start executing in function
+ * ENTRYPOINT once passed to thread_start. DATA1 and DATA2 are passed
+ * to ENTRYPOINT.
  *
  * The new thread is given no address space (the caller decides that)
- * but inherits its current working directory from the caller. It will
- * start on the same CPU as the caller, unless the scheduler
- * intervenes first.
+ * but inherits its current working directory from the caller. Until
+ * it is started nothing else can see it, so the caller may finish
+ * setting it up without locking; or it can be thrown away with
+ * thread_discard.
  */
 int
-thread_fork(const char *name,
-	    void (*entrypoint)(void *data1, unsigned long data2),
-	    void *data1, unsigned long data2,
-	    struct thread **ret)
+thread_prepare(const char *name,
+	       void (*entrypoint)(void *data1, unsigned long data2),
+	       void *data1, unsigned long data2,
+	       struct thread **ret)
 {
 	struct thread *newthread;
 
@@ -539,8 +849,52 @@ thread_fork(const char *name,
 	/* Set up the switchframe so entrypoint() gets called */
 	switchframe_init(newthread, entrypoint, data1, data2);
 
+	*ret = newthread;
+	return 0;
+}
+
+/*
+ * Start a thread made by thread_prepare. It will start on the same
+ * CPU as the caller, unless the scheduler intervenes first.
+ */
+void
+thread_start(struct thread *newthread)
+{
 	/* Lock the current cpu's run queue and make the new thread runnable */
 	thread_make_runnable(newthread, false);
+}
+
+/*
+ * Throw away a thread made by thread_prepare that was never started.
+ */
+void
+thread_discard(struct thread *newthread)
+{
+	if (newthread->t_cwd != NULL) {
+		VOP_DECREF(newthread->t_cwd);
+		newthread->t_cwd = NULL;
+	}
+	thread_destroy(newthread);
+}
+
+/*
+ * Create a new thread based on an existing one and start it.
+ */
+int
+thread_fork(const char *name,
+	    void (*entrypoint)(void *data1, unsigned long data2),
+	    void *data1, unsigned long data2,
+	    struct thread **ret)
+{
+	struct thread *newthread;
+	int result;
+
+	result = thread_prepare(name, entrypoint, data1, data2, &newthread);
+	if (result) {
+		return result;
+	}
+
+	thread_start(newthread);
 
 	/*
 	 * Return new thread structure if it's wanted. Note that using
@@ -569,6 +923,7 @@ void
 thread_switch(threadstate_t newstate, struct wchan *wc)
 {
 	struct thread *cur, *next;
+	unsigned cpustate;
 	int spl;
 
 	DEBUGASSERT(curcpu->c_curthread == curthread);
@@ -594,13 +949,40 @@ thread_switch(threadstate_t newstate, struct wchan *wc)
 	/* Lock the run queue. */
 	spinlock_acquire(&curcpu->c_runqueue_lock);
 
-	/* Micro-optimization: if nothing to do, just return */
-	if (newstate == S_READY && threadlist_isempty(&curcpu->c_runqueue)) {
+	/*
+	 * Micro-optimization: if nothing to do, just return. A thread
+	 * only yields to threads at its own priority level or better.
+	 */
+	if (newstate == S_READY &&
+	    !runqueue_hasready(curcpu, cur->t_priority)) {
 		spinlock_release(&curcpu->c_runqueue_lock);
 		splx(spl);
 		return;
 	}
 
+	/* Remember when it last ran here, for thread_steal. */
+	cur->t_lastrun = curcpu->c_hardclocks;
+
+	/*
+	 * Count the switch. Being put back on the run queue from an
+	 * interrupt is preemption; anything else the thread asked for.
+	 */
+	if (newstate == S_READY && cur->t_in_interrupt) {
+		cur->t_cputime.ct_ivcsw++;
+		curcpu->c_cputime.ct_ivcsw++;
+	}
+	else {
+		cur->t_cputime.ct_vcsw++;
+		curcpu->c_cputime.ct_vcsw++;
+	}
+
+	/*
+	 * The switch itself is kernel time. Save the state we were
+	 * in (we might be in an interrupt) to go back to when this
+	 * thread next runs.
+	 */
+	cpustate = cputime_switch(CPUTIME_SYS);
+
 	/* Put the thread in the right place. */
 	switch (newstate) {
 	    case S_RUN:
@@ -611,6 +993,7 @@ thread_switch(threadstate_t newstate, struct wchan *wc)
 		break;
 	    case S_SLEEP:
 		cur->t_wchan_name = wc->wc_name;
+		cur->t_wchan = wc;
 		/*
 		 * Add the thread to the list in the wait channel, and
 		 * unlock same. To avoid a race with someone else
@@ -654,15 +1037,26 @@ thread_switch(threadstate_t newstate, struct wchan *wc)
 	/* The current cpu is now idle. */
 	curcpu->c_isidle = true;
 	do {
-		next = threadlist_remhead(&curcpu->c_runqueue);
+		next = runqueue_remnext(curcpu);
 		if (next == NULL) {
 			spinlock_release(&curcpu->c_runqueue_lock);
-			cpu_idle();
+			/* Out of work here; look for some elsewhere */
+			next = thread_steal();
+			if (next == NULL) {
+				/* No ticks while idle */
+				hardclock_settimer(0);
+				cputime_switch(CPUTIME_IDLE);
+				cpu_idle();
+				cputime_switch(CPUTIME_SYS);
+			}
 			spinlock_acquire(&curcpu->c_runqueue_lock);
 		}
 	} while (next == NULL);
 	curcpu->c_isidle = false;
 
+	/* Set the timer for next's quantum */
+	thread_nexttick(next);
+
 	/*
 	 * Note that curcpu->c_curthread may be the same variable as
 	 * curthread and it may not be, depending on how curthread and
@@ -670,6 +1064,7 @@ thread_switch(threadstate_t newstate, struct wchan *wc)
 	 * assume the compiler will optimize one away if they're the
 	 * same.
 	 */
+	KTRACE(KTE_SWITCH, next->pid, newstate);
 	curcpu->c_curthread = next;
 	curthread = next;
 
@@ -727,6 +1122,13 @@ thread_switch(threadstate_t newstate, struct wchan *wc)
 	cur->t_wchan_name = NULL;
 	cur->t_state = S_RUN;
 
+	/*
+	 * Go back to the accounting state we switched out in. (New
+	 * threads skip this; they start in CPUTIME_SYS, which is
+	 * what the switch left the cpu in.)
+	 */
+	cputime_switch(cpustate);
+
 	/* Unlock the run queue. */
 	spinlock_release(&curcpu->c_runqueue_lock);
 
@@ -815,6 +1217,12 @@ thread_exit(void)
 		cur->t_cwd = NULL;
 	}
 
+	/* Outstanding async I/O still needs the address space */
+	aio_detach();
+
+	/* Close any files still open, now that async I/O is done */
+	file_closeall();
+
 	/* VM fields */
 	if (cur->t_addrspace) {
 		/*
@@ -829,6 +1237,9 @@ thread_exit(void)
 		as_destroy(as);
 	}
 
+	/* Pass our CPU time on to the parent; leave the process table */
+	proc_thread_exit(cur);
+
 	/* Check the stack guard band. */
 	thread_checkstack(cur);
 
@@ -852,146 +1263,124 @@ thread_yield(void)
 /*
  * Scheduler.
  *
- * This is called periodically from hardclock(). It should reshuffle
- * the current CPU's run queue by job priority.
+ * The default scheduler is plain round-robin: everything stays at
+ * level 0 and the running thread is preempted on every hardclock.
+ *
+ * Otherwise we run a multi-level feedback queue. Threads start at
+ * level 0. Each level has a quantum, longer at the lower levels; a
+ * thread that uses up its whole quantum is demoted one level, so
+ * compute-bound jobs (hog, matmult) sink. A thread woken up from a
+ * wait channel is promoted one level, so things that mostly wait for
+ * input (sh) stay near the top. Higher levels always run first, and
+ * a running thread is preempted at the next tick if something better
+ * becomes runnable. To keep the bottom levels from starving, every
+ * SCHED_BOOST_HARDCLOCKS everything runnable goes back to level 0.
  */
 
-#if OPT_DEFAULTSCHEDULER
+/*
+ * A thread has been woken up. Called before putting it on a run
+ * queue.
+ */
+static
 void
-schedule(void)
+thread_wakeboost(struct thread *t)
 {
-  // 28 Feb 2012 : GWA : Leave the default scheduler alone!
-}
+#if OPT_DEFAULTSCHEDULER
+	(void)t;
 #else
-void
-schedule(void)
-{
-  // 28 Feb 2012 : GWA : Implement your scheduler that prioritizes
-  // "interactive" threads here.
-}
+	if (t->t_priority > 0) {
+		t->t_priority--;
+	}
+	t->t_ticks = 0;
 #endif
+}
 
 /*
- * Thread migration.
- *
- * This is also called periodically from hardclock(). If the current
- * CPU is busy and other CPUs are idle, or less busy, it should move
- * threads across to those other other CPUs.
- *
- * Migrating threads isn't free because of cache affinity; a thread's
- * working cache set will end up having to be moved to the other CPU,
- * which is fairly slow. The tradeoff between this performance loss
- * and the performance loss due to underutilization of some CPUs is
- * something that needs to be tuned and probably is workload-specific.
- *
- * For here and now, because we know we're running on System/161 and
- * System/161 does not (yet) model such cache effects, we'll be very
- * aggressive.
+ * This is called from hardclock() on each timer interrupt; TICKS is
+ * how many ticks have gone by since the last one.
  */
 void
-thread_consider_migration(void)
+thread_tick(unsigned ticks)
 {
-	unsigned my_count, total_count, one_share, to_send;
-	unsigned i, numcpus;
-	struct cpu *c;
-	struct threadlist victims;
-	struct thread *t;
-
-	my_count = total_count = 0;
-	numcpus = cpuarray_num(&allcpus);
-	for (i=0; i<numcpus; i++) {
-		c = cpuarray_get(&allcpus, i);
-		spinlock_acquire(&c->c_runqueue_lock);
-		total_count += c->c_runqueue.tl_count;
-		if (c == curcpu->c_self) {
-			my_count = c->c_runqueue.tl_count;
-		}
-		spinlock_release(&c->c_runqueue_lock);
-	}
+	struct thread *cur = curthread;
+	bool preempt;
 
-	one_share = DIVROUNDUP(total_count, numcpus);
-	if (my_count < one_share) {
+	if (curcpu->c_isidle) {
+		/* Interrupted the idle loop; nobody to charge */
 		return;
 	}
 
-	to_send = my_count - one_share;
-	threadlist_init(&victims);
 	spinlock_acquire(&curcpu->c_runqueue_lock);
-	for (i=0; i<to_send; i++) {
-		t = threadlist_remtail(&curcpu->c_runqueue);
-		threadlist_addhead(&victims, t);
+#if OPT_DEFAULTSCHEDULER
+	(void)ticks;
+	preempt = runqueue_hasready(curcpu, 0);
+#else
+	cur->t_ticks += ticks;
+	if (cur->t_ticks >= sched_quantum[cur->t_priority]) {
+		/* Used its whole quantum: demote, and let others run */
+		if (cur->t_priority < SCHED_NLEVELS - 1) {
+			cur->t_priority++;
+		}
+		cur->t_ticks = 0;
+		preempt = runqueue_hasready(curcpu, cur->t_priority);
+	}
+	else {
+		/* Preempt only for something better */
+		preempt = cur->t_priority > 0 &&
+			runqueue_hasready(curcpu, cur->t_priority - 1);
+	}
+#endif
+	if (!preempt) {
+		/* Keep running; thread_switch does this otherwise */
+		thread_nexttick(cur);
 	}
 	spinlock_release(&curcpu->c_runqueue_lock);
 
-	for (i=0; i < numcpus && to_send > 0; i++) {
-		c = cpuarray_get(&allcpus, i);
-		if (c == curcpu->c_self) {
-			continue;
-		}
-		spinlock_acquire(&c->c_runqueue_lock);
-		while (c->c_runqueue.tl_count < one_share && to_send > 0) {
-			t = threadlist_remhead(&victims);
-			/*
-			 * Ordinarily, curthread will not appear on
-			 * the run queue. However, it can under the
-			 * following circumstances:
-			 *   - it went to sleep;
-			 *   - the processor became idle, so it
-			 *     remained curthread;
-			 *   - it was reawakened, so it was put on the
-			 *     run queue;
-			 *   - and the processor hasn't fully unidled
-			 *     yet, so all these things are still true.
-			 *
-			 * If the timer interrupt happens at (almost)
-			 * exactly the proper moment, we can come here
-			 * while things are in this state and see
-			 * curthread. However, *migrating* curthread
-			 * can cause bad things to happen (Exercise:
-			 * Why? And what?) so shuffle it to the end of
-			 * the list and decrement to_send in order to
-			 * skip it. Then it goes back on our own run
-			 * queue below.
-			 */
-			if (t == curthread) {
-				threadlist_addtail(&victims, t);
-				to_send--;
-				continue;
-			}
+	if (preempt) {
+		thread_yield();
+	}
+}
 
-			t->t_cpu = c;
-			threadlist_addtail(&c->c_runqueue, t);
-			DEBUG(DB_THREADS,
-			      "Migrated thread %s: cpu %u -> %u",
-			      t->t_name, curcpu->c_number, c->c_number);
-			to_send--;
-			if (c->c_isidle) {
-				/*
-				 * Other processor is idle; send
-				 * interrupt to make sure it unidles.
-				 */
-				ipi_send(c, IPI_UNIDLE);
-			}
-		}
-		spinlock_release(&c->c_runqueue_lock);
+/*
+ * This is called periodically from hardclock(). It should reshuffle
+ * the current CPU's run queue by job priority.
+ */
+
+#if OPT_DEFAULTSCHEDULER
+void
+schedule(void)
+{
+  // 28 Feb 2012 : GWA : Leave the default scheduler alone!
+}
+#else
+void
+schedule(void)
+{
+	struct thread *t;
+	unsigned i;
+
+	if (curcpu->c_hardclocks - curcpu->c_lastboost
+	    < SCHED_BOOST_HARDCLOCKS) {
+		return;
 	}
+	curcpu->c_lastboost = curcpu->c_hardclocks;
 
-	/*
-	 * Because the code above isn't atomic, the thread counts may have
-	 * changed while we were working and we may end up with leftovers.
-	 * Don't panic; just put them back on our own run queue.
-	 */
-	if (!threadlist_isempty(&victims)) {
-		spinlock_acquire(&curcpu->c_runqueue_lock);
-		while ((t = threadlist_remhead(&victims)) != NULL) {
-			threadlist_addtail(&curcpu->c_runqueue, t);
+	spinlock_acquire(&curcpu->c_runqueue_lock);
+	for (i=1; i<SCHED_NLEVELS; i++) {
+		while ((t = threadlist_remhead(&curcpu->c_runqueue[i]))
+		       != NULL) {
+			t->t_priority = 0;
+			t->t_ticks = 0;
+			threadlist_addtail(&curcpu->c_runqueue[0], t);
 		}
-		spinlock_release(&curcpu->c_runqueue_lock);
 	}
-
-	KASSERT(threadlist_isempty(&victims));
-	threadlist_cleanup(&victims);
+	if (!curcpu->c_isidle) {
+		curthread->t_priority = 0;
+		curthread->t_ticks = 0;
+	}
+	spinlock_release(&curcpu->c_runqueue_lock);
 }
+#endif
 
 ////////////////////////////////////////////////////////////
 
@@ -1064,6 +1453,74 @@ wchan_sleep(struct wchan *wc)
 	thread_switch(S_SLEEP, wc);
 }
 
+/*
+ * State shared between wchan_sleep_timeout and its callout.
+ */
+struct wchan_timeout {
+	struct thread *wt_thread;
+	struct wchan *wt_wchan;
+	bool wt_timedout;
+};
+
+/*
+ * Callout for wchan_sleep_timeout: if the thread is still asleep on
+ * the channel, take it off and wake it. Whoever gets the channel
+ * lock first, this or a wakeup, is the one that wakes the thread.
+ */
+static
+void
+wchan_timeout(void *data)
+{
+	struct wchan_timeout *wt = data;
+	struct thread *target = wt->wt_thread;
+	struct wchan *wc = wt->wt_wchan;
+
+	spinlock_acquire(&wc->wc_lock);
+	if (target->t_wchan != wc) {
+		/* Already woken up */
+		spinlock_release(&wc->wc_lock);
+		return;
+	}
+	threadlist_remove(&wc->wc_threads, target);
+	target->t_wchan = NULL;
+	wt->wt_timedout = true;
+	spinlock_release(&wc->wc_lock);
+
+	thread_wakeboost(target);
+	thread_make_runnable(target, false);
+}
+
+/*
+ * Like wchan_sleep, but give up after TICKS hardclocks. Returns 0 if
+ * woken up, or ETIMEDOUT.
+ */
+int
+wchan_sleep_timeout(struct wchan *wc, unsigned ticks)
+{
+	struct wchan_timeout wt;
+	struct callout co;
+
+	/* may not sleep in an interrupt handler */
+	KASSERT(!curthread->t_in_interrupt);
+
+	wt.wt_thread = curthread;
+	wt.wt_wchan = wc;
+	wt.wt_timedout = false;
+	callout_init(&co, wchan_timeout, &wt);
+
+	/*
+	 * The channel is locked, so the callout can't get at us until
+	 * we're on the sleep list.
+	 */
+	callout_schedule(&co, ticks);
+	thread_switch(S_SLEEP, wc);
+
+	/* Make sure it's not still running before WT goes away */
+	callout_stop(&co);
+
+	return wt.wt_timedout ? ETIMEDOUT : 0;
+}
+
 /*
  * Wake up one thread sleeping on a wait channel.
  */
@@ -1075,6 +1532,9 @@ wchan_wakeone(struct wchan *wc)
 	/* Lock the channel and grab a thread from it */
 	spinlock_acquire(&wc->wc_lock);
 	target = threadlist_remhead(&wc->wc_threads);
+	if (target != NULL) {
+		target->t_wchan = NULL;
+	}
 	/*
 	 * Nobody else can wake up this thread now, so we don't need
 	 * to hang onto the lock.
@@ -1086,6 +1546,7 @@ wchan_wakeone(struct wchan *wc)
 		return;
 	}
 
+	thread_wakeboost(target);
 	thread_make_runnable(target, false);
 }
 
@@ -1106,6 +1567,7 @@ wchan_wakeall(struct wchan *wc)
 	 */
 	spinlock_acquire(&wc->wc_lock);
 	while ((target = threadlist_remhead(&wc->wc_threads)) != NULL) {
+		target->t_wchan = NULL;
 		threadlist_addtail(&list, target);
 	}
 	/*
@@ -1120,6 +1582,7 @@ wchan_wakeall(struct wchan *wc)
 	 * make each thread runnable.
 	 */
 	while ((target = threadlist_remhead(&list)) != NULL) {
+		thread_wakeboost(target);
 		thread_make_runnable(target, false);
 	}
 
@@ -1224,9 +1687,15 @@ interprocessor_interrupt(void)
 	}
 	if (bits & (1U << IPI_UNIDLE)) {
 		/*
-		 * The cpu has already unidled itself to take the
-		 * interrupt; don't need to do anything else.
+		 * If idle, the cpu has already unidled itself to take
+		 * the interrupt; don't need to do anything else.
+		 * Otherwise it's been sent by thread_make_runnable
+		 * because there's new work and our tick may be off;
+		 * take one soon to reconsider.
 		 */
+		if (!curcpu->c_isidle) {
+			hardclock_settimer(1);
+		}
 	}
 	if (bits & (1U << IPI_TLBSHOOTDOWN)) {
 		if (curcpu->c_numshootdown == TLBSHOOTDOWN_ALL) {
@@ -421,6 +421,7 @@ static const struct vnode_ops dev_vnode_ops = {
 	dev_read,
 	null_io,      /* readlink */
 	null_io,      /* getdirentry */
+	null_io,      /* getdirentries */
 	dev_write,
 	dev_ioctl,
 	dev_stat,
@@ -0,0 +1,597 @@
+/*
+ * Copyright (c) 2009
+ *	The President and Fellows of Harvard College.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the University nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE UNIVERSITY AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE UNIVERSITY OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+/*
+ * Pipes.
+ *
+ * A pipe is a PIPE_SIZE ring buffer with two vnodes on it: one for
+ * the read end and one for the write end. Both are handed back
+ * already open, so they go into the file table like anything else
+ * and are closed with vfs_close.
+ *
+ * The ring is single-producer/single-consumer: only the reader
+ * advances p_tail and only the writer advances p_head, both as
+ * free-running byte counts, so moving data needs no lock at all;
+ * memory barriers keep the data and the counters in order. There is
+ * only ever one reader and one writer at a time because each end
+ * belongs to exactly one struct File, and the system call layer
+ * holds that File's lock around every read and write.
+ *
+ * Locks only come into it for sleeping. A side that finds the ring
+ * empty (or full) locks its wait channel, sets its waiting flag,
+ * issues a barrier, looks again, and sleeps; the other side updates
+ * its counter, issues a barrier, and only calls wchan_wakeall (which
+ * needs the channel lock) if it sees the flag. One of the two always
+ * sees the other's store, so no wakeup is lost.
+ */
+
+#include <types.h>
+#include <kern/errno.h>
+#include <kern/fcntl.h>
+#include <stat.h>
+#include <lib.h>
+#include <uio.h>
+#include <spinlock.h>
+#include <membar.h>
+#include <wchan.h>
+#include <vm.h>
+#include <vnode.h>
+#include <vfs.h>
+
+#define PIPE_SIZE	PAGE_SIZE
+
+struct pipe {
+	char *p_buf;			/* PIPE_SIZE bytes */
+	volatile unsigned p_head;	/* bytes ever written */
+	volatile unsigned p_tail;	/* bytes ever read */
+
+	struct wchan *p_rwchan;		/* reader sleeps here */
+	struct wchan *p_wwchan;		/* writer sleeps here */
+	volatile bool p_rwaiting;	/* reader is (about to be) asleep */
+	volatile bool p_wwaiting;	/* writer is (about to be) asleep */
+	volatile bool p_rclosed;	/* read end closed */
+	volatile bool p_wclosed;	/* write end closed */
+
+	struct spinlock p_lock;		/* protects p_ends */
+	unsigned p_ends;		/* ends not yet reclaimed */
+
+	struct vnode p_rvn;		/* read end */
+	struct vnode p_wvn;		/* write end */
+};
+
+/*
+ * Wake up whoever is sleeping on WC, if WAITING says someone is.
+ */
+static
+void
+pipe_wake(volatile bool *waiting, struct wchan *wc)
+{
+	membar_any_any();
+	if (*waiting) {
+		*waiting = false;
+		wchan_wakeall(wc);
+	}
+}
+
+/*
+ * Copy between the ring and UIO. POS is a free-running position;
+ * the copy may wrap around the end of the buffer.
+ */
+static
+int
+pipe_copy(struct pipe *p, unsigned pos, size_t len, struct uio *uio)
+{
+	size_t idx, first;
+	int result;
+
+	idx = pos % PIPE_SIZE;
+	first = PIPE_SIZE - idx;
+	if (first > len) {
+		first = len;
+	}
+	result = uiomove(p->p_buf + idx, first, uio);
+	if (result == 0 && len > first) {
+		result = uiomove(p->p_buf, len - first, uio);
+	}
+	return result;
+}
+
+/*
+ * Read. Returns as soon as anything is available; blocks while the
+ * pipe is empty and the write end is still open.
+ */
+static
+int
+pipe_read(struct vnode *v, struct uio *uio)
+{
+	struct pipe *p = v->vn_data;
+	size_t avail, resid;
+	int result;
+
+	KASSERT(uio->uio_rw == UIO_READ);
+	KASSERT(v == &p->p_rvn);
+
+	while ((avail = p->p_head - p->p_tail) == 0) {
+		if (p->p_wclosed || uio->uio_resid == 0) {
+			/* EOF */
+			return 0;
+		}
+		wchan_lock(p->p_rwchan);
+		p->p_rwaiting = true;
+		membar_any_any();
+		if (p->p_head == p->p_tail && !p->p_wclosed) {
+			wchan_sleep(p->p_rwchan);
+		}
+		else {
+			p->p_rwaiting = false;
+			wchan_unlock(p->p_rwchan);
+		}
+	}
+	/* don't read the data before we've seen the head move */
+	membar_load_load();
+
+	if (avail > uio->uio_resid) {
+		avail = uio->uio_resid;
+	}
+	resid = uio->uio_resid;
+	result = pipe_copy(p, p->p_tail, avail, uio);
+
+	/* give back whatever was copied, even on a fault partway */
+	membar_any_store();
+	p->p_tail += resid - uio->uio_resid;
+	pipe_wake(&p->p_wwaiting, p->p_wwchan);
+
+	return result;
+}
+
+/*
+ * Write. Blocks until everything has gone into the ring. Fails with
+ * EPIPE if the read end is closed before anything is written.
+ */
+static
+int
+pipe_write(struct vnode *v, struct uio *uio)
+{
+	struct pipe *p = v->vn_data;
+	size_t space, resid, start;
+	int result;
+
+	KASSERT(uio->uio_rw == UIO_WRITE);
+	KASSERT(v == &p->p_wvn);
+
+	start = uio->uio_resid;
+	while (uio->uio_resid > 0) {
+		if (p->p_rclosed) {
+			return uio->uio_resid == start ? EPIPE : 0;
+		}
+
+		space = PIPE_SIZE - (p->p_head - p->p_tail);
+		if (space == 0) {
+			wchan_lock(p->p_wwchan);
+			p->p_wwaiting = true;
+			membar_any_any();
+			if (p->p_head - p->p_tail == PIPE_SIZE &&
+			    !p->p_rclosed) {
+				wchan_sleep(p->p_wwchan);
+			}
+			else {
+				p->p_wwaiting = false;
+				wchan_unlock(p->p_wwchan);
+			}
+			continue;
+		}
+		/* don't overwrite data the reader may still be copying */
+		membar_any_any();
+
+		if (space > uio->uio_resid) {
+			space = uio->uio_resid;
+		}
+		resid = uio->uio_resid;
+		result = pipe_copy(p, p->p_head, space, uio);
+
+		/* publish the data before the new head */
+		membar_store_store();
+		p->p_head += resid - uio->uio_resid;
+		pipe_wake(&p->p_rwaiting, p->p_rwchan);
+
+		if (result) {
+			return result;
+		}
+	}
+	return 0;
+}
+
+/*
+ * Last close of one end: tell the other side.
+ */
+static
+int
+pipe_close(struct vnode *v)
+{
+	struct pipe *p = v->vn_data;
+
+	if (v == &p->p_rvn) {
+		p->p_rclosed = true;
+		membar_any_any();
+		wchan_wakeall(p->p_wwchan);
+	}
+	else {
+		p->p_wclosed = true;
+		membar_any_any();
+		wchan_wakeall(p->p_rwchan);
+	}
+	return 0;
+}
+
+/*
+ * Free the pipe. Both vnodes must be cleaned up already.
+ */
+static
+void
+pipe_destroy(struct pipe *p)
+{
+	if (p->p_rwchan != NULL) {
+		wchan_destroy(p->p_rwchan);
+	}
+	if (p->p_wwchan != NULL) {
+		wchan_destroy(p->p_wwchan);
+	}
+	spinlock_cleanup(&p->p_lock);
+	kfree(p->p_buf);
+	kfree(p);
+}
+
+/*
+ * Last reference to one end went away. The pipe goes when both have.
+ */
+static
+int
+pipe_reclaim(struct vnode *v)
+{
+	struct pipe *p = v->vn_data;
+	bool last;
+
+	VOP_CLEANUP(v);
+
+	spinlock_acquire(&p->p_lock);
+	KASSERT(p->p_ends > 0);
+	p->p_ends--;
+	last = p->p_ends == 0;
+	spinlock_release(&p->p_lock);
+
+	if (last) {
+		pipe_destroy(p);
+	}
+	return 0;
+}
+
+/*
+ * Open - can't happen, as pipes have no name, but refuse anything
+ * odd anyway.
+ */
+static
+int
+pipe_open(struct vnode *v, int flags)
+{
+	(void)v;
+	(void)flags;
+	return EINVAL;
+}
+
+static
+int
+pipe_stat(struct vnode *v, struct stat *statbuf)
+{
+	struct pipe *p = v->vn_data;
+
+	bzero(statbuf, sizeof(struct stat));
+	statbuf->st_mode = S_IFIFO | 0600;
+	statbuf->st_nlink = 1;
+	/* what's waiting to be read */
+	statbuf->st_size = p->p_head - p->p_tail;
+	statbuf->st_blksize = PIPE_SIZE;
+	return 0;
+}
+
+static
+int
+pipe_gettype(struct vnode *v, mode_t *ret)
+{
+	(void)v;
+	*ret = S_IFIFO;
+	return 0;
+}
+
+static
+int
+pipe_tryseek(struct vnode *v, off_t pos)
+{
+	(void)v;
+	(void)pos;
+	return ESPIPE;
+}
+
+/*
+ * Operations that don't make sense on pipes.
+ */
+
+static
+int
+pipe_badio(struct vnode *v, struct uio *uio)
+{
+	(void)v;
+	(void)uio;
+	return EBADF;
+}
+
+static
+int
+pipe_inval_io(struct vnode *v, struct uio *uio)
+{
+	(void)v;
+	(void)uio;
+	return EINVAL;
+}
+
+static
+int
+pipe_ioctl(struct vnode *v, int op, userptr_t data)
+{
+	(void)v;
+	(void)op;
+	(void)data;
+	return EIOCTL;
+}
+
+static
+int
+pipe_fsync(struct vnode *v)
+{
+	(void)v;
+	return EINVAL;
+}
+
+static
+int
+pipe_mmap(struct vnode *v)
+{
+	(void)v;
+	return ENODEV;
+}
+
+static
+int
+pipe_truncate(struct vnode *v, off_t len)
+{
+	(void)v;
+	(void)len;
+	return EINVAL;
+}
+
+static
+int
+pipe_creat(struct vnode *v, const char *name, bool excl, mode_t mode,
+	   struct vnode **result)
+{
+	(void)v;
+	(void)name;
+	(void)excl;
+	(void)mode;
+	(void)result;
+	return ENOTDIR;
+}
+
+static
+int
+pipe_symlink(struct vnode *v, const char *contents, const char *name)
+{
+	(void)v;
+	(void)contents;
+	(void)name;
+	return ENOTDIR;
+}
+
+static
+int
+pipe_mkdir(struct vnode *v, const char *name, mode_t mode)
+{
+	(void)v;
+	(void)name;
+	(void)mode;
+	return ENOTDIR;
+}
+
+static
+int
+pipe_link(struct vnode *v, const char *name, struct vnode *file)
+{
+	(void)v;
+	(void)name;
+	(void)file;
+	return ENOTDIR;
+}
+
+static
+int
+pipe_nameop(struct vnode *v, const char *name)
+{
+	(void)v;
+	(void)name;
+	return ENOTDIR;
+}
+
+static
+int
+pipe_rename(struct vnode *v, const char *n1, struct vnode *v2, const char *n2)
+{
+	(void)v;
+	(void)n1;
+	(void)v2;
+	(void)n2;
+	return ENOTDIR;
+}
+
+static
+int
+pipe_lookup(struct vnode *v, char *pathname, struct vnode **result)
+{
+	(void)v;
+	(void)pathname;
+	(void)result;
+	return ENOTDIR;
+}
+
+static
+int
+pipe_lookparent(struct vnode *v, char *pathname, struct vnode **result,
+		char *buf, size_t len)
+{
+	(void)v;
+	(void)pathname;
+	(void)result;
+	(void)buf;
+	(void)len;
+	return ENOTDIR;
+}
+
+/*
+ * Function tables for the two ends. They differ only in which of
+ * read and write works.
+ */
+static const struct vnode_ops pipe_readops = {
+	VOP_MAGIC,
+
+	pipe_open,
+	pipe_close,
+	pipe_reclaim,
+	pipe_read,
+	pipe_inval_io,	/* readlink */
+	pipe_inval_io,	/* getdirentry */
+	pipe_inval_io,	/* getdirentries */
+	pipe_badio,	/* write */
+	pipe_ioctl,
+	pipe_stat,
+	pipe_gettype,
+	pipe_tryseek,
+	pipe_fsync,
+	pipe_mmap,
+	pipe_truncate,
+	pipe_inval_io,	/* namefile */
+	pipe_creat,
+	pipe_symlink,
+	pipe_mkdir,
+	pipe_link,
+	pipe_nameop,	/* remove */
+	pipe_nameop,	/* rmdir */
+	pipe_rename,
+	pipe_lookup,
+	pipe_lookparent,
+};
+
+static const struct vnode_ops pipe_writeops = {
+	VOP_MAGIC,
+
+	pipe_open,
+	pipe_close,
+	pipe_reclaim,
+	pipe_badio,	/* read */
+	pipe_inval_io,	/* readlink */
+	pipe_inval_io,	/* getdirentry */
+	pipe_inval_io,	/* getdirentries */
+	pipe_write,
+	pipe_ioctl,
+	pipe_stat,
+	pipe_gettype,
+	pipe_tryseek,
+	pipe_fsync,
+	pipe_mmap,
+	pipe_truncate,
+	pipe_inval_io,	/* namefile */
+	pipe_creat,
+	pipe_symlink,
+	pipe_mkdir,
+	pipe_link,
+	pipe_nameop,	/* remove */
+	pipe_nameop,	/* rmdir */
+	pipe_rename,
+	pipe_lookup,
+	pipe_lookparent,
+};
+
+/*
+ * Create a pipe. Hands back both ends, each opened as if by vfs_open;
+ * release them with vfs_close.
+ */
+int
+vfs_pipe(struct vnode **ret_read, struct vnode **ret_write)
+{
+	struct pipe *p;
+	int result;
+
+	p = kmalloc(sizeof(struct pipe));
+	if (p == NULL) {
+		return ENOMEM;
+	}
+	p->p_buf = kmalloc(PIPE_SIZE);
+	if (p->p_buf == NULL) {
+		kfree(p);
+		return ENOMEM;
+	}
+	p->p_head = p->p_tail = 0;
+	spinlock_init(&p->p_lock);
+	p->p_rwaiting = p->p_wwaiting = false;
+	p->p_rclosed = p->p_wclosed = false;
+	p->p_ends = 0;
+	p->p_rwchan = wchan_create("pipe-read");
+	p->p_wwchan = wchan_create("pipe-write");
+	if (p->p_rwchan == NULL || p->p_wwchan == NULL) {
+		pipe_destroy(p);
+		return ENOMEM;
+	}
+
+	result = VOP_INIT(&p->p_rvn, &pipe_readops, NULL, p);
+	if (result) {
+		pipe_destroy(p);
+		return result;
+	}
+	result = VOP_INIT(&p->p_wvn, &pipe_writeops, NULL, p);
+	if (result) {
+		VOP_CLEANUP(&p->p_rvn);
+		pipe_destroy(p);
+		return result;
+	}
+	p->p_ends = 2;
+
+	VOP_INCOPEN(&p->p_rvn);
+	VOP_INCOPEN(&p->p_wvn);
+
+	*ret_read = &p->p_rvn;
+	*ret_write = &p->p_wvn;
+	return 0;
+}
@@ -0,0 +1,320 @@
+/*
+ * Copyright (c) 2000, 2001, 2002, 2003, 2004, 2005, 2008, 2009
+ *	The President and Fellows of Harvard College.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the University nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE UNIVERSITY AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE UNIVERSITY OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+/*
+ * VFS name cache.
+ *
+ * Remembers the results of single-component lookups as
+ * (directory vnode, name) -> vnode, so that repeatedly opening the
+ * same file does not go back to the filesystem each time. A NULL
+ * vnode records that the name did not exist (a negative entry).
+ *
+ * The cache is direct-mapped: each (directory, name) pair hashes to
+ * exactly one slot, and entering a new pair replaces whatever was
+ * there. Each entry holds a reference to both the directory and the
+ * vnode it names, so neither can be reclaimed and have its address
+ * reused while the entry exists. That pins at most 2*NC_SIZE vnodes
+ * in memory; a vnode stays pinned until its slot is reused or its
+ * name is invalidated. Since removing a name invalidates it, the
+ * cache never keeps an unlinked file's storage from being freed. As
+ * in 4.4BSD, long names are simply not cached.
+ *
+ * Filesystems whose names can change without going through the VFS
+ * (emufs) turn the cache off with fs_ncache, since neither positive
+ * nor negative entries for them could be trusted.
+ *
+ * Creating, removing, or renaming a name is bracketed by
+ * vfs_ncache_begin and vfs_ncache_end. Both drop the name's entry;
+ * begin does so before the filesystem changes anything, so nobody
+ * can hit the old entry while the change is going on. Entries are
+ * also dropped by vfs_ncache_purgefs before a filesystem is
+ * unmounted. Because a lookup can race with any of these, each
+ * invalidation bumps nc_gen, and a lookup only enters its result if
+ * no invalidation happened while it was talking to the filesystem
+ * and no change is still in progress (nc_busy).
+ */
+
+#include <types.h>
+#include <kern/errno.h>
+#include <lib.h>
+#include <synch.h>
+#include <fs.h>
+#include <vfs.h>
+#include <vnode.h>
+
+#define NC_SIZE		256	/* number of slots; power of 2 */
+#define NC_NAMELEN	31	/* longest name we cache */
+
+struct ncentry {
+	struct vnode *nc_dir;		/* directory, or NULL if slot empty */
+	struct vnode *nc_vn;		/* result, or NULL for negative entry */
+	char nc_name[NC_NAMELEN+1];
+};
+
+static struct ncentry nc_table[NC_SIZE];
+static struct lock *nc_lock;
+static unsigned nc_gen;
+static unsigned nc_busy;		/* changes between begin and end */
+
+/*
+ * Set up the cache.
+ */
+void
+vfs_ncache_bootstrap(void)
+{
+	nc_lock = lock_create("vfs name cache");
+	if (nc_lock == NULL) {
+		panic("vfs: Could not create name cache lock\n");
+	}
+}
+
+/*
+ * Hash a (directory, name) pair to a slot.
+ */
+static
+struct ncentry *
+nc_slot(struct vnode *dir, const char *name)
+{
+	uint32_t h;
+
+	h = (uint32_t)(uintptr_t)dir >> 4;
+	while (*name) {
+		h = h*33 + (unsigned char)*name++;
+	}
+	return &nc_table[h & (NC_SIZE-1)];
+}
+
+/*
+ * Check if NAME is something we cache: a single component, short
+ * enough, and not "." or ".." (whose meaning rename can change
+ * without telling us).
+ */
+static
+bool
+nc_cacheable(struct vnode *dir, const char *name)
+{
+	size_t len;
+
+	if (dir->vn_fs == NULL) {
+		/* device vnode; let the device interpret names */
+		return false;
+	}
+	if (!dir->vn_fs->fs_ncache) {
+		/* names can change without the VFS knowing */
+		return false;
+	}
+	len = strlen(name);
+	if (len == 0 || len > NC_NAMELEN) {
+		return false;
+	}
+	if (strchr(name, '/') != NULL) {
+		return false;
+	}
+	if (!strcmp(name, ".") || !strcmp(name, "..")) {
+		return false;
+	}
+	return true;
+}
+
+/*
+ * Empty a slot. The references it held are handed back through
+ * DIRP and VNP so the caller can drop them after releasing nc_lock;
+ * dropping the last reference may reclaim the vnode, which does I/O.
+ */
+static
+void
+nc_clear(struct ncentry *nc, struct vnode **dirp, struct vnode **vnp)
+{
+	*dirp = nc->nc_dir;
+	*vnp = nc->nc_vn;
+	nc->nc_dir = NULL;
+	nc->nc_vn = NULL;
+	nc->nc_name[0] = 0;
+}
+
+static
+void
+nc_release(struct vnode *dir, struct vnode *vn)
+{
+	if (vn != NULL) {
+		VOP_DECREF(vn);
+	}
+	if (dir != NULL) {
+		VOP_DECREF(dir);
+	}
+}
+
+/*
+ * Look up NAME in DIR.
+ *
+ * Returns 0 and a new reference in *RET on a hit, ENOENT on a
+ * negative hit, and EAGAIN on a miss. On a miss, *GEN is set to the
+ * value to pass to vfs_ncache_enter.
+ */
+int
+vfs_ncache_lookup(struct vnode *dir, const char *name,
+		  struct vnode **ret, unsigned *gen)
+{
+	struct ncentry *nc;
+	int result;
+
+	if (!nc_cacheable(dir, name)) {
+		*gen = 0;
+		return EAGAIN;
+	}
+
+	nc = nc_slot(dir, name);
+
+	lock_acquire(nc_lock);
+	if (nc->nc_dir == dir && !strcmp(nc->nc_name, name)) {
+		if (nc->nc_vn == NULL) {
+			result = ENOENT;
+		}
+		else {
+			VOP_INCREF(nc->nc_vn);
+			*ret = nc->nc_vn;
+			result = 0;
+		}
+	}
+	else {
+		*gen = nc_gen;
+		result = EAGAIN;
+	}
+	lock_release(nc_lock);
+
+	return result;
+}
+
+/*
+ * Record the result of looking up NAME in DIR: VN, or NULL if the
+ * name does not exist. GEN is what vfs_ncache_lookup returned; if
+ * anything was invalidated since, or a change is still in progress,
+ * the result may already be stale and is not entered.
+ */
+void
+vfs_ncache_enter(struct vnode *dir, const char *name, struct vnode *vn,
+		 unsigned gen)
+{
+	struct ncentry *nc;
+	struct vnode *olddir = NULL, *oldvn = NULL;
+
+	if (!nc_cacheable(dir, name)) {
+		return;
+	}
+
+	nc = nc_slot(dir, name);
+
+	lock_acquire(nc_lock);
+	if (gen != nc_gen || nc_busy > 0) {
+		lock_release(nc_lock);
+		return;
+	}
+	nc_clear(nc, &olddir, &oldvn);
+	VOP_INCREF(dir);
+	if (vn != NULL) {
+		VOP_INCREF(vn);
+	}
+	nc->nc_dir = dir;
+	nc->nc_vn = vn;
+	strcpy(nc->nc_name, name);
+	lock_release(nc_lock);
+
+	nc_release(olddir, oldvn);
+}
+
+/*
+ * Forget NAME in DIR, and start or finish (DELTA 1 or -1) a change.
+ */
+static
+void
+nc_forget(struct vnode *dir, const char *name, int delta)
+{
+	struct ncentry *nc;
+	struct vnode *olddir = NULL, *oldvn = NULL;
+
+	lock_acquire(nc_lock);
+	nc_gen++;
+	KASSERT(delta > 0 || nc_busy > 0);
+	nc_busy += delta;
+	if (nc_cacheable(dir, name)) {
+		nc = nc_slot(dir, name);
+		if (nc->nc_dir == dir && !strcmp(nc->nc_name, name)) {
+			nc_clear(nc, &olddir, &oldvn);
+		}
+	}
+	lock_release(nc_lock);
+
+	nc_release(olddir, oldvn);
+}
+
+/*
+ * Call before anything that creates, removes, or renames NAME in DIR.
+ */
+void
+vfs_ncache_begin(struct vnode *dir, const char *name)
+{
+	nc_forget(dir, name, 1);
+}
+
+/*
+ * Call afterwards, whether it worked or not.
+ */
+void
+vfs_ncache_end(struct vnode *dir, const char *name)
+{
+	nc_forget(dir, name, -1);
+}
+
+/*
+ * Forget everything on filesystem FS (or everything at all, if FS
+ * is NULL). Called before unmounting, so the cache's references
+ * don't make the filesystem look busy.
+ */
+void
+vfs_ncache_purgefs(struct fs *fs)
+{
+	struct ncentry *nc;
+	struct vnode *olddir, *oldvn;
+	unsigned i;
+
+	for (i=0; i<NC_SIZE; i++) {
+		nc = &nc_table[i];
+		olddir = oldvn = NULL;
+
+		lock_acquire(nc_lock);
+		nc_gen++;
+		if (nc->nc_dir != NULL &&
+		    (fs == NULL || nc->nc_dir->vn_fs == fs)) {
+			nc_clear(nc, &olddir, &oldvn);
+		}
+		lock_release(nc_lock);
+
+		nc_release(olddir, oldvn);
+	}
+}
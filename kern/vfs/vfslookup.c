@@ -235,11 +235,11 @@ vfs_lookparent(char *path, struct vnode **retval,
 	struct vnode *startvn;
 	int result;
 
+	/* The big lock covers the mount list; the lookup itself doesn't need it */
 	vfs_biglock_acquire();
-
 	result = getdevice(path, &path, &startvn);
+	vfs_biglock_release();
 	if (result) {
-		vfs_biglock_release();
 		return result;
 	}
 
@@ -256,8 +256,6 @@ vfs_lookparent(char *path, struct vnode **retval,
 	}
 
 	VOP_DECREF(startvn);
-
-	vfs_biglock_release();
 	return result;
 }
 
@@ -265,25 +263,35 @@ int
 vfs_lookup(char *path, struct vnode **retval)
 {
 	struct vnode *startvn;
+	unsigned gen;
 	int result;
 
 	vfs_biglock_acquire();
-
 	result = getdevice(path, &path, &startvn);
+	vfs_biglock_release();
 	if (result) {
-		vfs_biglock_release();
 		return result;
 	}
 
 	if (strlen(path)==0) {
 		*retval = startvn;
-		vfs_biglock_release();
 		return 0;
 	}
 
+	result = vfs_ncache_lookup(startvn, path, retval, &gen);
+	if (result != EAGAIN) {
+		VOP_DECREF(startvn);
+		return result;
+	}
+
 	result = VOP_LOOKUP(startvn, path, retval);
+	if (result == 0) {
+		vfs_ncache_enter(startvn, path, *retval, gen);
+	}
+	else if (result == ENOENT) {
+		vfs_ncache_enter(startvn, path, NULL, gen);
+	}
 
 	VOP_DECREF(startvn);
-	vfs_biglock_release();
 	return result;
 }
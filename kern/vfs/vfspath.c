@@ -73,7 +73,9 @@ vfs_open(char *path, int openflags, mode_t mode, struct vnode **ret)
 			return result;
 		}
 
+		vfs_ncache_begin(dir, name);
 		result = VOP_CREAT(dir, name, excl, mode, &vn);
+		vfs_ncache_end(dir, name);
 
 		VOP_DECREF(dir);
 	}
@@ -149,7 +151,9 @@ vfs_remove(char *path)
 		return result;
 	}
 
+	vfs_ncache_begin(dir, name);
 	result = VOP_REMOVE(dir, name);
+	vfs_ncache_end(dir, name);
 	VOP_DECREF(dir);
 
 	return result;
@@ -182,7 +186,11 @@ vfs_rename(char *oldpath, char *newpath)
 		return EXDEV;
 	}
 
+	vfs_ncache_begin(olddir, oldname);
+	vfs_ncache_begin(newdir, newname);
 	result = VOP_RENAME(olddir, oldname, newdir, newname);
+	vfs_ncache_end(newdir, newname);
+	vfs_ncache_end(olddir, oldname);
 
 	VOP_DECREF(newdir);
 	VOP_DECREF(olddir);
@@ -216,7 +224,9 @@ vfs_link(char *oldpath, char *newpath)
 		return EXDEV;
 	}
 
+	vfs_ncache_begin(newdir, newname);
 	result = VOP_LINK(newdir, newname, oldfile);
+	vfs_ncache_end(newdir, newname);
 
 	VOP_DECREF(newdir);
 	VOP_DECREF(oldfile);
@@ -243,7 +253,9 @@ vfs_symlink(const char *contents, char *path)
 		return result;
 	}
 
+	vfs_ncache_begin(newdir, newname);
 	result = VOP_SYMLINK(newdir, newname, contents);
+	vfs_ncache_end(newdir, newname);
 	VOP_DECREF(newdir);
 
 	return result;
@@ -289,7 +301,9 @@ vfs_mkdir(char *path, mode_t mode)
 		return result;
 	}
 
+	vfs_ncache_begin(parent, name);
 	result = VOP_MKDIR(parent, name, mode);
+	vfs_ncache_end(parent, name);
 
 	VOP_DECREF(parent);
 
@@ -311,7 +325,9 @@ vfs_rmdir(char *path)
 		return result;
 	}
 
+	vfs_ncache_begin(parent, name);
 	result = VOP_RMDIR(parent, name);
+	vfs_ncache_end(parent, name);
 
 	VOP_DECREF(parent);
 
@@ -32,6 +32,7 @@
 #include <stdio.h>
 #include <unistd.h>
 #include <string.h>
+#include <dirent.h>
 #include <errno.h>
 #include <err.h>
 
@@ -188,14 +189,21 @@ print(const char *path)
 /*
  * List a directory.
  */
+/*
+ * Buffer for getdirentries(). Declared as uint32_t so the records in
+ * it are aligned.
+ */
+#define DIRBUFSIZE 1024
+
 static
 void
 listdir(const char *path, int showheader)
 {
 	int fd;
-	char buf[1024];
+	uint32_t buf[DIRBUFSIZE / sizeof(uint32_t)];
 	char newpath[1024];
-	int len;
+	struct dirent *de;
+	int len, pos;
 
 	if (showheader) {
 		printheader(path);
@@ -212,19 +220,22 @@ listdir(const char *path, int showheader)
 	/*
 	 * List the directory.
 	 */
-	while ((len = getdirentry(fd, buf, sizeof(buf)-1)) > 0) {
-		buf[len] = 0;
+	while ((len = getdirentries(fd, (char *)buf, sizeof(buf))) > 0) {
+		for (pos = 0; pos < len; pos += de->d_reclen) {
+			de = (struct dirent *)((char *)buf + pos);
 
-		/* Assemble the full name of the new item */
-		snprintf(newpath, sizeof(newpath), "%s/%s", path, buf);
+			/* Assemble the full name of the new item */
+			snprintf(newpath, sizeof(newpath), "%s/%s",
+				 path, de->d_name);
 
-		if (aopt || buf[0]!='.') {
-			/* Print it */
-			print(newpath);
+			if (aopt || de->d_name[0]!='.') {
+				/* Print it */
+				print(newpath);
+			}
 		}
 	}
 	if (len<0) {
-		err(1, "%s: getdirentry", path);
+		err(1, "%s: getdirentries", path);
 	}
 
 	/* Done */
@@ -236,9 +247,10 @@ void
 recursedir(const char *path)
 {
 	int fd;
-	char buf[1024];
+	uint32_t buf[DIRBUFSIZE / sizeof(uint32_t)];
 	char newpath[1024];
-	int len;
+	struct dirent *de;
+	int len, pos;
 
 	/*
 	 * Open it.
@@ -251,29 +263,35 @@ recursedir(const char *path)
 	/*
 	 * List the directory.
 	 */
-	while ((len = getdirentry(fd, buf, sizeof(buf)-1)) > 0) {
-		buf[len] = 0;
+	while ((len = getdirentries(fd, (char *)buf, sizeof(buf))) > 0) {
+		for (pos = 0; pos < len; pos += de->d_reclen) {
+			de = (struct dirent *)((char *)buf + pos);
 
-		/* Assemble the full name of the new item */
-		snprintf(newpath, sizeof(newpath), "%s/%s", path, buf);
+			/* Assemble the full name of the new item */
+			snprintf(newpath, sizeof(newpath), "%s/%s",
+				 path, de->d_name);
 
-		if (!aopt && buf[0]=='.') {
-			/* skip this one */
-			continue;
-		}
+			if (!aopt && de->d_name[0]=='.') {
+				/* skip this one */
+				continue;
+			}
 
-		if (!strcmp(buf, ".") || !strcmp(buf, "..")) {
-			/* always skip these */
-			continue;
-		}
+			if (!strcmp(de->d_name, ".") ||
+			    !strcmp(de->d_name, "..")) {
+				/* always skip these */
+				continue;
+			}
 
-		if (!isdir(newpath)) {
-			continue;
-		}
+			/* Only stat it if the directory didn't say */
+			if (de->d_type != DT_UNKNOWN ? de->d_type != DT_DIR
+			    : !isdir(newpath)) {
+				continue;
+			}
 
-		listdir(newpath, 1 /*showheader*/);
-		if (Ropt) {
-			recursedir(newpath);
+			listdir(newpath, 1 /*showheader*/);
+			if (Ropt) {
+				recursedir(newpath);
+			}
 		}
 	}
 	if (len<0) {
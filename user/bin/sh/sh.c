@@ -65,6 +65,9 @@
 /* set to nonzero if __time syscall seems to work */
 static int timing = 0;
 
+/* most commands in one pipeline */
+#define MAXPIPE 16
+
 /* array of backgrounded jobs (allows "foregrounding") */
 #define MAXBG 128
 static pid_t bgpids[MAXBG];
@@ -292,12 +295,113 @@ static struct {
 	{ NULL, NULL }
 };
 
+/*
+ * dopipeline
+ * runs "cmd1 | cmd2 | ..." with each command's standard output going
+ * to the next one's standard input through a pipe. args is the whole
+ * command line, with the "|" tokens still in it. waits for all the
+ * commands and returns the status of the last one.
+ */
+static
+int
+dopipeline(char **args, int nargs)
+{
+	pid_t pids[MAXPIPE];
+	int npids = 0, nstages = 1;
+	int infd = -1, fds[2];
+	int start, i, last;
+	int status = _MKWAIT_EXIT(255), st;
+	pid_t pid;
+
+	for (i=0; i<nargs; i++) {
+		if (!strcmp(args[i], "|")) {
+			if (i == 0 || i == nargs-1 || !strcmp(args[i+1], "|")) {
+				printf("Invalid null command\n");
+				return _MKWAIT_EXIT(255);
+			}
+			nstages++;
+		}
+	}
+	if (nstages > MAXPIPE) {
+		printf("Too many commands in pipeline (max %d)\n", MAXPIPE);
+		return _MKWAIT_EXIT(255);
+	}
+
+	start = 0;
+	for (i=0; i<=nargs; i++) {
+		if (i < nargs && strcmp(args[i], "|")) {
+			continue;
+		}
+		last = (i == nargs);
+		args[i] = NULL;
+
+		if (!last && pipe(fds) < 0) {
+			warn("pipe");
+			break;
+		}
+
+		pid = fork();
+		if (pid < 0) {
+			warn("fork");
+			if (!last) {
+				close(fds[0]);
+				close(fds[1]);
+			}
+			break;
+		}
+		if (pid == 0) {
+			/* child */
+			if (infd >= 0) {
+				dup2(infd, STDIN_FILENO);
+				close(infd);
+			}
+			if (!last) {
+				dup2(fds[1], STDOUT_FILENO);
+				close(fds[0]);
+				close(fds[1]);
+			}
+			execv(args[start], args+start);
+			warn("%s", args[start]);
+			_exit(1);
+		}
+
+		/* parent: pass the read end on to the next command */
+		pids[npids++] = pid;
+		if (infd >= 0) {
+			close(infd);
+			infd = -1;
+		}
+		if (!last) {
+			close(fds[1]);
+			infd = fds[0];
+		}
+		start = i+1;
+	}
+
+	if (infd >= 0) {
+		/* stopped early; let the commands already started see EOF */
+		close(infd);
+	}
+
+	for (i=0; i<npids; i++) {
+		if (waitpid(pids[i], &st, 0) < 0) {
+			warn("waitpid");
+			st = -1;
+		}
+		if (i == nstages-1) {
+			status = st;
+		}
+	}
+	return status;
+}
+
 /*
  * docommand
  * tokenizes the command line using strtok.  if there aren't any commands,
  * simply returns.  checks to see if it's a builtin, running it if it is.
  * otherwise, it's a standard command.  check for the '&', try to background
- * the job if possible, otherwise just run it and wait on it.
+ * the job if possible, otherwise just run it and wait on it.  commands
+ * separated by '|' are run as a pipeline.
  */
 static
 int
@@ -308,7 +412,7 @@ docommand(char *buf)
 	char *s;
 	pid_t pid;
 	int status;
-	int bg=0;
+	int bg=0, piped=0;
 	time_t startsecs, endsecs;
 	unsigned long startnsecs, endnsecs;
 
@@ -350,10 +454,26 @@ docommand(char *buf)
 		bg = 1;
 	}
 
+	for (i=0; i<nargs; i++) {
+		if (!strcmp(args[i], "|")) {
+			piped = 1;
+		}
+	}
+	if (piped && bg) {
+		printf("%s: Pipelines can't be run in the background\n",
+		       args[0]);
+		return -1;
+	}
+
 	if (timing) {
 		__time(&startsecs, &startnsecs);
 	}
 
+	if (piped) {
+		status = dopipeline(args, nargs);
+		goto done;
+	}
+
 	pid = fork();
 	switch (pid) {
 		case -1:
@@ -389,6 +509,7 @@ docommand(char *buf)
 		status = -1;
 	}
 
+ done:
 	if (timing) {
 		__time(&endsecs, &endnsecs);
 		if (endnsecs < startnsecs) {
@@ -153,8 +153,14 @@ int symlink(const char *target, const char *linkname);
 int readlink(const char *path, char *buf, size_t buflen);
 int dup2(int filehandle, int newhandle);
 int pipe(int filehandles[2]);
+ssize_t pread(int filehandle, void *buf, size_t size, off_t pos);
+ssize_t pwrite(int filehandle, const void *buf, size_t size, off_t pos);
+ssize_t copy_file_range(int infile, int outfile, size_t size, unsigned flags);
+/* readv, writev - see sys/uio.h */
 time_t __time(time_t *seconds, unsigned long *nanoseconds);
+int nanosleep(const struct timespec *req, struct timespec *rem);
 int __getcwd(char *buf, size_t buflen);
+/* getrusage - see sys/resource.h */
 /* stat - see sys/stat.h */
 /* lstat - see sys/stat.h */
 
@@ -164,5 +170,6 @@ int __getcwd(char *buf, size_t buflen);
 
 char *getcwd(char *buf, size_t buflen);		/* calls __getcwd */
 time_t time(time_t *seconds);			/* calls __time */
+unsigned sleep(unsigned seconds);		/* calls nanosleep */
 
 #endif /* _UNISTD_H_ */
@@ -56,6 +56,35 @@
 
 #include "disk.h"
 
+static
+void
+dumpjournal(uint32_t start, uint32_t nblocks)
+{
+	struct sfs_jheader jh;
+	uint32_t i, n;
+
+	printf("Journal: %u blocks at %u\n", nblocks, start);
+
+	diskread(&jh, start);
+	if (SWAPL(jh.jh_magic) != SFS_JMAGIC) {
+		printf("    Bad journal header\n");
+		return;
+	}
+	n = SWAPL(jh.jh_nblocks);
+	if (n == 0) {
+		printf("    Clean (next transaction %u)\n", SWAPL(jh.jh_seq));
+		return;
+	}
+	printf("    Transaction %u, %u blocks:", SWAPL(jh.jh_seq), n);
+	for (i=0; i<n && i<SFS_JMAXBLOCKS; i++) {
+		if (i%8 == 0) {
+			printf("\n   ");
+		}
+		printf(" %u", SWAPL(jh.jh_home[i]));
+	}
+	printf("\n");
+}
+
 static
 uint32_t
 dumpsb(void)
@@ -65,9 +94,23 @@ dumpsb(void)
 	if (SWAPL(sp.sp_magic) != SFS_MAGIC) {
 		errx(1, "Not an sfs filesystem");
 	}
+	if (SWAPL(sp.sp_version) != SFS_VERSION ||
+	    SWAPL(sp.sp_blocksize) != SFS_BLOCKSIZE) {
+		errx(1, "Unsupported sfs version %u, block size %u",
+		     SWAPL(sp.sp_version), SWAPL(sp.sp_blocksize));
+	}
 	sp.sp_volname[sizeof(sp.sp_volname)-1] = 0;
 	printf("Volume name: %-40s  %u blocks\n", sp.sp_volname, 
 	       SWAPL(sp.sp_nblocks));
+	printf("Format version %u, %u-byte blocks\n",
+	       SWAPL(sp.sp_version), SWAPL(sp.sp_blocksize));
+	if (SWAPL(sp.sp_journalblocks) > 0) {
+		dumpjournal(SWAPL(sp.sp_journalstart),
+			    SWAPL(sp.sp_journalblocks));
+	}
+	else {
+		printf("No journal\n");
+	}
 
 	return SWAPL(sp.sp_nblocks);
 }
@@ -95,14 +138,37 @@ dodirblock(uint32_t block)
 	}
 }
 
+/* Dump the directory blocks under an indirect block; returns count */
+static
+uint32_t
+dumpindirect(uint32_t block, int indirection)
+{
+	uint32_t ib[SFS_DBPERIDB];
+	uint32_t nblocks=0;
+	int i;
+
+	if (block == 0) {
+		return 0;
+	}
+	if (indirection == 0) {
+		dodirblock(block);
+		return 1;
+	}
+
+	diskread(&ib, block);
+	for (i=0; i<SFS_DBPERIDB; i++) {
+		nblocks += dumpindirect(SWAPL(ib[i]), indirection-1);
+	}
+	return nblocks;
+}
+
 static
 void
 dumpdir(uint32_t ino)
 {
 	struct sfs_inode sfi;
-	uint32_t ib[SFS_DBPERIDB];
 	int nentries, i;
-	uint32_t block, nblocks=0;
+	uint32_t j, nblocks=0;
 
 	diskread(&sfi, ino);
 
@@ -112,23 +178,27 @@ dumpdir(uint32_t ino)
 	}
 	printf("Directory %u: %d entries\n", ino, nentries);
 
-	for (i=0; i<SFS_NDIRECT; i++) {
-		block = SWAPL(sfi.sfi_direct[i]);
-		if (block) {
-			dodirblock(block);
+	for (i=0; i<SFS_NEXTENTS; i++) {
+		uint32_t fileblock = SWAPL(sfi.sfi_extents[i].sfe_fileblock);
+		uint32_t diskblock = SWAPL(sfi.sfi_extents[i].sfe_diskblock);
+		uint32_t len = SWAPL(sfi.sfi_extents[i].sfe_nblocks);
+
+		if (len == 0) {
+			continue;
+		}
+		printf("    [extent: file blocks %u-%u at block %u]\n",
+		       fileblock, fileblock + len - 1, diskblock);
+		for (j=0; j<len; j++) {
+			dodirblock(diskblock + j);
 			nblocks++;
 		}
 	}
-	if (SWAPL(sfi.sfi_indirect)) {
-		diskread(&ib, SWAPL(sfi.sfi_indirect));
-		for (i=0; i<SFS_DBPERIDB; i++) {
-			block = SWAPL(ib[i]);
-			if (block) {
-				dodirblock(block);
-				nblocks++;
-			}
-		}
+	for (i=0; i<SFS_NDIRECT; i++) {
+		nblocks += dumpindirect(SWAPL(sfi.sfi_direct[i]), 0);
 	}
+	nblocks += dumpindirect(SWAPL(sfi.sfi_indirect), 1);
+	nblocks += dumpindirect(SWAPL(sfi.sfi_dindirect), 2);
+	nblocks += dumpindirect(SWAPL(sfi.sfi_tindirect), 3);
 	printf("    %u blocks in directory\n", nblocks);
 }
 
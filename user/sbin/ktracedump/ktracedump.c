@@ -0,0 +1,309 @@
+/*
+ * Copyright (c) 2000, 2001, 2002, 2003, 2004, 2005, 2008, 2009
+ *	The President and Fellows of Harvard College.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the University nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE UNIVERSITY AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE UNIVERSITY OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+/*
+ * ktracedump - decode a kernel trace file.
+ *
+ * The kernel writes these with the "kt dump" menu command (see
+ * kern/ktrace.h for the format). We merge the per-cpu event streams
+ * by timestamp and print one line per event, with the time taken by
+ * syscalls, faults, disk I/O and lock waits where the matching start
+ * event is in the trace.
+ *
+ * Each cpu's clock is its own, so merged times from different cpus
+ * are only roughly in order, and durations for threads that moved
+ * between cpus are approximate.
+ */
+
+#include <sys/types.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdio.h>
+#include <err.h>
+
+#include <netinet/in.h> // for arpa/inet.h
+#include <arpa/inet.h>  // for ntohl
+#include "hostcompat.h"
+#include "kern/ktrace.h"
+
+#define SWAPL(x) ntohl(x)
+
+/* Largest pid we track durations for (matches the kernel's PID_MAX) */
+#define MAXPID 32768
+
+/* Largest disk unit we track durations for */
+#define MAXUNIT 16
+
+/* An event, decoded */
+struct event {
+	uint64_t time;
+	unsigned seq;		/* position in the file, for stable sorting */
+	unsigned cpu;
+	unsigned type;
+	int pid;
+	uint32_t arg0, arg1;
+};
+
+static struct event *events;
+static unsigned nevents;
+
+/* Start times of things in progress, for durations; 0 if none */
+static uint64_t syscallstart[MAXPID];
+static uint64_t faultstart[MAXPID];
+static uint64_t lockstart[MAXPID];
+static uint64_t diskstart[MAXUNIT];
+
+static const char *const typenames[KTE_NTYPES] = {
+	"?",
+	"switch",
+	"syscall",
+	"sysret",
+	"vmfault",
+	"faultdone",
+	"tlbrefill",
+	"diskread",
+	"diskwrite",
+	"diskdone",
+	"spinwait",
+	"lockwait",
+	"lockacq",
+};
+
+/* Thread states, as in the kernel's threadstate_t */
+static const char *const statenames[] = {
+	"run", "ready", "sleep", "zombie",
+};
+
+static
+void
+doread(FILE *f, void *buf, size_t len, const char *what)
+{
+	if (fread(buf, 1, len, f) != len) {
+		if (ferror(f)) {
+			err(1, "Reading %s", what);
+		}
+		errx(1, "Trace file truncated in %s", what);
+	}
+}
+
+/*
+ * Read the whole file into events[].
+ */
+static
+void
+loadtrace(const char *path)
+{
+	struct ktrace_header kh;
+	struct ktrace_cpuheader kc;
+	struct ktrace_event ke;
+	struct event *ev;
+	uint32_t ncpus, cpu, n, i;
+	FILE *f;
+
+	f = fopen(path, "rb");
+	if (f == NULL) {
+		err(1, "%s", path);
+	}
+
+	doread(f, &kh, sizeof(kh), "header");
+	if (SWAPL(kh.kth_magic) != KTRACE_MAGIC) {
+		errx(1, "%s: Not a kernel trace file", path);
+	}
+	if (SWAPL(kh.kth_version) != KTRACE_VERSION ||
+	    SWAPL(kh.kth_evsize) != sizeof(struct ktrace_event)) {
+		errx(1, "%s: Unsupported trace version %u, event size %u",
+		     path, SWAPL(kh.kth_version), SWAPL(kh.kth_evsize));
+	}
+	ncpus = SWAPL(kh.kth_ncpus);
+
+	for (cpu=0; cpu<ncpus; cpu++) {
+		doread(f, &kc, sizeof(kc), "cpu header");
+		n = SWAPL(kc.ktc_nevents);
+		printf("cpu%u: %u events", SWAPL(kc.ktc_cpu), n);
+		if (SWAPL(kc.ktc_lost) > 0) {
+			printf(" (%u older ones overwritten)",
+			       SWAPL(kc.ktc_lost));
+		}
+		printf("\n");
+
+		events = realloc(events, (nevents + n) * sizeof(*events));
+		if (events == NULL && nevents + n > 0) {
+			err(1, "realloc");
+		}
+		for (i=0; i<n; i++) {
+			doread(f, &ke, sizeof(ke), "events");
+			ev = &events[nevents];
+			ev->time = ((uint64_t)SWAPL(ke.kte_timehi) << 32)
+				| SWAPL(ke.kte_timelo);
+			ev->seq = nevents;
+			ev->cpu = SWAPL(kc.ktc_cpu);
+			ev->type = SWAPL(ke.kte_type);
+			ev->pid = (int32_t)SWAPL(ke.kte_pid);
+			ev->arg0 = SWAPL(ke.kte_arg0);
+			ev->arg1 = SWAPL(ke.kte_arg1);
+			nevents++;
+		}
+	}
+
+	fclose(f);
+}
+
+static
+int
+eventcmp(const void *av, const void *bv)
+{
+	const struct event *a = av, *b = bv;
+
+	if (a->time != b->time) {
+		return a->time < b->time ? -1 : 1;
+	}
+	return a->seq < b->seq ? -1 : (a->seq > b->seq);
+}
+
+/*
+ * Note when something started, for printing its duration later.
+ */
+static
+void
+start(uint64_t *table, unsigned max, unsigned key, uint64_t time)
+{
+	if (key < max) {
+		table[key] = time;
+	}
+}
+
+/*
+ * Print the time since something started, if we saw it start.
+ */
+static
+void
+finish(uint64_t *table, unsigned max, unsigned key, uint64_t time)
+{
+	if (key < max && table[key] != 0 && time >= table[key]) {
+		printf(" (%.3f us)", (time - table[key]) / 1000.0);
+		table[key] = 0;
+	}
+}
+
+static
+void
+printevent(const struct event *ev, uint64_t base)
+{
+	const char *name;
+
+	name = ev->type < KTE_NTYPES ? typenames[ev->type] : "?";
+	printf("%14.3f cpu%-2u pid %-5d %-10s", (ev->time - base) / 1000.0,
+	       ev->cpu, ev->pid, name);
+
+	switch (ev->type) {
+	    case KTE_SWITCH:
+		printf(" -> pid %d, was %s", (int)ev->arg0,
+		       ev->arg1 < 4 ? statenames[ev->arg1] : "?");
+		break;
+	    case KTE_SYSCALL:
+		printf(" #%u", ev->arg0);
+		start(syscallstart, MAXPID, ev->pid, ev->time);
+		break;
+	    case KTE_SYSRET:
+		printf(" #%u", ev->arg0);
+		if (ev->arg1 != 0) {
+			printf(" error %u", ev->arg1);
+		}
+		finish(syscallstart, MAXPID, ev->pid, ev->time);
+		break;
+	    case KTE_VMFAULT:
+		printf(" type %u at 0x%08x", ev->arg0, ev->arg1);
+		start(faultstart, MAXPID, ev->pid, ev->time);
+		break;
+	    case KTE_VMFAULTDONE:
+		printf(" at 0x%08x result %u", ev->arg1, ev->arg0);
+		finish(faultstart, MAXPID, ev->pid, ev->time);
+		break;
+	    case KTE_TLBREFILL:
+		printf(" 0x%08x slot %u", ev->arg0, ev->arg1);
+		break;
+	    case KTE_DISKREAD:
+	    case KTE_DISKWRITE:
+		printf(" lhd%u sector %u", ev->arg0, ev->arg1);
+		start(diskstart, MAXUNIT, ev->arg0, ev->time);
+		break;
+	    case KTE_DISKDONE:
+		printf(" lhd%u", ev->arg0);
+		if (ev->arg1 != 0) {
+			printf(" error %u", ev->arg1);
+		}
+		finish(diskstart, MAXUNIT, ev->arg0, ev->time);
+		break;
+	    case KTE_SPINWAIT:
+		printf(" spinlock 0x%08x", ev->arg0);
+		break;
+	    case KTE_LOCKWAIT:
+		printf(" lock 0x%08x", ev->arg0);
+		start(lockstart, MAXPID, ev->pid, ev->time);
+		break;
+	    case KTE_LOCKACQ:
+		printf(" lock 0x%08x", ev->arg0);
+		finish(lockstart, MAXPID, ev->pid, ev->time);
+		break;
+	    default:
+		printf(" 0x%x 0x%x", ev->arg0, ev->arg1);
+		break;
+	}
+	printf("\n");
+}
+
+int
+main(int argc, char **argv)
+{
+	unsigned i;
+
+	hostcompat_init(argc, argv);
+
+	if (argc != 2) {
+		errx(1, "Usage: ktracedump tracefile");
+	}
+
+	loadtrace(argv[1]);
+	if (nevents == 0) {
+		printf("No events\n");
+		return 0;
+	}
+
+	qsort(events, nevents, sizeof(*events), eventcmp);
+
+	printf("\n%14s %-5s %-9s %s\n", "time (us)", "cpu", "pid",
+	       "event");
+	for (i=0; i<nevents; i++) {
+		printevent(&events[i], events[0].time);
+	}
+
+	free(events);
+	return 0;
+}
@@ -38,10 +38,18 @@
 #include <err.h>
 
 #include "support.h"
+#include "kern/sfs.h"
 #include "disk.h"
 
 #define HOSTSTRING "System/161 Disk Image"
-#define BLOCKSIZE  512
+#define SECTSIZE   512		/* hardware sector size */
+#define BLOCKSIZE  SFS_BLOCKSIZE	/* unit of diskread/diskwrite */
+
+#ifdef HOST
+#define HEADERSIZE SECTSIZE	/* disk image header */
+#else
+#define HEADERSIZE 0
+#endif
 
 #ifndef EINTR
 #define EINTR 0
@@ -64,10 +72,9 @@ opendisk(const char *path)
 		err(1, "%s: fstat", path);
 	}
 
-	nblocks = statbuf.st_size / BLOCKSIZE;
+	nblocks = (statbuf.st_size - HEADERSIZE) / BLOCKSIZE;
 
 #ifdef HOST
-	nblocks--;
 
 	{
 		char buf[64];
@@ -94,7 +101,7 @@ uint32_t
 diskblocksize(void)
 {
 	assert(fd>=0);
-	return BLOCKSIZE;
+	return SECTSIZE;
 }
 
 uint32_t
@@ -113,12 +120,8 @@ diskwrite(const void *data, uint32_t block)
 
 	assert(fd>=0);
 
-#ifdef HOST
-	// skip over disk file header
-	block++;
-#endif
-
-	if (lseek(fd, block*BLOCKSIZE, SEEK_SET)<0) {
+	// skip over disk file header, if any
+	if (lseek(fd, (off_t)block*BLOCKSIZE + HEADERSIZE, SEEK_SET)<0) {
 		err(1, "lseek");
 	}
 
@@ -146,12 +149,8 @@ diskread(void *data, uint32_t block)
 
 	assert(fd>=0);
 
-#ifdef HOST
-	// skip over disk file header
-	block++;
-#endif
-
-	if (lseek(fd, block*BLOCKSIZE, SEEK_SET)<0) {
+	// skip over disk file header, if any
+	if (lseek(fd, (off_t)block*BLOCKSIZE + HEADERSIZE, SEEK_SET)<0) {
 		err(1, "lseek");
 	}
 
@@ -29,6 +29,11 @@
 
 void opendisk(const char *path);
 
+/*
+ * diskblocksize returns the device's sector size. diskblocks returns
+ * the size of the device in (SFS_BLOCKSIZE) filesystem blocks, which
+ * is also the unit diskread and diskwrite work in.
+ */
 uint32_t diskblocksize(void);
 uint32_t diskblocks(void);
 
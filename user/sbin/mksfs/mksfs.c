@@ -66,6 +66,9 @@ check(void)
 	assert(SFS_BLOCKSIZE % sizeof(struct sfs_dir) == 0);
 }
 
+/* Where the journal goes; both 0 if there isn't room for one */
+static uint32_t journalstart, journalblocks;
+
 static
 void
 writesuper(const char *volname, uint32_t nblocks)
@@ -81,10 +84,32 @@ writesuper(const char *volname, uint32_t nblocks)
 	sp.sp_magic = SWAPL(SFS_MAGIC);
 	sp.sp_nblocks = SWAPL(nblocks);
 	strcpy(sp.sp_volname, volname);
+	sp.sp_version = SWAPL(SFS_VERSION);
+	sp.sp_blocksize = SWAPL(SFS_BLOCKSIZE);
+	sp.sp_journalstart = SWAPL(journalstart);
+	sp.sp_journalblocks = SWAPL(journalblocks);
 
 	diskwrite(&sp, SFS_SB_LOCATION);
 }
 
+static
+void
+writejournal(void)
+{
+	struct sfs_jheader jh;
+
+	if (journalblocks == 0) {
+		return;
+	}
+
+	bzero((void *)&jh, sizeof(jh));
+	jh.jh_magic = SWAPL(SFS_JMAGIC);
+	jh.jh_seq = SWAPL(0);
+	jh.jh_nblocks = SWAPL(0);
+
+	diskwrite(&jh, journalstart);
+}
+
 static
 void
 writerootdir(void)
@@ -133,6 +158,9 @@ writebitmap(uint32_t fsblocks)
 	for (i=0; i<nblocks; i++) {
 		doallocbit(SFS_MAP_LOCATION+i);
 	}
+	for (i=0; i<journalblocks; i++) {
+		doallocbit(journalstart+i);
+	}
 	for (i=fsblocks; i<nbits; i++) {
 		doallocbit(i);
 	}
@@ -179,15 +207,26 @@ main(int argc, char **argv)
 	opendisk(argv[1]);
 	blocksize = diskblocksize();
 
-	if (blocksize!=SFS_BLOCKSIZE) {
-		errx(1, "Device has wrong blocksize %u (should be %u)\n",
+	if (blocksize > SFS_BLOCKSIZE || SFS_BLOCKSIZE % blocksize != 0) {
+		errx(1, "Device has wrong blocksize %u (should divide %u)\n",
 		     blocksize, SFS_BLOCKSIZE);
 	}
 	size = diskblocks();
 
+	/*
+	 * The journal goes right after the bitmap. Leave it out if
+	 * it would take more than an eighth of the disk.
+	 */
+	journalstart = SFS_MAP_LOCATION + SFS_BITBLOCKS(size);
+	journalblocks = SFS_JOURNAL_BLOCKS;
+	if (journalblocks > size / 8) {
+		journalstart = journalblocks = 0;
+	}
+
 	writesuper(volname, size);
 	writerootdir();
 	writebitmap(size);
+	writejournal();
 
 	closedisk();
 
@@ -83,6 +83,10 @@ swapsb(struct sfs_super *sp)
 {
 	sp->sp_magic = SWAPL(sp->sp_magic);
 	sp->sp_nblocks = SWAPL(sp->sp_nblocks);
+	sp->sp_version = SWAPL(sp->sp_version);
+	sp->sp_blocksize = SWAPL(sp->sp_blocksize);
+	sp->sp_journalstart = SWAPL(sp->sp_journalstart);
+	sp->sp_journalblocks = SWAPL(sp->sp_journalblocks);
 }
 
 static
@@ -99,6 +103,13 @@ swapinode(struct sfs_inode *sfi)
 		sfi->sfi_direct[i] = SWAPL(sfi->sfi_direct[i]);
 	}
 
+	for (i=0; i<SFS_NEXTENTS; i++) {
+		struct sfs_extent *ext = &sfi->sfi_extents[i];
+		ext->sfe_fileblock = SWAPL(ext->sfe_fileblock);
+		ext->sfe_diskblock = SWAPL(ext->sfe_diskblock);
+		ext->sfe_nblocks = SWAPL(ext->sfe_nblocks);
+	}
+
 #ifdef SFS_NIDIRECT
 	for (i=0; i<SFS_NIDIRECT; i++) {
 		sfi->sfi_indirect[i] = SWAPL(sfi->sfi_indirect[i]);
@@ -172,6 +183,7 @@ domalloc(size_t len)
 typedef enum {
 	B_SUPERBLOCK,	/* Block that is the superblock */
 	B_BITBLOCK,	/* Block used by free-block bitmap */
+	B_JOURNAL,	/* Block used by the journal */
 	B_INODE,	/* Block that is an inode */
 	B_IBLOCK,	/* Indirect (or doubly-indirect etc.) block */
 	B_DIRDATA,	/* Data block of a directory */
@@ -210,6 +222,7 @@ blockusagestr(blockusage_t how, uint32_t howdesc)
 	switch (how) {
 	    case B_SUPERBLOCK: return "superblock";
 	    case B_BITBLOCK: return "bitmap block";
+	    case B_JOURNAL: return "journal block";
 	    case B_INODE: return "inode";
 	    case B_IBLOCK: 
 		snprintf(rv, sizeof(rv), "indirect block of inode %lu", 
@@ -521,6 +534,11 @@ check_sb(void)
 	if (sp.sp_magic != SFS_MAGIC) {
 		errx(EXIT_UNRECOV, "Not an sfs filesystem");
 	}
+	if (sp.sp_version != SFS_VERSION || sp.sp_blocksize != SFS_BLOCKSIZE) {
+		errx(EXIT_UNRECOV, "Unsupported sfs version %lu, block size %lu",
+		     (unsigned long) sp.sp_version,
+		     (unsigned long) sp.sp_blocksize);
+	}
 
 	assert(nblocks==0);
 	assert(bitblocks==0);
@@ -554,6 +572,119 @@ check_sb(void)
 	for (i=0; i<bitblocks; i++) {
 		bitmap_mark(SFS_MAP_LOCATION+i, B_BITBLOCK, i);
 	}
+	for (i=0; i<sp.sp_journalblocks; i++) {
+		bitmap_mark(sp.sp_journalstart+i, B_JOURNAL, i);
+	}
+}
+
+////////////////////////////////////////////////////////////
+
+/*
+ * Journal checksum; see kern/sfs.h. The words are in disk order.
+ */
+static
+uint32_t
+jchecksum(uint32_t sum, const uint32_t *words, unsigned n)
+{
+	unsigned i;
+
+	for (i=0; i<n; i++) {
+		sum = ((sum << 1) | (sum >> 31)) + SWAPL(words[i]);
+	}
+	return sum;
+}
+
+/*
+ * Replay the journal, if it holds a complete transaction, so the
+ * rest of the checks see the filesystem as the kernel would after
+ * mounting it. Must run before check_sb, since the superblock may
+ * be in the journal.
+ */
+static
+void
+check_journal(void)
+{
+	static uint32_t buf[SFS_BLOCKSIZE/sizeof(uint32_t)];
+	struct sfs_super sp;
+	struct sfs_jheader jh;
+	uint32_t start, len, seq, n, i, home, sum;
+
+	diskread(&sp, SFS_SB_LOCATION);
+	swapsb(&sp);
+	if (sp.sp_magic != SFS_MAGIC || sp.sp_version != SFS_VERSION ||
+	    sp.sp_blocksize != SFS_BLOCKSIZE) {
+		/* check_sb will complain about it */
+		return;
+	}
+
+	start = sp.sp_journalstart;
+	len = sp.sp_journalblocks;
+	if (len == 0) {
+		return;
+	}
+	if (len < 2 || start < SFS_MAP_LOCATION + SFS_BITBLOCKS(sp.sp_nblocks)
+	    || start + len > sp.sp_nblocks) {
+		warnx("Journal location invalid (journal removed)");
+		setbadness(EXIT_RECOV);
+		sp.sp_journalstart = sp.sp_journalblocks = 0;
+		swapsb(&sp);
+		diskwrite(&sp, SFS_SB_LOCATION);
+		return;
+	}
+
+	diskread(&jh, start);
+	seq = SWAPL(jh.jh_seq);
+	n = SWAPL(jh.jh_nblocks);
+	if (SWAPL(jh.jh_magic) != SFS_JMAGIC || n > len - 1 ||
+	    n > SFS_JMAXBLOCKS) {
+		warnx("Journal header invalid (fixed)");
+		setbadness(EXIT_RECOV);
+		seq = 0;
+	}
+	else if (n == 0) {
+		/* clean */
+		return;
+	}
+	else {
+		sum = jchecksum(0, &jh.jh_seq, 2);
+		sum = jchecksum(sum, jh.jh_home, n);
+		for (i=0; i<n; i++) {
+			diskread(buf, start+1+i);
+			sum = jchecksum(sum, buf, SFS_BLOCKSIZE/sizeof(uint32_t));
+		}
+
+		if (sum != SWAPL(jh.jh_checksum)) {
+			warnx("Journal transaction %lu incomplete (discarded)",
+			      (unsigned long) seq);
+			setbadness(EXIT_RECOV);
+		}
+		else {
+			for (i=0; i<n; i++) {
+				home = SWAPL(jh.jh_home[i]);
+				if (home >= sp.sp_nblocks ||
+				    (home >= start && home < start+len)) {
+					warnx("Journal block %lu has invalid "
+					      "location %lu (skipped)",
+					      (unsigned long) i,
+					      (unsigned long) home);
+					setbadness(EXIT_RECOV);
+					continue;
+				}
+				diskread(buf, start+1+i);
+				diskwrite(buf, home);
+			}
+			warnx("Replayed %lu blocks from journal",
+			      (unsigned long) n);
+			setbadness(EXIT_RECOV);
+		}
+	}
+
+	/* Nothing left to replay */
+	bzero(&jh, sizeof(jh));
+	jh.jh_magic = SWAPL(SFS_JMAGIC);
+	jh.jh_seq = SWAPL(seq);
+	jh.jh_nblocks = SWAPL(0);
+	diskwrite(&jh, start);
 }
 
 ////////////////////////////////////////////////////////////
@@ -565,19 +696,21 @@ check_indirect_block(uint32_t ino, uint32_t *ientry, uint32_t *blockp,
 		     int isdir, int indirection)
 {
 	uint32_t entries[SFS_DBPERIDB];
-	uint32_t i, ct;
+	uint32_t i, ct, span;
 
-	if (*ientry !=0) {
-		diskread(entries, *ientry);
-		swapindir(entries);
-		bitmap_mark(*ientry, B_IBLOCK, ino);
-	}
-	else {
-		for (i=0; i<SFS_DBPERIDB; i++) {
-			entries[i] = 0;
+	if (*ientry == 0) {
+		/* Nothing under here; just skip over the blocks it covers */
+		for (span=1, i=0; i<(uint32_t)indirection; i++) {
+			span *= SFS_DBPERIDB;
 		}
+		*blockp += span;
+		return;
 	}
 
+	diskread(entries, *ientry);
+	swapindir(entries);
+	bitmap_mark(*ientry, B_IBLOCK, ino);
+
 	if (indirection > 1) {
 		for (i=0; i<SFS_DBPERIDB; i++) {
 			check_indirect_block(ino, &entries[i], 
@@ -636,13 +769,47 @@ static
 int
 check_inode_blocks(uint32_t ino, struct sfs_inode *sfi, int isdir)
 {
-	uint32_t size, block, nblocks, badcount;
+	uint32_t size, block, nblocks, badcount, keep, j;
+	struct sfs_extent *ext;
+	int i;
 
 	badcount = 0;
 
 	size = SFS_ROUNDUP(sfi->sfi_size, SFS_BLOCKSIZE);
 	nblocks = size/SFS_BLOCKSIZE;
 
+	for (i=0; i<SFS_NEXTENTS; i++) {
+		ext = &sfi->sfi_extents[i];
+		if (ext->sfe_nblocks == 0) {
+			continue;
+		}
+		if (ext->sfe_fileblock >= nblocks) {
+			keep = 0;
+		}
+		else if (ext->sfe_nblocks > nblocks - ext->sfe_fileblock) {
+			keep = nblocks - ext->sfe_fileblock;
+		}
+		else {
+			keep = ext->sfe_nblocks;
+		}
+		for (j=0; j<ext->sfe_nblocks; j++) {
+			if (j < keep) {
+				bitmap_mark(ext->sfe_diskblock + j,
+					    isdir ? B_DIRDATA : B_DATA, ino);
+			}
+			else {
+				badcount++;
+				bitmap_mark(ext->sfe_diskblock + j,
+					    B_TOFREE, 0);
+			}
+		}
+		ext->sfe_nblocks = keep;
+		if (keep == 0) {
+			ext->sfe_fileblock = 0;
+			ext->sfe_diskblock = 0;
+		}
+	}
+
 	for (block=0; block<SFS_NDIRECT; block++) {
 		if (block < nblocks) {
 			if (sfi->sfi_direct[block] != 0) {
@@ -766,21 +933,33 @@ ibmap(uint32_t iblock, uint32_t offset, uint32_t entrysize)
 #endif
 #endif
 
-#define BMAP_DMAX   BMAP_ND
-#define BMAP_IMAX   (BMAP_DMAX+SFS_DBPERIDB*BMAP_NI)
-#define BMAP_IIMAX  (BMAP_IMAX+SFS_DBPERIDB*BMAP_NII)
-#define BMAP_IIIMAX (BMAP_IIMAX+SFS_DBPERIDB*BMAP_NIII)
-
 #define BMAP_DSIZE	1
 #define BMAP_ISIZE	(BMAP_DSIZE*SFS_DBPERIDB)
 #define BMAP_IISIZE	(BMAP_ISIZE*SFS_DBPERIDB)
 #define BMAP_IIISIZE	(BMAP_IISIZE*SFS_DBPERIDB)
 
+#define BMAP_DMAX   BMAP_ND
+#define BMAP_IMAX   (BMAP_DMAX+BMAP_ISIZE*BMAP_NI)
+#define BMAP_IIMAX  (BMAP_IMAX+BMAP_IISIZE*BMAP_NII)
+#define BMAP_IIIMAX (BMAP_IIMAX+BMAP_IIISIZE*BMAP_NIII)
+
 static
 uint32_t
 dobmap(const struct sfs_inode *sfi, uint32_t fileblock)
 {
+	const struct sfs_extent *ext;
 	uint32_t iblock, offset;
+	int i;
+
+	for (i=0; i<SFS_NEXTENTS; i++) {
+		ext = &sfi->sfi_extents[i];
+		if (ext->sfe_nblocks > 0 &&
+		    fileblock >= ext->sfe_fileblock &&
+		    fileblock - ext->sfe_fileblock < ext->sfe_nblocks) {
+			return ext->sfe_diskblock +
+				(fileblock - ext->sfe_fileblock);
+		}
+	}
 
 	if (fileblock < BMAP_DMAX) {
 		return BMAP_D(sfi, fileblock);
@@ -1257,6 +1436,7 @@ main(int argc, char **argv)
 
 	opendisk(argv[1]);
 
+	check_journal();
 	check_sb();
 	check_root_dir();
 	check_bitmap();
@@ -0,0 +1,197 @@
+/*
+ * Copyright (c) 2000, 2001, 2002, 2003, 2004, 2005, 2008, 2009
+ *	The President and Fellows of Harvard College.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the University nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE UNIVERSITY AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE UNIVERSITY OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+/*
+ * aiotest.c
+ *
+ * 	Tests asynchronous I/O: submits a batch of writes and then a
+ * 	batch of reads through the aio ring, reaps all the completions,
+ * 	and checks that each request completed exactly once with the
+ * 	right result. One deliberately bad request (a closed file
+ * 	handle) must complete with EBADF rather than fail the call.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <err.h>
+#include <aio.h>
+
+#define TESTFILE	"aiodata"
+#define NENTRIES	16		/* ring size; power of 2 */
+#define NREQS		8		/* requests per batch */
+#define BLOCKSIZE	512
+
+/* The ring must be 8-byte aligned */
+static uint64_t ringmem[(AIO_RINGSIZE(NENTRIES) + 7) / 8];
+static struct aio_ring *ring = (struct aio_ring *)ringmem;
+
+static char bufs[NREQS][BLOCKSIZE];
+static int done[NREQS + 1];
+
+static
+void
+fillblock(char *buf, unsigned n)
+{
+	unsigned i;
+
+	for (i=0; i<BLOCKSIZE; i++) {
+		buf[i] = 'A' + (n * 7 + i) % 26;
+	}
+}
+
+/*
+ * Queue a request. Tags start at 1 so that 0 can't look like one.
+ */
+static
+void
+queue(unsigned op, int fd, unsigned n, void *buf)
+{
+	struct aio_sqe *sqe;
+
+	sqe = &AIO_SQES(ring)[ring->ar_sqtail & (NENTRIES - 1)];
+	sqe->sqe_op = op;
+	sqe->sqe_fd = fd;
+	sqe->sqe_offset = (off_t)n * BLOCKSIZE;
+	sqe->sqe_buf = buf;
+	sqe->sqe_data = (void *)(uintptr_t)(n + 1);
+	sqe->sqe_len = BLOCKSIZE;
+	sqe->sqe_reserved = 0;
+	ring->ar_sqtail++;
+}
+
+/*
+ * Submit everything queued, wait for NWANT completions, and check
+ * them off. Requests with tag BADTAG must fail with EBADF; the rest
+ * must move a whole block.
+ */
+static
+void
+submit_and_reap(const char *what, unsigned nsubmit, unsigned nwant,
+		unsigned badtag)
+{
+	struct aio_cqe *cqe;
+	unsigned tag, got;
+	int r;
+
+	r = aio_enter(nsubmit, nwant);
+	if (r < 0) {
+		err(1, "%s: aio_enter", what);
+	}
+	if ((unsigned)r != nsubmit) {
+		errx(1, "%s: aio_enter took %d of %u entries", what, r,
+		     nsubmit);
+	}
+
+	memset(done, 0, sizeof(done));
+	for (got = 0; got < nwant; got++) {
+		if (ring->ar_cqhead == ring->ar_cqtail) {
+			/* more still in flight */
+			if (aio_enter(0, 1) < 0) {
+				err(1, "%s: aio_enter", what);
+			}
+		}
+		cqe = &AIO_CQES(ring, NENTRIES)[ring->ar_cqhead &
+						 (NENTRIES - 1)];
+		tag = (uintptr_t)cqe->cqe_data;
+		if (tag == 0 || tag > NREQS + 1) {
+			errx(1, "%s: completion with bogus tag %u", what, tag);
+		}
+		if (done[tag - 1]++) {
+			errx(1, "%s: request %u completed twice", what, tag);
+		}
+		if (tag == badtag) {
+			if (cqe->cqe_result != -EBADF) {
+				errx(1, "%s: bad request returned %d, "
+				     "expected %d", what,
+				     (int)cqe->cqe_result, -EBADF);
+			}
+		}
+		else if (cqe->cqe_result != BLOCKSIZE) {
+			errx(1, "%s: request %u returned %d", what, tag,
+			     (int)cqe->cqe_result);
+		}
+		ring->ar_cqhead++;
+	}
+	if (ring->ar_sqhead != ring->ar_sqtail) {
+		errx(1, "%s: kernel left entries unsubmitted", what);
+	}
+	printf("%s: %u requests completed\n", what, nwant);
+}
+
+int
+main(void)
+{
+	unsigned n;
+	int fd;
+
+	fd = open(TESTFILE, O_RDWR|O_CREAT|O_TRUNC, 0664);
+	if (fd < 0) {
+		err(1, "%s", TESTFILE);
+	}
+	if (aio_setup(ring, NENTRIES)) {
+		err(1, "aio_setup");
+	}
+
+	/* Writes, plus one to a handle that isn't open */
+	for (n=0; n<NREQS; n++) {
+		fillblock(bufs[n], n);
+		queue(AIO_OP_WRITE, fd, n, bufs[n]);
+	}
+	queue(AIO_OP_WRITE, fd + 1, NREQS, bufs[0]);
+	submit_and_reap("writes", NREQS + 1, NREQS + 1, NREQS + 1);
+
+	/* Read it all back, in reverse just for variety */
+	memset(bufs, 0, sizeof(bufs));
+	for (n=NREQS; n-- > 0; ) {
+		queue(AIO_OP_READ, fd, n, bufs[n]);
+	}
+	submit_and_reap("reads", NREQS, NREQS, 0);
+
+	for (n=0; n<NREQS; n++) {
+		char expect[BLOCKSIZE];
+
+		fillblock(expect, n);
+		if (memcmp(bufs[n], expect, BLOCKSIZE)) {
+			errx(1, "block %u read back wrong", n);
+		}
+	}
+
+	if (aio_setup(NULL, 0)) {
+		err(1, "aio_setup(NULL)");
+	}
+	close(fd);
+	remove(TESTFILE);
+
+	printf("aiotest: passed\n");
+	return 0;
+}
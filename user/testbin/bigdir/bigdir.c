@@ -0,0 +1,118 @@
+/*
+ * Copyright (c) 2000, 2001, 2002, 2003, 2004, 2005, 2008, 2009
+ *	The President and Fellows of Harvard College.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the University nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE UNIVERSITY AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE UNIVERSITY OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+/*
+ * bigdir.c
+ *
+ * 	Makes a directory big enough that SFS has to map its later
+ * 	blocks through the double indirect block, for checking that
+ * 	sfsck can read such directories. Give it a directory on a
+ * 	scratch SFS volume, e.g.
+ *
+ * 		/testbin/bigdir lhd1:
+ *
+ * 	then unmount the volume and run sfsck on it. Each file takes an
+ * 	inode block, so the volume needs about 280 MB free.
+ *
+ * 	The files are left behind, since the point is for sfsck to see
+ * 	them; run it again with -r to remove them.
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <err.h>
+
+/*
+ * SFS has 15 direct blocks and 1024 block numbers per indirect
+ * block; a 4K directory block holds 64 entries. One more block's
+ * worth of entries than direct plus single indirect can map.
+ */
+#define DIRENTS_PER_BLOCK	64
+#define NFILES			((15 + 1024 + 1) * DIRENTS_PER_BLOCK)
+
+static
+void
+mkname(char *buf, size_t len, const char *dir, int i)
+{
+	snprintf(buf, len, "%s/bd%05d", dir, i);
+}
+
+int
+main(int argc, char *argv[])
+{
+	char name[128];
+	const char *dir;
+	int i, fd, doremove = 0;
+
+	if (argc > 1 && !strcmp(argv[1], "-r")) {
+		doremove = 1;
+		argc--;
+		argv++;
+	}
+	if (argc != 2) {
+		errx(1, "Usage: bigdir [-r] directory");
+	}
+	dir = argv[1];
+
+	for (i=0; i<NFILES; i++) {
+		mkname(name, sizeof(name), dir, i);
+		if (doremove) {
+			if (remove(name)) {
+				err(1, "%s: remove", name);
+			}
+			continue;
+		}
+		fd = open(name, O_WRONLY|O_CREAT|O_EXCL, 0664);
+		if (fd < 0) {
+			err(1, "%s: create", name);
+		}
+		close(fd);
+		if (i % 4096 == 0) {
+			printf("%d files\n", i);
+		}
+	}
+
+	/* Make sure names past the single indirect range still work */
+	if (!doremove) {
+		for (i=NFILES-DIRENTS_PER_BLOCK; i<NFILES; i++) {
+			mkname(name, sizeof(name), dir, i);
+			fd = open(name, O_RDONLY);
+			if (fd < 0) {
+				err(1, "%s: open", name);
+			}
+			close(fd);
+		}
+	}
+
+	printf("bigdir: %s %d files in %s\n",
+	       doremove ? "removed" : "created", NFILES, dir);
+	return 0;
+}
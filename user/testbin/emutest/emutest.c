@@ -0,0 +1,215 @@
+/*
+ * Copyright (c) 2000, 2001, 2002, 2003, 2004, 2005, 2008, 2009
+ *	The President and Fellows of Harvard College.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the University nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE UNIVERSITY AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE UNIVERSITY OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+/*
+ * emutest.c
+ *
+ * 	Tests emufs's per-file read-ahead/write-behind buffer. Run it
+ * 	in a directory on emu0: (the current directory at boot), or
+ * 	give a pathname on emu0: as the argument.
+ *
+ * 	Writes a file several buffers long in small pieces, reads it
+ * 	back in odd-sized pieces, overwrites a stretch in the middle of
+ * 	a buffer after seeking, reads across the changed region before
+ * 	and after closing, and checks the file size throughout. A copy
+ * 	of what the file should hold is kept in memory to compare with.
+ *
+ * 	The file is left behind; the next run truncates it.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <err.h>
+
+#define TESTFILE	"emutest.dat"
+#define CHUNK		16384		/* emufs buffer size (EMU_MAXIO) */
+#define FILESIZE	(3*CHUNK + 1000)
+
+static char shadow[FILESIZE];
+static char buf[FILESIZE];
+
+static
+void
+doseek(int fd, off_t pos)
+{
+	off_t r;
+
+	r = lseek(fd, pos, SEEK_SET);
+	if (r < 0) {
+		err(1, "lseek to %ld", (long)pos);
+	}
+	if (r != pos) {
+		errx(1, "lseek to %ld went to %ld", (long)pos, (long)r);
+	}
+}
+
+static
+void
+dowrite(int fd, const char *data, size_t len)
+{
+	ssize_t r;
+
+	r = write(fd, data, len);
+	if (r < 0) {
+		err(1, "write");
+	}
+	if ((size_t)r != len) {
+		errx(1, "write: wrote %ld of %lu", (long)r,
+		     (unsigned long)len);
+	}
+}
+
+static
+void
+checksize(int fd, off_t expect, const char *when)
+{
+	off_t size;
+
+	size = lseek(fd, 0, SEEK_END);
+	if (size < 0) {
+		err(1, "%s: lseek to end", when);
+	}
+	if (size != expect) {
+		errx(1, "%s: size is %ld, expected %ld", when,
+		     (long)size, (long)expect);
+	}
+}
+
+/*
+ * Read LEN bytes at POS in pieces of STEP and compare with the shadow.
+ */
+static
+void
+checkrange(int fd, off_t pos, size_t len, size_t step, const char *when)
+{
+	size_t done, amt;
+	ssize_t r;
+
+	doseek(fd, pos);
+	for (done = 0; done < len; done += r) {
+		amt = len - done < step ? len - done : step;
+		r = read(fd, buf + done, amt);
+		if (r < 0) {
+			err(1, "%s: read", when);
+		}
+		if (r == 0) {
+			errx(1, "%s: early EOF at %ld", when,
+			     (long)(pos + done));
+		}
+	}
+	if (memcmp(buf, shadow + pos, len)) {
+		for (done = 0; buf[done] == shadow[pos + done]; done++);
+		errx(1, "%s: wrong data at offset %ld", when,
+		     (long)(pos + done));
+	}
+}
+
+int
+main(int argc, char *argv[])
+{
+	const char *file;
+	size_t i, amt;
+	off_t pos;
+	ssize_t r;
+	int fd;
+
+	file = argc > 1 ? argv[1] : TESTFILE;
+
+	for (i=0; i<FILESIZE; i++) {
+		shadow[i] = 'a' + (i * 7 + i / 100) % 26;
+	}
+
+	fd = open(file, O_RDWR|O_CREAT|O_TRUNC, 0664);
+	if (fd < 0) {
+		err(1, "%s", file);
+	}
+
+	/* Small sequential writes, which collect in the buffer */
+	for (i=0; i<FILESIZE; i+=amt) {
+		amt = FILESIZE - i < 100 ? FILESIZE - i : 100;
+		dowrite(fd, shadow + i, amt);
+	}
+	checksize(fd, FILESIZE, "after writing");
+	printf("Sequential write: ok\n");
+
+	/* Odd-sized reads, some crossing buffer boundaries */
+	checkrange(fd, 0, FILESIZE, 777, "sequential read");
+	printf("Sequential read: ok\n");
+
+	/* Seek into the middle of a buffer and overwrite a stretch */
+	pos = CHUNK + CHUNK / 2 - 50;
+	checkrange(fd, pos - 200, 400, 400, "read before overwrite");
+	for (i=0; i<300; i++) {
+		shadow[pos + i] = 'A' + i % 26;
+	}
+	doseek(fd, pos);
+	dowrite(fd, shadow + pos, 150);
+	dowrite(fd, shadow + pos + 150, 150);
+	checkrange(fd, pos - 1000, 2300, 333, "read after overwrite");
+	checksize(fd, FILESIZE, "after overwrite");
+	printf("Overwrite mid-buffer: ok\n");
+
+	/* Write at a spot not adjoining the last write */
+	pos = 2 * CHUNK + 10;
+	for (i=0; i<50; i++) {
+		shadow[pos + i] = '0' + i % 10;
+	}
+	doseek(fd, pos);
+	dowrite(fd, shadow + pos, 50);
+
+	/* Extend the file past its end, straddling no buffer */
+	doseek(fd, FILESIZE - 20);
+	dowrite(fd, shadow + FILESIZE - 20, 20);
+
+	/* Read at EOF */
+	r = read(fd, buf, 10);
+	if (r != 0) {
+		errx(1, "read at EOF returned %ld", (long)r);
+	}
+
+	/* Close with the last writes still buffered, then reopen */
+	if (close(fd) < 0) {
+		err(1, "close");
+	}
+	fd = open(file, O_RDONLY);
+	if (fd < 0) {
+		err(1, "%s: reopen", file);
+	}
+	checksize(fd, FILESIZE, "after reopen");
+	checkrange(fd, 0, FILESIZE, CHUNK + 1, "read after reopen");
+	close(fd);
+	printf("Close and reopen: ok\n");
+
+	printf("emutest: passed\n");
+	return 0;
+}
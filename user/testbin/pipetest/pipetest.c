@@ -0,0 +1,214 @@
+/*
+ * Copyright (c) 2000, 2001, 2002, 2003, 2004, 2005, 2008, 2009
+ *	The President and Fellows of Harvard College.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the University nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE UNIVERSITY AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE UNIVERSITY OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+/*
+ * pipetest.c
+ *
+ * 	Runs a two-stage pipeline, like "cat file | cat", and checks that
+ * 	every stage sees end-of-file once the stage before it exits.
+ *
+ * 	Neither child closes its pipe descriptors before exiting, so
+ * 	this fails (by hanging) unless the kernel closes them on exit.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <err.h>
+
+#define NBLOCKS		64
+#define BLOCKSIZE	512
+
+static char buf[BLOCKSIZE];
+
+/*
+ * Fill buf with the contents of block N.
+ */
+static
+void
+fillblock(unsigned n)
+{
+	unsigned i;
+
+	for (i=0; i<BLOCKSIZE; i++) {
+		buf[i] = 'a' + (n + i) % 26;
+	}
+}
+
+/*
+ * Write NBLOCKS blocks to FD, then exit without closing it.
+ */
+static
+void
+producer(int fd)
+{
+	unsigned n;
+	ssize_t r;
+
+	for (n=0; n<NBLOCKS; n++) {
+		fillblock(n);
+		r = write(fd, buf, BLOCKSIZE);
+		if (r < 0) {
+			err(1, "producer: write");
+		}
+		if (r != BLOCKSIZE) {
+			errx(1, "producer: short write (%ld)", (long)r);
+		}
+	}
+	_exit(0);
+}
+
+/*
+ * Copy INFD to OUTFD until end-of-file, then exit without closing
+ * either one.
+ */
+static
+void
+copier(int infd, int outfd)
+{
+	char cbuf[100];
+	ssize_t r, w;
+
+	while ((r = read(infd, cbuf, sizeof(cbuf))) > 0) {
+		w = write(outfd, cbuf, r);
+		if (w < 0) {
+			err(1, "copier: write");
+		}
+		if (w != r) {
+			errx(1, "copier: short write");
+		}
+	}
+	if (r < 0) {
+		err(1, "copier: read");
+	}
+	_exit(0);
+}
+
+/*
+ * Read FD to end-of-file and check it holds what the producer wrote.
+ */
+static
+void
+consumer(int fd)
+{
+	char rbuf[BLOCKSIZE];
+	size_t total = 0, got;
+	ssize_t r;
+	unsigned n;
+
+	for (n=0; ; n++) {
+		got = 0;
+		while (got < BLOCKSIZE) {
+			r = read(fd, rbuf + got, BLOCKSIZE - got);
+			if (r < 0) {
+				err(1, "consumer: read");
+			}
+			if (r == 0) {
+				break;
+			}
+			got += r;
+		}
+		total += got;
+		if (got == 0) {
+			break;
+		}
+		if (got != BLOCKSIZE || n >= NBLOCKS) {
+			errx(1, "consumer: got %lu bytes, expected %lu",
+			     (unsigned long)total,
+			     (unsigned long)NBLOCKS*BLOCKSIZE);
+		}
+		fillblock(n);
+		if (memcmp(rbuf, buf, BLOCKSIZE)) {
+			errx(1, "consumer: block %u has the wrong data", n);
+		}
+	}
+	if (n != NBLOCKS) {
+		errx(1, "consumer: got %lu bytes, expected %lu",
+		     (unsigned long)total, (unsigned long)NBLOCKS*BLOCKSIZE);
+	}
+}
+
+static
+void
+dowait(pid_t pid, const char *what)
+{
+	int status;
+
+	if (waitpid(pid, &status, 0) < 0) {
+		err(1, "waitpid %s", what);
+	}
+	if (!WIFEXITED(status) || WEXITSTATUS(status) != 0) {
+		errx(1, "%s failed", what);
+	}
+}
+
+int
+main(void)
+{
+	int p1[2], p2[2];
+	pid_t pid1, pid2;
+
+	if (pipe(p1) < 0) {
+		err(1, "pipe");
+	}
+	pid1 = fork();
+	if (pid1 < 0) {
+		err(1, "fork");
+	}
+	if (pid1 == 0) {
+		close(p1[0]);
+		producer(p1[1]);
+	}
+	close(p1[1]);
+
+	if (pipe(p2) < 0) {
+		err(1, "pipe");
+	}
+	pid2 = fork();
+	if (pid2 < 0) {
+		err(1, "fork");
+	}
+	if (pid2 == 0) {
+		close(p2[0]);
+		copier(p1[0], p2[1]);
+	}
+	close(p1[0]);
+	close(p2[1]);
+
+	consumer(p2[0]);
+	close(p2[0]);
+
+	dowait(pid1, "producer");
+	dowait(pid2, "copier");
+
+	printf("pipetest: passed\n");
+	return 0;
+}
@@ -0,0 +1,224 @@
+/*
+ * Copyright (c) 2000, 2001, 2002, 2003, 2004, 2005, 2008, 2009
+ *	The President and Fellows of Harvard College.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the University nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE UNIVERSITY AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE UNIVERSITY OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+/*
+ * prwtest.c
+ *
+ * 	Tests pread, pwrite, readv, and writev:
+ * 	  - writev and readv move a whole vector and advance the offset;
+ * 	  - pread and pwrite use the offset given and leave the file's
+ * 	    own offset alone;
+ * 	  - pread and pwrite on the console fail with ESPIPE.
+ */
+
+#include <sys/uio.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <err.h>
+
+#define TESTFILE	"prwdata"
+
+static const char part1[] = "The quick brown fox ";
+static const char part2[] = "jumps over ";
+static const char part3[] = "the lazy dog.";
+
+#define LEN1	(sizeof(part1)-1)
+#define LEN2	(sizeof(part2)-1)
+#define LEN3	(sizeof(part3)-1)
+#define TOTAL	(LEN1+LEN2+LEN3)
+
+static
+off_t
+getpos(int fd)
+{
+	off_t pos;
+
+	pos = lseek(fd, 0, SEEK_CUR);
+	if (pos < 0) {
+		err(1, "lseek");
+	}
+	return pos;
+}
+
+static
+void
+checkpos(int fd, off_t expect, const char *after)
+{
+	off_t pos;
+
+	pos = getpos(fd);
+	if (pos != expect) {
+		errx(1, "Offset after %s is %ld, expected %ld", after,
+		     (long)pos, (long)expect);
+	}
+}
+
+static
+void
+vectortest(int fd)
+{
+	struct iovec iov[3];
+	char b1[LEN1], b2[LEN2], b3[LEN3];
+	ssize_t r;
+
+	iov[0].iov_base = (void *)part1;
+	iov[0].iov_len = LEN1;
+	iov[1].iov_base = (void *)part2;
+	iov[1].iov_len = LEN2;
+	iov[2].iov_base = (void *)part3;
+	iov[2].iov_len = LEN3;
+	r = writev(fd, iov, 3);
+	if (r < 0) {
+		err(1, "writev");
+	}
+	if ((size_t)r != TOTAL) {
+		errx(1, "writev: wrote %ld of %lu", (long)r,
+		     (unsigned long)TOTAL);
+	}
+	checkpos(fd, TOTAL, "writev");
+
+	if (lseek(fd, 0, SEEK_SET) < 0) {
+		err(1, "lseek");
+	}
+	iov[0].iov_base = b1;
+	iov[1].iov_base = b2;
+	iov[2].iov_base = b3;
+	r = readv(fd, iov, 3);
+	if (r < 0) {
+		err(1, "readv");
+	}
+	if ((size_t)r != TOTAL) {
+		errx(1, "readv: read %ld of %lu", (long)r,
+		     (unsigned long)TOTAL);
+	}
+	if (memcmp(b1, part1, LEN1) || memcmp(b2, part2, LEN2) ||
+	    memcmp(b3, part3, LEN3)) {
+		errx(1, "readv: wrong data");
+	}
+	checkpos(fd, TOTAL, "readv");
+	printf("readv/writev: ok\n");
+}
+
+static
+void
+positionaltest(int fd)
+{
+	char buf[TOTAL];
+	ssize_t r;
+
+	/* Leave the offset somewhere recognizable */
+	if (lseek(fd, 3, SEEK_SET) < 0) {
+		err(1, "lseek");
+	}
+
+	r = pread(fd, buf, LEN2, LEN1);
+	if (r < 0) {
+		err(1, "pread");
+	}
+	if ((size_t)r != LEN2 || memcmp(buf, part2, LEN2)) {
+		errx(1, "pread: wrong data");
+	}
+	checkpos(fd, 3, "pread");
+
+	r = pwrite(fd, "JUMPS", 5, LEN1);
+	if (r < 0) {
+		err(1, "pwrite");
+	}
+	if (r != 5) {
+		errx(1, "pwrite: wrote %ld of 5", (long)r);
+	}
+	checkpos(fd, 3, "pwrite");
+
+	r = pread(fd, buf, TOTAL, 0);
+	if (r < 0) {
+		err(1, "pread");
+	}
+	if ((size_t)r != TOTAL || memcmp(buf, part1, LEN1) ||
+	    memcmp(buf + LEN1, "JUMPS", 5) ||
+	    memcmp(buf + LEN1 + 5, part2 + 5, LEN2 - 5)) {
+		errx(1, "pread after pwrite: wrong data");
+	}
+
+	/* Past EOF is just EOF */
+	r = pread(fd, buf, TOTAL, TOTAL + 100);
+	if (r != 0) {
+		errx(1, "pread past EOF returned %ld", (long)r);
+	}
+	checkpos(fd, 3, "pread past EOF");
+	printf("pread/pwrite: ok\n");
+}
+
+static
+void
+espipetest(void)
+{
+	char c = 'x';
+	ssize_t r;
+
+	/* stdout is the console, which can't seek */
+	r = pwrite(STDOUT_FILENO, &c, 1, 0);
+	if (r >= 0) {
+		errx(1, "pwrite on the console succeeded");
+	}
+	if (errno != ESPIPE) {
+		err(1, "pwrite on the console: expected ESPIPE, got");
+	}
+	r = pread(STDIN_FILENO, &c, 1, 0);
+	if (r >= 0) {
+		errx(1, "pread on the console succeeded");
+	}
+	if (errno != ESPIPE) {
+		err(1, "pread on the console: expected ESPIPE, got");
+	}
+	printf("ESPIPE on the console: ok\n");
+}
+
+int
+main(void)
+{
+	int fd;
+
+	fd = open(TESTFILE, O_RDWR|O_CREAT|O_TRUNC, 0664);
+	if (fd < 0) {
+		err(1, "%s", TESTFILE);
+	}
+	vectortest(fd);
+	positionaltest(fd);
+	close(fd);
+	remove(TESTFILE);
+
+	espipetest();
+
+	printf("prwtest: passed\n");
+	return 0;
+}
@@ -0,0 +1,207 @@
+/*
+ * Copyright (c) 2000, 2001, 2002, 2003, 2004, 2005, 2008, 2009
+ *	The President and Fellows of Harvard College.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the University nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE UNIVERSITY AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE UNIVERSITY OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+/*
+ * rwtest.c
+ *
+ * 	Tests read and write moving data straight to and from user
+ * 	memory:
+ * 	  - one write and one read much larger than any single kernel
+ * 	    allocation could reasonably be;
+ * 	  - a short read at EOF returns the right count and leaves the
+ * 	    rest of the buffer alone;
+ * 	  - bad buffer pointers fail with EFAULT, not a crash;
+ * 	  - a file dup2'd over stdout gets writes to stdout.
+ *
+ * 	The test file is left behind; the next run truncates it.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <err.h>
+
+#define TESTFILE	"rwdata"
+#define BIGSIZE		(256*1024)
+#define SAVEFD		10
+
+#define KERN_PTR	((void *)0x80000000)	/* kernel memory */
+#define INVAL_PTR	((void *)0x40000000)	/* unmapped user memory */
+
+static char bigbuf[BIGSIZE];
+static char readbuf[BIGSIZE];
+
+static
+void
+doseek(int fd, off_t pos)
+{
+	if (lseek(fd, pos, SEEK_SET) != pos) {
+		err(1, "lseek to %ld", (long)pos);
+	}
+}
+
+static
+void
+bigtest(int fd)
+{
+	ssize_t r;
+	size_t i;
+
+	for (i=0; i<BIGSIZE; i++) {
+		bigbuf[i] = i * 13 + i / 512;
+	}
+	r = write(fd, bigbuf, BIGSIZE);
+	if (r < 0) {
+		err(1, "big write");
+	}
+	if (r != BIGSIZE) {
+		errx(1, "big write: wrote %ld of %d", (long)r, BIGSIZE);
+	}
+
+	doseek(fd, 0);
+	r = read(fd, readbuf, BIGSIZE);
+	if (r < 0) {
+		err(1, "big read");
+	}
+	if (r != BIGSIZE) {
+		errx(1, "big read: read %ld of %d", (long)r, BIGSIZE);
+	}
+	if (memcmp(bigbuf, readbuf, BIGSIZE)) {
+		errx(1, "big read: wrong data");
+	}
+	printf("Big read/write: ok\n");
+}
+
+static
+void
+eoftest(int fd)
+{
+	ssize_t r;
+	size_t i;
+
+	memset(readbuf, 0x5a, 1000);
+	doseek(fd, BIGSIZE - 100);
+	r = read(fd, readbuf, 1000);
+	if (r != 100) {
+		errx(1, "read at EOF-100 returned %ld", (long)r);
+	}
+	if (memcmp(readbuf, bigbuf + BIGSIZE - 100, 100)) {
+		errx(1, "read at EOF-100: wrong data");
+	}
+	for (i=100; i<1000; i++) {
+		if (readbuf[i] != 0x5a) {
+			errx(1, "read at EOF-100 wrote past what it read "
+			     "(at %lu)", (unsigned long)i);
+		}
+	}
+	r = read(fd, readbuf, 1000);
+	if (r != 0) {
+		errx(1, "read at EOF returned %ld", (long)r);
+	}
+	printf("Short read at EOF: ok\n");
+}
+
+static
+void
+expectfault(ssize_t r, const char *what)
+{
+	if (r >= 0) {
+		errx(1, "%s succeeded", what);
+	}
+	if (errno != EFAULT) {
+		err(1, "%s: expected EFAULT, got", what);
+	}
+}
+
+static
+void
+faulttest(int fd)
+{
+	doseek(fd, 0);
+	expectfault(read(fd, KERN_PTR, 100), "read into kernel memory");
+	expectfault(read(fd, INVAL_PTR, 100), "read into unmapped memory");
+	expectfault(write(fd, KERN_PTR, 100), "write from kernel memory");
+	expectfault(write(fd, NULL, 100), "write from NULL");
+	printf("Bad pointers: ok\n");
+}
+
+static
+void
+duptest(int fd)
+{
+	static const char msg[] = "written to stdout\n";
+	char check[sizeof(msg)];
+	ssize_t r;
+
+	doseek(fd, 0);
+	if (dup2(STDOUT_FILENO, SAVEFD) < 0) {
+		err(1, "dup2 stdout");
+	}
+	if (dup2(fd, STDOUT_FILENO) < 0) {
+		err(1, "dup2 over stdout");
+	}
+	r = write(STDOUT_FILENO, msg, sizeof(msg) - 1);
+	if (dup2(SAVEFD, STDOUT_FILENO) < 0) {
+		/* no stdout to complain on... */
+		_exit(1);
+	}
+	close(SAVEFD);
+	if (r != sizeof(msg) - 1) {
+		errx(1, "write to dup2'd stdout returned %ld", (long)r);
+	}
+
+	doseek(fd, 0);
+	r = read(fd, check, sizeof(msg) - 1);
+	if (r != sizeof(msg) - 1 || memcmp(check, msg, sizeof(msg) - 1)) {
+		errx(1, "write to stdout didn't go to the dup2'd file");
+	}
+	printf("Write through dup2'd stdout: ok\n");
+}
+
+int
+main(void)
+{
+	int fd;
+
+	fd = open(TESTFILE, O_RDWR|O_CREAT|O_TRUNC, 0664);
+	if (fd < 0) {
+		err(1, "%s", TESTFILE);
+	}
+	bigtest(fd);
+	eoftest(fd);
+	faulttest(fd);
+	duptest(fd);
+	close(fd);
+
+	printf("rwtest: passed\n");
+	return 0;
+}
@@ -0,0 +1,141 @@
+/*
+ * Copyright (c) 2000, 2001, 2002, 2003, 2004, 2005, 2008, 2009
+ *	The President and Fellows of Harvard College.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the University nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE UNIVERSITY AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE UNIVERSITY OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+/*
+ * sleeptest.c
+ *
+ * 	Tests nanosleep: sleeps for a range of times and checks, using
+ * 	__time, that each took about as long as asked. Also checks that
+ * 	bad requests fail with EINVAL and that the remaining time comes
+ * 	back as zero.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <errno.h>
+#include <err.h>
+
+/*
+ * A sleep may end up to one clock tick early, depending on where in
+ * a tick it started, and may run late by scheduling delay.
+ */
+#define EARLY_NS	10000000LL	/* 1/100 s */
+#define LATE_NS		200000000LL	/* 1/5 s */
+
+static const long long sleeps_ns[] = {
+	1000000LL,		/* 1 ms */
+	10000000LL,		/* 10 ms */
+	50000000LL,		/* 50 ms */
+	250000000LL,		/* 250 ms */
+	1000000000LL,		/* 1 s */
+	1500000000LL,		/* 1.5 s */
+};
+#define NSLEEPS (sizeof(sleeps_ns) / sizeof(sleeps_ns[0]))
+
+static
+long long
+now_ns(void)
+{
+	time_t secs;
+	unsigned long nsecs;
+
+	if (__time(&secs, &nsecs) == (time_t)-1) {
+		err(1, "__time");
+	}
+	return (long long)secs * 1000000000LL + nsecs;
+}
+
+static
+void
+timedsleep(long long ns)
+{
+	struct timespec req, rem;
+	long long start, elapsed;
+
+	req.tv_sec = ns / 1000000000LL;
+	req.tv_nsec = ns % 1000000000LL;
+	rem.tv_sec = rem.tv_nsec = -1;
+
+	start = now_ns();
+	if (nanosleep(&req, &rem)) {
+		err(1, "nanosleep %lld ns", ns);
+	}
+	elapsed = now_ns() - start;
+
+	if (rem.tv_sec != 0 || rem.tv_nsec != 0) {
+		errx(1, "nanosleep %lld ns: remaining time not zeroed", ns);
+	}
+	if (elapsed < ns - EARLY_NS) {
+		errx(1, "nanosleep %lld ns: woke after only %lld ns", ns,
+		     elapsed);
+	}
+	if (elapsed > ns + LATE_NS) {
+		errx(1, "nanosleep %lld ns: took %lld ns", ns, elapsed);
+	}
+	printf("nanosleep %lld ns: took %lld ns\n", ns, elapsed);
+}
+
+static
+void
+badsleep(long sec, long nsec)
+{
+	struct timespec req;
+
+	req.tv_sec = sec;
+	req.tv_nsec = nsec;
+	if (nanosleep(&req, NULL) == 0) {
+		errx(1, "nanosleep {%ld, %ld} succeeded", sec, nsec);
+	}
+	if (errno != EINVAL) {
+		err(1, "nanosleep {%ld, %ld}: expected EINVAL, got", sec,
+		    nsec);
+	}
+}
+
+int
+main(void)
+{
+	unsigned i;
+
+	for (i=0; i<NSLEEPS; i++) {
+		timedsleep(sleeps_ns[i]);
+	}
+
+	/* Zero is allowed and shouldn't take long */
+	timedsleep(0);
+
+	badsleep(0, 1000000000L);
+	badsleep(0, -1);
+	badsleep(-1, 0);
+	printf("Bad requests: ok\n");
+
+	printf("sleeptest: passed\n");
+	return 0;
+}